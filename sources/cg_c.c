@@ -144,8 +144,9 @@ static CSTR error_target = CQL_CLEANUP_DEFAULT_LABEL;
 // holding the right value.  Each catch scope has its own corresponding to the error
 // that it caught.
 
-#define CQL_PROTO_NORMAL false
-#define CQL_FORCE_FETCH_RESULTS true
+#define CQL_PROTO_NORMAL 0
+#define CQL_FORCE_FETCH_RESULTS 1
+#define CQL_PROTO_STREAM 2
 
 // Points to most recent thrown rc variable for rethrow/context capture.
 static CSTR rcthrown_current = CQL_RCTHROWN_DEFAULT;
@@ -3364,6 +3365,36 @@ static void cg_params(ast_node *ast, charbuf *decls, bool_t alias_in_ref) {
   }
 }
 
+// Emit the parameter names as arguments, exactly as cg_params named them, so
+// that one generated function can forward its arguments to another with the
+// same parameter list.
+static void cg_param_forwards(ast_node *ast, charbuf *args) {
+  Contract(is_ast_params(ast));
+
+  while (ast) {
+    Contract(is_ast_params(ast));
+    EXTRACT_NOTNULL(param, ast->left);
+    EXTRACT_NOTNULL(param_detail, param->right);
+    EXTRACT_NAME_AST(name_ast, param_detail->left)
+    EXTRACT_STRING(name, name_ast);
+
+    sem_t sem_type = name_ast->sem->sem_type;
+
+    if (!is_out_parameter(sem_type) && was_set_variable(sem_type) && is_ref_type(sem_type)) {
+      bprintf(args, "_in__%s", name);
+    }
+    else {
+      bprintf(args, "%s", name);
+    }
+
+    if (ast->right) {
+      bprintf(args, ", ");
+    }
+
+    ast = ast->right;
+  }
+}
+
 // Emit any initialization code needed for the parameters. In particular out
 // parameters assume that there is garbage in the out location, so they hammer a
 // NULL or 0 into that slot.
@@ -3502,6 +3533,74 @@ static void cg_fields_in_canonical_order(charbuf *output, sem_struct *sptr) {
   }
 }
 
+// The storage size of a primitive in the compact layout, this is also its
+// alignment.
+static uint32_t compact_field_size(sem_t sem_type) {
+  switch (core_type_of(sem_type)) {
+    case SEM_TYPE_BOOL:
+      return 1;
+    case SEM_TYPE_INTEGER:
+      return 4;
+  }
+  // long integer and real
+  return 8;
+}
+
+// The compact row layout, selected with `cql:compact_rows`, stores nullable
+// primitives as bare values with their null flags packed into a bitmap at the
+// start of the row (bit `i` is column `i`, see CQL_DATA_TYPE_NULL_BIT). The
+// primitives then follow in order of increasing size so that the bitmap and the
+// bools pack together and padding is only needed when the size goes up, at most
+// once before the int32s and once before the 8 byte types. References go at the
+// end as usual.  This avoids the padding byte(s) that each cql_nullable_* struct
+// carries which is about half of the storage for rows of nullable ints and bools.
+// The column offsets are still emitted with cql_offsetof so the metadata means
+// exactly what it always did.
+static void cg_fields_in_compact_order(charbuf *output, sem_struct *sptr) {
+  uint32_t count = sptr->count;
+  bool_t needs_null_bits = false;
+
+  for (uint32_t i = 0; i < count; i++) {
+    sem_t sem_type = sptr->semtypes[i];
+    if (is_nullable(sem_type) && !is_ref_type(sem_type)) {
+      needs_null_bits = true;
+    }
+  }
+
+  if (needs_null_bits) {
+    bprintf(output, "  uint8_t _null_bits_[%d];\n", (count + 7) / 8);
+  }
+
+  // primitives by increasing size
+  uint32_t sizes[] = { 1, 4, 8 };
+
+  for (uint32_t pass = 0; pass < sizeof(sizes)/sizeof(sizes[0]); pass++) {
+    for (uint32_t i = 0; i < count; i++) {
+      sem_t sem_type = sptr->semtypes[i];
+      if (is_ref_type(sem_type) || compact_field_size(sem_type) != sizes[pass]) {
+        continue;
+      }
+      CSTR col = sptr->names[i];
+      bprintf(output, "  ");
+      cg_var_decl(output, core_type_of(sem_type) | SEM_TYPE_NOTNULL, col, CG_VAR_DECL_PROTO);
+      bprintf(output, ";\n");
+    }
+  }
+
+  // then reference types
+  for (uint32_t i = 0; i < count; i++) {
+    sem_t sem_type = sptr->semtypes[i];
+    if (!is_ref_type(sem_type)) {
+      continue;
+    }
+
+    CSTR col = sptr->names[i];
+    bprintf(output, "  ");
+    cg_var_decl(output, sem_type, col, CG_VAR_DECL_PROTO);
+    bprintf(output, ";\n");
+  }
+}
+
 // This function generates a struct definition into the indicated output. If
 // `cursor_name` is NULL, as is the case for the result type of procs with the
 // OUT keyword, the struct will be named with the current proc name. If
@@ -3692,6 +3791,112 @@ static bool_t cg_identity_columns(
   return count > 0;
 }
 
+typedef struct encoded_columns_info {
+  sem_struct *sptr;
+  charbuf *cols;
+  uint32_t count;
+  int32_t context_index;
+  bool_t found;
+  bool_t listed;
+} encoded_columns_info;
+
+// Add one named column to the encoded set, names that are not columns of the
+// result are ignored, the attribute is advisory.
+static void add_encoded_column(encoded_columns_info *info, ast_node *ast) {
+  if (!is_ast_str(ast)) {
+    return;
+  }
+
+  EXTRACT_STRING(name, ast);
+  info->listed = true;
+  int32_t col_index = sem_column_index(info->sptr, name);
+  if (col_index >= 0) {
+    bprintf(info->cols, "  %d, // %s\n", col_index, name);
+    info->count++;
+  }
+}
+
+// The vault_sensitive attribute has three forms:
+//  * [[vault_sensitive]] : all the @sensitive columns are encoded
+//  * [[vault_sensitive=(a, b)]] : the named columns are encoded
+//  * [[vault_sensitive=(ctx, (a, b))]] : as above with ctx as the context column
+static void find_encoded_columns_callback(
+  CSTR _Nullable misc_attr_prefix,
+  CSTR _Nonnull misc_attr_name,
+  ast_node *_Nullable values,
+  void *_Nullable context)
+{
+  encoded_columns_info *info = (encoded_columns_info *)context;
+
+  if (!misc_attr_prefix ||
+      StrCaseCmp(misc_attr_prefix, "cql") ||
+      StrCaseCmp(misc_attr_name, "vault_sensitive")) {
+    return;
+  }
+
+  info->found = true;
+
+  if (is_ast_misc_attr_value_list(values)) {
+    ast_node *first = values->left;
+    ast_node *second = values->right ? values->right->left : NULL;
+    if (is_ast_str(first) && is_ast_misc_attr_value_list(second)) {
+      EXTRACT_STRING(context_name, first);
+      info->context_index = sem_column_index(info->sptr, context_name);
+      values = second;
+    }
+
+    for (ast_node *item = values; item; item = item->right) {
+      add_encoded_column(info, item->left);
+    }
+  }
+  else if (values) {
+    add_encoded_column(info, values);
+  }
+}
+
+// Emit the array of encoded columns, these are handed to the registered column
+// encoder in batches when the result set is created.  Returns the number of
+// encoded columns and the context column index (-1 for none).
+static uint32_t cg_encoded_columns(
+  charbuf *headers_output,
+  charbuf *defs_output,
+  sem_struct *sptr,
+  ast_node *_Nullable misc_attrs,
+  CSTR encoded_columns_sym,
+  int32_t *context_index)
+{
+  *context_index = -1;
+  if (!misc_attrs) {
+    return 0;
+  }
+
+  CHARBUF_OPEN(cols);
+  encoded_columns_info info = {
+    .sptr = sptr,
+    .cols = &cols,
+    .context_index = -1,
+  };
+
+  find_misc_attrs(misc_attrs, find_encoded_columns_callback, &info);
+
+  if (info.found && !info.listed) {
+    for (uint32_t i = 0; i < sptr->count; i++) {
+      if (sensitive_flag(sptr->semtypes[i])) {
+        bprintf(&cols, "  %d, // %s\n", i, sptr->names[i]);
+        info.count++;
+      }
+    }
+  }
+
+  if (info.count > 0) {
+    *context_index = info.context_index;
+    bprintf(headers_output, "%scql_uint16 %s[];\n\n", rt->symbol_visibility, encoded_columns_sym);
+    bprintf(defs_output, "\ncql_uint16 %s[] = { %d,\n%s};\n", encoded_columns_sym, info.count, cols.ptr);
+  }
+  CHARBUF_CLOSE(cols);
+  return info.count;
+}
+
 // Emit the teardown information for use in in a rowset row or cursor row
 // this is just the count of references and the offset of the first reference
 // in the row structure. Since the references are stored together and are
@@ -3838,7 +4043,9 @@ static void cg_emit_fetch_results_prototype(
 // The prototype for the given procedure goes into the given buffer.  This is a
 // naked prototype, so additional arguments could be added -- it will be missing
 // the trailing ")" and it will not have EXPORT or anything like that on it.
-static void cg_emit_proc_prototype(ast_node *ast, charbuf *proc_decl, bool_t force_fetch_results) {
+// CQL_PROTO_STREAM gives the foo_stream form of an OUT UNION proc, which
+// takes a row sink instead of producing a result set.
+static void cg_emit_proc_prototype(ast_node *ast, charbuf *proc_decl, int32_t proto_kind) {
   Contract(is_ast_create_proc_stmt(ast) || is_ast_declare_proc_stmt(ast));
   EXTRACT_NOTNULL(proc_params_stmts, ast->right);
   EXTRACT(params, proc_params_stmts->left);
@@ -3856,14 +4063,16 @@ static void cg_emit_proc_prototype(ast_node *ast, charbuf *proc_decl, bool_t for
     name = n;
   }
 
+  bool_t force_fetch_results = proto_kind == CQL_FORCE_FETCH_RESULTS;
+  bool_t stream_rows = proto_kind == CQL_PROTO_STREAM;
   bool_t private_proc = is_proc_private(ast);
   bool_t dml_proc = is_dml_proc(ast->sem->sem_type);
   bool_t result_set_proc = has_result_set(ast);
   bool_t out_stmt_proc = has_out_stmt_result(ast);
-  bool_t out_union_proc = has_out_union_stmt_result(ast) || force_fetch_results;
+  bool_t out_union_proc = (has_out_union_stmt_result(ast) || force_fetch_results) && !stream_rows;
 
   // if you're doing out_union then the row fetcher is all there is
-  CSTR suffix = out_union_proc ? "_fetch_results" : "";
+  CSTR suffix = stream_rows ? "_stream" : out_union_proc ? "_fetch_results" : "";
 
   // use alternative prefix if there is one.
   CSTR prefix = rt->symbol_prefix;
@@ -3911,6 +4120,14 @@ static void cg_emit_proc_prototype(ast_node *ast, charbuf *proc_decl, bool_t for
       bprintf(proc_decl, ", ");
     }
     cg_params(params, proc_decl, CG_PROC_PARAMS_IN_ALIAS);
+    need_comma = true;
+  }
+
+  if (stream_rows) {
+    if (need_comma) {
+      bprintf(proc_decl, ", ");
+    }
+    bprintf(proc_decl, "cql_row_sink _Nonnull _sink_, void *_Nullable _sink_context_");
   }
 
   if (out_stmt_proc && !force_fetch_results) {
@@ -3923,13 +4140,84 @@ static void cg_emit_proc_prototype(ast_node *ast, charbuf *proc_decl, bool_t for
     CHARBUF_CLOSE(result_type);
   }
 
-  if (!params && !out_stmt_proc && !out_union_proc && !dml_proc) {
+  if (!params && !out_stmt_proc && !out_union_proc && !dml_proc && !stream_rows) {
     bprintf(proc_decl, "void");  // make foo(void) rather than foo()
   }
 
   CHARBUF_CLOSE(proc_sym);
 }
 
+// A procedure marked [[stream_rows]] is emitted as foo_stream which hands each
+// OUT UNION row to a caller supplied sink.  The usual foo_fetch_results is then
+// just a wrapper that streams into a byte buffer with the standard sink and
+// makes the result set from that, so callers of either form see the same rows.
+static void cg_stream_rows_fetch_results(ast_node *ast) {
+  Contract(is_ast_create_proc_stmt(ast));
+  EXTRACT_STRING(name, ast->left);
+  EXTRACT_NOTNULL(proc_params_stmts, ast->right);
+  EXTRACT(params, proc_params_stmts->left);
+
+  bool_t private_proc = is_proc_private(ast);
+  bool_t dml_proc = is_dml_proc(ast->sem->sem_type);
+
+  CG_CHARBUF_OPEN_SYM(proc_name_base, name);
+  CG_CHARBUF_OPEN_SYM(stream_sym, name, "_stream");
+  CG_CHARBUF_OPEN_SYM(perf_index, name, "_perf_index");
+  CHARBUF_OPEN(fetch_results_decl);
+  CHARBUF_OPEN(args);
+
+  cg_emit_proc_prototype(ast, &fetch_results_decl, CQL_PROTO_NORMAL);
+
+  if (private_proc)  {
+    bprintf(cg_header_output, "// %s);\n", fetch_results_decl.ptr);
+  }
+  else {
+    bprintf(cg_header_output, "%s%s);\n", rt->symbol_visibility, fetch_results_decl.ptr);
+  }
+
+  if (dml_proc) {
+    bprintf(&args, "_db_, ");
+  }
+  if (params) {
+    cg_param_forwards(params, &args);
+    bprintf(&args, ", ");
+  }
+  bprintf(&args, "cql_bytebuf_row_sink, &_rows_");
+
+  bprintf(cg_declarations_output, "\n%s) {\n", fetch_results_decl.ptr);
+  bprintf(cg_declarations_output, "  cql_bytebuf _rows_;\n");
+  bprintf(cg_declarations_output, "  cql_bytebuf_open(&_rows_);\n");
+  bprintf(cg_declarations_output, "  *_result_set_ = NULL;\n");
+  bprintf(cg_declarations_output, "  cql_profile_start(CRC_%s, &%s);\n", proc_name_base.ptr, perf_index.ptr);
+
+  if (dml_proc) {
+    bprintf(cg_declarations_output, "  cql_code _rc_ = %s(%s);\n", stream_sym.ptr, args.ptr);
+    bprintf(cg_declarations_output, "  %s_info.db = _db_;\n", proc_name_base.ptr);
+  }
+  else {
+    bprintf(cg_declarations_output, "  %s(%s);\n", stream_sym.ptr, args.ptr);
+  }
+
+  CSTR rc = dml_proc ? "_rc_" : "SQLITE_OK";
+  bprintf(cg_declarations_output,
+    "  cql_results_from_data(%s, &_rows_, &%s_info, (cql_result_set_ref *)_result_set_);\n",
+    rc,
+    proc_name_base.ptr);
+
+  if (dml_proc) {
+    bprintf(cg_declarations_output, "  %s_info.db = NULL;\n", proc_name_base.ptr);
+    bprintf(cg_declarations_output, "  return _rc_;\n");
+  }
+
+  bprintf(cg_declarations_output, "}\n");
+
+  CHARBUF_CLOSE(args);
+  CHARBUF_CLOSE(fetch_results_decl);
+  CHARBUF_CLOSE(perf_index);
+  CHARBUF_CLOSE(stream_sym);
+  CHARBUF_CLOSE(proc_name_base);
+}
+
 // Emitting a stored proc is mostly setup.  We have a bunch of housekeeping to do:
 //  * create new scratch buffers for the body and the locals and the cleanup section
 //  * save the current output globals
@@ -3958,6 +4246,7 @@ static void cg_create_proc_stmt(ast_node *ast) {
   bool_t out_stmt_proc = has_out_stmt_result(ast);
   bool_t out_union_proc = has_out_union_stmt_result(ast);
   bool_t calls_out_union = has_out_union_call(ast);
+  bool_t stream_rows = out_union_proc && !calls_out_union && is_proc_stream_rows(ast);
   proc_cte_index = 0;
   cur_bound_statement = 0;
   int32_t c_prepared_statement_index_saved = c_prepared_statement_index;
@@ -4009,8 +4298,10 @@ static void cg_create_proc_stmt(ast_node *ast) {
 
   bprintf(cg_declarations_output, "\n");
 
-  // if you're doing out_union then the row fetcher is all there is
-  CSTR suffix = out_union_proc ? "_fetch_results" : "";
+  // if you're doing out_union then the row fetcher is all there is, unless
+  // the rows are streamed in which case the body is the streaming form
+  // and the row fetcher is a wrapper around it.
+  CSTR suffix = stream_rows ? "_stream" : out_union_proc ? "_fetch_results" : "";
 
   CG_CHARBUF_OPEN_SYM(proc_name_base, name);
   CG_CHARBUF_OPEN_SYM(proc_sym, name, suffix);
@@ -4018,7 +4309,9 @@ static void cg_create_proc_stmt(ast_node *ast) {
   bprintf(cg_declarations_output, "#define _PROC_ \"%s\"\n", proc_sym.ptr);
 
   if (out_stmt_proc || out_union_proc) {
-    cg_c_struct_for_sptr(cg_fwd_ref_output, ast->sem->sptr, NULL);
+    // a sink is handed rows in this layout so it has to be public
+    charbuf *row_struct_output = stream_rows ? cg_header_output : cg_fwd_ref_output;
+    cg_c_struct_for_sptr(row_struct_output, ast->sem->sptr, NULL);
     cg_struct_teardown_info(cg_declarations_output, ast->sem->sptr, NULL);
   }
 
@@ -4047,12 +4340,16 @@ static void cg_create_proc_stmt(ast_node *ast) {
   cg_cleanup_output = &proc_cleanup;
 
   CHARBUF_OPEN(proc_decl);
-  cg_emit_proc_prototype(ast, &proc_decl, CQL_PROTO_NORMAL);
+  cg_emit_proc_prototype(ast, &proc_decl, stream_rows ? CQL_PROTO_STREAM : CQL_PROTO_NORMAL);
 
   if (out_union_proc) {
     CG_CHARBUF_OPEN_SYM(result_set_ref, name, "_result_set_ref");
 
-    if (!calls_out_union) {
+    if (stream_rows) {
+      // the rows go to the sink, the _fetch_results wrapper emitted after the
+      // body does the result set work
+    }
+    else if (!calls_out_union) {
       CSTR rc = dml_proc ? "_rc_" : "SQLITE_OK";
       if (dml_proc) {
         bprintf(&proc_cleanup, "  %s_info.db = _db_;\n", proc_name_base.ptr);
@@ -4126,7 +4423,7 @@ static void cg_create_proc_stmt(ast_node *ast) {
     gen_declare_proc_closure(ast, emitted_proc_decls);
   }
 
-  if (out_union_proc) {
+  if (out_union_proc && !stream_rows) {
     // clobber the out arg, it is assumed to be trash by convention
     bprintf(&proc_locals, "*_result_set_ = NULL;\n");
   }
@@ -4155,7 +4452,7 @@ static void cg_create_proc_stmt(ast_node *ast) {
     }
   }
 
-  if (out_union_proc && !calls_out_union) {
+  if (out_union_proc && !calls_out_union && !stream_rows) {
     bprintf(cg_declarations_output, "  cql_bytebuf _rows_;\n");
     bprintf(cg_declarations_output, "  cql_bytebuf_open(&_rows_);\n");
   }
@@ -4218,6 +4515,10 @@ static void cg_create_proc_stmt(ast_node *ast) {
   bprintf(cg_declarations_output, "}\n");
   bprintf(cg_declarations_output, "#undef _PROC_\n");
 
+  if (stream_rows) {
+    cg_stream_rows_fetch_results(ast);
+  }
+
   CHARBUF_CLOSE(proc_decl);
   CHARBUF_CLOSE(proc_sym);
   CHARBUF_CLOSE(proc_name_base);
@@ -5396,8 +5697,13 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
   bool_t may_reuse_statement = !has_conditional_fragments && cg_in_loop;
   bool_t reusing_statement = false;
 
+  if (cg_in_loop && has_conditional_fragments) {
+    cg_loop_prepare_warning(stmt, "the statement text depends on conditional fragments");
+  }
+
   bool_t minify_aliases = !!(cg_flags & CG_MINIFY_ALIASES);
   bool_t exec_only = !!(cg_flags & CG_EXEC);
+  bool_t loop_cursor = !!(cg_flags & CG_LOOP_CURSOR);
 
   gen_sql_callbacks callbacks;
   init_gen_sql_callbacks(&callbacks);
@@ -5420,8 +5726,13 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
   gen_set_output_buffer(&sql);
   gen_statement_with_callbacks(stmt, &callbacks);
 
+  // A DML statement with no bindings would normally go to cql_exec which
+  // prepares it every time, in a loop we prepare it once and step it instead.
+  bool_t hoist_unbound = exec_only && !vars && may_reuse_statement &&
+    (is_insert_stmt(stmt) || is_update_stmt(stmt) || is_delete_stmt(stmt));
+
   // whether or not there is a prepare statement
-  bool_t has_prepare_stmt = !exec_only || vars;
+  bool_t has_prepare_stmt = !exec_only || vars || hoist_unbound;
 
   uint32_t count = 0;
   for (list_item *item = vars; item; item = item->next, count++) ;
@@ -5438,6 +5749,18 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
     stmt_name = temp_stmt.ptr;
   }
 
+  // A cursor declared in a loop keeps its statement from the last iteration,
+  // if the text can't change we reset it and bind again, otherwise start over.
+  if (loop_cursor) {
+    Invariant(stmt_name);
+    if (may_reuse_statement) {
+      reusing_statement = true;
+    }
+    else {
+      bprintf(cg_main_output, "cql_finalize_stmt(&%s_stmt);\n", stmt_name);
+    }
+  }
+
   // take care of what's left in the buffer after the other fragments have been emitted
   if (has_shared_fragments) {
     cg_emit_one_frag(&sql);
@@ -5512,7 +5835,12 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
   }
 
   if (reusing_statement) {
-    bprintf(cg_main_output, "}\nelse {\n  _rc_ = SQLITE_OK;\n}\n");
+    if (loop_cursor) {
+      bprintf(cg_main_output, "}\nelse {\n  sqlite3_reset(%s_stmt);\n  _rc_ = SQLITE_OK;\n}\n", stmt_name);
+    }
+    else {
+      bprintf(cg_main_output, "}\nelse {\n  _rc_ = SQLITE_OK;\n}\n");
+    }
   }
 
   CHARBUF_CLOSE(temp_stmt);
@@ -5543,7 +5871,7 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
     cg_error_on_not_sqlite_ok();
   }
 
-  if (exec_only && vars) {
+  if (exec_only && has_prepare_stmt) {
     bprintf(cg_main_output, "_rc_ = sqlite3_step(%s_stmt);\n", stmt_name);
     cg_error_on_rc_notequal("SQLITE_DONE");
 
@@ -5958,7 +6286,7 @@ static void cg_declare_cursor(ast_node *ast) {
       // easy case, no boxing, just finalize on exit.
       bprintf(cg_cleanup_output, "  cql_finalize_stmt(&%s_stmt);\n", cursor_name);
 
-      if (cg_in_loop) {
+      if (cg_in_loop && !is_for_select) {
         // tricky case, the call might iterate so we have to clean up the cursor before we do the call
         bprintf(cg_main_output, "cql_finalize_stmt(&%s_stmt);\n", cursor_name);
       }
@@ -5971,12 +6299,23 @@ static void cg_declare_cursor(ast_node *ast) {
     // DECLARE [name] CURSOR FOR [explain_stmt]
     EXTRACT_ANY_NOTNULL(select_stmt, ast->right);
 
+    int32_t cg_flags = CG_PREPARE|CG_MINIFY_ALIASES;
+
     if (is_boxed) {
       // The next prepare will finalize the statement, we don't want to do that
       // if the cursor is being handled by boxes. The box downcount will take care of it
       bprintf(cg_main_output, "%s_stmt = NULL;\n", cursor_name);
+
+      if (cg_in_loop) {
+        cg_loop_prepare_warning(ast, "boxed cursors get a new statement every time");
+      }
+    }
+    else if (cg_in_loop) {
+      // the cursor's statement survives to the next iteration, it can be reused
+      cg_flags |= CG_LOOP_CURSOR;
     }
-    cg_bound_sql_statement(cursor_name, select_stmt, CG_PREPARE|CG_MINIFY_ALIASES);
+
+    cg_bound_sql_statement(cursor_name, select_stmt, cg_flags);
   }
   else if (is_unboxing) {
     Invariant(is_for_expr);
@@ -6040,6 +6379,27 @@ static void cg_declare_cursor(ast_node *ast) {
 
   if (name_ast->sem->sem_type & SEM_TYPE_HAS_SHAPE_STORAGE) {
     cg_declare_auto_cursor(cursor_name, name_ast->sem);
+
+    if (out_union_processing) {
+      // The cursor's column offsets and types; when the result set rows have
+      // exactly these, fetch can copy the rows directly into the cursor.
+      CSTR scope = current_proc_name();
+      CSTR suffix = scope ? "_" : "";
+      scope = scope ? scope : "";
+
+      CG_CHARBUF_OPEN_SYM(row_type, scope, suffix, cursor_name, "_row");
+      CHARBUF_OPEN(cols_name);
+      CHARBUF_OPEN(types_name);
+
+      bprintf(&cols_name, "%s_cols_", cursor_name);
+      bprintf(&types_name, "%s_data_types_", cursor_name);
+      cg_col_offsets(cg_declarations_output, name_ast->sem->sptr, cols_name.ptr, row_type.ptr);
+      cg_data_types(cg_declarations_output, name_ast->sem->sptr, types_name.ptr);
+
+      CHARBUF_CLOSE(types_name);
+      CHARBUF_CLOSE(cols_name);
+      CHARBUF_CLOSE(row_type);
+    }
   }
   else {
     // if it's a global cursor (`!in_proc`) we have to assume we will need the
@@ -6222,6 +6582,23 @@ static void cg_fetch_stmt(ast_node *ast) {
   // auto-generated cursor variables.  Either way we get each column.
 
   sem_struct *sptr = ast->left->sem->sptr;
+
+  // When fetching into the cursor storage try the direct row copy first, it
+  // declines if the result set's layout isn't the cursor's (e.g. rows made by
+  // a select, or encoded or compact columns) and then we read column by column
+  // as usual.
+  bool_t direct_copy = uses_out_union && !name_list;
+  charbuf *fetch_output = cg_main_output;
+  CHARBUF_OPEN(slow_fetch);
+
+  if (direct_copy) {
+    Invariant(ast->sem->sem_type & SEM_TYPE_HAS_SHAPE_STORAGE);
+    bprintf(cg_main_output,
+      "if (!cql_copyoutrow_direct((cql_result_set_ref)%s_result_set_, %s_row_num_, &%s, sizeof(%s), %s_cols_, %s_data_types_)) {\n",
+      cursor_name, cursor_name, cursor_name, cursor_name, cursor_name, cursor_name);
+    cg_main_output = &slow_fetch;
+  }
+
   if (uses_out_union) {
     bool_t dml_proc = is_dml_proc(ast->sem->sem_type);
     CSTR db_sym = "NULL";
@@ -6265,6 +6642,14 @@ static void cg_fetch_stmt(ast_node *ast) {
     }
   }
   bprintf(cg_main_output, ");\n");
+
+  if (direct_copy) {
+    cg_main_output = fetch_output;
+    bindent(cg_main_output, &slow_fetch, 2);
+    bprintf(cg_main_output, "}\n");
+  }
+  CHARBUF_CLOSE(slow_fetch);
+
   if (!uses_out_union) {
     cg_error_on_expr("_rc_ != SQLITE_ROW && _rc_ != SQLITE_DONE");
   }
@@ -6716,6 +7101,19 @@ static void cg_out_union_stmt(ast_node *ast) {
 
   // OUT UNION [cursor_name]
 
+  if (is_proc_stream_rows(current_proc)) {
+    // the row is lent to the sink, if the sink wants no more rows we're done
+    bprintf(cg_main_output, "if (%s._has_row_ && !_sink_(_sink_context_, (const void *)&%s, sizeof(%s))) {\n",
+      cursor_name, cursor_name, cursor_name);
+    if (is_dml_proc(current_proc->sem->sem_type)) {
+      bprintf(cg_main_output, "  _rc_ = SQLITE_OK;\n");
+    }
+    bprintf(cg_main_output, "  goto %s;\n", CQL_CLEANUP_DEFAULT_LABEL);
+    bprintf(cg_main_output, "}\n");
+    return_used = true;
+    return;
+  }
+
   bprintf(cg_main_output, "cql_retain_row(%s);\n", cursor_name);
   bprintf(cg_main_output, "if (%s._has_row_) ", cursor_name);
   bprintf(cg_main_output, "cql_bytebuf_append(&_rows_, (const void *)&%s, sizeof(%s));\n", cursor_name, cursor_name);
@@ -7836,8 +8234,60 @@ typedef struct function_info {
   CSTR row_struct_type;
   CSTR sym_suffix;
   CSTR value_suffix;
+  sem_t col_type;
+  bool_t null_bit;
+  bool_t nullable_value;  // the value part of a nullable primitive column
 } function_info;
 
+// With --unchecked_getters the inline getter reads the column straight out of
+// the row storage rather than going through the runtime helpers.  The helpers
+// verify the row, the column, and the data type on every call and nullable
+// columns take a second call for the null bit.  Codegen already knows the
+// column index and exact type statically so none of that is needed.  Note that
+// we can't simply index the generated row struct: a result set of this type
+// might have been extracted from a partition (parent/child) and those rows have
+// the cursor layout.  The offset from the result set's own meta is always right.
+// The row index is checked with cql_unchecked_getter_contract which is only
+// active in debug builds.
+//
+// e.g.
+//   cql_unchecked_getter_contract(result_set, row);
+//   return ((cql_nullable_int32 *)cql_unchecked_col_address(result_set, row, 3))->value;
+static void cg_proc_result_set_unchecked_getter_body(function_info *_Nonnull info, CSTR row) {
+  charbuf *out = info->headers;
+
+  bprintf(out, "  cql_unchecked_getter_contract(result_set, %s);\n", row);
+  bprintf(out, "  return ");
+
+  if (is_result_set_type(info->ret_type, info->ret_kind)) {
+    bprintf(out, "(");
+    cg_result_set_type_from_kind(out, info->ret_type, info->ret_kind);
+    bprintf(out, ")");
+  }
+
+  CHARBUF_OPEN(address);
+  bprintf(&address, "cql_unchecked_col_address(result_set, %s, %d)", row, info->col_index);
+
+  if (info->name_type == SEM_TYPE_NULL || info->nullable_value) {
+    // nullable primitives are stored as cql_nullable_* structs
+    sem_t stored_type = core_type_of(info->name_type == SEM_TYPE_NULL ? info->col_type : info->name_type);
+    CSTR field = info->name_type == SEM_TYPE_NULL ? "is_null" : "value";
+    bprintf(out, "((");
+    cg_var_decl(out, stored_type, "*", CG_VAR_DECL_PROTO);
+    bprintf(out, ")%s)->%s", address.ptr, field);
+  }
+  else {
+    bprintf(out, "*(");
+    cg_var_decl(out, info->col_type, "*", CG_VAR_DECL_PROTO);
+    bprintf(out, ")%s", address.ptr);
+  }
+
+  CHARBUF_CLOSE(address);
+
+  bprintf(out, ";\n");
+  bprintf(out, "}\n");
+}
+
 // The inlineable version of the getter can be generated instead of the opened
 // coded version as above This type inlines well because it uses a small number
 // of standard helpers to do the fetching. The situation is not so different
@@ -7892,6 +8342,17 @@ static void cg_proc_result_set_type_based_getter(function_info *_Nonnull info)
   // definitely set now
   Invariant(out);
 
+  // Nullable primitives in compact rows live in the null bitmap but a result set
+  // extracted from a partition has the cursor layout, so only the runtime
+  // helper, which consults the data type, can read them correctly.
+  if (options.unchecked_getters && !info->null_bit) {
+    cg_proc_result_set_unchecked_getter_body(info, row);
+    bprintf(h, "\n#endif\n\n");
+    CHARBUF_CLOSE(func_decl);
+    CHARBUF_CLOSE(col_getter_sym);
+    return;
+  }
+
   bprintf(out, "  return ");
 
   // cast the data type in the buffer to the correct result type
@@ -8097,12 +8558,15 @@ typedef struct fetch_result_info {
   CSTR col_offsets_sym;
   CSTR refs_offset_sym;
   CSTR identity_columns_sym;
+  CSTR encoded_columns_sym;
   CSTR row_sym;
   CSTR proc_sym;
   CSTR perf_index;
   ast_node *misc_attrs;
   int32_t refs_count;
   bool_t has_identity_columns;
+  bool_t has_encoded_columns;
+  int32_t encode_context_index;
   bool_t dml_proc;
   bool_t use_stmt;
   int32_t indent;
@@ -8154,6 +8618,10 @@ static void cg_fetch_info(fetch_result_info *info, charbuf *output)
     if (info->has_identity_columns) {
       bprintf(&tmp, "  .identity_columns = %s,\n", info->identity_columns_sym);
     }
+    if (info->has_encoded_columns) {
+      bprintf(&tmp, "  .encoded_columns = %s,\n", info->encoded_columns_sym);
+      bprintf(&tmp, "  .encode_context_index = %d,\n", info->encode_context_index);
+    }
     bprintf(&tmp, "  .rowsize = sizeof(%s),\n", info->row_sym);
     bprintf(&tmp, "  .crc = CRC_%s,\n", info->proc_sym);
     bprintf(&tmp, "  .perf_index = &%s,\n", info->perf_index);
@@ -8204,6 +8672,10 @@ static void cg_proc_result_set(ast_node *ast) {
 
   bool_t dml_proc = is_dml_proc(ast->sem->sem_type);
 
+  // only the select form has its own row storage, the others use the cursor
+  // layout which is shared with the generated code
+  bool_t compact_rows = result_set_proc && is_proc_compact_rows(ast);
+
   // register the proc name if there is a callback, the particular result type
   // will do whatever it wants
   if (rt->register_proc_name) rt->register_proc_name(name);
@@ -8227,6 +8699,7 @@ static void cg_proc_result_set(ast_node *ast) {
   CG_CHARBUF_OPEN_SYM(col_offsets_sym, name, "_col_offsets");
   CG_CHARBUF_OPEN_SYM(refs_offset_sym, name, "_refs_offset");
   CG_CHARBUF_OPEN_SYM(identity_columns_sym, name, "_identity_columns");
+  CG_CHARBUF_OPEN_SYM(encoded_columns_sym, name, "_encoded_columns");
   CG_CHARBUF_OPEN_SYM(result_count_sym, name, "_result_count");
   CG_CHARBUF_OPEN_SYM(fetch_results_sym, name, "_fetch_results");
   CG_CHARBUF_OPEN_SYM(copy_sym, name, "_copy");
@@ -8249,7 +8722,12 @@ static void cg_proc_result_set(ast_node *ast) {
     // As we walk the fields, construct the teardown operation needed
     // to clean up that field and save it.
     bprintf(d, "\ntypedef struct %s {\n", row_sym.ptr);
-    cg_fields_in_canonical_order(d, sptr);
+    if (compact_rows) {
+      cg_fields_in_compact_order(d, sptr);
+    }
+    else {
+      cg_fields_in_canonical_order(d, sptr);
+    }
     bprintf(d, "} %s;\n", row_sym.ptr);
   }
 
@@ -8287,8 +8765,13 @@ static void cg_proc_result_set(ast_node *ast) {
     CSTR col = sptr->names[i];
     CSTR kind = sptr->kinds[i];
 
+    bool_t null_bit = compact_rows && is_nullable(sem_type) && !is_ref_type(sem_type);
+
     bprintf(&data_types, "  ");
     cg_data_type(&data_types, sem_type);
+    if (null_bit) {
+      bprintf(&data_types, " | CQL_DATA_TYPE_NULL_BIT");
+    }
     bprintf(&data_types, ", // %s\n", col);
 
     if (suppress_getters) {
@@ -8308,6 +8791,8 @@ static void cg_proc_result_set(ast_node *ast) {
       .result_set_ref_type = result_set_ref.ptr,
       .row_struct_type = row_sym.ptr,
       .ret_kind = kind,
+      .col_type = sem_type,
+      .null_bit = null_bit,
     };
 
     if (col_is_nullable && !is_ref_type(sem_type)) {
@@ -8319,7 +8804,9 @@ static void cg_proc_result_set(ast_node *ast) {
       info.ret_type = core_type | SEM_TYPE_NOTNULL;
       info.name_type = core_type;
       info.sym_suffix = "_value";
+      info.nullable_value = true;
       cg_proc_result_set_type_based_getter(&info);
+      info.nullable_value = false;
 
       if (emit_setters) {
         info.name_type = core_type;
@@ -8351,6 +8838,9 @@ static void cg_proc_result_set(ast_node *ast) {
   bool_t generate_copy = (generate_copy_attr ||
                          (rt->proc_should_generate_copy && rt->proc_should_generate_copy(name)));
 
+  // Check whether we need to generate the result set blob helpers.
+  bool_t generate_serializer = misc_attrs && exists_attribute_str(misc_attrs, "generate_serializer");
+
   int32_t refs_count = refs_count_sptr(sptr);
 
   // generate reference and column offsets
@@ -8366,6 +8856,10 @@ static void cg_proc_result_set(ast_node *ast) {
 
   bool_t has_identity_columns = cg_identity_columns(h, d, name, misc_attrs, identity_columns_sym.ptr);
 
+  int32_t encode_context_index;
+  bool_t has_encoded_columns =
+    cg_encoded_columns(h, d, sptr, misc_attrs, encoded_columns_sym.ptr, &encode_context_index) > 0;
+
   bprintf(&result_set_create,
           "(%s)cql_result_set_create(%s, count, %d, %s, meta)",
           result_set_ref.ptr,
@@ -8406,7 +8900,7 @@ static void cg_proc_result_set(ast_node *ast) {
     // one row result set from out parameter
 
     bprintf(d, "  *result_set = NULL;\n");
-    bprintf(d, "  %s *row = (%s *)calloc(1, sizeof(%s));\n", row_sym.ptr, row_sym.ptr, row_sym.ptr);
+    bprintf(d, "  %s *row = (%s *)cql_calloc(1, sizeof(%s), CQL_ALLOC_ROW_DATA);\n", row_sym.ptr, row_sym.ptr, row_sym.ptr);
     bprintf(d, "  ");
 
     // optional db arg and return code
@@ -8432,6 +8926,9 @@ static void cg_proc_result_set(ast_node *ast) {
         .refs_offset_sym = refs_offset_sym.ptr,
         .has_identity_columns = has_identity_columns,
         .identity_columns_sym = identity_columns_sym.ptr,
+        .has_encoded_columns = has_encoded_columns,
+        .encoded_columns_sym = encoded_columns_sym.ptr,
+        .encode_context_index = encode_context_index,
         .row_sym = row_sym.ptr,
         .proc_sym = proc_sym.ptr,
         .perf_index = perf_index.ptr,
@@ -8485,6 +8982,9 @@ static void cg_proc_result_set(ast_node *ast) {
         .refs_offset_sym = refs_offset_sym.ptr,
         .has_identity_columns = has_identity_columns,
         .identity_columns_sym = identity_columns_sym.ptr,
+        .has_encoded_columns = has_encoded_columns,
+        .encoded_columns_sym = encoded_columns_sym.ptr,
+        .encode_context_index = encode_context_index,
         .row_sym = row_sym.ptr,
         .proc_sym = proc_sym.ptr,
         .perf_index = perf_index.ptr,
@@ -8509,6 +9009,9 @@ static void cg_proc_result_set(ast_node *ast) {
         .refs_offset_sym = refs_offset_sym.ptr,
         .has_identity_columns = has_identity_columns,
         .identity_columns_sym = identity_columns_sym.ptr,
+        .has_encoded_columns = has_encoded_columns,
+        .encoded_columns_sym = encoded_columns_sym.ptr,
+        .encode_context_index = encode_context_index,
         .row_sym = row_sym.ptr,
         .proc_sym = proc_sym.ptr,
         .perf_index = perf_index.ptr,
@@ -8533,6 +9036,67 @@ static void cg_proc_result_set(ast_node *ast) {
       uses_out ? "": ", from, count",
       uses_out ? "0" : "from",
       uses_out ? "1" : "count");
+
+    // slices share the rows with the source, so only useful for many rows
+    if (!uses_out) {
+      CG_CHARBUF_OPEN_SYM(slice_sym, name, "_slice");
+      bprintf(
+        h,
+        "#define %s(result_set, result_set_to, from, count) \\\n"
+        "cql_rowset_slice( \\\n"
+        "  (cql_result_set_ref)(result_set), \\\n"
+        "  (cql_result_set_ref *)(result_set_to), \\\n"
+        "  from, \\\n"
+        "  count)\n",
+        slice_sym.ptr);
+      CHARBUF_CLOSE(slice_sym);
+    }
+  }
+
+  if (generate_serializer) {
+    // the writer is generic, the reader needs the shape and the row layout
+    CG_CHARBUF_OPEN_SYM(to_blob_sym, name, "_to_blob");
+    CG_CHARBUF_OPEN_SYM(from_blob_sym, name, "_from_blob");
+
+    bprintf(
+      h,
+      "#define %s(result_set, blob) \\\n"
+      "cql_result_set_to_blob((cql_result_set_ref)(result_set), blob)\n",
+      to_blob_sym.ptr);
+
+    bclear(&temp);
+    bprintf(&temp,
+      "CQL_WARN_UNUSED cql_code %s(cql_blob_ref _Nullable blob, %s _Nullable *_Nonnull result_set)",
+      from_blob_sym.ptr,
+      result_set_ref.ptr);
+    bprintf(h, "%s%s;\n", rt->symbol_visibility, temp.ptr);
+    bprintf(d, "\n%s {\n", temp.ptr);
+
+    // the values were encoded when the result set was made, they are read as is
+    fetch_result_info info = {
+        .dml_proc = false,
+        .use_stmt = false,
+        .data_types_sym = data_types_sym.ptr,
+        .col_offsets_sym = col_offsets_sym.ptr,
+        .refs_count = refs_count,
+        .refs_offset_sym = refs_offset_sym.ptr,
+        .has_identity_columns = has_identity_columns,
+        .identity_columns_sym = identity_columns_sym.ptr,
+        .row_sym = row_sym.ptr,
+        .proc_sym = proc_sym.ptr,
+        .perf_index = perf_index.ptr,
+        .indent = 2,
+    };
+
+    cg_fetch_info(&info, d);
+
+    // only the rows of select procs have no row header
+    bprintf(d, "  return cql_result_set_from_blob(&info, %s, blob, (cql_result_set_ref *)result_set);\n",
+      result_set_proc ? "false" : "true");
+    bprintf(d, "}\n");
+
+    CHARBUF_CLOSE(from_blob_sym);
+    CHARBUF_CLOSE(to_blob_sym);
   }
 
   if (rt->generate_equality_macros) {
@@ -8580,6 +9144,19 @@ static void cg_proc_result_set(ast_node *ast) {
         uses_out ? "0" : "row1",
         uses_out ? "0" : "row2");
       CHARBUF_CLOSE(same_sym);
+
+      // the diff is only interesting for many rows so there's no OUT form
+      if (!uses_out) {
+        CG_CHARBUF_OPEN_SYM(diff_sym, name, "_diff");
+        bprintf(
+          h, "#define %s(old_rs, new_rs, diff) \\\n"
+          "cql_result_set_diff( \\\n"
+          "  (cql_result_set_ref)(old_rs), \\\n"
+          "  (cql_result_set_ref)(new_rs), \\\n"
+          "  diff)\n",
+          diff_sym.ptr);
+        CHARBUF_CLOSE(diff_sym);
+      }
     }
   }
 
@@ -8587,6 +9164,7 @@ static void cg_proc_result_set(ast_node *ast) {
   CHARBUF_CLOSE(copy_sym);
   CHARBUF_CLOSE(fetch_results_sym);
   CHARBUF_CLOSE(result_count_sym);
+  CHARBUF_CLOSE(encoded_columns_sym);
   CHARBUF_CLOSE(identity_columns_sym);
   CHARBUF_CLOSE(refs_offset_sym);
   CHARBUF_CLOSE(col_offsets_sym);
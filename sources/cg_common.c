@@ -118,6 +118,18 @@ cql_noexport void cg_common_init(void)
 cql_noexport void cg_no_op(ast_node * ast) {
 }
 
+// Statements in loops normally keep their prepared statement from one
+// iteration to the next.  When the code generator can't do that it says
+// so here, if asked.  This is a warning, it doesn't stop the compilation.
+cql_noexport void cg_loop_prepare_warning(ast_node *ast, CSTR reason) {
+  if (options.warn_loop_prepare) {
+    cql_error("%s:%d:1: warning: statement in a loop is prepared on every iteration : %s\n",
+      ast->filename,
+      ast->lineno,
+      reason);
+  }
+}
+
 // If there is a semantic error, we should not proceed with code generation.
 // We find such an error at the root of the AST.  Note its important
 // to be pristine in memory usage because the amalgam version of the compiler
@@ -28,6 +28,9 @@
 #define CG_EMIT_ONLY_BINDING 4  // assume the statement is ready to be bound, emit only the bindings
 #define CG_EMIT_ONLY_PREPARE 8  // emit only the prepare, omitting the bindings which will be done later using the above
 
+// the named statement belongs to a cursor declared in a loop, it may be reset and rebound rather than prepared again
+#define CG_LOOP_CURSOR 16
+
 // To understand the PUSH/POP eval macros, and generally all the expression state
 // macros you have to understand the overall theory of operation of the expression
 // code generation.  In a traditional evaluation you could walk the tree and assemble
@@ -145,6 +148,10 @@ cql_noexport void exit_on_no_global_proc(void);
 // For the common case of "semantic-only" nodes
 cql_noexport void cg_no_op(ast_node *_Nonnull ast);
 
+// With --warn_loop_prepare, reports a statement in a loop that can't reuse
+// its prepared statement and so is prepared on every iteration
+cql_noexport void cg_loop_prepare_warning(ast_node *_Nonnull ast, CSTR _Nonnull reason);
+
 cql_noexport int32_t cg_find_first_line(ast_node *_Nonnull ast);
 
 typedef struct cg_blob_mappings_struct {
@@ -27,6 +27,7 @@ cql_noexport void cg_lua_cleanup() {}
 #include "eval.h"
 #include "symtab.h"
 #include "encoders.h"
+#include "compat.h"
 #include "cg_lua.h"
 
 // relevant LUA binding order
@@ -244,6 +245,60 @@ static bool_t lua_needs_paren(ast_node *ast, int32_t pri_new, int32_t pri) {
   return ast->parent->right == ast;
 }
 
+// True if the generated Lua text can be evaluated more than once with no side
+// effects and essentially no cost: a plain identifier, a field reference, or
+// an unsigned number.  Anything else (calls, operators, parens) is not simple.
+static bool_t lua_is_simple_operand(CSTR text) {
+  if (!text[0]) {
+    return false;
+  }
+
+  for (CSTR p = text; *p; p++) {
+    if (!IsAlpha(*p) && !IsDigit(*p) && *p != '_' && *p != '.') {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// True if the generated Lua text is entirely wrapped in one pair of parens
+// so that it can be used as an operand of any operator.  String literals are
+// skipped so that parens inside them do not confuse the count.
+static bool_t lua_is_parenthesized(CSTR text) {
+  if (text[0] != '(') {
+    return false;
+  }
+
+  int32_t depth = 0;
+  bool_t in_string = false;
+
+  for (CSTR p = text; *p; p++) {
+    if (in_string) {
+      if (*p == '\\' && p[1]) {
+        p++;
+      }
+      else if (*p == '"') {
+        in_string = false;
+      }
+    }
+    else if (*p == '"') {
+      in_string = true;
+    }
+    else if (*p == '(') {
+      depth++;
+    }
+    else if (*p == ')') {
+      depth--;
+      if (depth == 0) {
+        return p[1] == 0;
+      }
+    }
+  }
+
+  return false;
+}
+
 // emits a cql_to_num call including a few special cases
 // e.g. cql_to_num(true) and cql_to_num(false) are very common
 static void cg_lua_emit_to_num(charbuf *output, CSTR input) {
@@ -267,12 +322,23 @@ static void cg_lua_emit_to_num(charbuf *output, CSTR input) {
 
 // converts a boolean into a number if necessary
 // this is important because stuff like "true + 1 == 2" must be true
+// a boolean that can't be nil can be converted inline without the helper
 static void cg_lua_to_num(sem_t sem_type, charbuf *value) {
   if (is_bool(sem_type)) {
      CHARBUF_OPEN(temp);
      bprintf(&temp, "%s", value->ptr);
      bclear(value);
-     cg_lua_emit_to_num(value, temp.ptr);
+     if (is_not_nullable(sem_type) && strcmp("true", temp.ptr) && strcmp("false", temp.ptr)) {
+       if (lua_is_simple_operand(temp.ptr) || lua_is_parenthesized(temp.ptr)) {
+         bprintf(value, "(%s and 1 or 0)", temp.ptr);
+       }
+       else {
+         bprintf(value, "((%s) and 1 or 0)", temp.ptr);
+       }
+     }
+     else {
+       cg_lua_emit_to_num(value, temp.ptr);
+     }
      CHARBUF_CLOSE(temp);
   }
 }
@@ -323,13 +389,19 @@ static void cg_lua_emit_to_bool(charbuf *output, CSTR input) {
 // converts a numeric type into a boolean, this is important because
 // in lua 0 is not falsey.  So we must always generate stuff like
 // if cql_to_bool(int_expression) if we have a numeric exprecession and
-// need a boolean expression.
+// need a boolean expression.  If the number can't be nil a simple
+// comparison does the job without the helper.
 static void cg_lua_to_bool(sem_t sem_type, charbuf *value) {
   if (!is_bool(sem_type)) {
      CHARBUF_OPEN(temp);
      bprintf(&temp, "%s", value->ptr);
      bclear(value);
-     cg_lua_emit_to_bool(value, temp.ptr);
+     if (is_not_nullable(sem_type) && strcmp("0", temp.ptr) && strcmp("1", temp.ptr)) {
+       bprintf(value, "(%s ~= 0)", temp.ptr);
+     }
+     else {
+       cg_lua_emit_to_bool(value, temp.ptr);
+     }
      CHARBUF_CLOSE(temp);
   }
 }
@@ -622,6 +694,73 @@ static void cg_lua_store_same_type(charbuf *output, CSTR var, sem_t sem_type, CS
   cg_lua_store(output, var, sem_type, sem_type, value);
 }
 
+// True if the expression is known to produce a non-negative integer.  We only
+// trust integer literals (negative numbers are unary minus of a literal) and
+// division or modulus of such values because those cannot overflow.  This is
+// enough to let the common "x / 2" and "4 / 3" shapes avoid the sign fixups.
+static bool_t lua_is_non_negative_int(ast_node *ast) {
+  if (is_ast_num(ast)) {
+    EXTRACT_NUM_TYPE(num_type, ast);
+    return num_type == NUM_INT || num_type == NUM_LONG;
+  }
+
+  if (is_ast_div(ast) || is_ast_mod(ast)) {
+    return lua_is_non_negative_int(ast->left) && lua_is_non_negative_int(ast->right);
+  }
+
+  return false;
+}
+
+// Integer division and modulus in Lua round toward negative infinity but
+// C and SQLite truncate toward zero.  When both operands are known not null
+// we can usually open code the fixup rather than call cql_idiv or cql_mod
+// which also have to test for nil.
+//  * both sides non-negative: the Lua operator is already correct
+//  * right side non-negative, left side simple: test only the left sign
+//  * both sides simple: compare the signs directly
+//  * modulus otherwise: math.fmod has exactly the C semantics
+// Returns false if none of these apply, in which case the helper is used.
+static bool_t cg_lua_notnull_int_div_mod(
+  ast_node *ast,
+  CSTR op,
+  CSTR l,
+  CSTR r,
+  charbuf *value,
+  int32_t pri,
+  int32_t pri_new)
+{
+  bool_t is_mod = !strcmp(op, "%");
+  CSTR lua_op = is_mod ? "%" : "//";
+
+  if (lua_is_non_negative_int(ast->left) && lua_is_non_negative_int(ast->right)) {
+    if (lua_needs_paren(ast, pri_new, pri)) {
+      bprintf(value, "(%s %s %s)", l, lua_op, r);
+    }
+    else {
+      bprintf(value, "%s %s %s", l, lua_op, r);
+    }
+    return true;
+  }
+
+  if (lua_is_non_negative_int(ast->right) && lua_is_simple_operand(l)) {
+    bprintf(value, "(%s >= 0 and %s %s %s or -(-%s %s %s))", l, l, lua_op, r, l, lua_op, r);
+    return true;
+  }
+
+  if (is_mod) {
+    // the sign of the result follows the left operand, just like C
+    bprintf(value, "math.fmod(%s, %s)", l, r);
+    return true;
+  }
+
+  if (lua_is_simple_operand(l) && lua_is_simple_operand(r)) {
+    bprintf(value, "((%s < 0) == (%s < 0) and %s // %s or -(-%s // %s))", l, r, l, r, l, r);
+    return true;
+  }
+
+  return false;
+}
+
 // All the normal (no short-circuit) binary operators
 // can be handled the same way.
 //   * op is the operator text
@@ -635,6 +774,7 @@ static void cg_lua_store_same_type(charbuf *output, CSTR var, sem_t sem_type, CS
 static void cg_lua_binary(ast_node *ast, CSTR op, charbuf *value, int32_t pri, int32_t pri_new) {
   // left op right
   bool_t force_call = false;
+  bool_t int_div_or_mod = false;
 
   ast_node *l = ast->left;
   ast_node *r = ast->right;
@@ -651,7 +791,7 @@ static void cg_lua_binary(ast_node *ast, CSTR op, charbuf *value, int32_t pri, i
     if (core_type_of(sem_type_result) != SEM_TYPE_REAL) {
        // lua integer division operator
        op_name = "idiv";
-       force_call = true;
+       int_div_or_mod = true;
     }
   }
 
@@ -659,7 +799,7 @@ static void cg_lua_binary(ast_node *ast, CSTR op, charbuf *value, int32_t pri, i
   // numbers than C. We have to emulate the C/SQLite behavior
   // Mod is only allowed to operate on integer so we don't have to check
   if (!strcmp(op, "%")) {
-    force_call = true;
+    int_div_or_mod = true;
   }
 
   if (!strcmp(op, "~=")) {
@@ -701,6 +841,11 @@ static void cg_lua_binary(ast_node *ast, CSTR op, charbuf *value, int32_t pri, i
   else if (force_call || is_nullable(sem_type_left) || is_nullable(sem_type_right)) {
     bprintf(value, "cql_%s(%s, %s)", op_name, l_value.ptr, r_value.ptr);
   }
+  else if (int_div_or_mod) {
+    if (!cg_lua_notnull_int_div_mod(ast, op, l_value.ptr, r_value.ptr, value, pri, pri_new)) {
+      bprintf(value, "cql_%s(%s, %s)", op_name, l_value.ptr, r_value.ptr);
+    }
+  }
   else {
     // Direct operator form only when semantics exactly match Lua defaults
     // (no nullables, no sign quirks, no blob compare); this keeps generated
@@ -929,14 +1074,30 @@ static void cg_lua_expr_and_or(ast_node *ast, CSTR str, charbuf *value, int32_t
 
       CSTR short_circuit_value = !strcmp("or", str) ? "true" : "false";
 
+      // When the result is not nullable neither operand can be nil so the
+      // left value can be tested directly and the right value is the answer
+      // if we get that far.  No helpers needed in that case.
+      bool_t notnull_result = is_not_nullable(sem_type_result);
+
       // we need a scratch for the left to avoid evaluating it twice
       CG_LUA_PUSH_TEMP(temp, SEM_TYPE_BOOL);
-      cg_lua_store_same_type(cg_main_output, temp.ptr, SEM_TYPE_BOOL, l_value.ptr);
+      if (notnull_result) {
+        // the direct test needs a real boolean, 0 is not falsey in Lua
+        cg_lua_store(cg_main_output, temp.ptr, SEM_TYPE_BOOL, sem_type_left, l_value.ptr);
+      }
+      else {
+        cg_lua_store_same_type(cg_main_output, temp.ptr, SEM_TYPE_BOOL, l_value.ptr);
+      }
 
       // This is the open coded short circuit version, the only difference between
       // `and` and `or` is the short circuit value (true or false) and of course
       // the test and final logical operation.  The rest of the code is the same.
-      bprintf(cg_main_output, "if cql_is_%s(%s) then\n", short_circuit_value, temp.ptr);
+      if (notnull_result) {
+        bprintf(cg_main_output, "if %s%s then\n", !strcmp("or", str) ? "" : "not ", temp.ptr);
+      }
+      else {
+        bprintf(cg_main_output, "if cql_is_%s(%s) then\n", short_circuit_value, temp.ptr);
+      }
       bprintf(cg_main_output, "  "); // indent the one line
       cg_lua_store_same_type(cg_main_output, result_var.ptr, sem_type_result, short_circuit_value);
       bprintf(cg_main_output, "else\n");
@@ -948,7 +1109,13 @@ static void cg_lua_expr_and_or(ast_node *ast, CSTR str, charbuf *value, int32_t
         CG_PUSH_MAIN_INDENT(r, 2)
         bprintf(cg_main_output, "%s", right_eval.ptr);
         CHARBUF_OPEN(result_expr);
-        bprintf(&result_expr, "cql_logical_%s(%s, %s)", str, temp.ptr, r_value.ptr);
+        if (notnull_result) {
+          bprintf(&result_expr, "%s", r_value.ptr);
+          cg_lua_to_bool(sem_type_right, &result_expr);
+        }
+        else {
+          bprintf(&result_expr, "cql_logical_%s(%s, %s)", str, temp.ptr, r_value.ptr);
+        }
         cg_lua_store_same_type(cg_main_output, result_var.ptr, sem_type_result, result_expr.ptr);
         CHARBUF_CLOSE(result_expr);
         CG_POP_MAIN_INDENT(r);
@@ -3432,8 +3599,13 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
   bool_t may_reuse_statement = !lua_has_conditional_fragments && lua_in_loop;
   bool_t reusing_statement = false;
 
+  if (lua_in_loop && lua_has_conditional_fragments) {
+    cg_loop_prepare_warning(stmt, "the statement text depends on conditional fragments");
+  }
+
   bool_t minify_aliases = !!(cg_lua_flags & CG_MINIFY_ALIASES);
   bool_t exec_only = !!(cg_lua_flags & CG_EXEC);
+  bool_t loop_cursor = !!(cg_lua_flags & CG_LOOP_CURSOR);
 
   gen_sql_callbacks callbacks;
   init_gen_sql_callbacks(&callbacks);
@@ -3456,8 +3628,13 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
   gen_set_output_buffer(&sql);
   gen_statement_with_callbacks(stmt, &callbacks);
 
+  // A DML statement with no bindings would normally go to cql_exec which
+  // prepares it every time, in a loop we prepare it once and step it instead.
+  bool_t hoist_unbound = exec_only && !vars && may_reuse_statement &&
+    (is_insert_stmt(stmt) || is_update_stmt(stmt) || is_delete_stmt(stmt));
+
   // whether or not there is a prepare statement
-  bool_t has_prepare_stmt = !exec_only || vars;
+  bool_t has_prepare_stmt = !exec_only || vars || hoist_unbound;
 
   uint32_t count = 0;
   for (list_item *item = vars; item; item = item->next, count++) ;
@@ -3474,6 +3651,18 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
     stmt_name = temp_stmt.ptr;
   }
 
+  // A cursor declared in a loop keeps its statement from the last iteration,
+  // if the text can't change we reset it and bind again, otherwise start over.
+  if (loop_cursor) {
+    Invariant(stmt_name);
+    if (may_reuse_statement) {
+      reusing_statement = true;
+    }
+    else {
+      bprintf(cg_main_output, "cql_finalize_stmt(%s_stmt)\n", stmt_name);
+    }
+  }
+
   // take care of what's left in the buffer after the other fragments have been emitted
   if (lua_has_shared_fragments) {
     cg_lua_emit_one_frag(&sql);
@@ -3530,6 +3719,10 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
   if (reusing_statement) {
     bprintf(cg_main_output, "  ");
     cg_lua_error_on_not_sqlite_ok();
+    if (loop_cursor) {
+      bprintf(cg_main_output, "else\n");
+      bprintf(cg_main_output, "  cql_reset_stmt(%s_stmt)\n", stmt_name);
+    }
     bprintf(cg_main_output, "end\n");
   }
   else {
@@ -3578,7 +3771,7 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
     cg_lua_error_on_not_sqlite_ok();
   }
 
-  if (exec_only && vars) {
+  if (exec_only && has_prepare_stmt) {
     bprintf(cg_main_output, "_rc_ = cql_step(%s_stmt)\n", stmt_name);
     cg_lua_error_on_rc_notequal("CQL_DONE");
     if (reusing_statement) {
@@ -3757,7 +3950,7 @@ static void cg_lua_declare_cursor(ast_node *ast) {
       bprintf(cg_cleanup_output, "  cql_finalize_stmt(%s_stmt)\n", cursor_name);
       bprintf(cg_cleanup_output, "  %s_stmt = nil\n", cursor_name);
 
-      if (lua_in_loop) {
+      if (lua_in_loop && !is_for_select) {
         // tricky case, the call might iterate so we have to clean up the cursor before we do the call
         bprintf(cg_main_output, "cql_finalize_stmt(%s_stmt)\n", cursor_name);
       }
@@ -3770,12 +3963,23 @@ static void cg_lua_declare_cursor(ast_node *ast) {
     // DECLARE [name] CURSOR FOR [explain_stmt]
     EXTRACT_ANY_NOTNULL(select_stmt, ast->right);
 
+    int32_t cg_lua_flags = CG_PREPARE|CG_MINIFY_ALIASES;
+
     if (is_boxed) {
       // The next prepare will finalize the statement, we don't want to do that
       // if the cursor is being handled by boxes. The box downcount will take care of it
       bprintf(cg_main_output, "%s_stmt = nil\n", cursor_name);
+
+      if (lua_in_loop) {
+        cg_loop_prepare_warning(ast, "boxed cursors get a new statement every time");
+      }
     }
-    cg_lua_bound_sql_statement(cursor_name, select_stmt, CG_PREPARE|CG_MINIFY_ALIASES);
+    else if (lua_in_loop) {
+      // the cursor's statement survives to the next iteration, it can be reused
+      cg_lua_flags |= CG_LOOP_CURSOR;
+    }
+
+    cg_lua_bound_sql_statement(cursor_name, select_stmt, cg_lua_flags);
   }
   else if (is_unboxing) {
     Invariant(is_for_expr);
@@ -18,13 +18,16 @@ cql_noexport void cg_query_plan_main(ast_node *head) {}
 #include <stdlib.h>
 #include "ast.h"
 #include "cg_query_plan.h"
+#include "bytebuf.h"
 #include "charbuf.h"
+#include "compat.h"
 #include "cql.h"
 #include "encoders.h"
 #include "gen_sql.h"
 #include "cg_common.h"
 #include "sem.h"
 #include "eval.h"
+#include "symtab.h"
 
 static void cg_qp_one_stmt(ast_node *stmt);
 
@@ -35,6 +38,14 @@ static CSTR current_procedure_name;
 static charbuf *current_ok_table_scan;
 static symtab *virtual_tables;
 
+// Every explained statement gets a stable id: the name of the proc it is in
+// and its ordinal within that proc, e.g. "get_users#2".  Unlike the sql id
+// this doesn't change when statements are added to other procs, so plans can
+// be compared across builds.  Statements outside of any proc use "#n".
+static CSTR qp_proc_name;
+static ast_node *qp_proc_misc_attrs;
+static uint32_t qp_stmt_ordinal;
+
 // Count sql statement found in ast
 static uint32_t sql_stmt_count = 0;
 
@@ -266,6 +277,431 @@ static bool_t if_stmt_callback(
   return true;
 }
 
+// The index advisor (--query_plan_advisor) keeps a little more state.  For each
+// explained statement we harvest the columns that an index could serve: equality
+// columns, range columns, and order by/group by columns.  Each of these turns into
+// a candidate index.  Candidates are de-duplicated across the whole file so that
+// one hypothetical index is evaluated against every statement that wanted it.
+typedef struct qp_index_candidate {
+  CSTR key;          // canonical table(cols) form, used for de-duplication
+  CSTR table_name;   // the table to be indexed
+  CSTR columns;      // the comma separated index columns
+  uint32_t id;       // one based candidate number
+} qp_index_candidate;
+
+static symtab *advisor_candidates;
+static symtab *advisor_calls;
+static bytebuf *advisor_candidate_list;
+static charbuf *advisor_stmts;
+static charbuf *advisor_plans;
+
+// Per statement state for the advisor, the tables in scope and the columns
+// that were found in the various index friendly positions.
+typedef struct qp_advisor_stmt {
+  symtab *aliases;      // alias or table name -> table name
+  bytebuf tables;       // distinct table names in order of appearance
+  symtab *eq_cols;      // table name -> bytebuf of equality columns
+  symtab *range_cols;   // table name -> bytebuf of range columns
+  symtab *order_cols;   // table name -> bytebuf of order by columns
+} qp_advisor_stmt;
+
+// Only real tables can be indexed. Views, virtual tables, backed tables and
+// quoted names are skipped, the latter only because they make the advice hard
+// to read.  We also return the canonical table name.
+static CSTR qp_advisor_indexable_table(ast_node *name_ast) {
+  if (!is_id(name_ast)) {
+    return NULL;
+  }
+
+  EXTRACT_STRING(name, name_ast);
+  ast_node *table_ast = find_table_or_view_even_deleted(name);
+  if (!table_ast || !is_ast_create_table_stmt(table_ast) || is_virtual_ast(table_ast)) {
+    return NULL;
+  }
+
+  if (is_backed(table_ast->sem->sem_type) || table_ast->sem->delete_version > 0) {
+    return NULL;
+  }
+
+  return table_ast->sem->sptr->struct_name;
+}
+
+// Returns the canonical column name if the table has such a column.
+static CSTR qp_advisor_find_column(CSTR table_name, CSTR col) {
+  ast_node *table_ast = find_table_or_view_even_deleted(table_name);
+  sem_struct *sptr = table_ast->sem->sptr;
+  for (uint32_t i = 0; i < sptr->count; i++) {
+    if (!StrCaseCmp(sptr->names[i], col)) {
+      return sptr->names[i];
+    }
+  }
+  return NULL;
+}
+
+// First pass: record every indexable table in the statement under its alias.
+static void qp_advisor_gather_tables(ast_node *ast, qp_advisor_stmt *info) {
+  if (!ast || is_primitive(ast)) {
+    return;
+  }
+
+  ast_node *name_ast = NULL;
+  ast_node *alias_ast = NULL;
+
+  if (is_ast_table_or_subquery(ast)) {
+    name_ast = ast->left;
+    EXTRACT(opt_as_alias, ast->right);
+    alias_ast = opt_as_alias ? opt_as_alias->left : NULL;
+  }
+  else if (is_ast_delete_stmt(ast) || is_ast_update_stmt(ast)) {
+    name_ast = ast->left;
+  }
+
+  CSTR table_name = name_ast ? qp_advisor_indexable_table(name_ast) : NULL;
+  if (table_name) {
+    CSTR alias = table_name;
+    if (alias_ast) {
+      EXTRACT_STRING(alias_name, alias_ast);
+      alias = alias_name;
+    }
+    symtab_add(info->aliases, alias, (void *)table_name);
+
+    bool_t found = false;
+    CSTR *tables = (CSTR *)info->tables.ptr;
+    for (uint32_t i = 0; i < info->tables.used / sizeof(CSTR); i++) {
+      found |= tables[i] == table_name;
+    }
+    if (!found) {
+      bytebuf_append_var(&info->tables, table_name);
+    }
+  }
+
+  qp_advisor_gather_tables(ast->left, info);
+  qp_advisor_gather_tables(ast->right, info);
+}
+
+// Map a column reference back to its table.  Dotted names go through the
+// alias table, bare names must match exactly one of the tables in scope.
+// Variables are not columns and anything ambiguous is ignored.
+static bool_t qp_advisor_resolve_column(
+  ast_node *ast,
+  qp_advisor_stmt *info,
+  CSTR *table_name,
+  CSTR *col_name)
+{
+  if (!is_id_or_dot(ast) || !ast->sem || is_variable(ast->sem->sem_type)) {
+    return false;
+  }
+
+  if (is_ast_dot(ast)) {
+    EXTRACT_STRING(scope, ast->left);
+    EXTRACT_STRING(col, ast->right);
+    symtab_entry *entry = symtab_find(info->aliases, scope);
+    if (!entry) {
+      return false;
+    }
+    *table_name = (CSTR)entry->val;
+    *col_name = qp_advisor_find_column(*table_name, col);
+    return !!*col_name;
+  }
+
+  EXTRACT_STRING(col, ast);
+  uint32_t matches = 0;
+  CSTR *tables = (CSTR *)info->tables.ptr;
+  for (uint32_t i = 0; i < info->tables.used / sizeof(CSTR); i++) {
+    CSTR found = qp_advisor_find_column(tables[i], col);
+    if (found) {
+      *table_name = tables[i];
+      *col_name = found;
+      matches++;
+    }
+  }
+  return matches == 1;
+}
+
+// Append the column to the list for its table if it isn't already there.
+static void qp_advisor_add_column(symtab *cols, CSTR table_name, CSTR col_name) {
+  bytebuf *buf = symtab_ensure_bytebuf(cols, table_name);
+  CSTR *names = (CSTR *)buf->ptr;
+  for (uint32_t i = 0; i < buf->used / sizeof(CSTR); i++) {
+    if (names[i] == col_name) {
+      return;
+    }
+  }
+  bytebuf_append_var(buf, col_name);
+}
+
+static void qp_advisor_column_use(ast_node *ast, qp_advisor_stmt *info, symtab *cols) {
+  CSTR table_name;
+  CSTR col_name;
+  if (qp_advisor_resolve_column(ast, info, &table_name, &col_name)) {
+    qp_advisor_add_column(cols, table_name, col_name);
+  }
+}
+
+// Walk the AND tree of a WHERE or ON clause, each conjunct that compares
+// a column might be satisfied by an index.  OR terms can't use a single
+// index so they are ignored.
+static void qp_advisor_conjuncts(ast_node *ast, qp_advisor_stmt *info) {
+  if (is_ast_and(ast)) {
+    qp_advisor_conjuncts(ast->left, info);
+    qp_advisor_conjuncts(ast->right, info);
+  }
+  else if (is_ast_eq(ast) || is_ast_is(ast)) {
+    qp_advisor_column_use(ast->left, info, info->eq_cols);
+    qp_advisor_column_use(ast->right, info, info->eq_cols);
+  }
+  else if (is_ast_in_pred(ast)) {
+    qp_advisor_column_use(ast->left, info, info->eq_cols);
+  }
+  else if (is_ast_lt(ast) || is_ast_gt(ast) || is_ast_le(ast) || is_ast_ge(ast)) {
+    qp_advisor_column_use(ast->left, info, info->range_cols);
+    qp_advisor_column_use(ast->right, info, info->range_cols);
+  }
+  else if (is_ast_between(ast)) {
+    qp_advisor_column_use(ast->left, info, info->range_cols);
+  }
+}
+
+// An ORDER BY or GROUP BY can use an index only if all its terms are columns
+// of the same table.
+static void qp_advisor_order_list(ast_node *list, qp_advisor_stmt *info) {
+  CSTR order_table = NULL;
+  bytebuf cols;
+  bytebuf_open(&cols);
+
+  for (ast_node *item = list; item; item = item->right) {
+    // groupby_item and orderby_item both have the expression on the left
+    EXTRACT_ANY_NOTNULL(expr, item->left->left);
+    CSTR table_name;
+    CSTR col_name;
+    if (!qp_advisor_resolve_column(expr, info, &table_name, &col_name)) {
+      goto cleanup;
+    }
+    if (order_table && order_table != table_name) {
+      goto cleanup;
+    }
+    order_table = table_name;
+    bytebuf_append_var(&cols, col_name);
+  }
+
+  if (order_table && !symtab_find(info->order_cols, order_table)) {
+    CSTR *names = (CSTR *)cols.ptr;
+    for (uint32_t i = 0; i < cols.used / sizeof(CSTR); i++) {
+      qp_advisor_add_column(info->order_cols, order_table, names[i]);
+    }
+  }
+
+cleanup:
+  bytebuf_close(&cols);
+}
+
+// Second pass: find the column uses anywhere in the statement, including
+// nested selects.
+static void qp_advisor_gather_columns(ast_node *ast, qp_advisor_stmt *info) {
+  if (!ast || is_primitive(ast)) {
+    return;
+  }
+
+  if (is_ast_opt_where(ast)) {
+    qp_advisor_conjuncts(ast->left, info);
+  }
+  else if (is_ast_join_cond(ast)) {
+    qp_advisor_conjuncts(ast->right, info);
+  }
+  else if (is_ast_orderby_list(ast) && !is_ast_orderby_list(ast->parent)) {
+    qp_advisor_order_list(ast, info);
+  }
+  else if (is_ast_groupby_list(ast) && !is_ast_groupby_list(ast->parent)) {
+    qp_advisor_order_list(ast, info);
+  }
+
+  qp_advisor_gather_columns(ast->left, info);
+  qp_advisor_gather_columns(ast->right, info);
+}
+
+// Record one candidate index for the current statement, merging with any
+// identical candidate that an earlier statement produced.
+static bool_t qp_advisor_add_candidate(CSTR table_name, bytebuf *cols) {
+  uint32_t count = cols->used / sizeof(CSTR);
+  if (!count) {
+    return false;
+  }
+
+  CSTR *names = (CSTR *)cols->ptr;
+  CHARBUF_OPEN(columns);
+  CHARBUF_OPEN(key);
+  for (uint32_t i = 0; i < count; i++) {
+    bprintf(&columns, "%s%s", i ? ", " : "", names[i]);
+  }
+  bprintf(&key, "%s(%s)", table_name, columns.ptr);
+
+  qp_index_candidate *candidate = NULL;
+  symtab_entry *entry = symtab_find(advisor_candidates, key.ptr);
+  if (entry) {
+    candidate = (qp_index_candidate *)(advisor_candidate_list->ptr) + (uint32_t)(uintptr_t)entry->val;
+  }
+  else {
+    uint32_t index = advisor_candidate_list->used / sizeof(qp_index_candidate);
+    candidate = bytebuf_new(advisor_candidate_list, qp_index_candidate);
+    candidate->key = Strdup(key.ptr);
+    candidate->table_name = table_name;
+    candidate->columns = Strdup(columns.ptr);
+    candidate->id = index + 1;
+    symtab_add(advisor_candidates, candidate->key, (void *)(uintptr_t)index);
+  }
+
+  // the same candidate can come up twice in one statement, e.g. the range
+  // column is also the order by column, only record the statement once
+  CHARBUF_OPEN(stmt_key);
+  bprintf(&stmt_key, "%s#%d", candidate->key, sql_stmt_count);
+  bool_t added = symtab_add(advisor_candidates, Strdup(stmt_key.ptr), NULL);
+  CHARBUF_CLOSE(stmt_key);
+
+  if (added) {
+    bprintf(advisor_stmts, "%s    (%d, %d, \"%s\")",
+      advisor_stmts->used > 1 ? ",\n" : "",
+      candidate->id,
+      sql_stmt_count,
+      qp_proc_name ? qp_proc_name : "");
+
+    charbuf *calls = symtab_ensure_charbuf(advisor_calls, candidate->key);
+    bprintf(calls, "  CALL advise_query_plan_%d(%d);\n", sql_stmt_count, candidate->id);
+  }
+
+  CHARBUF_CLOSE(key);
+  CHARBUF_CLOSE(columns);
+  return added;
+}
+
+// Harvest the index candidates for the statement, there are at most two per
+// table: the equality columns followed by the first range column, and the
+// equality columns followed by the order by columns.  Returns true if the
+// statement has any candidates and therefore needs to be re-planned.
+static bool_t qp_advisor_collect(ast_node *stmt) {
+  qp_advisor_stmt info;
+  info.aliases = symtab_new();
+  info.eq_cols = symtab_new();
+  info.range_cols = symtab_new();
+  info.order_cols = symtab_new();
+  bytebuf_open(&info.tables);
+
+  qp_advisor_gather_tables(stmt, &info);
+  qp_advisor_gather_columns(stmt, &info);
+
+  bool_t any = false;
+  CSTR *tables = (CSTR *)info.tables.ptr;
+  for (uint32_t i = 0; i < info.tables.used / sizeof(CSTR); i++) {
+    CSTR table_name = tables[i];
+    symtab_entry *eq = symtab_find(info.eq_cols, table_name);
+    symtab_entry *range = symtab_find(info.range_cols, table_name);
+    symtab_entry *order = symtab_find(info.order_cols, table_name);
+
+    bytebuf cols;
+    bytebuf_open(&cols);
+    if (eq) {
+      bytebuf *eq_buf = (bytebuf *)eq->val;
+      bytebuf_append(&cols, eq_buf->ptr, eq_buf->used);
+    }
+    uint32_t eq_used = cols.used;
+
+    if (range) {
+      // only the first range column that isn't already an equality column helps
+      CSTR *names = (CSTR *)((bytebuf *)range->val)->ptr;
+      uint32_t count = ((bytebuf *)range->val)->used / sizeof(CSTR);
+      for (uint32_t j = 0; j < count; j++) {
+        bool_t dup = false;
+        for (uint32_t k = 0; k < eq_used / sizeof(CSTR); k++) {
+          dup |= ((CSTR *)cols.ptr)[k] == names[j];
+        }
+        if (!dup) {
+          bytebuf_append_var(&cols, names[j]);
+          break;
+        }
+      }
+    }
+    any |= qp_advisor_add_candidate(table_name, &cols);
+
+    if (order) {
+      cols.used = eq_used;
+      CSTR *names = (CSTR *)((bytebuf *)order->val)->ptr;
+      uint32_t count = ((bytebuf *)order->val)->used / sizeof(CSTR);
+      for (uint32_t j = 0; j < count; j++) {
+        bool_t dup = false;
+        for (uint32_t k = 0; k < eq_used / sizeof(CSTR); k++) {
+          dup |= ((CSTR *)cols.ptr)[k] == names[j];
+        }
+        if (!dup) {
+          bytebuf_append_var(&cols, names[j]);
+        }
+      }
+      if (cols.used > eq_used) {
+        any |= qp_advisor_add_candidate(table_name, &cols);
+      }
+    }
+
+    bytebuf_close(&cols);
+  }
+
+  bytebuf_close(&info.tables);
+  SYMTAB_CLEANUP(info.aliases);
+  SYMTAB_CLEANUP(info.eq_cols);
+  SYMTAB_CLEANUP(info.range_cols);
+  SYMTAB_CLEANUP(info.order_cols);
+  return any;
+}
+
+// A plan regression can be tolerated by marking the statement, or its whole
+// proc, with [[ok_plan_regression]] or [[ok_plan_regression="reason"]].  The
+// baseline comparison reports these but they don't fail the run.
+static void cg_qp_emit_ok_plan_regression(ast_node *stmt, charbuf *output) {
+  // the explained statement might be nested, e.g. in a SET, so we climb to the
+  // statement that is in the statement list, that is where the attributes go
+  ast_node *enclosing = stmt;
+  while (enclosing->parent && !is_ast_stmt_list(enclosing->parent) && !is_ast_stmt_and_attr(enclosing->parent)) {
+    enclosing = enclosing->parent;
+  }
+
+  ast_node *misc_attrs = is_ast_stmt_and_attr(enclosing->parent) ? enclosing->parent->left : NULL;
+  if (!misc_attrs || !find_named_attr(misc_attrs, "ok_plan_regression")) {
+    misc_attrs = qp_proc_misc_attrs;
+    if (!misc_attrs || !find_named_attr(misc_attrs, "ok_plan_regression")) {
+      return;
+    }
+  }
+
+  // a bare attribute has no reason, we record an empty string for that
+  CSTR reason = get_named_string_attribute_value(misc_attrs, "ok_plan_regression");
+  if (!reason) {
+    reason = "";
+  }
+
+  CHARBUF_OPEN(plain);
+  CHARBUF_OPEN(json);
+  CHARBUF_OPEN(literal);
+
+  if (reason[0] == '\'') {
+    cg_decode_string_literal(reason, &plain);
+  }
+  else {
+    bprintf(&plain, "%s", reason);
+  }
+
+  // the reason goes into the JSON report verbatim so it is stored JSON encoded,
+  // this is the same double encoding that the statement text gets
+  cg_encode_json_string_literal(plain.ptr, &json);
+  bprintf(&literal, "\"");
+  for (uint32_t i = 1; i < json.used - 2; i++) {
+    cg_encode_char_as_c_string_literal(json.ptr[i], &literal);
+  }
+  bprintf(&literal, "\"");
+
+  bprintf(output, "INSERT INTO ok_plan_regression(sql_id, reason) VALUES(%d, %s);\n", sql_stmt_count, literal.ptr);
+
+  CHARBUF_CLOSE(literal);
+  CHARBUF_CLOSE(json);
+  CHARBUF_CLOSE(plain);
+}
+
 // Emits an explain query plan statement for the given statement node
 // the node could be any kind of DML including the select part of
 // a nested select expression like:  let x:= (select etc.);
@@ -313,7 +749,22 @@ static void cg_qp_explain_query_stmt(ast_node *stmt) {
   // string has escaped any quotes etc. that were in the original SQL.
   bprintf(&body, "LET stmt := %s;\n", c_str.ptr);
 
-  bprintf(&body, "INSERT INTO sql_temp(id, sql) VALUES(%d, stmt);\n", sql_stmt_count);
+  qp_stmt_ordinal++;
+  CSTR proc_name = qp_proc_name ? qp_proc_name : "";
+  bprintf(
+    &body,
+    "INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(%d, stmt, \"%s#%d\", \"%s\", \"%llx\");\n",
+    sql_stmt_count,
+    proc_name,
+    qp_stmt_ordinal,
+    proc_name,
+    (unsigned long long)crc_charbuf(&sql)
+  );
+
+  if (options.query_plan_baseline) {
+    cg_qp_emit_ok_plan_regression(stmt, &body);
+  }
+
   if (current_procedure_name && current_ok_table_scan && current_ok_table_scan->used > 1) {
     bprintf(
       &body,
@@ -337,6 +788,23 @@ static void cg_qp_explain_query_stmt(ast_node *stmt) {
 
   bprintf(query_plans, "%s", proc.ptr);
 
+  // In advisor mode, statements that could use an index get a second explain
+  // proc which records the plan under a hypothetical index.
+  if (options.query_plan_advisor && qp_advisor_collect(stmt)) {
+    bprintf(advisor_plans, "PROC advise_query_plan_%d(candidate_id INT!)\n", sql_stmt_count);
+    bprintf(advisor_plans, "BEGIN\n");
+    bprintf(advisor_plans, "  LET query_plan_trivial_object := trivial_object();\n");
+    bprintf(advisor_plans, "  LET query_plan_trivial_blob := trivial_blob();\n\n");
+    bprintf(advisor_plans, "  CURSOR C FOR EXPLAIN QUERY PLAN\n");
+    bindent(advisor_plans, &sql, 2);
+    bprintf(advisor_plans, ";\n");
+    bprintf(advisor_plans, "  LOOP FETCH C\n");
+    bprintf(advisor_plans, "  BEGIN\n");
+    bprintf(advisor_plans, "    INSERT INTO advisor_plan(candidate_id, sql_id, zdetail) VALUES(candidate_id, %d, C.zdetail);\n", sql_stmt_count);
+    bprintf(advisor_plans, "  END;\n");
+    bprintf(advisor_plans, "END;\n\n");
+  }
+
   CHARBUF_CLOSE(c_str);
   CHARBUF_CLOSE(json_str);
   CHARBUF_CLOSE(sql);
@@ -475,9 +943,19 @@ static void cg_qp_create_proc_stmt(ast_node *ast) {
     find_ok_table_scan(misc_attrs, cg_qp_ok_table_scan_callback, (void *) &ok_table_scan_buf);
   }
 
+  // stable ids and the index advisor both need every proc name, not just the attributed ones
+  EXTRACT_STRING(proc_name, ast->left);
+  qp_proc_name = proc_name;
+  qp_proc_misc_attrs = is_ast_stmt_and_attr(ast->parent) ? ast->parent->left : NULL;
+  uint32_t saved_stmt_ordinal = qp_stmt_ordinal;
+  qp_stmt_ordinal = 0;
+
   cg_qp_one_stmt(ast->left);
   cg_qp_one_stmt(ast->right);
 
+  qp_stmt_ordinal = saved_stmt_ordinal;
+  qp_proc_misc_attrs = NULL;
+  qp_proc_name = NULL;
   current_procedure_name = NULL;
   current_ok_table_scan = NULL;
   CHARBUF_CLOSE(ok_table_scan_buf);
@@ -622,7 +1100,10 @@ static void cg_qp_emit_create_schema_proc(charbuf *output) {
     "%s",
     "  CREATE TABLE sql_temp(\n"
     "    id INT! PRIMARY KEY,\n"
-    "    sql TEXT!\n"
+    "    sql TEXT!,\n"
+    "    stable_id TEXT!,\n"
+    "    proc_name TEXT!,\n"
+    "    sql_hash TEXT!\n"
     "  ) WITHOUT ROWID;\n"
     "  CREATE TABLE plan_temp(\n"
     "    iselectid INT!,\n"
@@ -646,10 +1127,60 @@ static void cg_qp_emit_create_schema_proc(charbuf *output) {
     "    proc_name TEXT!,\n"
     "    table_names TEXT!\n"
     "  ) WITHOUT ROWID;\n"
-    "END;\n"
-    "\n"
   );
 
+  if (options.query_plan_advisor) {
+    bprintf(output,
+      "%s",
+      "  CREATE TABLE advisor_candidate(\n"
+      "    id INT! PRIMARY KEY,\n"
+      "    table_name TEXT!,\n"
+      "    index_sql TEXT!\n"
+      "  ) WITHOUT ROWID;\n"
+      "  CREATE TABLE advisor_stmt(\n"
+      "    candidate_id INT!,\n"
+      "    sql_id INT!,\n"
+      "    proc_name TEXT!,\n"
+      "    PRIMARY KEY (candidate_id, sql_id)\n"
+      "  ) WITHOUT ROWID;\n"
+      "  CREATE TABLE advisor_plan(\n"
+      "    candidate_id INT!,\n"
+      "    sql_id INT!,\n"
+      "    zdetail TEXT!\n"
+      "  );\n"
+    );
+  }
+
+  if (options.query_plan_baseline) {
+    bprintf(output,
+      "%s",
+      "  CREATE TABLE ok_plan_regression(\n"
+      "    sql_id INT! PRIMARY KEY,\n"
+      "    reason TEXT!\n"
+      "  ) WITHOUT ROWID;\n"
+      "  CREATE TABLE plan_baseline(\n"
+      "    stable_id TEXT! PRIMARY KEY,\n"
+      "    proc_name TEXT!,\n"
+      "    sql_hash TEXT!,\n"
+      "    scans INT!,\n"
+      "    b_trees INT!\n"
+      "  ) WITHOUT ROWID;\n"
+      "  CREATE TABLE plan_diff(\n"
+      "    sql_id INT,\n"
+      "    stable_id TEXT!,\n"
+      "    proc_name TEXT!,\n"
+      "    kind TEXT!,\n"
+      "    baseline_scans INT,\n"
+      "    scans INT,\n"
+      "    baseline_b_trees INT,\n"
+      "    b_trees INT,\n"
+      "    sql_changed BOOL!,\n"
+      "    ok_reason TEXT\n"
+      "  );\n"
+    );
+  }
+
+  bprintf(output, "END;\n\n");
   bprintf(output, "%s", backed_tables->ptr);
 }
 
@@ -664,6 +1195,9 @@ static void emit_print_sql_statement_proc(charbuf *output) {
     "BEGIN\n"
     "  DECLARE C CURSOR FOR SELECT * FROM sql_temp WHERE id = sql_id LIMIT 1;\n"
     "  FETCH C;\n"
+    "  CALL printf(\"   \\\"stableId\\\" : \\\"%s\\\",\\n\", C.stable_id);\n"
+    "  CALL printf(\"   \\\"proc\\\" : \\\"%s\\\",\\n\", C.proc_name);\n"
+    "  CALL printf(\"   \\\"sqlHash\\\" : \\\"%s\\\",\\n\", C.sql_hash);\n"
     "  CALL printf(\"   \\\"query\\\" : \\\"%s\\\",\\n\", C.sql);\n"
     "END;\n"
     "\n"
@@ -853,6 +1387,318 @@ static void emit_print_query_plan(charbuf *output) {
   );
 }
 
+// The advisor procs: load the candidates, then for each candidate create the
+// hypothetical index, re-plan the statements that asked for it, and drop it again.
+// Candidates whose statements have no scans or temp b-trees are not evaluated.
+static void emit_advisor_procs(charbuf *output) {
+  uint32_t count = advisor_candidate_list->used / sizeof(qp_index_candidate);
+  qp_index_candidate *candidates = (qp_index_candidate *)advisor_candidate_list->ptr;
+
+  bprintf(output, "PROC populate_advisor_candidates()\n");
+  bprintf(output, "BEGIN\n");
+  if (count) {
+    bprintf(output, "  INSERT INTO advisor_candidate(id, table_name, index_sql) VALUES\n");
+    for (uint32_t i = 0; i < count; i++) {
+      qp_index_candidate *candidate = &candidates[i];
+      // the suggested name is table_col1_col2_idx
+      CHARBUF_OPEN(index_name);
+      bprintf(&index_name, "%s_", candidate->table_name);
+      for (CSTR p = candidate->columns; *p; p++) {
+        if (*p != ' ') {
+          bputc(&index_name, *p == ',' ? '_' : *p);
+        }
+      }
+      bprintf(output, "    (%d, \"%s\", \"CREATE INDEX %s_idx ON %s (%s)\")%s\n",
+        candidate->id,
+        candidate->table_name,
+        index_name.ptr,
+        candidate->table_name,
+        candidate->columns,
+        i + 1 < count ? "," : ";");
+      CHARBUF_CLOSE(index_name);
+    }
+    bprintf(output, "  INSERT INTO advisor_stmt(candidate_id, sql_id, proc_name) VALUES\n");
+    bprintf(output, "%s;\n", advisor_stmts->ptr);
+  }
+  bprintf(output, "END;\n\n");
+
+  bprintf(output, "%s", advisor_plans->ptr);
+
+  for (uint32_t i = 0; i < count; i++) {
+    qp_index_candidate *candidate = &candidates[i];
+    bprintf(output, "PROC advise_index_%d()\n", candidate->id);
+    bprintf(output, "BEGIN\n");
+    bprintf(output, "  IF NOT (SELECT EXISTS(\n");
+    bprintf(output, "    SELECT 1 FROM advisor_stmt S JOIN plan_temp P ON P.sql_id = S.sql_id\n");
+    bprintf(output, "      WHERE S.candidate_id = %d AND (P.zdetail LIKE '%%scan%%' OR P.zdetail LIKE '%%temp b-tree%%'))) THEN\n", candidate->id);
+    bprintf(output, "    RETURN;\n");
+    bprintf(output, "  END IF;\n");
+    bprintf(output, "  CREATE INDEX cql_advisor_%d ON %s (%s);\n", candidate->id, candidate->table_name, candidate->columns);
+    bprintf(output, "%s", symtab_ensure_charbuf(advisor_calls, candidate->key)->ptr);
+
+    bprintf(output, "  DROP INDEX cql_advisor_%d;\n", candidate->id);
+    bprintf(output, "END;\n\n");
+  }
+
+  bprintf(output, "PROC advise_indexes()\n");
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  CALL populate_advisor_candidates();\n");
+  for (uint32_t i = 0; i < count; i++) {
+    bprintf(output, "  CALL advise_index_%d();\n", candidates[i].id);
+  }
+  bprintf(output, "END;\n\n");
+
+  bprintf(output,
+    "%s",
+    "PROC print_index_advice()\n"
+    "BEGIN\n"
+    "  CURSOR C FOR\n"
+    "  WITH\n"
+    "    before(candidate_id, scans, b_trees) AS (\n"
+    "      SELECT S.candidate_id,\n"
+    "        SUM(P.zdetail LIKE '%scan%'),\n"
+    "        SUM(P.zdetail LIKE '%temp b-tree%')\n"
+    "        FROM advisor_stmt S\n"
+    "        JOIN plan_temp P ON P.sql_id = S.sql_id\n"
+    "        GROUP BY S.candidate_id\n"
+    "    ),\n"
+    "    after(candidate_id, scans, b_trees) AS (\n"
+    "      SELECT candidate_id,\n"
+    "        SUM(zdetail LIKE '%scan%'),\n"
+    "        SUM(zdetail LIKE '%temp b-tree%')\n"
+    "        FROM advisor_plan\n"
+    "        GROUP BY candidate_id\n"
+    "    ),\n"
+    "    advice(id, table_name, index_sql, scans_removed, b_trees_removed) AS (\n"
+    "      SELECT C.id, C.table_name, C.index_sql,\n"
+    "        B.scans - A.scans,\n"
+    "        B.b_trees - A.b_trees\n"
+    "        FROM advisor_candidate C\n"
+    "        JOIN before B ON B.candidate_id = C.id\n"
+    "        JOIN after A ON A.candidate_id = C.id\n"
+    "    )\n"
+    "  SELECT id, table_name, index_sql, scans_removed, b_trees_removed,\n"
+    "    (SELECT group_concat(sql_id, ', ') FROM\n"
+    "      (SELECT sql_id FROM advisor_stmt WHERE candidate_id = id ORDER BY sql_id)) AS sql_ids,\n"
+    "    (SELECT group_concat('\"' || proc_name || '\"', ', ') FROM\n"
+    "      (SELECT DISTINCT proc_name FROM advisor_stmt WHERE candidate_id = id AND proc_name != '' ORDER BY proc_name)) AS proc_names\n"
+    "    FROM advice\n"
+    "    WHERE scans_removed + b_trees_removed > 0\n"
+    "    ORDER BY scans_removed + b_trees_removed DESC, scans_removed DESC, id;\n"
+    "\n"
+    "  LET rank := 0;\n"
+    "  CALL printf(\"\\\"indexAdvice\\\" : [\\n\");\n"
+    "  LOOP FETCH C\n"
+    "  BEGIN\n"
+    "    SET rank := rank + 1;\n"
+    "    CALL printf(\"%s\", IIF(rank == 1, \"\", \",\\n\"));\n"
+    "    CALL printf(\"  {\\n\");\n"
+    "    CALL printf(\"   \\\"rank\\\" : %d,\\n\", rank);\n"
+    "    CALL printf(\"   \\\"table\\\" : \\\"%s\\\",\\n\", C.table_name);\n"
+    "    CALL printf(\"   \\\"index\\\" : \\\"%s\\\",\\n\", C.index_sql);\n"
+    "    CALL printf(\"   \\\"scansRemoved\\\" : %d,\\n\", C.scans_removed);\n"
+    "    CALL printf(\"   \\\"tempBTreesRemoved\\\" : %d,\\n\", C.b_trees_removed);\n"
+    "    CALL printf(\"   \\\"statements\\\" : [%s],\\n\", C.sql_ids);\n"
+    "    CALL printf(\"   \\\"procs\\\" : [%s]\\n\", ifnull(C.proc_names, \"\"));\n"
+    "    CALL printf(\"  }\");\n"
+    "  END;\n"
+    "  CALL printf(\"\\n]\\n\");\n"
+    "END;\n"
+    "\n"
+  );
+}
+
+// Reads the whole of the named file into the buffer, this is used for the
+// inputs that are embedded in the generated code.  A missing file is fatal.
+static void cg_qp_read_file(CSTR file_name, charbuf *output) {
+  FILE *f = fopen(file_name, "r");
+  if (!f) {
+    cql_error("unable to open '%s' for read\n", file_name);
+    cql_cleanup_and_exit(1);
+  }
+
+  char buf[4096];
+  size_t bytes;
+  while ((bytes = fread(buf, 1, sizeof(buf), f)) > 0) {
+    bprintf(output, "%.*s", (int)bytes, buf);
+  }
+  fclose(f);
+}
+
+// Planner statistics are embedded in the generated code as one big string
+// literal.  The runtime helper cql_load_planner_stats loads them into the
+// sqlite_stat tables so that the plans match a populated database.
+static void emit_load_planner_stats_proc(charbuf *output) {
+  CHARBUF_OPEN(stats);
+  CHARBUF_OPEN(stats_literal);
+
+  cg_qp_read_file(options.query_plan_stats, &stats);
+  cg_encode_c_string_literal(stats.ptr, &stats_literal);
+
+  bprintf(output, "PROC load_planner_stats()\n");
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  CALL cql_load_planner_stats(%s);\n", stats_literal.ptr);
+  bprintf(output, "END;\n\n");
+
+  CHARBUF_CLOSE(stats_literal);
+  CHARBUF_CLOSE(stats);
+}
+
+// The baseline is the JSON output of an earlier run of the query plan program.
+// It is embedded like the planner statistics and the scan and temp b-tree counts
+// of each plan are extracted from it by stable id.  Reports without stable ids
+// contribute nothing so every statement would show up as added.
+static void emit_plan_baseline_procs(charbuf *output) {
+  CHARBUF_OPEN(baseline);
+  CHARBUF_OPEN(baseline_literal);
+
+  cg_qp_read_file(options.query_plan_baseline, &baseline);
+  cg_encode_c_string_literal(baseline.ptr, &baseline_literal);
+
+  bprintf(output, "PROC load_plan_baseline()\n");
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  LET baseline := %s;\n", baseline_literal.ptr);
+  bprintf(output,
+    "%s",
+    "  INSERT OR REPLACE INTO plan_baseline(stable_id, proc_name, sql_hash, scans, b_trees)\n"
+    "    WITH\n"
+    "      plan_index(i) AS (\n"
+    "        SELECT 0\n"
+    "        UNION ALL\n"
+    "        SELECT i + 1 FROM plan_index WHERE i + 1 < ifnull(json_array_length(baseline, '$.plans'), 0)\n"
+    "      ),\n"
+    "      plan_path(path) AS (\n"
+    "        SELECT '$.plans[' || i || ']' FROM plan_index\n"
+    "      ),\n"
+    "      plan_entry(path, stable_id) AS (\n"
+    "        SELECT path, json_extract(baseline, path || '.stableId') FROM plan_path\n"
+    "      )\n"
+    "    SELECT\n"
+    "      stable_id,\n"
+    "      ifnull(json_extract(baseline, path || '.proc'), '') proc_name,\n"
+    "      ifnull(json_extract(baseline, path || '.sqlHash'), '') sql_hash,\n"
+    "      ifnull(CAST(json_extract(baseline, path || '.stats.scan') AS INT), 0) scans,\n"
+    "      ifnull(CAST(json_extract(baseline, path || '.stats.tempBTree') AS INT), 0) b_trees\n"
+    "    FROM plan_entry\n"
+    "    WHERE stable_id IS NOT NULL;\n"
+  );
+  bprintf(output, "END;\n\n");
+
+  CHARBUF_CLOSE(baseline_literal);
+  CHARBUF_CLOSE(baseline);
+
+  // Only plans that changed their scan or temp b-tree counts are recorded.  A
+  // regression is any increase, even if the other count went down, the rest
+  // are improvements.  Statements that are new or gone are listed as such.
+  bprintf(output,
+    "%s",
+    "PROC compute_plan_diff()\n"
+    "BEGIN\n"
+    "  INSERT INTO plan_diff(sql_id, stable_id, proc_name, kind, baseline_scans, scans, baseline_b_trees, b_trees, sql_changed, ok_reason)\n"
+    "    WITH\n"
+    "      current_plan(sql_id, stable_id, proc_name, sql_hash, scans, b_trees) AS (\n"
+    "        SELECT\n"
+    "          id,\n"
+    "          stable_id,\n"
+    "          proc_name,\n"
+    "          sql_hash,\n"
+    "          (SELECT COUNT(*) FROM plan_temp WHERE sql_id = id AND zdetail LIKE '%scan%'),\n"
+    "          (SELECT COUNT(*) FROM plan_temp WHERE sql_id = id AND zdetail LIKE '%temp b-tree%')\n"
+    "        FROM sql_temp\n"
+    "      )\n"
+    "    SELECT\n"
+    "      C.sql_id,\n"
+    "      C.stable_id,\n"
+    "      C.proc_name,\n"
+    "      CASE\n"
+    "        WHEN B.stable_id IS NULL THEN 'added'\n"
+    "        WHEN C.scans > B.scans OR C.b_trees > B.b_trees THEN 'regression'\n"
+    "        ELSE 'improvement'\n"
+    "      END,\n"
+    "      B.scans,\n"
+    "      C.scans,\n"
+    "      B.b_trees,\n"
+    "      C.b_trees,\n"
+    "      ifnull(B.sql_hash <> C.sql_hash, false),\n"
+    "      R.reason\n"
+    "    FROM current_plan C\n"
+    "    LEFT JOIN plan_baseline B ON B.stable_id = C.stable_id\n"
+    "    LEFT JOIN ok_plan_regression R ON R.sql_id = C.sql_id\n"
+    "    WHERE B.stable_id IS NULL OR B.scans <> C.scans OR B.b_trees <> C.b_trees;\n"
+    "\n"
+    "  INSERT INTO plan_diff(sql_id, stable_id, proc_name, kind, baseline_scans, scans, baseline_b_trees, b_trees, sql_changed, ok_reason)\n"
+    "    SELECT NULL, stable_id, proc_name, 'removed', scans, NULL, b_trees, NULL, false, NULL\n"
+    "      FROM plan_baseline\n"
+    "      WHERE stable_id NOT IN (SELECT stable_id FROM sql_temp);\n"
+    "END;\n"
+    "\n"
+    "PROC print_plan_diff(OUT untolerated INT!)\n"
+    "BEGIN\n"
+    "  SET untolerated := (SELECT COUNT(*) FROM plan_diff WHERE kind = 'regression' AND ok_reason IS NULL);\n"
+    "  CALL printf(\"\\\"planDiff\\\" : {\\n\");\n"
+    "  CALL printf(\"  \\\"untoleratedRegressions\\\" : %d,\\n\", untolerated);\n"
+    "  CALL printf(\"  \\\"procs\\\" : [\");\n"
+    "  CURSOR P FOR\n"
+    "    SELECT\n"
+    "      proc_name,\n"
+    "      ifnull(SUM(kind = 'regression' AND ok_reason IS NULL), 0) regressions,\n"
+    "      ifnull(SUM(kind = 'regression' AND ok_reason IS NOT NULL), 0) tolerated,\n"
+    "      ifnull(SUM(kind = 'improvement'), 0) improvements,\n"
+    "      ifnull(SUM(kind = 'added'), 0) added,\n"
+    "      ifnull(SUM(kind = 'removed'), 0) removed\n"
+    "    FROM plan_diff\n"
+    "    GROUP BY proc_name\n"
+    "    ORDER BY proc_name;\n"
+    "  LET first := true;\n"
+    "  LOOP FETCH P\n"
+    "  BEGIN\n"
+    "    CALL printf(\"%s\\n    {\\n\", IIF(first, \"\", \",\"));\n"
+    "    SET first := false;\n"
+    "    CALL printf(\"      \\\"proc\\\" : \\\"%s\\\",\\n\", P.proc_name);\n"
+    "    CALL printf(\"      \\\"regressions\\\" : %d,\\n\", P.regressions);\n"
+    "    CALL printf(\"      \\\"toleratedRegressions\\\" : %d,\\n\", P.tolerated);\n"
+    "    CALL printf(\"      \\\"improvements\\\" : %d,\\n\", P.improvements);\n"
+    "    CALL printf(\"      \\\"added\\\" : %d,\\n\", P.added);\n"
+    "    CALL printf(\"      \\\"removed\\\" : %d\\n\", P.removed);\n"
+    "    CALL printf(\"    }\");\n"
+    "  END;\n"
+    "  CALL printf(\"%s],\\n\", IIF(first, \"\", \"\\n  \"));\n"
+    "  CALL printf(\"  \\\"changes\\\" : [\");\n"
+    "  CURSOR C FOR\n"
+    "    SELECT\n"
+    "      stable_id,\n"
+    "      proc_name,\n"
+    "      kind,\n"
+    "      ifnull(CAST(baseline_scans AS TEXT), 'null') baseline_scans,\n"
+    "      ifnull(CAST(scans AS TEXT), 'null') scans,\n"
+    "      ifnull(CAST(baseline_b_trees AS TEXT), 'null') baseline_b_trees,\n"
+    "      ifnull(CAST(b_trees AS TEXT), 'null') b_trees,\n"
+    "      sql_changed,\n"
+    "      ok_reason IS NOT NULL tolerated,\n"
+    "      ifnull(ok_reason, '') reason\n"
+    "    FROM plan_diff\n"
+    "    ORDER BY sql_id IS NULL, sql_id, stable_id;\n"
+    "  SET first := true;\n"
+    "  LOOP FETCH C\n"
+    "  BEGIN\n"
+    "    CALL printf(\"%s\\n    {\\n\", IIF(first, \"\", \",\"));\n"
+    "    SET first := false;\n"
+    "    CALL printf(\"      \\\"stableId\\\" : \\\"%s\\\",\\n\", C.stable_id);\n"
+    "    CALL printf(\"      \\\"proc\\\" : \\\"%s\\\",\\n\", C.proc_name);\n"
+    "    CALL printf(\"      \\\"kind\\\" : \\\"%s\\\",\\n\", C.kind);\n"
+    "    CALL printf(\"      \\\"scan\\\" : [%s, %s],\\n\", C.baseline_scans, C.scans);\n"
+    "    CALL printf(\"      \\\"tempBTree\\\" : [%s, %s],\\n\", C.baseline_b_trees, C.b_trees);\n"
+    "    CALL printf(\"      \\\"sqlChanged\\\" : %s,\\n\", IIF(C.sql_changed, \"true\", \"false\"));\n"
+    "    CALL printf(\"      \\\"tolerated\\\" : %s,\\n\", IIF(C.tolerated, \"true\", \"false\"));\n"
+    "    CALL printf(\"      \\\"reason\\\" : \\\"%s\\\"\\n\", C.reason);\n"
+    "    CALL printf(\"    }\");\n"
+    "  END;\n"
+    "  CALL printf(\"%s]\\n}\", IIF(first, \"\", \"\\n  \"));\n"
+    "END;\n"
+    "\n"
+  );
+}
+
 #undef STMT_INIT
 #define STMT_INIT(x) symtab_add(cg_stmts, k_ast_ ## x, (void *)cg_qp_ ## x)
 
@@ -912,6 +1758,15 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
   CHARBUF_OPEN(backed_tables_buf);
   backed_tables = &backed_tables_buf;
   CHARBUF_OPEN(output_buf);
+  CHARBUF_OPEN(advisor_stmts_buf);
+  advisor_stmts = &advisor_stmts_buf;
+  CHARBUF_OPEN(advisor_plans_buf);
+  advisor_plans = &advisor_plans_buf;
+  bytebuf advisor_candidate_list_buf;
+  bytebuf_open(&advisor_candidate_list_buf);
+  advisor_candidate_list = &advisor_candidate_list_buf;
+  advisor_candidates = symtab_new();
+  advisor_calls = symtab_new();
 
   gen_sql_callbacks callbacks;
   init_gen_sql_callbacks(&callbacks);
@@ -947,7 +1802,11 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
     goto cleanup;
   }
 
-  bprintf(&output_buf, "declare proc cql_create_udf_stub(name TEXT!) using transaction;\n\n");
+  bprintf(&output_buf, "declare proc cql_create_udf_stub(name TEXT!) using transaction;\n");
+  if (options.query_plan_stats) {
+    bprintf(&output_buf, "declare proc cql_load_planner_stats(stats TEXT!) using transaction;\n");
+  }
+  bprintf(&output_buf, "\n");
 
   bprintf(&output_buf,
     "proc trivial_object()\n"
@@ -973,6 +1832,15 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
   cg_qp_emit_declare_func(&output_buf);
   cg_qp_emit_create_schema_proc(&output_buf);
   emit_populate_no_table_scan_proc(&output_buf);
+
+  if (options.query_plan_stats) {
+    emit_load_planner_stats_proc(&output_buf);
+  }
+
+  if (options.query_plan_baseline) {
+    emit_plan_baseline_procs(&output_buf);
+  }
+
   emit_populate_tables_proc(&output_buf);
   emit_populate_table_scan_alert_table_proc(&output_buf);
   emit_populate_b_tree_alert_table_proc(&output_buf);
@@ -982,6 +1850,10 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
   emit_print_query_plan_graph_proc(&output_buf);
   emit_print_query_plan(&output_buf);
 
+  if (options.query_plan_advisor) {
+    emit_advisor_procs(&output_buf);
+  }
+
   bprintf(&output_buf, "PROC query_plan()\n");
   bprintf(&output_buf, "BEGIN\n");
   bprintf(&output_buf, "  CALL create_schema();\n");
@@ -992,6 +1864,15 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
   bprintf(&output_buf, "    THROW;\n");
   bprintf(&output_buf, "  END;\n");
 
+  if (options.query_plan_stats) {
+    bprintf(&output_buf, "  TRY\n");
+    bprintf(&output_buf, "    CALL load_planner_stats();\n");
+    bprintf(&output_buf, "  CATCH\n");
+    bprintf(&output_buf, "    CALL printf(\"failed loading planner statistics\\n\");\n");
+    bprintf(&output_buf, "    THROW;\n");
+    bprintf(&output_buf, "  END;\n");
+  }
+
   for (uint32_t i = 1; i <= sql_stmt_count; i++) {
     bprintf(&output_buf, "  TRY\n");
     bprintf(&output_buf, "    CALL populate_query_plan_%d();\n", i);
@@ -1001,6 +1882,25 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
     bprintf(&output_buf, "  END;\n");
   }
 
+  if (options.query_plan_baseline) {
+    bprintf(&output_buf, "  TRY\n");
+    bprintf(&output_buf, "    CALL load_plan_baseline();\n");
+    bprintf(&output_buf, "    CALL compute_plan_diff();\n");
+    bprintf(&output_buf, "  CATCH\n");
+    bprintf(&output_buf, "    CALL printf(\"failed comparing against the plan baseline\\n\");\n");
+    bprintf(&output_buf, "    THROW;\n");
+    bprintf(&output_buf, "  END;\n");
+  }
+
+  if (options.query_plan_advisor) {
+    bprintf(&output_buf, "  TRY\n");
+    bprintf(&output_buf, "    CALL advise_indexes();\n");
+    bprintf(&output_buf, "  CATCH\n");
+    bprintf(&output_buf, "    CALL printf(\"failed evaluating index candidates\\n\");\n");
+    bprintf(&output_buf, "    THROW;\n");
+    bprintf(&output_buf, "  END;\n");
+  }
+
   bprintf(&output_buf, "  CALL printf(\"{\\n\");\n");
   bprintf(&output_buf, "  CALL print_query_violation();\n");
   bprintf(&output_buf, "  CALL printf(\"\\\"plans\\\" : [\\n\");\n");
@@ -1011,8 +1911,27 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
   bprintf(&output_buf, "    CALL print_query_plan(q);\n");
   bprintf(&output_buf, "    SET q := q + 1;\n");
   bprintf(&output_buf, "  END;\n");
-  bprintf(&output_buf, "  CALL printf(\"\\n]\\n\");\n");
+  if (options.query_plan_baseline || options.query_plan_advisor) {
+    bprintf(&output_buf, "  CALL printf(\"\\n],\\n\");\n");
+  }
+  else {
+    bprintf(&output_buf, "  CALL printf(\"\\n]\\n\");\n");
+  }
+  if (options.query_plan_baseline) {
+    bprintf(&output_buf, "  DECLARE untolerated INT!;\n");
+    bprintf(&output_buf, "  CALL print_plan_diff(untolerated);\n");
+    bprintf(&output_buf, "  CALL printf(\"%s\\n\");\n", options.query_plan_advisor ? "," : "");
+  }
+  if (options.query_plan_advisor) {
+    bprintf(&output_buf, "  CALL print_index_advice();\n");
+  }
   bprintf(&output_buf, "  CALL printf(\"}\");\n");
+  if (options.query_plan_baseline) {
+    // untolerated regressions fail the run so that a CI job can gate on it
+    bprintf(&output_buf, "  IF untolerated THEN\n");
+    bprintf(&output_buf, "    THROW;\n");
+    bprintf(&output_buf, "  END IF;\n");
+  }
 
   bprintf(&output_buf, "END;\n");
 
@@ -1020,17 +1939,25 @@ cql_noexport void cg_query_plan_main(ast_node *head) {
   goto cleanup;
 
 cleanup:
+  bytebuf_close(&advisor_candidate_list_buf);
+  CHARBUF_CLOSE(advisor_plans_buf);
+  CHARBUF_CLOSE(advisor_stmts_buf);
   CHARBUF_CLOSE(output_buf);
   CHARBUF_CLOSE(backed_tables_buf);
   CHARBUF_CLOSE(schema_stmts_buf);
   CHARBUF_CLOSE(query_plans_buf);
   SYMTAB_CLEANUP(cg_stmts);
   SYMTAB_CLEANUP(virtual_tables);
+  SYMTAB_CLEANUP(advisor_candidates);
+  SYMTAB_CLEANUP(advisor_calls);
 
   // Force the globals to null state so that they do not look like roots to LeakSanitizer
   // all of these should have been freed already.  This is the final safety net to prevent
   // non-reporting of leaks.
 
+  advisor_candidate_list = NULL;
+  advisor_plans = NULL;
+  advisor_stmts = NULL;
   backed_tables = NULL;
   schema_stmts = NULL;
   query_plans = NULL;
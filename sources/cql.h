@@ -88,6 +88,11 @@ typedef struct cmd_options {
   bool_t run_unit_tests;
   bool_t nolines;
   bool_t schema_exclusive;
+  bool_t query_plan_advisor;
+  bool_t warn_loop_prepare;
+  bool_t unchecked_getters;
+  char *query_plan_stats;
+  char *query_plan_baseline;
   char *rt;
   char **file_names;
   uint32_t file_names_count;
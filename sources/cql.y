@@ -3006,6 +3006,18 @@ static void parse_cmd(int argc, char **argv) {
     else if (strcmp(arg, "--schema_exclusive") == 0) {
       options.schema_exclusive = 1;
     }
+    else if (strcmp(arg, "--warn_loop_prepare") == 0) {
+      options.warn_loop_prepare = 1;
+    }
+    else if (strcmp(arg, "--query_plan_advisor") == 0) {
+      options.query_plan_advisor = 1;
+    }
+    else if (strcmp(arg, "--query_plan_stats") == 0) {
+      a = gather_arg_param(a, argc, argv, &options.query_plan_stats, "for the planner statistics file");
+    }
+    else if (strcmp(arg, "--query_plan_baseline") == 0) {
+      a = gather_arg_param(a, argc, argv, &options.query_plan_baseline, "for the query plan baseline file");
+    }
     else if (strcmp(arg, "--dot") == 0) {
       options.print_dot = 1;
     }
@@ -3025,6 +3037,9 @@ static void parse_cmd(int argc, char **argv) {
     else if (strcmp(arg, "--generate_exports") == 0) {
       options.generate_exports = 1;
     }
+    else if (strcmp(arg, "--unchecked_getters") == 0) {
+      options.unchecked_getters = 1;
+    }
     else if (strcmp(arg, "--cg") == 0) {
       a = gather_arg_params(a, argc, argv, &options.file_names_count, &options.file_names);
       options.codegen = 1;
@@ -3488,7 +3503,7 @@ cql_noexport CSTR cql_builtin_text() {
     "  CQL_DATA_TYPE_BLOB      = 6,"
     "  CQL_DATA_TYPE_OBJECT    = 7,"
     "  CQL_DATA_TYPE_CORE      = 0x3f,"
-    "  CQL_DATA_TYPE_ENCODED   = 0x40,"
+    "  CQL_DATA_TYPE_NULL_BIT  = 0x40,"
     "  CQL_DATA_TYPE_NOT_NULL  = 0x80"
     ");"
 
@@ -3502,6 +3517,16 @@ cql_noexport CSTR cql_builtin_text() {
     "[[builtin]]"
     "@op cursor: call from_blob as cql_cursor_from_blob;"
 
+    "[[builtin]]"
+    "declare proc cql_cursor_to_fixed_blob(C cursor, out result blob!) using transaction;"
+    "[[builtin]]"
+    "@op cursor: call to_fixed_blob as cql_cursor_to_fixed_blob;"
+
+    "[[builtin]]"
+    "declare proc cql_cursor_view_from_blob(C cursor, b blob) using transaction;"
+    "[[builtin]]"
+    "@op cursor: call view_from_blob as cql_cursor_view_from_blob;"
+
     "[[builtin]]"
     "function cql_blob_from_int(prefix text, val int!) create blob!;"
 
@@ -3874,6 +3899,15 @@ static void cql_usage() {
     "--schema_exclusive\n"
     "  the schema upgrade script assumes it owns all the schema in the database, it aggressively removes other things\n"
     "  used with --rt schema_upgrade\n"
+    "--query_plan_advisor\n"
+    "  the query plan script also evaluates candidate indices and reports the ones that remove scans or temp b-trees\n"
+    "  used with --rt query_plan\n"
+    "--query_plan_stats stats.json\n"
+    "  the query plan script loads the given sqlite_stat1/sqlite_stat4 rows before computing plans\n"
+    "  used with --rt query_plan\n"
+    "--query_plan_baseline plans.json\n"
+    "  the query plan script compares its plans to the given earlier output and fails on untolerated regressions\n"
+    "  used with --rt query_plan\n"
     "--c_include_namespace\n"
     "  for the C codegen runtimes, headers will be referenced as #include <namespace/file.h>\n"
     "--c_include_path\n"
@@ -3883,6 +3917,12 @@ static void cql_usage() {
     "--generate_exports\n"
     "  requires another output file to --cg; it contains the procedure declarations for the input\n"
     "  used with --rt c\n"
+    "--warn_loop_prepare\n"
+    "  reports statements in loops that have to be prepared again on every iteration\n"
+    "  used with --rt c and --rt lua\n"
+    "--unchecked_getters\n"
+    "  result set getters read the row struct directly, the row is only checked in debug builds\n"
+    "  used with --rt c\n"
     );
 }
 
@@ -42,7 +42,7 @@ void cql_release(cql_type_ref _Nullable ref) {
       if (ref->finalize) {
         ref->finalize(ref);
       }
-      free((void *)ref);
+      cql_free((void *)ref, CQL_ALLOC_OBJECT);
     }
     cql_outstanding_refs--;
     cql_invariant(cql_outstanding_refs >= 0);
@@ -53,7 +53,7 @@ void cql_release(cql_type_ref _Nullable ref) {
 static void cql_blob_finalize(cql_type_ref _Nonnull ref) {
   cql_blob_ref blob = (cql_blob_ref)ref;
   cql_invariant(blob->ptr != NULL);
-  free((void *)blob->ptr);
+  cql_free((void *)blob->ptr, CQL_ALLOC_PAYLOAD);
   blob->size = 0;
 }
 
@@ -62,17 +62,66 @@ static void cql_blob_finalize(cql_type_ref _Nonnull ref) {
 // Note that blobs are immutable.
 cql_blob_ref _Nonnull cql_blob_ref_new(const void *_Nonnull bytes, cql_uint32 size) {
   cql_invariant(bytes != NULL);
-  cql_blob_ref result = malloc(sizeof(cql_blob));
+  cql_blob_ref result = cql_malloc(sizeof(cql_blob), CQL_ALLOC_OBJECT);
   result->base.type = CQL_C_TYPE_BLOB;
   result->base.ref_count = 1;
   result->base.finalize = &cql_blob_finalize;
-  result->ptr = malloc((size_t)size);
+  result->ptr = cql_malloc((size_t)size, CQL_ALLOC_PAYLOAD);
   result->size = (cql_int32)size;
   memcpy((void *)result->ptr, bytes, (size_t)size);
   cql_outstanding_refs++;
   return result;
 }
 
+// A view is a blob or string whose payload lives inside another blob, such as
+// a serialized cursor.  Rather than owning a copy of the bytes the view holds a
+// reference to that blob.
+typedef struct cql_blob_view {
+  cql_blob blob;
+  cql_blob_ref _Nullable owner;
+} cql_blob_view;
+
+typedef struct cql_string_view {
+  cql_string string;
+  cql_blob_ref _Nullable owner;
+} cql_string_view;
+
+// Views have nothing to free but the owner reference
+static void cql_blob_view_finalize(cql_type_ref _Nonnull ref) {
+  cql_blob_view *view = (cql_blob_view *)ref;
+  cql_blob_release(view->owner);
+  view->owner = NULL;
+}
+
+static void cql_string_view_finalize(cql_type_ref _Nonnull ref) {
+  cql_string_view *view = (cql_string_view *)ref;
+  cql_blob_release(view->owner);
+  view->owner = NULL;
+  view->string.ptr = NULL;  // in case of use after free, fail fast
+}
+
+// The bytes must be inside the owner, this is only checked loosely.
+cql_blob_ref _Nonnull cql_blob_ref_new_view(
+  cql_blob_ref _Nonnull owner,
+  const void *_Nonnull bytes,
+  cql_uint32 size)
+{
+  cql_contract(owner);
+  cql_contract((const uint8_t *)bytes >= (const uint8_t *)owner->ptr);
+  cql_contract((const uint8_t *)bytes + size <= (const uint8_t *)owner->ptr + owner->size);
+
+  cql_blob_view *result = cql_malloc(sizeof(cql_blob_view), CQL_ALLOC_OBJECT);
+  result->blob.base.type = CQL_C_TYPE_BLOB;
+  result->blob.base.ref_count = 1;
+  result->blob.base.finalize = &cql_blob_view_finalize;
+  result->blob.ptr = bytes;
+  result->blob.size = (cql_int32)size;
+  result->owner = owner;
+  cql_blob_retain(owner);
+  cql_outstanding_refs++;
+  return &result->blob;
+}
+
 // Super simple hash for blobs.  This is a rework of hashpjw.
 cql_hash_code cql_blob_hash(cql_blob_ref _Nullable blob) {
   cql_hash_code hash = 0;
@@ -110,7 +159,7 @@ cql_bool cql_blob_equal(cql_blob_ref _Nullable blob1, cql_blob_ref _Nullable blo
 static void cql_string_finalize(cql_type_ref _Nonnull ref) {
   cql_string_ref string = (cql_string_ref)ref;
   cql_invariant(string->ptr != NULL);
-  free((void *)string->ptr);
+  cql_free((void *)string->ptr, CQL_ALLOC_PAYLOAD);
   string->ptr = NULL;  // in case of use after free, fail fast
 }
 
@@ -118,17 +167,37 @@ static void cql_string_finalize(cql_type_ref _Nonnull ref) {
 // string and use the finalizer above to release the memory
 cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr) {
   cql_invariant(cstr != NULL);
-  cql_string_ref result = malloc(sizeof(cql_string));
+  cql_string_ref result = cql_malloc(sizeof(cql_string), CQL_ALLOC_OBJECT);
   result->base.type = CQL_C_TYPE_STRING;
   result->base.ref_count = 1;
   result->base.finalize = &cql_string_finalize;
   size_t cstrlen = strlen(cstr);
-  result->ptr = malloc(cstrlen + 1);
+  result->ptr = cql_malloc(cstrlen + 1, CQL_ALLOC_PAYLOAD);
   memcpy((void *)result->ptr, cstr, cstrlen + 1);
   cql_outstanding_refs++;
   return result;
 }
 
+// The string must be inside the owner (including the terminator)
+cql_string_ref _Nonnull cql_string_ref_new_view(
+  cql_blob_ref _Nonnull owner,
+  const char *_Nonnull cstr)
+{
+  cql_contract(owner);
+  cql_contract((const uint8_t *)cstr >= (const uint8_t *)owner->ptr);
+  cql_contract((const uint8_t *)cstr < (const uint8_t *)owner->ptr + owner->size);
+
+  cql_string_view *result = cql_malloc(sizeof(cql_string_view), CQL_ALLOC_OBJECT);
+  result->string.base.type = CQL_C_TYPE_STRING;
+  result->string.base.ref_count = 1;
+  result->string.base.finalize = &cql_string_view_finalize;
+  result->string.ptr = cstr;
+  result->owner = owner;
+  cql_blob_retain(owner);
+  cql_outstanding_refs++;
+  return &result->string;
+}
+
 // Comparison is via strcmp
 cql_int32 cql_string_compare(cql_string_ref _Nonnull s1, cql_string_ref _Nonnull s2) {
   cql_invariant(s1 != NULL);
@@ -186,7 +255,11 @@ int cql_string_like(cql_string_ref _Nonnull s1, cql_string_ref _Nonnull s2) {
 static void cql_result_set_finalize(cql_type_ref _Nonnull ref) {
   cql_result_set_ref result_set = (cql_result_set_ref)ref;
 
-  if (result_set->meta.teardown) {
+  // a slice doesn't own its rows, the parent does
+  if (result_set->parent) {
+    cql_result_set_release(result_set->parent);
+  }
+  else if (result_set->meta.teardown) {
     result_set->meta.teardown(result_set);
   }
 }
@@ -201,17 +274,38 @@ cql_result_set_ref _Nonnull cql_result_set_create(
   cql_int32 count,
   cql_result_set_meta meta)
 {
-  cql_result_set_ref result = malloc(sizeof(cql_result_set));
+  cql_result_set_ref result = cql_malloc(sizeof(cql_result_set), CQL_ALLOC_OBJECT);
   result->base.type = CQL_C_TYPE_RESULTS;
   result->base.ref_count = 1;
   result->base.finalize = &cql_result_set_finalize;
   result->meta = meta;
   result->count = count;
   result->data = data;
+  result->parent = NULL;
   cql_outstanding_refs++;
   return result;
 }
 
+// A slice is a result set that refers to some of the rows of another result
+// set rather than a copy of them.  It has the same metadata as the parent so all
+// the normal getters and helpers work on it, but it holds a reference to the
+// parent and that's all it gives back when it is finalized.  Slices of slices
+// refer directly to the result set that owns the rows.
+cql_result_set_ref _Nonnull cql_result_set_create_slice(
+  cql_result_set_ref _Nonnull parent,
+  void *_Nonnull data,
+  cql_int32 count)
+{
+  if (parent->parent) {
+    parent = parent->parent;
+  }
+
+  cql_result_set_ref result = cql_result_set_create(data, count, parent->meta);
+  cql_result_set_retain(parent);
+  result->parent = parent;
+  return result;
+}
+
 // This helper can hash any refence type using its ->type member
 // to choose the correct hash functions.  It's really only strings and blobs
 // that are hashable at this point.
@@ -286,7 +380,7 @@ cql_object_ref _Nonnull _cql_generic_object_create(void *_Nonnull data, void (*f
   cql_contract(data);
   cql_contract(finalize);
 
-  cql_object_ref obj = (cql_object_ref)calloc(sizeof(cql_object), 1);
+  cql_object_ref obj = (cql_object_ref)cql_calloc(sizeof(cql_object), 1, CQL_ALLOC_OBJECT);
   obj->base.type = CQL_C_TYPE_OBJECT;
   obj->base.ref_count = 1;
   obj->base.finalize = _cql_generic_finalize;
@@ -308,3 +402,7 @@ void *_Nonnull _cql_generic_object_get_data(cql_object_ref obj)
 // what follows will use the above to do its job.
 
 #include "cqlrt_common.c"
+
+#ifdef CQL_PROFILING
+#include "cqlrt_profile.c"
+#endif
@@ -131,6 +131,16 @@ typedef struct cql_blob {
 // cql_blob_ref cql_blob_ref_new(const void *data, cql_uint32 size);
 cql_blob_ref _Nonnull cql_blob_ref_new(const void *_Nonnull data, cql_uint32 size);
 
+// Construct a blob object that shares bytes inside an owning blob.
+// @param owner the blob that holds the bytes, it is retained by the view.
+// @param data the bytes of the view, these must be inside the owner.
+// @param size the number of bytes of the view.
+// @return A blob object of the type defined by cql_blob_ref.
+cql_blob_ref _Nonnull cql_blob_ref_new_view(
+  cql_blob_ref _Nonnull owner,
+  const void *_Nonnull data,
+  cql_uint32 size);
+
 // Get the bytes of the blob object.  This is not null, even if the blob is zero
 // size and in general the memory allocated might be larger than the size of the blob.
 // Get cql_get_blob_size must be used to know how much you can read.
@@ -172,6 +182,15 @@ typedef struct cql_string {
 // cql_string_ref cql_string_ref_new(const char *cstr);
 cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr);
 
+// Construct a string object that shares a null terminated string inside an
+// owning blob.
+// @param owner the blob that holds the string, it is retained by the view.
+// @param cstr the C string, this must be inside the owner.
+// @return A string object of the type defined by cql_string_ref.
+cql_string_ref _Nonnull cql_string_ref_new_view(
+  cql_blob_ref _Nonnull owner,
+  const char *_Nonnull cstr);
+
 // Adds a reference count to the string object.
 // @param str The string object to be retained.
 // void cql_string_retain(cql_string_ref _Nullable str);
@@ -326,6 +345,8 @@ typedef struct cql_result_set {
   cql_result_set_meta meta;
   cql_int32 count;
   void *_Nonnull data;
+  // if not null, data points into the rows of this result set which owns them
+  cql_result_set_ref _Nullable parent;
 } cql_result_set;
 
 #define cql_result_set_type_decl(result_set_type, result_set_ref) \
@@ -345,6 +366,23 @@ cql_result_set_ref _Nonnull cql_result_set_create(
   cql_int32 count,
   cql_result_set_meta meta);
 
+// Construct a result set that shares the rows of another result set.  This is
+// optional, runtimes that don't define CQL_HAS_RESULT_SET_SLICE get a default
+// in cqlrt_common.c that copies the rows instead.
+// @param parent The result set that owns the row storage, it is retained.
+// @param data The first row of the slice, this must point into the parent's data.
+// @param count The count of records in the slice.
+// @return A result_set object of the same type as the parent.
+// cql_result_set_ref _Nonnull cql_result_set_create_slice(
+//     cql_result_set_ref _Nonnull parent,
+//     void *_Nonnull data,
+//     cql_int32 count);
+#define CQL_HAS_RESULT_SET_SLICE 1
+cql_result_set_ref _Nonnull cql_result_set_create_slice(
+  cql_result_set_ref _Nonnull parent,
+  void *_Nonnull data,
+  cql_int32 count);
+
 // Adds a reference count to the result_set object.
 // NOTE: This MUST be implemented as a macro, as it takes a result set as a param, which has an undefined type.
 // @param result_set The result set object to be retained.
@@ -384,6 +422,10 @@ cql_result_set_ref _Nonnull cql_result_set_create(
 SQLITE_API cql_code mockable_sqlite3_step(sqlite3_stmt *_Nonnull);
 #endif
 
+#ifdef CQL_PROFILING
+// The real profiler, see cqlrt_profile.h
+#include "cqlrt_profile.h"
+#else
 // No-op implementation of profiling
 // * Note: we emit the crc as an expression just to be sure that there are no compiler
 //   errors caused by names being incorrect.  This improves the quality of the CQL
@@ -391,6 +433,8 @@ SQLITE_API cql_code mockable_sqlite3_step(sqlite3_stmt *_Nonnull);
 //   you could emit any junk in the call and it would still compile.
 #define cql_profile_start(crc, index) (void)crc; (void)index;
 #define cql_profile_stop(crc, index)  (void)crc; (void)index;
+#define cql_profile_rows(crc, index, rows, bytes) (void)crc; (void)index; (void)(rows); (void)(bytes);
+#endif
 
 // implementation of encoding values. All sensitive values read from sqlite db will
 // be encoded at the source. CQL never decode encoded sensitive string unless the
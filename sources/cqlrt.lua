@@ -45,7 +45,7 @@ CQL_DATA_TYPE_STRING = 5
 CQL_DATA_TYPE_BLOB = 6
 CQL_DATA_TYPE_OBJECT = 7
 CQL_DATA_TYPE_CORE = 63
-CQL_DATA_TYPE_ENCODED = 64
+CQL_DATA_TYPE_NULL_BIT = 64 -- compact rows only, the Lua runtime never sets it
 CQL_DATA_TYPE_NOT_NULL = 128
 
 cql_data_type_decode = {
@@ -1246,6 +1246,71 @@ function cql_create_udf_stub(db, name)
   return rc
 end
 
+-- load planner statistics from JSON into sqlite_stat1 and sqlite_stat4, the
+-- format is described in cqlrt_common.c, stat4 rows are skipped if this
+-- SQLite doesn't have sqlite_stat4
+function cql_load_planner_stats(db, stats)
+  local rc = db:exec("ANALYZE sqlite_schema")
+  if rc ~= sqlite3.OK then return rc end
+
+  rc = db:exec("DELETE FROM sqlite_stat1")
+  if rc ~= sqlite3.OK then return rc end
+
+  local stmt = db:prepare(
+    "INSERT INTO sqlite_stat1(tbl, idx, stat) " ..
+    "  SELECT json_extract(value, '$.tbl'), json_extract(value, '$.idx'), json_extract(value, '$.stat') " ..
+    "  FROM json_each(?, '$.sqlite_stat1')")
+  if stmt == nil then return db:errcode() end
+  stmt:bind(1, stats)
+  rc = stmt:step()
+  stmt:finalize()
+  if rc ~= sqlite3.DONE then return rc end
+
+  stmt = db:prepare("SELECT 1 FROM sqlite_schema WHERE name = 'sqlite_stat4'")
+  local has_stat4 = stmt:step() == sqlite3.ROW
+  stmt:finalize()
+
+  if has_stat4 then
+    rc = db:exec("DELETE FROM sqlite_stat4")
+    if rc ~= sqlite3.OK then return rc end
+
+    stmt = db:prepare(
+      "SELECT json_extract(value, '$.tbl'), json_extract(value, '$.idx'), " ..
+      "  json_extract(value, '$.neq'), json_extract(value, '$.nlt'), " ..
+      "  json_extract(value, '$.ndlt'), json_extract(value, '$.sample') " ..
+      "  FROM json_each(?, '$.sqlite_stat4')")
+    if stmt == nil then return db:errcode() end
+    stmt:bind(1, stats)
+
+    local insert = db:prepare("INSERT INTO sqlite_stat4(tbl, idx, neq, nlt, ndlt, sample) VALUES(?, ?, ?, ?, ?, ?)")
+    while stmt:step() == sqlite3.ROW do
+      local hex = stmt:get_value(5) or ""
+      if #hex % 2 ~= 0 or hex:find("[^%x]") then
+        insert:finalize()
+        stmt:finalize()
+        return sqlite3.MISMATCH
+      end
+      -- the sample is a record in SQLite's format, it arrives as hex text
+      local sample = hex:gsub("%x%x", function(h) return string.char(tonumber(h, 16)) end)
+      for i = 0, 4 do
+        insert:bind(i + 1, stmt:get_value(i))
+      end
+      insert:bind_blob(6, sample)
+      rc = insert:step()
+      insert:reset()
+      if rc ~= sqlite3.DONE then
+        insert:finalize()
+        stmt:finalize()
+        return rc
+      end
+    end
+    insert:finalize()
+    stmt:finalize()
+  end
+
+  return db:exec("ANALYZE sqlite_schema")
+end
+
 -- this global will hold all the emitted constants
 _cql = {}
 
@@ -1403,7 +1468,33 @@ function cql_int_encode_64(x)
   return cql_varint_encode(cql_zigzag_encode_64(x))
 end
 
+-- a serialized cursor that starts with '#' stores its integers (and blob
+-- sizes) at fixed width rather than as varints, readers accept both forms
+CQL_CURSOR_BLOB_FIXED_WIDTH = string.byte("#")
+
+function cql_int_pack_32(x, fixed)
+  if fixed then
+    return string.pack("<i4", x)
+  end
+  return cql_int_encode_32(x)
+end
+
+function cql_int_pack_64(x, fixed)
+  if fixed then
+    return string.pack("<i8", x)
+  end
+  return cql_int_encode_64(x)
+end
+
 function cql_cursor_to_blob(db, C, C_types, C_fields)
+  return cql_cursor_write_blob(C, C_types, C_fields, false)
+end
+
+function cql_cursor_to_fixed_blob(db, C, C_types, C_fields)
+  return cql_cursor_write_blob(C, C_types, C_fields, true)
+end
+
+function cql_cursor_write_blob(C, C_types, C_fields, fixed)
   local bool_count = 0
   local var_encoding_count = 0
   local nullable_count = 0
@@ -1411,7 +1502,10 @@ function cql_cursor_to_blob(db, C, C_types, C_fields)
   local pieces = {}
   local bits = {}
 
-  -- output starts with null terminated types
+  -- output starts with null terminated types, after the mark if fixed width
+  if fixed then
+    table.insert(header, string.char(CQL_CURSOR_BLOB_FIXED_WIDTH))
+  end
   table.insert(header, C_types)
   table.insert(header, "\0")
 
@@ -1466,22 +1560,22 @@ function cql_cursor_to_blob(db, C, C_types, C_fields)
       if value == nil then
          return -1, ""
       end
-      table.insert(pieces, cql_int_encode_32(value))
+      table.insert(pieces, cql_int_pack_32(value, fixed))
     elseif code == CQL_ENCODED_TYPE_INT then
       if value ~= nil then
         cql_setbit(bits, nullable_index)
-        table.insert(pieces, cql_int_encode_32(value))
+        table.insert(pieces, cql_int_pack_32(value, fixed))
       end
       nullable_index = nullable_index + 1
     elseif code == CQL_ENCODED_TYPE_LONG_NOTNULL then
       if value == nil then
          return -1, ""
       end
-      table.insert(pieces, cql_int_encode_64(value))
+      table.insert(pieces, cql_int_pack_64(value, fixed))
     elseif code == CQL_ENCODED_TYPE_LONG then
       if value ~= nil then
         cql_setbit(bits, nullable_index)
-        table.insert(pieces, cql_int_encode_64(value))
+        table.insert(pieces, cql_int_pack_64(value, fixed))
       end
       nullable_index = nullable_index + 1
     elseif code == CQL_ENCODED_TYPE_STRING_NOTNULL then
@@ -1499,12 +1593,12 @@ function cql_cursor_to_blob(db, C, C_types, C_fields)
       if value == nil then
          return -1, ""
       end
-      table.insert(pieces, cql_int_encode_32(#value))
+      table.insert(pieces, cql_int_pack_32(#value, fixed))
       table.insert(pieces, value)
     elseif code == CQL_ENCODED_TYPE_BLOB then
       if value ~= nil then
         cql_setbit(bits, nullable_index)
-        table.insert(pieces, cql_int_encode_32(#value))
+        table.insert(pieces, cql_int_pack_32(#value, fixed))
         table.insert(pieces, value)
       end
       nullable_index = nullable_index + 1
@@ -1624,6 +1718,34 @@ function cql_unpack_c(str, pos, size)
   end
 end
 
+function cql_unpack_fixed(fmt, str, pos)
+  local success, result, next_pos = pcall(string.unpack, fmt, str, pos)
+  if success then
+    return result, next_pos
+  else
+    return nil, nil
+  end
+end
+
+function cql_int_unpack_32(x, pos, fixed)
+  if fixed then
+    return cql_unpack_fixed("<i4", x, pos)
+  end
+  return cql_varint_decode_32(x, pos)
+end
+
+function cql_int_unpack_64(x, pos, fixed)
+  if fixed then
+    return cql_unpack_fixed("<i8", x, pos)
+  end
+  return cql_varint_decode_64(x, pos)
+end
+
+-- Lua strings are immutable and shared already so a view is just a fetch
+function cql_cursor_view_from_blob(db, C, C_types, C_fields, buffer)
+  return cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
+end
+
 function cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
   if C == nil then
     return -100
@@ -1649,6 +1771,11 @@ function cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
   cql_empty_cursor(C, C_types, C_fields)
 
   local pos = 1
+  local fixed = string.byte(buffer, 1) == CQL_CURSOR_BLOB_FIXED_WIDTH
+  if fixed then
+    pos = 2
+  end
+
   local types, pos = cql_unpack_z(buffer, pos)
   if types == nil then
     return -104
@@ -1742,7 +1869,7 @@ function cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
       bool_index = bool_index + 1
       nullable_index = nullable_index + 1
     elseif code == CQL_ENCODED_TYPE_INT_NOTNULL then
-      C[field], pos = cql_varint_decode_32(buffer, pos)
+      C[field], pos = cql_int_unpack_32(buffer, pos, fixed)
       if pos == nil then
         return -4
       end
@@ -1752,14 +1879,14 @@ function cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
         return -5
       end
       if bit then
-        C[field], pos = cql_varint_decode_32(buffer, pos)
+        C[field], pos = cql_int_unpack_32(buffer, pos, fixed)
         if pos == nil then
           return -6
         end
       end
       nullable_index = nullable_index + 1
     elseif code == CQL_ENCODED_TYPE_LONG_NOTNULL then
-      C[field], pos = cql_varint_decode_64(buffer, pos)
+      C[field], pos = cql_int_unpack_64(buffer, pos, fixed)
       if pos == nil then
         return -7
       end
@@ -1769,7 +1896,7 @@ function cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
         return -8
       end
       if bit then
-        C[field], pos = cql_varint_decode_64(buffer, pos)
+        C[field], pos = cql_int_unpack_64(buffer, pos, fixed)
         if pos == nil then
           return -9
         end
@@ -1810,7 +1937,7 @@ function cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
       end
       nullable_index = nullable_index + 1
     elseif code == CQL_ENCODED_TYPE_BLOB_NOTNULL then
-      chunk_size, pos = cql_varint_decode_32(buffer, pos)
+      chunk_size, pos = cql_int_unpack_32(buffer, pos, fixed)
       if pos == nil then
         return -16
       end
@@ -1824,7 +1951,7 @@ function cql_cursor_from_blob(db, C, C_types, C_fields, buffer)
         return -18
       end
       if bit then
-        chunk_size, pos = cql_varint_decode_32(buffer, pos)
+        chunk_size, pos = cql_int_unpack_32(buffer, pos, fixed)
         if pos == nil then
           return -19
         end
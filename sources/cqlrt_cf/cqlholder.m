@@ -55,7 +55,13 @@
       // the result set knows how to clean itself up
       cql_result_set_ref ref = (__bridge cql_result_set_ref)self;
       cql_result_set *result_set = (cql_result_set *)self.bytes;
-      result_set->meta.teardown(ref);
+      if (result_set->parent) {
+        // a slice only holds its parent, the parent owns the rows
+        CFRelease(result_set->parent);
+      }
+      else {
+        result_set->meta.teardown(ref);
+      }
       break;
     }
 
@@ -98,11 +104,31 @@ cql_result_set_ref _Nonnull cql_result_set_create(
   result_set->count = count;
   result_set->data = data;
   result_set->meta = meta;
+  result_set->parent = NULL;
 
   CQLHolder *holder = [[CQLHolder alloc] initWithBytes:(void *)result_set andType:CF_HELD_TYPE_RESULT_SET];
   return (__bridge_retained cql_result_set_ref)holder;
 }
 
+// A slice shares the rows of its parent and keeps the parent alive, slices of
+// slices refer directly to the result set that owns the rows.
+cql_result_set_ref _Nonnull cql_result_set_create_slice(
+  cql_result_set_ref _Nonnull parent,
+  void *_Nonnull data,
+  cql_int32 count)
+{
+  cql_result_set *parent_result_set = cql_get_result_set_from_ref(parent);
+  if (parent_result_set->parent) {
+    parent = parent_result_set->parent;
+    parent_result_set = cql_get_result_set_from_ref(parent);
+  }
+
+  cql_result_set_ref result = cql_result_set_create(data, count, parent_result_set->meta);
+  CFRetain(parent);
+  cql_get_result_set_from_ref(result)->parent = parent;
+  return result;
+}
+
 cql_result_set *_Nonnull cql_get_result_set_from_ref(cql_result_set_ref _Nonnull ref)
 {
   CQLHolder *holder = (__bridge CQLHolder *)ref;
@@ -126,6 +126,10 @@ typedef CFStringRef cql_string_ref;
 void cql_string_retain(cql_string_ref _Nullable str);
 void cql_string_release(cql_string_ref _Nullable str);
 cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr);
+
+// CF has no cheap way to keep the owner alive, views are plain copies here
+#define cql_string_ref_new_view(owner, cstr) cql_string_ref_new(cstr)
+#define cql_blob_ref_new_view(owner, bytes, size) cql_blob_ref_new(bytes, size)
 cql_hash_code cql_string_hash(cql_string_ref _Nonnull str);
 cql_int32 cql_string_equal(cql_string_ref _Nullable s1, cql_string_ref _Nullable s2);
 cql_int32 cql_string_compare(cql_string_ref _Nonnull s1, cql_string_ref _Nonnull s2);
@@ -197,6 +201,8 @@ typedef struct cql_result_set {
   cql_result_set_meta meta;
   cql_int32 count;
   void *_Nonnull data;
+  // if not null, data points into the rows of this result set which owns them
+  cql_result_set_ref _Nullable parent;
 } cql_result_set;
 
 #define cql_result_set_type_decl(result_set_type, result_set_ref) \
@@ -207,6 +213,12 @@ cql_result_set_ref _Nonnull cql_result_set_create(
   cql_int32 count,
   cql_result_set_meta meta);
 
+#define CQL_HAS_RESULT_SET_SLICE 1
+cql_result_set_ref _Nonnull cql_result_set_create_slice(
+  cql_result_set_ref _Nonnull parent,
+  void *_Nonnull data,
+  cql_int32 count);
+
 cql_result_set *_Nonnull cql_get_result_set_from_ref(cql_result_set_ref _Nonnull ref);
 
 #define cql_result_set_retain(result_set) cql_retain((cql_type_ref)result_set);
@@ -9,10 +9,22 @@
 // to mean the same thing.
 
 #include <stdlib.h>
+#include <time.h>
 
 // Enable this to print a trace of running statements to stderr
 // #define CQL_TRACE_STATEMENTS 1
 
+// The most rows in one multi-row INSERT made by the bulk insert helpers, the
+// variable limit of the database may make it fewer
+#ifndef CQL_INSERT_ROWS_MAX_CHUNK
+#define CQL_INSERT_ROWS_MAX_CHUNK 64
+#endif
+
+// The number of events in the statement trace ring, must be a power of 2
+#ifndef CQL_TRACE_RING_SIZE
+#define CQL_TRACE_RING_SIZE 1024
+#endif
+
 #if defined(TARGET_OS_LINUX) && TARGET_OS_LINUX
 #include <alloca.h>
 #endif // TARGET_OS_LINUX
@@ -27,6 +39,306 @@
 #endif // TARGET_OS_WIN32
 #endif // STACK_BYTES_ALLLOC
 
+// The allocator for this thread, NULL means use malloc and friends directly.
+static CQL_THREAD_LOCAL const cql_allocator *cql_current_allocator;
+
+// Installs the allocator for the current thread and returns the previous one.
+const cql_allocator *_Nullable cql_set_allocator(const cql_allocator *_Nullable allocator) {
+  const cql_allocator *prev = cql_current_allocator;
+  cql_current_allocator = allocator;
+  return prev;
+}
+
+// The allocator for the current thread, NULL if none is installed.
+const cql_allocator *_Nullable cql_get_allocator(void) {
+  return cql_current_allocator;
+}
+
+// Every allocation starts with a header recording the allocator it came from,
+// NULL for malloc.  Memory is resized and freed through that allocator no
+// matter which one is current on the calling thread, so an object can be
+// released after its allocator was replaced or on another thread.  The header
+// is 16 bytes so the memory handed out keeps malloc's alignment.
+typedef union cql_alloc_header {
+  const cql_allocator *_Nullable allocator;
+  char pad[CQL_ALLOC_HEADER_SIZE];
+} cql_alloc_header;
+
+CQL_C_ASSERT(sizeof(cql_alloc_header) == CQL_ALLOC_HEADER_SIZE);
+
+#define CQL_ALLOC_BASE(ptr) ((cql_alloc_header *)((char *)(ptr) - CQL_ALLOC_HEADER_SIZE))
+
+// The size to ask the allocator for, the header included.  Sizes that would
+// wrap around are fatal just like a failed allocation.
+static size_t cql_alloc_total(size_t count, size_t size) {
+  cql_invariant(size == 0 || count <= (SIZE_MAX - CQL_ALLOC_HEADER_SIZE) / size);
+  return count * size + CQL_ALLOC_HEADER_SIZE;
+}
+
+// Stamps the allocator into a fresh block and returns the memory after the header.
+static void *_Nonnull cql_alloc_stamp(void *_Nullable base, const cql_allocator *_Nullable a) {
+  cql_invariant(base != NULL);
+  ((cql_alloc_header *)base)->allocator = a;
+  return (char *)base + CQL_ALLOC_HEADER_SIZE;
+}
+
+// Allocate memory via the current allocator, the kind is a hint.
+void *_Nonnull cql_malloc(size_t size, int32_t kind) {
+  const cql_allocator *a = cql_current_allocator;
+  size_t total = cql_alloc_total(1, size);
+  return cql_alloc_stamp(a ? a->allocate(a->context, total, kind) : malloc(total), a);
+}
+
+// Allocate zeroed memory via the current allocator.
+void *_Nonnull cql_calloc(size_t count, size_t size, int32_t kind) {
+  const cql_allocator *a = cql_current_allocator;
+  size_t total = cql_alloc_total(count, size);
+  return cql_alloc_stamp(a ? a->allocate_zeroed(a->context, total, kind) : calloc(1, total), a);
+}
+
+// Resize memory via the allocator it came from, NULL is a fresh allocation
+// from the current allocator.
+void *_Nonnull cql_realloc(void *_Nullable ptr, size_t size, int32_t kind) {
+  if (!ptr) {
+    return cql_malloc(size, kind);
+  }
+  cql_alloc_header *base = CQL_ALLOC_BASE(ptr);
+  const cql_allocator *a = base->allocator;
+  size_t total = cql_alloc_total(1, size);
+  return cql_alloc_stamp(a ? a->reallocate(a->context, base, total, kind) : realloc(base, total), a);
+}
+
+// Free memory via the allocator it came from, NULL is ignored.
+void cql_free(void *_Nullable ptr, int32_t kind) {
+  if (!ptr) {
+    return;
+  }
+  cql_alloc_header *base = CQL_ALLOC_BASE(ptr);
+  const cql_allocator *a = base->allocator;
+  if (a) {
+    a->deallocate(a->context, base, kind);
+  }
+  else {
+    free(base);
+  }
+}
+
+// Every arena allocation is preceded by a header holding its size, this keeps
+// the payload aligned to 16 bytes and lets realloc know how much to copy.
+#define CQL_ARENA_ALIGN 16
+#define CQL_ARENA_ROUND(x) (((x) + (CQL_ARENA_ALIGN - 1)) & ~(size_t)(CQL_ARENA_ALIGN - 1))
+
+typedef struct cql_arena_chunk {
+  struct cql_arena_chunk *next;
+  size_t size;         // usable bytes after the chunk header
+  size_t used;         // bytes handed out so far, headers included
+  size_t last;         // offset of the header of the most recent allocation
+} cql_arena_chunk;
+
+// The data follows the chunk header, four size_t fields is 16 or 32 bytes so
+// the data stays aligned.
+
+struct cql_arena {
+  cql_allocator allocator;     // the vtable, context points back to the arena
+  cql_arena_chunk *head;       // the chunk being filled, big allocations go after it
+  size_t chunk_size;
+  size_t bytes[CQL_ALLOC_KINDS];
+  char lock;                   // a spin lock held while allocating, resizing, or freeing
+};
+
+// The lock is only ever held for a bump or a copy so spinning is fine, it
+// lets a thread release arena objects made on another thread.
+static void cql_arena_lock(cql_arena *arena) {
+  while (__atomic_test_and_set(&arena->lock, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static void cql_arena_unlock(cql_arena *arena) {
+  __atomic_clear(&arena->lock, __ATOMIC_RELEASE);
+}
+
+#define CQL_ARENA_DATA(chunk) ((char *)(chunk) + sizeof(cql_arena_chunk))
+
+static cql_arena_chunk *cql_arena_new_chunk(size_t size) {
+  cql_arena_chunk *chunk = malloc(sizeof(cql_arena_chunk) + size);
+  cql_invariant(chunk != NULL);
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->last = 0;
+  return chunk;
+}
+
+// The allocation itself, the caller holds the lock.
+static void *cql_arena_allocate_locked(cql_arena *arena, size_t size, int32_t kind) {
+  cql_invariant(size <= SIZE_MAX - sizeof(cql_arena_chunk) - 2 * CQL_ARENA_ALIGN);
+  size_t needed = CQL_ARENA_ALIGN + CQL_ARENA_ROUND(size);
+  cql_arena_chunk *chunk = arena->head;
+
+  if (needed > arena->chunk_size / 2) {
+    // a big allocation gets a dedicated chunk, it's put after the head so that
+    // the rest of the current chunk is not wasted
+    chunk = cql_arena_new_chunk(needed);
+    chunk->next = arena->head->next;
+    arena->head->next = chunk;
+  }
+  else if (chunk->used + needed > chunk->size) {
+    chunk = cql_arena_new_chunk(arena->chunk_size);
+    chunk->next = arena->head;
+    arena->head = chunk;
+  }
+
+  char *header = CQL_ARENA_DATA(chunk) + chunk->used;
+  *(size_t *)header = size;
+  chunk->last = chunk->used;
+  chunk->used += needed;
+  if (kind >= 0 && kind < CQL_ALLOC_KINDS) {
+    arena->bytes[kind] += size;
+  }
+  return header + CQL_ARENA_ALIGN;
+}
+
+static void *cql_arena_allocate(void *_Nullable context, size_t size, int32_t kind) {
+  cql_arena *arena = (cql_arena *)context;
+  cql_arena_lock(arena);
+  void *result = cql_arena_allocate_locked(arena, size, kind);
+  cql_arena_unlock(arena);
+  return result;
+}
+
+static void *cql_arena_allocate_zeroed(void *_Nullable context, size_t size, int32_t kind) {
+  void *result = cql_arena_allocate(context, size, kind);
+  memset(result, 0, size);
+  return result;
+}
+
+// True if ptr is the most recent allocation in the head chunk, such memory can
+// be grown or given back in place.
+static bool cql_arena_is_last(cql_arena *arena, void *ptr) {
+  cql_arena_chunk *chunk = arena->head;
+  return chunk->used && (char *)ptr == CQL_ARENA_DATA(chunk) + chunk->last + CQL_ARENA_ALIGN;
+}
+
+// Grows or shrinks in place when possible, the caller holds the lock.
+static void *cql_arena_reallocate_locked(cql_arena *arena, void *_Nonnull ptr, size_t size, int32_t kind) {
+  size_t *header = (size_t *)((char *)ptr - CQL_ARENA_ALIGN);
+  size_t old_size = *header;
+
+  if (cql_arena_is_last(arena, ptr)) {
+    cql_arena_chunk *chunk = arena->head;
+    size_t needed = CQL_ARENA_ALIGN + CQL_ARENA_ROUND(size);
+    if (chunk->last + needed <= chunk->size && needed <= arena->chunk_size / 2) {
+      chunk->used = chunk->last + needed;
+      *header = size;
+      if (kind >= 0 && kind < CQL_ALLOC_KINDS && size > old_size) {
+        arena->bytes[kind] += size - old_size;
+      }
+      return ptr;
+    }
+  }
+
+  if (size <= old_size) {
+    return ptr;
+  }
+
+  void *result = cql_arena_allocate_locked(arena, size, kind);
+  memcpy(result, ptr, old_size);
+  return result;
+}
+
+static void *cql_arena_reallocate(void *_Nullable context, void *_Nullable ptr, size_t size, int32_t kind) {
+  if (!ptr) {
+    return cql_arena_allocate(context, size, kind);
+  }
+  cql_arena *arena = (cql_arena *)context;
+  cql_arena_lock(arena);
+  void *result = cql_arena_reallocate_locked(arena, ptr, size, kind);
+  cql_arena_unlock(arena);
+  return result;
+}
+
+static void cql_arena_deallocate(void *_Nullable context, void *_Nullable ptr, int32_t kind) {
+  cql_arena *arena = (cql_arena *)context;
+  if (!ptr) {
+    return;
+  }
+  cql_arena_lock(arena);
+  if (cql_arena_is_last(arena, ptr)) {
+    // give back the most recent allocation, the one before it can't be found so
+    // only one level of this is possible
+    cql_arena_chunk *chunk = arena->head;
+    chunk->used = chunk->last;
+  }
+  cql_arena_unlock(arena);
+}
+
+// Makes an arena that gets memory from malloc in chunks of the given size.
+cql_arena *_Nonnull cql_arena_create(size_t chunk_size) {
+  cql_arena *arena = calloc(1, sizeof(cql_arena));
+  cql_invariant(arena != NULL);
+  if (chunk_size < 1024) {
+    chunk_size = 1024;
+  }
+  arena->chunk_size = CQL_ARENA_ROUND(chunk_size);
+  arena->head = cql_arena_new_chunk(arena->chunk_size);
+  arena->allocator.allocate = cql_arena_allocate;
+  arena->allocator.allocate_zeroed = cql_arena_allocate_zeroed;
+  arena->allocator.reallocate = cql_arena_reallocate;
+  arena->allocator.deallocate = cql_arena_deallocate;
+  arena->allocator.context = arena;
+  return arena;
+}
+
+// The allocator to pass to cql_set_allocator to use this arena.
+const cql_allocator *_Nonnull cql_arena_allocator(cql_arena *_Nonnull arena) {
+  return &arena->allocator;
+}
+
+// The bytes requested with the given hint since the last reset.
+size_t cql_arena_bytes_used(cql_arena *_Nonnull arena, int32_t kind) {
+  return (kind >= 0 && kind < CQL_ALLOC_KINDS) ? arena->bytes[kind] : 0;
+}
+
+// The bytes requested with any hint since the last reset.
+size_t cql_arena_total_bytes_used(cql_arena *_Nonnull arena) {
+  size_t total = 0;
+  for (int32_t i = 0; i < CQL_ALLOC_KINDS; i++) {
+    total += arena->bytes[i];
+  }
+  return total;
+}
+
+// Frees all the chunks but one standard sized chunk which is kept for reuse.
+void cql_arena_reset(cql_arena *_Nonnull arena) {
+  cql_arena_chunk *keep = NULL;
+  cql_arena_chunk *chunk = arena->head;
+  while (chunk) {
+    cql_arena_chunk *next = chunk->next;
+    if (!keep && chunk->size == arena->chunk_size) {
+      keep = chunk;
+    }
+    else {
+      free(chunk);
+    }
+    chunk = next;
+  }
+  if (!keep) {
+    keep = cql_arena_new_chunk(arena->chunk_size);
+  }
+  keep->next = NULL;
+  keep->used = 0;
+  keep->last = 0;
+  arena->head = keep;
+  memset(arena->bytes, 0, sizeof(arena->bytes));
+}
+
+// Frees the arena and all of its memory.
+void cql_arena_destroy(cql_arena *_Nonnull arena) {
+  cql_arena_reset(arena);
+  free(arena->head);
+  free(arena);
+}
+
 static cql_bool cql_blobtype_vs_argtype_compat(
   sqlite3_value *_Nonnull field_value_arg,
   int8_t blob_column_type,
@@ -56,6 +368,333 @@ void cql_finalize_on_error(
   }
 }
 
+// The statement trace ring.  Each writer claims the next sequence number with
+// one atomic add and owns that slot until it stores the slot's stamp.  The
+// stamp is 0 while the event is being written and seq+1 after, the drainer
+// copies the event out and then checks that the stamp didn't change, so it
+// never returns an event that was half written or overwritten under it.
+typedef struct cql_trace_slot {
+  uint64_t stamp;
+  cql_trace_event event;
+} cql_trace_slot;
+
+CQL_C_ASSERT((CQL_TRACE_RING_SIZE & (CQL_TRACE_RING_SIZE - 1)) == 0);
+
+static cql_trace_slot cql_trace_ring[CQL_TRACE_RING_SIZE];
+static uint64_t cql_trace_head;   // the next sequence number to write
+static uint64_t cql_trace_tail;   // the next sequence number to drain
+static int64_t cql_trace_lost_count;
+static cql_bool cql_trace_on;
+
+CQL_THREAD_LOCAL const char *_Nullable cql_trace_proc;
+
+#ifndef cql_trace_now_ns
+// The trace clock, a runtime can provide a cheaper one.
+static int64_t cql_trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+void cql_trace_set_enabled(cql_bool enabled) {
+  __atomic_store_n(&cql_trace_on, enabled, __ATOMIC_RELAXED);
+}
+
+cql_bool cql_trace_enabled(void) {
+  return __atomic_load_n(&cql_trace_on, __ATOMIC_RELAXED);
+}
+
+int64_t cql_trace_lost(void) {
+  return __atomic_load_n(&cql_trace_lost_count, __ATOMIC_RELAXED);
+}
+
+// FNV-1a of the statement text, this is only computed when something is
+// recording statements.
+int64_t cql_trace_stmt_id(const char *_Nullable sql) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  if (sql) {
+    while (*sql) {
+      hash = (hash ^ (uint8_t)*sql++) * 0x100000001b3ull;
+    }
+  }
+  return (int64_t)hash;
+}
+
+// Binding and stepping happen after the procedure that prepared the statement
+// has returned (e.g. in cql_fetch_all_results) so each thread remembers the
+// id, procedure, and bound parameter types of the statements it recently
+// prepared.  This also saves hashing the text again.  Statements that were
+// prepared while nothing was being recorded fall back to the text and the
+// current procedure.
+#define CQL_STMT_INFO_CACHE 64
+#define CQL_STMT_INFO_MAX_PARAMS 32
+
+typedef struct cql_stmt_info {
+  sqlite3_stmt *_Nullable stmt;
+  int64_t stmt_id;
+  const char *_Nullable proc;
+  cql_int32 param_count;
+  uint8_t param_types[CQL_STMT_INFO_MAX_PARAMS];
+} cql_stmt_info;
+
+static CQL_THREAD_LOCAL cql_stmt_info cql_stmt_infos[CQL_STMT_INFO_CACHE];
+
+static cql_stmt_info *_Nonnull cql_stmt_info_entry(sqlite3_stmt *_Nonnull stmt) {
+  return &cql_stmt_infos[((uintptr_t)stmt >> 4) & (CQL_STMT_INFO_CACHE - 1)];
+}
+
+static void cql_stmt_info_remember(sqlite3_stmt *_Nullable stmt, int64_t stmt_id) {
+  if (stmt) {
+    cql_stmt_info *info = cql_stmt_info_entry(stmt);
+    info->stmt = stmt;
+    info->stmt_id = stmt_id;
+    info->proc = cql_trace_proc;
+    info->param_count = 0;
+  }
+}
+
+// The cache entry for the statement, it is (re)initialized if it isn't there.
+static cql_stmt_info *_Nonnull cql_stmt_info_for(sqlite3_stmt *_Nonnull stmt) {
+  cql_stmt_info *info = cql_stmt_info_entry(stmt);
+  if (info->stmt != stmt) {
+    cql_stmt_info_remember(stmt, cql_trace_stmt_id(sqlite3_sql(stmt)));
+  }
+  return info;
+}
+
+static void cql_trace_add(
+  cql_int32 kind,
+  int64_t stmt_id,
+  const char *_Nullable proc,
+  int64_t duration_ns,
+  cql_int32 rows,
+  cql_code rc)
+{
+  uint64_t seq = __atomic_fetch_add(&cql_trace_head, 1, __ATOMIC_RELAXED);
+  cql_trace_slot *slot = &cql_trace_ring[seq & (CQL_TRACE_RING_SIZE - 1)];
+
+  __atomic_store_n(&slot->stamp, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  slot->event.stmt_id = stmt_id;
+  slot->event.proc = proc;
+  slot->event.duration_ns = duration_ns;
+  slot->event.rows = rows;
+  slot->event.rc = rc;
+  slot->event.kind = kind;
+
+  __atomic_store_n(&slot->stamp, seq + 1, __ATOMIC_RELEASE);
+}
+
+cql_int32 cql_trace_drain(cql_trace_event *_Nonnull events, cql_int32 max) {
+  uint64_t head = __atomic_load_n(&cql_trace_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = cql_trace_tail;
+
+  // anything more than a ring behind is already gone
+  if (head - tail > CQL_TRACE_RING_SIZE) {
+    __atomic_fetch_add(&cql_trace_lost_count, (int64_t)(head - tail - CQL_TRACE_RING_SIZE), __ATOMIC_RELAXED);
+    tail = head - CQL_TRACE_RING_SIZE;
+  }
+
+  cql_int32 count = 0;
+  while (tail < head && count < max) {
+    cql_trace_slot *slot = &cql_trace_ring[tail & (CQL_TRACE_RING_SIZE - 1)];
+    uint64_t stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+
+    if (stamp < tail + 1) {
+      // the writer isn't done yet, pick it up next time
+      break;
+    }
+
+    if (stamp == tail + 1) {
+      events[count] = slot->event;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) == stamp) {
+        count++;
+        tail++;
+        continue;
+      }
+    }
+
+    // a newer event took this slot
+    __atomic_fetch_add(&cql_trace_lost_count, 1, __ATOMIC_RELAXED);
+    tail++;
+  }
+
+  cql_trace_tail = tail;
+  return count;
+}
+
+// The slow statement log, off while the threshold is negative.  The plan
+// connection and callback are only read when a slow statement is reported.
+static int64_t cql_slow_threshold_ns = -1;
+static sqlite3 *_Nullable cql_slow_plan_db;
+static cql_slow_statement_callback _Nullable cql_slow_callback;
+static void *_Nullable cql_slow_context;
+
+void cql_slow_statement_log_enable(
+  int64_t threshold_ns,
+  sqlite3 *_Nullable plan_db,
+  cql_slow_statement_callback _Nonnull callback,
+  void *_Nullable context)
+{
+  cql_slow_plan_db = plan_db;
+  cql_slow_callback = callback;
+  cql_slow_context = context;
+  __atomic_store_n(&cql_slow_threshold_ns, threshold_ns < 0 ? 0 : threshold_ns, __ATOMIC_RELEASE);
+}
+
+void cql_slow_statement_log_disable(void) {
+  __atomic_store_n(&cql_slow_threshold_ns, -1, __ATOMIC_RELEASE);
+}
+
+// True if anything wants statement timings.
+static cql_bool cql_statement_timing(void) {
+  return cql_trace_enabled() || __atomic_load_n(&cql_slow_threshold_ns, __ATOMIC_RELAXED) >= 0;
+}
+
+static cql_bool cql_statement_is_slow(int64_t duration_ns) {
+  int64_t threshold_ns = __atomic_load_n(&cql_slow_threshold_ns, __ATOMIC_ACQUIRE);
+  return threshold_ns >= 0 && duration_ns >= threshold_ns;
+}
+
+// Appends the type names of the bound parameters e.g. "int!, text", these
+// are the CQL types, the values are never recorded.
+static void cql_slow_param_types(cql_bytebuf *_Nonnull buf, cql_stmt_info *_Nullable info) {
+  static const char *const names[] = {
+    "null", "int", "long", "real", "bool", "text", "blob", "object"
+  };
+
+  cql_int32 count = info ? info->param_count : 0;
+  for (cql_int32 i = 0; i < count; i++) {
+    uint8_t type = info->param_types[i];
+    cql_bprintf(buf, "%s%s%s",
+      i ? ", " : "",
+      names[CQL_CORE_DATA_TYPE_OF(type) & 7],
+      (type & CQL_DATA_TYPE_NOT_NULL) ? "!" : "");
+  }
+  cql_bytebuf_append_null(buf);
+}
+
+// Appends the EXPLAIN QUERY PLAN output for the text, one line per plan node
+// indented by its depth.  This runs on the plan connection so the statement
+// that was slow, and the caller's connection, are not touched.  Parameters are
+// left unbound, they don't change the plan.
+static void cql_slow_plan(cql_bytebuf *_Nonnull buf, const char *_Nonnull sql) {
+  sqlite3 *db = cql_slow_plan_db;
+  if (!db) {
+    cql_bytebuf_append_null(buf);
+    return;
+  }
+
+  cql_bytebuf explain;
+  cql_bytebuf_open(&explain);
+  cql_bprintf(&explain, "EXPLAIN QUERY PLAN %s", sql);
+  cql_bytebuf_append_null(&explain);
+
+  sqlite3_stmt *stmt = NULL;
+  cql_code rc = sqlite3_prepare_v2(db, explain.ptr, -1, &stmt, NULL);
+  cql_bytebuf_close(&explain);
+
+  if (rc != SQLITE_OK) {
+    cql_bprintf(buf, "no plan: %s", sqlite3_errmsg(db));
+    cql_bytebuf_append_null(buf);
+    return;
+  }
+
+  // the ids of the open nodes from the root down, a node's depth is the
+  // number of its ancestors that are still open
+  cql_int32 ids[32];
+  cql_int32 depth = 0;
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    cql_int32 id = sqlite3_column_int(stmt, 0);
+    cql_int32 parent = sqlite3_column_int(stmt, 1);
+    const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+
+    while (depth > 0 && ids[depth - 1] != parent) {
+      depth--;
+    }
+    cql_bprintf(buf, "%*s%s\n", depth * 2, "", detail ? detail : "");
+    if (depth < 32) {
+      ids[depth++] = id;
+    }
+  }
+
+  sqlite3_finalize(stmt);
+  cql_bytebuf_append_null(buf);
+}
+
+static void cql_slow_statement_add(
+  cql_int32 kind,
+  const char *_Nonnull sql,
+  cql_stmt_info *_Nullable info,
+  int64_t duration_ns,
+  cql_int32 rows,
+  cql_code rc)
+{
+  cql_bytebuf param_types;
+  cql_bytebuf plan;
+  cql_bytebuf_open(&param_types);
+  cql_bytebuf_open(&plan);
+  cql_slow_param_types(&param_types, info);
+  cql_slow_plan(&plan, sql);
+
+  cql_slow_statement slow = {
+    .sql = sql,
+    .proc = info ? info->proc : cql_trace_proc,
+    .param_types = param_types.ptr,
+    .plan = plan.ptr,
+    .duration_ns = duration_ns,
+    .rows = rows,
+    .rc = rc,
+    .kind = kind,
+  };
+  cql_slow_callback(&slow, cql_slow_context);
+
+  cql_bytebuf_close(&param_types);
+  cql_bytebuf_close(&plan);
+}
+
+// Records a prepare or exec of the given text that started at start_ns.
+static void cql_statement_done(
+  cql_int32 kind,
+  sqlite3_stmt *_Nullable stmt,
+  const char *_Nonnull sql,
+  int64_t start_ns,
+  cql_code rc)
+{
+  int64_t duration_ns = cql_trace_now_ns() - start_ns;
+  int64_t stmt_id = cql_trace_stmt_id(sql);
+  cql_stmt_info_remember(stmt, stmt_id);
+
+  if (cql_trace_enabled()) {
+    cql_trace_add(kind, stmt_id, cql_trace_proc, duration_ns, 0, rc);
+  }
+  if (cql_statement_is_slow(duration_ns)) {
+    cql_slow_statement_add(kind, sql, NULL, duration_ns, 0, rc);
+  }
+}
+
+// Records the step loop over the statement that started at start_ns.
+static void cql_step_loop_done(
+  sqlite3_stmt *_Nonnull stmt,
+  int64_t start_ns,
+  cql_int32 rows,
+  cql_code rc)
+{
+  int64_t duration_ns = cql_trace_now_ns() - start_ns;
+  cql_stmt_info *info = cql_stmt_info_for(stmt);
+
+  if (cql_trace_enabled()) {
+    cql_trace_add(CQL_TRACE_STEP, info->stmt_id, info->proc, duration_ns, rows, rc);
+  }
+  if (cql_statement_is_slow(duration_ns)) {
+    cql_slow_statement_add(CQL_TRACE_STEP, sqlite3_sql(stmt), info, duration_ns, rows, rc);
+  }
+}
+
 // This method is used when handling CQL cursors; the cursor local variable may
 // already contain a statement.  When preparing a new statement, we want to
 // finalize any statement the cursor used to hold.  This lets us do simple
@@ -65,10 +704,16 @@ cql_code cql_prepare(
   sqlite3_stmt *_Nullable *_Nonnull pstmt,
   const char *_Nonnull sql)
 {
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
 
   cql_finalize_stmt(pstmt);
   cql_code rc = cql_sqlite3_prepare_v2(db, sql, -1, pstmt, NULL);
 
+  if (timing) {
+    cql_statement_done(CQL_TRACE_PREPARE, *pstmt, sql, start_ns, rc);
+  }
+
 #ifdef CQL_TRACE_STATEMENTS
   if (rc) {
     fprintf(stderr, "PREP> %s\n", sql);
@@ -98,7 +743,7 @@ static char *_Nonnull cql_vconcat(
     }
   }
 
-  char *result = malloc(bytes + 1);
+  char *result = cql_malloc(bytes + 1, CQL_ALLOC_TEMP);
 
   cql_int32 offset = 0;
 
@@ -128,19 +773,26 @@ cql_code cql_prepare_var(
   cql_uint32 count,
   const char *_Nullable preds, ...)
 {
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
+
   cql_finalize_stmt(pstmt);
   va_list args;
   va_start(args, preds);
   char *sql = cql_vconcat(count, preds, &args);
   cql_code rc = cql_sqlite3_prepare_v2(db, sql, -1, pstmt, NULL);
   va_end(args);
+
+  if (timing) {
+    cql_statement_done(CQL_TRACE_PREPARE, *pstmt, sql, start_ns, rc);
+  }
 #ifdef CQL_TRACE_STATEMENTS
   if (rc) {
     fprintf(stderr, "PREP> %s\n", sql);
     fprintf(stderr, "Error %d %s\n", rc, sqlite3_errmsg(db));
   }
 #endif
-  free(sql);
+  cql_free(sql, CQL_ALLOC_TEMP);
   return rc;
 }
 
@@ -148,8 +800,15 @@ cql_code cql_prepare_var(
 // arguments. This code is here just to reduce the code size of exec calls in
 // the generated code. There are a lot of such calls.
 cql_code cql_exec(sqlite3 *_Nonnull db, const char *_Nonnull sql) {
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
+
   cql_code rc = cql_sqlite3_exec(db, sql);
 
+  if (timing) {
+    cql_statement_done(CQL_TRACE_EXEC, NULL, sql, start_ns, rc);
+  }
+
 #ifdef CQL_TRACE_STATEMENTS
   if (rc) {
     fprintf(stderr, "EXEC> %s\n", sql);
@@ -167,18 +826,25 @@ cql_code cql_exec_var(
   cql_uint32 count,
   const char *_Nullable preds, ...)
 {
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
+
   va_list args;
   va_start(args, preds);
   char *sql = cql_vconcat(count, preds, &args);
   cql_code rc = cql_sqlite3_exec(db, sql);
   va_end(args);
+
+  if (timing) {
+    cql_statement_done(CQL_TRACE_EXEC, NULL, sql, start_ns, rc);
+  }
 #ifdef CQL_TRACE_STATEMENTS
   if (rc) {
     fprintf(stderr, "EXEC> %s\n", sql);
     fprintf(stderr, "Error %d %s\n", rc, sqlite3_errmsg(db));
   }
 #endif
-  free(sql);
+  cql_free(sql, CQL_ALLOC_TEMP);
   return rc;
 }
 
@@ -256,6 +922,9 @@ cql_code cql_prepare_frags(
   const char *_Nonnull base,
   const char *_Nonnull frags)
 {
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
+
   // NOTE: len is the allocation size (includes trailing \0)
   cql_finalize_stmt(pstmt);
   cql_int32 len;
@@ -263,6 +932,10 @@ cql_code cql_prepare_frags(
   STACK_BYTES_ALLOC(sql, len);
   cql_expand_frags(sql, base, frags);
   cql_code rc = cql_sqlite3_prepare_v2(db, sql, len, pstmt, NULL);
+
+  if (timing) {
+    cql_statement_done(CQL_TRACE_PREPARE, *pstmt, sql, start_ns, rc);
+  }
 #ifdef CQL_TRACE_STATEMENTS
   if (rc) {
     fprintf(stderr, "PREP> %s\n", sql);
@@ -280,12 +953,19 @@ cql_code cql_exec_frags(
   const char *_Nonnull base,
   const char *_Nonnull frags)
 {
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
+
   // NOTE: len is the allocation size (includes trailing \0)
   cql_int32 len;
   frags = cql_decode(frags, &len);
   STACK_BYTES_ALLOC(sql, len);
   cql_expand_frags(sql, base, frags);
   cql_code rc = cql_sqlite3_exec(db, sql);
+
+  if (timing) {
+    cql_statement_done(CQL_TRACE_EXEC, NULL, sql, start_ns, rc);
+  }
 #ifdef CQL_TRACE_STATEMENTS
   if (rc) {
     fprintf(stderr, "EXEC> %s\n", sql);
@@ -650,13 +1330,13 @@ void cql_contract_argument_notnull_when_dereferenced(
 // otherwise overflow resulting in at most 2N data operations for N rows.
 void cql_bytebuf_open(cql_bytebuf *_Nonnull b) {
   b->max = BYTEBUF_GROWTH_SIZE;
-  b->ptr = malloc(b->max);
+  b->ptr = cql_malloc(b->max, CQL_ALLOC_ROW_DATA);
   b->used = 0;
 }
 
 // Dispenses the buffer's memory when it is closed.
 void cql_bytebuf_close(cql_bytebuf *_Nonnull b) {
-  free(b->ptr);
+  cql_free(b->ptr, CQL_ALLOC_ROW_DATA);
   b->max = 0;
   b->ptr = NULL;
 }
@@ -678,10 +1358,10 @@ void *_Nonnull cql_bytebuf_alloc(
     else {
       b->max = needed + 2 * b->max;
     }
-    char *newptr = malloc(b->max);
+    char *newptr = cql_malloc(b->max, CQL_ALLOC_ROW_DATA);
 
     memcpy(newptr, b->ptr, b->used);
-    free(b->ptr);
+    cql_free(b->ptr, CQL_ALLOC_ROW_DATA);
     b->ptr = newptr;
   }
 
@@ -916,6 +1596,26 @@ static void cql_fetch_field(
   }
 }
 
+// Rows with the compact layout (see `cql:compact_rows`) begin with a bitmap
+// that holds the null flag of each nullable primitive column.  Such columns have
+// CQL_DATA_TYPE_NULL_BIT in their data type and store just the bare value at
+// their offset, the value is always zero when the column is null.  This keeps
+// the bytewise row hash and equality working without any changes.
+cql_bool cql_row_null_bit(const char *_Nonnull row, cql_uint32 col) {
+  return (((const uint8_t *)row)[col >> 3] >> (col & 7)) & 1;
+}
+
+// Sets or clears the null bit of the indicated column in a compact row.
+static void cql_row_set_null_bit(char *_Nonnull row, cql_uint32 col, cql_bool is_null) {
+  uint8_t mask = (uint8_t)(1 << (col & 7));
+  if (is_null) {
+    ((uint8_t *)row)[col >> 3] |= mask;
+  }
+  else {
+    ((uint8_t *)row)[col >> 3] &= (uint8_t)~mask;
+  }
+}
+
 // This method lets us get lots of columns out of a statement with one call in
 // the generated code saving us a lot of error management and reducing the
 // generated code cost to just the offsets and types.  This version does the
@@ -938,6 +1638,14 @@ void cql_multifetch_meta(
   for (cql_int32 column = 0; column < count; column++) {
     uint8_t type = data_types[column];
     char *field = data + col_offsets[column];
+
+    if (type & CQL_DATA_TYPE_NULL_BIT) {
+      // compact row: fetch the bare value, sqlite gives us zero for null
+      cql_bool is_null = sqlite3_column_type(stmt, column) == SQLITE_NULL;
+      cql_row_set_null_bit(data, (cql_uint32)column, is_null);
+      type = CQL_CORE_DATA_TYPE_OF(type) | CQL_DATA_TYPE_NOT_NULL;
+    }
+
     cql_fetch_field(type, column, db, stmt, field);
   }
 }
@@ -1100,6 +1808,50 @@ void cql_copyoutrow(
   va_end(args);
 }
 
+// The fast path for fetching from a cursor over an OUT UNION result set.  Those
+// rows are cursor structs, so if the result set has the cursor's column offsets
+// and types (and hence the same header) we can copy the fields in one go.  The
+// cursor keeps its own header.  Everything else declines: rows made by a select
+// have no header so their offsets differ, and encoded columns and compact rows
+// carry extra type bits.  Those must take the cql_copyoutrow path.
+cql_bool cql_copyoutrow_direct(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 row,
+  void *_Nonnull cursor,
+  cql_uint32 cursor_size,
+  const uint16_t *_Nonnull col_offsets,
+  const uint8_t *_Nonnull data_types)
+{
+  cql_contract(result_set);
+  cql_contract(cursor);
+  cql_contract(cursor_size >= sizeof(cql_row_header));
+
+  if (row < 0 || row >= cql_result_set_get_count(result_set)) {
+    return false;
+  }
+
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  cql_uint16 count = col_offsets[0];
+  if (meta->rowsize != cursor_size ||
+      meta->columnCount != count ||
+      !meta->columnOffsets ||
+      !meta->dataTypes ||
+      memcmp(meta->columnOffsets, col_offsets, (count + 1) * sizeof(uint16_t)) ||
+      memcmp(meta->dataTypes, data_types, count)) {
+    return false;
+  }
+
+  cql_row_header *header = (cql_row_header *)cursor;
+  const char *data = (const char *)cql_result_set_get_data(result_set) + row * meta->rowsize;
+
+  // drop the current values, the result set keeps its own references so this
+  // is safe even if the new row holds the same objects
+  cql_release_offsets(cursor, header->_refs_count_, header->_refs_offset_);
+  memcpy((char *)cursor + sizeof(cql_row_header), data + sizeof(cql_row_header), cursor_size - sizeof(cql_row_header));
+  cql_retain_offsets(cursor, header->_refs_count_, header->_refs_offset_);
+  return true;
+}
+
 // This is just the helper to ignore the indicated arg because the predicates
 // array tell us it is to be skipped
 static void cql_skip_arg(
@@ -1174,6 +1926,16 @@ static void cql_multibind_v(
 {
   cql_int32 column = 1;
 
+  // the statement is gone after a failed bind so it is looked up first, the
+  // parameter types are kept for the slow statement log
+  cql_stmt_info *stmt_info = NULL;
+  int64_t start_ns = 0;
+  if (cql_statement_timing() && *pstmt) {
+    start_ns = cql_trace_now_ns();
+    stmt_info = cql_stmt_info_for(*pstmt);
+    stmt_info->param_count = 0;
+  }
+
   for (cql_int32 i = 0; *prc == SQLITE_OK && i < count; i++) {
     cql_contract(pstmt && *pstmt);
     cql_int32 type = va_arg(*args, cql_int32);
@@ -1184,6 +1946,10 @@ static void cql_multibind_v(
       continue;
     }
 
+    if (stmt_info && stmt_info->param_count < CQL_STMT_INFO_MAX_PARAMS) {
+      stmt_info->param_types[stmt_info->param_count++] = (uint8_t)type;
+    }
+
     if (type & CQL_DATA_TYPE_NOT_NULL) {
       switch (core_data_type) {
         case CQL_DATA_TYPE_INT32: {
@@ -1300,6 +2066,11 @@ static void cql_multibind_v(
     }
     cql_finalize_on_error(*prc, pstmt);
   }
+
+  if (stmt_info && cql_trace_enabled()) {
+    int64_t duration_ns = cql_trace_now_ns() - start_ns;
+    cql_trace_add(CQL_TRACE_BIND, stmt_info->stmt_id, stmt_info->proc, duration_ns, 0, *prc);
+  }
 }
 
 // This wraps the underlying varargs worker, with no variable predicates
@@ -1329,14 +2100,338 @@ void cql_multibind_var(
   va_end(args);
 }
 
-// In a single row of a result set or a single auto-cursor, release all the references in that row
-// Note that all the references are together and they begin at refs_offset.
-void cql_release_offsets(void *_Nonnull pv, cql_uint16 refs_count, cql_uint16 refs_offset) {
-  if (refs_count) {
-    // first entry in the array is the count
-    char *base = pv;
+// Binds one column of a row to the indicated statement parameter.  The row has
+// the usual cursor layout: the offsets array begins with the column count and
+// the types are the CQL data types.  Compact rows (CQL_DATA_TYPE_NULL_BIT) are
+// handled too so any result set row can be bound this way.
+static cql_code cql_bind_row_col(
+  sqlite3_stmt *_Nonnull stmt,
+  cql_int32 param,
+  char *_Nonnull row,
+  cql_uint16 *_Nonnull offsets,
+  uint8_t *_Nonnull types,
+  cql_int32 col)
+{
+  uint8_t type = types[col];
+  char *data = row + offsets[col + 1];
+  cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(type);
 
-    // each entry then tells us the offset of an embedded pointer
+  switch (core_data_type) {
+    case CQL_DATA_TYPE_STRING: {
+      cql_string_ref str_ref = *(cql_string_ref *)data;
+      if (!str_ref) {
+        return sqlite3_bind_null(stmt, param);
+      }
+      cql_alloc_cstr(temp, str_ref);
+      cql_code rc = sqlite3_bind_text(stmt, param, temp, -1, SQLITE_TRANSIENT);
+      cql_free_cstr(temp, str_ref);
+      return rc;
+    }
+    case CQL_DATA_TYPE_BLOB: {
+      cql_blob_ref blob_ref = *(cql_blob_ref *)data;
+      if (!blob_ref) {
+        return sqlite3_bind_null(stmt, param);
+      }
+      const void *bytes = cql_get_blob_bytes(blob_ref);
+      cql_int32 size = cql_get_blob_size(blob_ref);
+      return sqlite3_bind_blob(stmt, param, bytes, size, SQLITE_TRANSIENT);
+    }
+    case CQL_DATA_TYPE_OBJECT:
+      // objects can't be stored, cql_insert_rows_with_shape rejects them
+      cql_contract(false);
+      return SQLITE_MISUSE;
+  }
+
+  // nullable primitives are either a nullable struct or, in compact rows, the
+  // bare value with the null flag in the row's bitmap
+  if (!(type & CQL_DATA_TYPE_NOT_NULL)) {
+    if (type & CQL_DATA_TYPE_NULL_BIT) {
+      if (cql_row_null_bit(row, (cql_uint32)col)) {
+        return sqlite3_bind_null(stmt, param);
+      }
+    }
+    else {
+      // is_null is the first field of all of the nullable structs
+      if (((cql_nullable_bool *)data)->is_null) {
+        return sqlite3_bind_null(stmt, param);
+      }
+      switch (core_data_type) {
+        case CQL_DATA_TYPE_INT32: data = (char *)&((cql_nullable_int32 *)data)->value; break;
+        case CQL_DATA_TYPE_INT64: data = (char *)&((cql_nullable_int64 *)data)->value; break;
+        case CQL_DATA_TYPE_DOUBLE: data = (char *)&((cql_nullable_double *)data)->value; break;
+        case CQL_DATA_TYPE_BOOL: data = (char *)&((cql_nullable_bool *)data)->value; break;
+      }
+    }
+  }
+
+  switch (core_data_type) {
+    case CQL_DATA_TYPE_INT32:
+      return sqlite3_bind_int(stmt, param, *(cql_int32 *)data);
+    case CQL_DATA_TYPE_INT64:
+      return sqlite3_bind_int64(stmt, param, *(cql_int64 *)data);
+    case CQL_DATA_TYPE_DOUBLE:
+      return sqlite3_bind_double(stmt, param, *(cql_double *)data);
+    case CQL_DATA_TYPE_BOOL:
+      return sqlite3_bind_int(stmt, param, !!*(cql_bool *)data);
+  }
+
+  cql_contract(false);
+  return SQLITE_MISUSE;
+}
+
+// The rows to be inserted by cql_insert_rows_with_shape, they can be the rows
+// of a result set or an array of cursors.
+typedef struct cql_insert_rows_source {
+  char *_Nonnull data;            // the first row
+  size_t row_size;                // the distance between rows
+  cql_int32 count;                // the number of rows
+  cql_uint16 *_Nonnull offsets;   // column count then the offset of each column
+  uint8_t *_Nonnull types;        // the data type of each column
+} cql_insert_rows_source;
+
+// Appends the first len characters of name as a quoted SQL identifier, any
+// quotes in the name are doubled.
+static void cql_bprint_identifier(cql_bytebuf *_Nonnull b, const char *_Nonnull name, size_t len) {
+  cql_bytebuf_append(b, "\"", 1);
+  for (size_t i = 0; i < len; i++) {
+    if (name[i] == '"') {
+      cql_bytebuf_append(b, "\"", 1);
+    }
+    cql_bytebuf_append(b, &name[i], 1);
+  }
+  cql_bytebuf_append(b, "\"", 1);
+}
+
+// Makes "INSERT INTO "table"("a", "b") VALUES (?, ?), (?, ?)" for the indicated
+// number of rows and prepares it.  The table and each of the comma separated
+// column names are quoted so they are only ever identifiers, spaces around the
+// column names are ignored.
+static cql_code cql_insert_rows_prepare(
+  sqlite3 *_Nonnull db,
+  sqlite3_stmt *_Nullable *_Nonnull pstmt,
+  const char *_Nonnull table,
+  const char *_Nonnull columns,
+  cql_int32 column_count,
+  cql_int32 rows)
+{
+  cql_bytebuf b;
+  cql_bytebuf_open(&b);
+  cql_bprintf(&b, "INSERT INTO ");
+  cql_bprint_identifier(&b, table, strlen(table));
+  cql_bprintf(&b, "(");
+  const char *col = columns;
+  for (;;) {
+    while (*col == ' ') {
+      col++;
+    }
+    const char *end = strchr(col, ',');
+    size_t len = end ? (size_t)(end - col) : strlen(col);
+    while (len && col[len - 1] == ' ') {
+      len--;
+    }
+    cql_bprint_identifier(&b, col, len);
+    if (!end) {
+      break;
+    }
+    cql_bprintf(&b, ", ");
+    col = end + 1;
+  }
+  cql_bprintf(&b, ") VALUES ");
+  for (cql_int32 row = 0; row < rows; row++) {
+    cql_bprintf(&b, row ? ", (" : "(");
+    for (cql_int32 col = 0; col < column_count; col++) {
+      cql_bprintf(&b, col ? ", ?" : "?");
+    }
+    cql_bprintf(&b, ")");
+  }
+  cql_bytebuf_append_null(&b);
+  cql_code rc = cql_prepare(db, pstmt, b.ptr);
+  cql_bytebuf_close(&b);
+  return rc;
+}
+
+// This is the worker for the bulk insert helpers.  The rows are inserted with
+// multi-row VALUES statements, as many rows per statement as the variable limit
+// allows (up to CQL_INSERT_ROWS_MAX_CHUNK), so there are at most two prepares
+// no matter how many rows there are.  Everything happens inside a savepoint so
+// this works in or out of a transaction and a failure inserts nothing.
+static cql_code cql_insert_rows_with_shape(
+  sqlite3 *_Nonnull db,
+  const char *_Nonnull table,
+  const char *_Nonnull columns,
+  cql_insert_rows_source *_Nonnull source)
+{
+  cql_int32 column_count = source->offsets[0];
+  cql_contract(column_count > 0);
+
+  // object columns have no storage form, like cql_result_set_to_blob they are
+  // an error rather than something written as a pointer value
+  for (cql_int32 col = 0; col < column_count; col++) {
+    if (CQL_CORE_DATA_TYPE_OF(source->types[col]) == CQL_DATA_TYPE_OBJECT) {
+      return SQLITE_ERROR;
+    }
+  }
+
+  if (source->count == 0) {
+    return SQLITE_OK;
+  }
+
+  cql_int32 chunk = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1) / column_count;
+  if (chunk > CQL_INSERT_ROWS_MAX_CHUNK) {
+    chunk = CQL_INSERT_ROWS_MAX_CHUNK;
+  }
+  if (chunk < 1) {
+    chunk = 1;
+  }
+
+  cql_code rc = cql_exec(db, "SAVEPOINT cql_insert_rows");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
+
+  sqlite3_stmt *stmt = NULL;
+  cql_int32 stmt_rows = 0;
+  cql_int32 row = 0;
+
+  while (row < source->count) {
+    cql_int32 rows = source->count - row;
+    if (rows > chunk) {
+      rows = chunk;
+    }
+
+    // the full sized statement is used until the last few rows which get their
+    // own statement
+    if (rows != stmt_rows) {
+      cql_finalize_stmt(&stmt);
+      rc = cql_insert_rows_prepare(db, &stmt, table, columns, column_count, rows);
+      if (rc != SQLITE_OK) {
+        break;
+      }
+      stmt_rows = rows;
+    }
+
+    cql_int32 param = 1;
+    for (cql_int32 i = 0; rc == SQLITE_OK && i < rows; i++) {
+      char *data = source->data + (size_t)(row + i) * source->row_size;
+      for (cql_int32 col = 0; rc == SQLITE_OK && col < column_count; col++) {
+        rc = cql_bind_row_col(stmt, param++, data, source->offsets, source->types, col);
+      }
+    }
+    if (rc != SQLITE_OK) {
+      break;
+    }
+
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE) {
+      break;
+    }
+    rc = SQLITE_OK;
+    row += rows;
+  }
+
+  if (timing && stmt) {
+    cql_step_loop_done(stmt, start_ns, row, rc);
+  }
+  cql_finalize_stmt(&stmt);
+
+  if (rc == SQLITE_OK) {
+    return cql_exec(db, "RELEASE cql_insert_rows");
+  }
+
+  // put everything back, the original error is the one to report
+  cql_exec(db, "ROLLBACK TO cql_insert_rows");
+  cql_exec(db, "RELEASE cql_insert_rows");
+  return rc;
+}
+
+// Inserts all the rows of the result set into the table.  The columns are the
+// comma separated column names in the order of the result set's columns.
+// CQLABI
+cql_code cql_result_set_insert_rows(
+  sqlite3 *_Nonnull db,
+  cql_result_set_ref _Nonnull result_set,
+  const char *_Nonnull table,
+  const char *_Nonnull columns)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  cql_contract(meta->columnOffsets);
+  cql_contract(meta->dataTypes);
+
+  cql_insert_rows_source source = {
+    .data = (char *)cql_result_set_get_data(result_set),
+    .row_size = meta->rowsize,
+    .count = cql_result_set_get_count(result_set),
+    .offsets = meta->columnOffsets,
+    .types = meta->dataTypes,
+  };
+
+  return cql_insert_rows_with_shape(db, table, columns, &source);
+}
+
+// Inserts an array of rows that have the shape of the given cursor, for
+// instance an array of the row structs of an OUT procedure.  The column names
+// are the cursor's field names.  Only the shape of the cursor is used, its data
+// need not be part of the array.
+cql_code cql_insert_cursor_rows(
+  sqlite3 *_Nonnull db,
+  const char *_Nonnull table,
+  cql_dynamic_cursor *_Nonnull shape,
+  const void *_Nonnull rows,
+  cql_int32 count)
+{
+  cql_int32 column_count = shape->cursor_col_offsets[0];
+
+  cql_bytebuf b;
+  cql_bytebuf_open(&b);
+  for (cql_int32 col = 0; col < column_count; col++) {
+    cql_bprintf(&b, col ? ", %s" : "%s", shape->cursor_fields[col]);
+  }
+  cql_bytebuf_append_null(&b);
+
+  cql_insert_rows_source source = {
+    .data = (char *)rows,
+    .row_size = shape->cursor_size,
+    .count = count,
+    .offsets = shape->cursor_col_offsets,
+    .types = shape->cursor_data_types,
+  };
+
+  cql_code rc = cql_insert_rows_with_shape(db, table, b.ptr, &source);
+  cql_bytebuf_close(&b);
+  return rc;
+}
+
+// The CQL version of cql_result_set_insert_rows, it can be declared like so:
+//
+//  declare proc cql_insert_rows(rs object!, table_name text!, columns text!) using transaction;
+//
+// CQLABI
+cql_code cql_insert_rows(
+  sqlite3 *_Nonnull db,
+  cql_object_ref _Nonnull rs,
+  cql_string_ref _Nonnull table_name,
+  cql_string_ref _Nonnull columns)
+{
+  cql_alloc_cstr(table_str, table_name);
+  cql_alloc_cstr(columns_str, columns);
+  cql_code rc = cql_result_set_insert_rows(db, (cql_result_set_ref)rs, table_str, columns_str);
+  cql_free_cstr(columns_str, columns);
+  cql_free_cstr(table_str, table_name);
+  return rc;
+}
+
+// In a single row of a result set or a single auto-cursor, release all the references in that row
+// Note that all the references are together and they begin at refs_offset.
+void cql_release_offsets(void *_Nonnull pv, cql_uint16 refs_count, cql_uint16 refs_offset) {
+  if (refs_count) {
+    // first entry in the array is the count
+    char *base = pv;
+
+    // each entry then tells us the offset of an embedded pointer
     for (cql_int32 i = 0; i < refs_count; i++) {
       cql_release(*(cql_type_ref *)(base + refs_offset));
       *(cql_type_ref *)(base + refs_offset) = NULL;
@@ -1359,6 +2454,18 @@ void cql_retain_offsets(void *_Nonnull pv, cql_uint16 refs_count, cql_uint16 ref
   }
 }
 
+// Append a borrowed row to the cql_bytebuf in context, the copy now holds
+// its own references.  This is the sink the _fetch_results wrapper of a
+// [[stream_rows]] procedure uses to build its result set.
+cql_bool cql_bytebuf_row_sink(void *_Nullable context, const void *_Nonnull row, cql_uint32 size) {
+  cql_contract(context);
+  cql_contract(size >= sizeof(cql_row_header));
+  const cql_row_header *header = (const cql_row_header *)row;
+  cql_retain_offsets((void *)row, header->_refs_count_, header->_refs_offset_);
+  cql_bytebuf_append((cql_bytebuf *)context, row, size);
+  return true;
+}
+
 // Teardown an entire result set by iterating the rows and then releasing all of
 // the references in each row using cql_release_offsets.  Once that is done,
 // it's safe to free the entire blob of storage.
@@ -1378,7 +2485,7 @@ void cql_result_set_teardown(cql_result_set_ref _Nonnull result_set) {
     }
   }
 
-  free(data);
+  cql_free(data, CQL_ALLOC_ROW_DATA);
 }
 
 // Hash a cursor or row as described by the buffer size and refs offset
@@ -1572,7 +2679,10 @@ cql_bool cql_rows_same(
       // the end so we compute the size using the datatype (there is a small
       // lookup table for our few types)
       uint8_t type  = meta1->dataTypes[col];
-      cql_bool notnull = !!(type & CQL_DATA_TYPE_NOT_NULL);
+      cql_bool notnull = !!(type & (CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_NULL_BIT));
+      if ((type & CQL_DATA_TYPE_NULL_BIT) && cql_row_null_bit(data1, col) != cql_row_null_bit(data2, col)) {
+        return false;
+      }
       type &= CQL_DATA_TYPE_CORE;
       size_t size = notnull ? normal_datasizes[type] : nullable_datasizes[type];
       if (memcmp(data1 + offset, data2 + offset, size)) {
@@ -1590,6 +2700,201 @@ cql_bool cql_rows_same(
   return true;
 }
 
+// Hash only the identity columns of a row, this walks the columns exactly the
+// way cql_rows_same does so that rows that are the "same" always have the same
+// identity hash.  Non-reference columns are hashed as bytes (the padding is
+// zero-filled) and references use the reference type hash.
+static cql_hash_code cql_row_identity_hash(
+  cql_result_set_meta *_Nonnull meta,
+  char *_Nonnull data)
+{
+  uint16_t identityColumnCount = meta->identityColumns[0];
+  uint16_t *identityColumns = &(meta->identityColumns[1]);
+  uint16_t *columnOffsets = &(meta->columnOffsets[1]);
+
+  cql_hash_code hash = 5381;   // djb2
+  for (uint16_t i = 0; i < identityColumnCount; i++) {
+    uint16_t col = identityColumns[i];
+    uint16_t offset = columnOffsets[col];
+    if (offset < meta->refsOffset) {
+      uint8_t type  = meta->dataTypes[col];
+      cql_bool notnull = !!(type & (CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_NULL_BIT));
+      if (type & CQL_DATA_TYPE_NULL_BIT) {
+        hash = ((hash << 5) + hash) + cql_row_null_bit(data, col);
+      }
+      type &= CQL_DATA_TYPE_CORE;
+      size_t size = notnull ? normal_datasizes[type] : nullable_datasizes[type];
+      unsigned char *bytes = (unsigned char *)(data + offset);
+      while (size--) {
+        hash = ((hash << 5) + hash) + *bytes++; /* hash * 33 + c */
+      }
+    }
+    else {
+      hash = ((hash << 5) + hash) + cql_ref_hash(*(cql_type_ref *)(data + offset));
+    }
+  }
+
+  return hash;
+}
+
+// Computes which matched rows have moved.  The matched new rows, in new order,
+// give a sequence of old row indices.  The longest increasing subsequence of
+// those is the largest set of rows that kept their relative order; everything
+// else is reported as moved.  This is the usual patience sorting approach so
+// it's O(k log k) in the number of matched rows k.
+static void cql_result_set_diff_moves(
+  cql_result_set_diff_info *_Nonnull diff,
+  cql_int32 new_count)
+{
+  cql_int32 *tails = cql_malloc(sizeof(cql_int32) * (size_t)new_count, CQL_ALLOC_TEMP);  // new row ending each run
+  cql_int32 *prev = cql_malloc(sizeof(cql_int32) * (size_t)new_count, CQL_ALLOC_TEMP);   // predecessor in the run
+  cql_bool *stays = cql_calloc((size_t)new_count, sizeof(cql_bool), CQL_ALLOC_TEMP);
+  cql_int32 *new_to_old = diff->new_to_old;
+  cql_int32 length = 0;
+
+  for (cql_int32 j = 0; j < new_count; j++) {
+    cql_int32 old_row = new_to_old[j];
+    if (old_row < 0) {
+      continue;
+    }
+
+    // find the first run whose tail is not smaller than this old row
+    cql_int32 lo = 0;
+    cql_int32 hi = length;
+    while (lo < hi) {
+      cql_int32 mid = lo + (hi - lo) / 2;
+      if (new_to_old[tails[mid]] < old_row) {
+        lo = mid + 1;
+      }
+      else {
+        hi = mid;
+      }
+    }
+
+    prev[j] = lo > 0 ? tails[lo - 1] : -1;
+    tails[lo] = j;
+    if (lo == length) {
+      length++;
+    }
+  }
+
+  for (cql_int32 j = length ? tails[length - 1] : -1; j >= 0; j = prev[j]) {
+    stays[j] = true;
+  }
+
+  for (cql_int32 j = 0; j < new_count; j++) {
+    if (new_to_old[j] >= 0 && !stays[j]) {
+      diff->moved[diff->moved_count++] = j;
+    }
+  }
+
+  cql_free(tails, CQL_ALLOC_TEMP);
+  cql_free(prev, CQL_ALLOC_TEMP);
+  cql_free(stays, CQL_ALLOC_TEMP);
+}
+
+// This helper compares an old and a new version of the same result set and
+// reports what happened to each row.  Rows are matched by identity columns
+// using a hash index built over the old rows so the matching is O(n+m) rather
+// than comparing every pair of rows.  The index is open addressed with linear
+// probing; because equal identities are inserted in old row order and always
+// probe from the same slot, duplicate identities are matched to the old rows
+// in order.  Matched rows that are not cql_rows_equal are "changed".  As with
+// the other helpers the two result sets must have the same shape.
+void cql_result_set_diff(
+  cql_result_set_ref _Nonnull old_rs,
+  cql_result_set_ref _Nonnull new_rs,
+  cql_result_set_diff_info *_Nonnull diff)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(old_rs);
+  cql_contract(memcmp(meta, cql_result_set_get_meta(new_rs), sizeof(cql_result_set_meta)) == 0);
+  cql_contract(meta->identityColumns);
+  cql_contract(meta->identityColumns[0] > 0);
+
+  cql_int32 old_count = cql_result_set_get_count(old_rs);
+  cql_int32 new_count = cql_result_set_get_count(new_rs);
+  size_t row_size = meta->rowsize;
+  char *old_data = (char *)cql_result_set_get_data(old_rs);
+  char *new_data = (char *)cql_result_set_get_data(new_rs);
+
+  memset(diff, 0, sizeof(*diff));
+  diff->new_to_old = cql_malloc(sizeof(cql_int32) * (size_t)(new_count + 1), CQL_ALLOC_ROW_DATA);
+  diff->inserted = cql_malloc(sizeof(cql_int32) * (size_t)(new_count + 1), CQL_ALLOC_ROW_DATA);
+  diff->deleted = cql_malloc(sizeof(cql_int32) * (size_t)(old_count + 1), CQL_ALLOC_ROW_DATA);
+  diff->moved = cql_malloc(sizeof(cql_int32) * (size_t)(new_count + 1), CQL_ALLOC_ROW_DATA);
+  diff->changed = cql_malloc(sizeof(cql_int32) * (size_t)(new_count + 1), CQL_ALLOC_ROW_DATA);
+
+  // at most half full so the probe sequences stay short
+  size_t capacity = 2;
+  while (capacity < 2 * (size_t)old_count) {
+    capacity <<= 1;
+  }
+  size_t mask = capacity - 1;
+
+  cql_int32 *slots = cql_malloc(sizeof(cql_int32) * capacity, CQL_ALLOC_TEMP);
+  cql_hash_code *old_hashes = cql_malloc(sizeof(cql_hash_code) * (size_t)(old_count + 1), CQL_ALLOC_TEMP);
+  cql_bool *old_matched = cql_calloc((size_t)(old_count + 1), sizeof(cql_bool), CQL_ALLOC_TEMP);
+
+  for (size_t s = 0; s < capacity; s++) {
+    slots[s] = -1;
+  }
+
+  for (cql_int32 i = 0; i < old_count; i++) {
+    cql_hash_code hash = cql_row_identity_hash(meta, old_data + (size_t)i * row_size);
+    old_hashes[i] = hash;
+    size_t s = (size_t)hash & mask;
+    while (slots[s] >= 0) {
+      s = (s + 1) & mask;
+    }
+    slots[s] = i;
+  }
+
+  for (cql_int32 j = 0; j < new_count; j++) {
+    cql_hash_code hash = cql_row_identity_hash(meta, new_data + (size_t)j * row_size);
+    cql_int32 match = -1;
+    for (size_t s = (size_t)hash & mask; slots[s] >= 0; s = (s + 1) & mask) {
+      cql_int32 i = slots[s];
+      if (!old_matched[i] && old_hashes[i] == hash && cql_rows_same(old_rs, i, new_rs, j)) {
+        match = i;
+        break;
+      }
+    }
+
+    diff->new_to_old[j] = match;
+    if (match < 0) {
+      diff->inserted[diff->inserted_count++] = j;
+    }
+    else {
+      old_matched[match] = true;
+      if (!cql_rows_equal(old_rs, match, new_rs, j)) {
+        diff->changed[diff->changed_count++] = j;
+      }
+    }
+  }
+
+  for (cql_int32 i = 0; i < old_count; i++) {
+    if (!old_matched[i]) {
+      diff->deleted[diff->deleted_count++] = i;
+    }
+  }
+
+  cql_result_set_diff_moves(diff, new_count);
+
+  cql_free(slots, CQL_ALLOC_TEMP);
+  cql_free(old_hashes, CQL_ALLOC_TEMP);
+  cql_free(old_matched, CQL_ALLOC_TEMP);
+}
+
+// Frees the index lists of a diff, the struct itself belongs to the caller.
+void cql_result_set_diff_release(cql_result_set_diff_info *_Nonnull diff) {
+  cql_free(diff->new_to_old, CQL_ALLOC_ROW_DATA);
+  cql_free(diff->inserted, CQL_ALLOC_ROW_DATA);
+  cql_free(diff->deleted, CQL_ALLOC_ROW_DATA);
+  cql_free(diff->moved, CQL_ALLOC_ROW_DATA);
+  cql_free(diff->changed, CQL_ALLOC_ROW_DATA);
+  memset(diff, 0, sizeof(*diff));
+}
+
 // This helper allows you to copy out some of the rows of a result set to make a
 // new result set. The helper uses only metadata to do its job so, as with the
 // others, codegen for this is very economical.  The result set includes in it
@@ -1615,7 +2920,7 @@ void cql_rowset_copy(
 
   size_t row_size = cql_result_set_get_meta(result_set)->rowsize;
 
-  char *new_data = calloc((size_t)count, row_size);
+  char *new_data = cql_calloc((size_t)count, row_size, CQL_ALLOC_ROW_DATA);
   char *old_data = ((char *)cql_result_set_get_data(result_set)) + row_size * (size_t)from;
 
   memcpy(new_data, old_data, ((size_t)(count) * row_size));
@@ -1628,6 +2933,52 @@ void cql_rowset_copy(
   *to_result_set = cql_result_set_create(new_data, count, *meta);
 }
 
+#ifndef CQL_HAS_RESULT_SET_SLICE
+// The runtime has no way to make a result set that shares rows so a "slice" is
+// a copy of the rows.  The result reads the same, only the sharing is lost.
+cql_result_set_ref _Nonnull cql_result_set_create_slice(
+  cql_result_set_ref _Nonnull parent,
+  void *_Nonnull data,
+  cql_int32 count)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(parent);
+  size_t row_size = meta->rowsize;
+
+  char *new_data = cql_calloc((size_t)count, row_size, CQL_ALLOC_ROW_DATA);
+  memcpy(new_data, data, (size_t)count * row_size);
+
+  char *row = new_data;
+  for (cql_int32 i = 0; i < count; i++, row += row_size) {
+    cql_retain_offsets(row, meta->refsCount, meta->refsOffset);
+  }
+
+  return cql_result_set_create(new_data, count, *meta);
+}
+#endif
+
+// This helper is the zero-copy version of cql_rowset_copy.  Instead of making
+// new storage for the rows the new result set points into the rows of the
+// original and holds a reference to it, so nothing is copied and none of the
+// references in the rows are retained.  The original rows stay alive as long as
+// any slice does.  The slice is indistinguishable from a copy for reading, but
+// note that if you use setters on one then the change is visible in the other.
+// With a runtime that has no slices (see above) this is cql_rowset_copy.
+void cql_rowset_slice(
+  cql_result_set_ref _Nonnull result_set,
+  cql_result_set_ref _Nonnull *_Nonnull to_result_set,
+  cql_int32 from,
+  cql_int32 count)
+{
+  cql_contract(from >= 0);
+  cql_contract(count >= 0);
+  cql_contract(from + count <= cql_result_set_get_count(result_set));
+
+  size_t row_size = cql_result_set_get_meta(result_set)->rowsize;
+  char *data = ((char *)cql_result_set_get_data(result_set)) + row_size * (size_t)from;
+
+  *to_result_set = cql_result_set_create_slice(result_set, data, count);
+}
+
 // This method is the workhorse of result set reading, the contract is a bit
 // unusual again to allow for economy in the generated code.  Most of the error
 // checking of result set access actually happens here in a generic fashion. The
@@ -1701,6 +3052,20 @@ char *_Nonnull cql_address_of_col(
   return ((char *)cql_result_set_get_data(result_set)) + ((size_t)row) * row_size + offset;
 }
 
+// Compact rows keep the null flags of nullable primitives in a bitmap at the
+// start of the row, this sets or clears the flag for the indicated cell.  The
+// row and column have already been validated by cql_address_of_col.
+static void cql_result_set_set_null_bit(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 row,
+  cql_int32 col,
+  cql_bool is_null)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  char *row_data = ((char *)cql_result_set_get_data(result_set)) + ((size_t)row) * meta->rowsize;
+  cql_row_set_null_bit(row_data, (cql_uint32)col, is_null);
+}
+
 // This is the helper method that reads an int32 out of a rowset at a particular
 // row and column. The same helper is used for reading the value from a nullable
 // or not nullable value, so the address helper has to report which kind of
@@ -1714,7 +3079,7 @@ cql_int32 cql_result_set_get_int32_col(
   cql_int32 data_type = CQL_DATA_TYPE_INT32;
   char *data = cql_address_of_col(result_set, row, col, &data_type);
 
-  if (data_type & CQL_DATA_TYPE_NOT_NULL) {
+  if (data_type & (CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_NULL_BIT)) {
     return *(cql_int32 *)data;
   }
   return ((cql_nullable_int32 *)data)->value;
@@ -1737,6 +3102,10 @@ void cql_result_set_set_int32_col(
   if (data_type & CQL_DATA_TYPE_NOT_NULL) {
     *(cql_int32 *)data = new_value;
   }
+  else if (data_type & CQL_DATA_TYPE_NULL_BIT) {
+    *(cql_int32 *)data = new_value;
+    cql_result_set_set_null_bit(result_set, row, col, false);
+  }
   else {
     ((cql_nullable_int32 *)data)->value = new_value;
     ((cql_nullable_int32 *)data)->is_null = false;
@@ -1756,7 +3125,7 @@ cql_int64 cql_result_set_get_int64_col(
   cql_int32 data_type = CQL_DATA_TYPE_INT64;
   char *data = cql_address_of_col(result_set, row, col, &data_type);
 
-  if (data_type & CQL_DATA_TYPE_NOT_NULL) {
+  if (data_type & (CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_NULL_BIT)) {
     return *(cql_int64 *)data;
   }
   return ((cql_nullable_int64 *)data)->value;
@@ -1779,6 +3148,10 @@ void cql_result_set_set_int64_col(
   if (data_type & CQL_DATA_TYPE_NOT_NULL) {
     *(cql_int64 *)data = new_value;
   }
+  else if (data_type & CQL_DATA_TYPE_NULL_BIT) {
+    *(cql_int64 *)data = new_value;
+    cql_result_set_set_null_bit(result_set, row, col, false);
+  }
   else {
     ((cql_nullable_int64 *)data)->value = new_value;
     ((cql_nullable_int64 *)data)->is_null = false;
@@ -1798,7 +3171,7 @@ cql_double cql_result_set_get_double_col(
   cql_int32 data_type = CQL_DATA_TYPE_DOUBLE;
   char *data = cql_address_of_col(result_set, row, col, &data_type);
 
-  if (data_type & CQL_DATA_TYPE_NOT_NULL) {
+  if (data_type & (CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_NULL_BIT)) {
     return *(cql_double *)data;
   }
   return ((cql_nullable_double *)data)->value;
@@ -1821,6 +3194,10 @@ void cql_result_set_set_double_col(
   if (data_type & CQL_DATA_TYPE_NOT_NULL) {
     *(cql_double *)data = new_value;
   }
+  else if (data_type & CQL_DATA_TYPE_NULL_BIT) {
+    *(cql_double *)data = new_value;
+    cql_result_set_set_null_bit(result_set, row, col, false);
+  }
   else {
     ((cql_nullable_double *)data)->value = new_value;
     ((cql_nullable_double *)data)->is_null = false;
@@ -1840,7 +3217,7 @@ cql_bool cql_result_set_get_bool_col(
   cql_int32 data_type = CQL_DATA_TYPE_BOOL;
   char *data = cql_address_of_col(result_set, row, col, &data_type);
 
-  if (data_type & CQL_DATA_TYPE_NOT_NULL) {
+  if (data_type & (CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_NULL_BIT)) {
     return *(cql_bool *)data;
   }
   return ((cql_nullable_bool *)data)->value;
@@ -1863,6 +3240,10 @@ void cql_result_set_set_bool_col(
   if (data_type & CQL_DATA_TYPE_NOT_NULL) {
     *(cql_bool *)data = new_value;
   }
+  else if (data_type & CQL_DATA_TYPE_NULL_BIT) {
+    *(cql_bool *)data = new_value;
+    cql_result_set_set_null_bit(result_set, row, col, false);
+  }
   else {
     ((cql_nullable_bool *)data)->value = new_value;
     ((cql_nullable_bool *)data)->is_null = false;
@@ -1946,21 +3327,201 @@ cql_blob_ref _Nullable cql_result_set_get_blob_col(
   return *(cql_blob_ref *)data;
 }
 
-// This is the helper method that write an blob into a rowset at a particular
-// row and column. The same helper is used for writing the value from a nullable
-// or not nullable value, so the address helper has to report which kind of
-// datum it is.  All the error checking is in cql_address_of_col.
-// CQLABI
-void cql_result_set_set_blob_col(
-  cql_result_set_ref _Nonnull result_set,
-  cql_int32 row,
-  cql_int32 col,
-  cql_blob_ref _Nullable new_value)
+// Measures a string or blob cell for the columnar export and copies its bytes
+// to dest if they fit in avail bytes, dest can be NULL to just measure.  The
+// result is false for a null cell.  The C string of a text cell only lives
+// inside this function, some runtimes make it in a stack buffer.
+static cql_bool cql_export_cell(
+  char *_Nonnull cell,
+  cql_int32 core_data_type,
+  char *_Nullable dest,
+  cql_int32 avail,
+  cql_int32 *_Nonnull size)
 {
-  cql_int32 data_type = CQL_DATA_TYPE_BLOB;
-  char *data = cql_address_of_col(result_set, row, col, &data_type);
-  cql_set_blob_ref((cql_blob_ref *)data, new_value);
-}
+  if (core_data_type == CQL_DATA_TYPE_BLOB) {
+    cql_blob_ref blob_ref = *(cql_blob_ref *)cell;
+    *size = blob_ref ? (cql_int32)cql_get_blob_size(blob_ref) : 0;
+    if (blob_ref && dest && *size <= avail) {
+      memcpy(dest, cql_get_blob_bytes(blob_ref), (size_t)*size);
+    }
+    return blob_ref != NULL;
+  }
+
+  cql_string_ref str_ref = *(cql_string_ref *)cell;
+  if (!str_ref) {
+    *size = 0;
+    return false;
+  }
+  cql_alloc_cstr(temp, str_ref);
+  *size = (cql_int32)strlen(temp);
+  if (dest && *size <= avail) {
+    memcpy(dest, temp, (size_t)*size);
+  }
+  cql_free_cstr(temp, str_ref);
+  return true;
+}
+
+// Checks the arguments of the export functions and computes the address of
+// the indicated column in the first row to be exported.
+static char *_Nonnull cql_export_column_start(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 col,
+  cql_int32 from,
+  cql_int32 count,
+  uint8_t *_Nonnull data_type)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  cql_contract(meta->columnOffsets != NULL);
+  cql_contract(col >= 0 && col < meta->columnCount);
+  cql_contract(from >= 0 && count >= 0);
+  cql_contract(from + count <= cql_result_set_get_count(result_set));
+
+  *data_type = meta->dataTypes[col];
+  char *data = (char *)cql_result_set_get_data(result_set);
+  return data + ((size_t)from) * meta->rowsize + meta->columnOffsets[col + 1];
+}
+
+// The number of heap bytes needed to export the indicated rows of a text or
+// blob column with cql_result_set_export_column.
+cql_int32 cql_result_set_export_heap_size(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 col,
+  cql_int32 from,
+  cql_int32 count)
+{
+  uint8_t data_type;
+  char *cell = cql_export_column_start(result_set, col, from, count, &data_type);
+  cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(data_type);
+  cql_contract(core_data_type == CQL_DATA_TYPE_STRING || core_data_type == CQL_DATA_TYPE_BLOB);
+
+  size_t row_size = cql_result_set_get_meta(result_set)->rowsize;
+  cql_int32 total = 0;
+  for (cql_int32 i = 0; i < count; i++, cell += row_size) {
+    cql_int32 size;
+    cql_export_cell(cell, core_data_type, NULL, 0, &size);
+    total += size;
+  }
+  return total;
+}
+
+// Copies one column of the rows [from, from + count) into flat buffers so that
+// a language binding can read a whole column with one call rather than one
+// call per cell.  The values array depends on the column type:
+//
+//  * bool: cql_bool[count]
+//  * integer: cql_int32[count]
+//  * long: cql_int64[count]
+//  * real: cql_double[count]
+//  * text and blob: cql_int32[count + 1] offsets into the heap, row i is the
+//    bytes from values[i] to values[i+1], text is UTF-8 with no terminator
+//
+// If nulls is not NULL it gets a bitmap of (count + 7) / 8 bytes with the bit
+// for each null cell set.  Null cells have zero values and zero length.  The
+// return value is the number of rows exported, fewer than count only if the
+// heap is too small for the text or blob values, see
+// cql_result_set_export_heap_size.  Object columns can't be exported this way.
+cql_int32 cql_result_set_export_column(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 col,
+  cql_int32 from,
+  cql_int32 count,
+  void *_Nonnull values,
+  uint8_t *_Nullable nulls,
+  char *_Nullable heap,
+  cql_int32 heap_size)
+{
+  uint8_t data_type;
+  char *cell = cql_export_column_start(result_set, col, from, count, &data_type);
+  cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(data_type);
+  cql_contract(core_data_type != CQL_DATA_TYPE_OBJECT);
+
+  size_t row_size = cql_result_set_get_meta(result_set)->rowsize;
+  char *row = cell - cql_result_set_get_meta(result_set)->columnOffsets[col + 1];
+
+  if (nulls) {
+    memset(nulls, 0, (size_t)(count + 7) / 8);
+  }
+
+  if (core_data_type == CQL_DATA_TYPE_STRING || core_data_type == CQL_DATA_TYPE_BLOB) {
+    cql_int32 *offsets = (cql_int32 *)values;
+    cql_int32 used = 0;
+    offsets[0] = 0;
+    for (cql_int32 i = 0; i < count; i++, cell += row_size) {
+      cql_int32 size;
+      char *dest = heap ? heap + used : NULL;
+      cql_bool present = cql_export_cell(cell, core_data_type, dest, heap_size - used, &size);
+      if (used + size > heap_size) {
+        return i;
+      }
+      if (!present && nulls) {
+        nulls[i >> 3] |= (uint8_t)(1 << (i & 7));
+      }
+      used += size;
+      offsets[i + 1] = used;
+    }
+    return count;
+  }
+
+  // the bare value is at the cell for not null columns and for compact rows,
+  // otherwise the cell is a nullable struct
+  cql_bool in_struct = !(data_type & (CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_NULL_BIT));
+
+  for (cql_int32 i = 0; i < count; i++, cell += row_size, row += row_size) {
+    cql_bool is_null = false;
+    if (data_type & CQL_DATA_TYPE_NULL_BIT) {
+      is_null = cql_row_null_bit(row, (cql_uint32)col);
+    }
+    else if (in_struct) {
+      // is_null is the first field of all of the nullable structs
+      is_null = ((cql_nullable_bool *)cell)->is_null;
+    }
+
+    if (is_null && nulls) {
+      nulls[i >> 3] |= (uint8_t)(1 << (i & 7));
+    }
+
+    switch (core_data_type) {
+      case CQL_DATA_TYPE_BOOL: {
+        cql_bool *src = in_struct ? &((cql_nullable_bool *)cell)->value : (cql_bool *)cell;
+        ((cql_bool *)values)[i] = is_null ? 0 : !!*src;
+        break;
+      }
+      case CQL_DATA_TYPE_INT32: {
+        cql_int32 *src = in_struct ? &((cql_nullable_int32 *)cell)->value : (cql_int32 *)cell;
+        ((cql_int32 *)values)[i] = is_null ? 0 : *src;
+        break;
+      }
+      case CQL_DATA_TYPE_INT64: {
+        cql_int64 *src = in_struct ? &((cql_nullable_int64 *)cell)->value : (cql_int64 *)cell;
+        ((cql_int64 *)values)[i] = is_null ? 0 : *src;
+        break;
+      }
+      case CQL_DATA_TYPE_DOUBLE: {
+        cql_double *src = in_struct ? &((cql_nullable_double *)cell)->value : (cql_double *)cell;
+        ((cql_double *)values)[i] = is_null ? 0 : *src;
+        break;
+      }
+    }
+  }
+
+  return count;
+}
+
+// This is the helper method that write an blob into a rowset at a particular
+// row and column. The same helper is used for writing the value from a nullable
+// or not nullable value, so the address helper has to report which kind of
+// datum it is.  All the error checking is in cql_address_of_col.
+// CQLABI
+void cql_result_set_set_blob_col(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 row,
+  cql_int32 col,
+  cql_blob_ref _Nullable new_value)
+{
+  cql_int32 data_type = CQL_DATA_TYPE_BLOB;
+  char *data = cql_address_of_col(result_set, row, col, &data_type);
+  cql_set_blob_ref((cql_blob_ref *)data, new_value);
+}
 
 // This is the helper method that determines if a nullable column column is null
 // or not. If the data type of the column is string or blob then we look for a
@@ -1995,7 +3556,8 @@ cql_bool cql_result_set_get_is_null_col(
 
   cql_uint16 offset = meta->columnOffsets[col + 1];
   size_t row_size = meta->rowsize;
-  char *data =((char *)cql_result_set_get_data(result_set)) + row * row_size + offset;
+  char *row_data = ((char *)cql_result_set_get_data(result_set)) + row * row_size;
+  char *data = row_data + offset;
 
   cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(data_type);
 
@@ -2009,6 +3571,10 @@ cql_bool cql_result_set_get_is_null_col(
      return false;
   }
 
+  if (data_type & CQL_DATA_TYPE_NULL_BIT) {
+     return cql_row_null_bit(row_data, col);
+  }
+
   cql_bool is_null = 1;
 
   switch (core_data_type) {
@@ -2062,7 +3628,8 @@ void cql_result_set_set_to_null_col(
 
   cql_uint16 offset = meta->columnOffsets[col + 1];
   size_t row_size = meta->rowsize;
-  char *data =((char *)cql_result_set_get_data(result_set)) + row * row_size + offset;
+  char *row_data = ((char *)cql_result_set_get_data(result_set)) + row * row_size;
+  char *data = row_data + offset;
 
   cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(data_type);
 
@@ -2077,6 +3644,14 @@ void cql_result_set_set_to_null_col(
   cql_contract(core_data_type != CQL_DATA_TYPE_STRING);
   cql_contract(core_data_type != CQL_DATA_TYPE_OBJECT);
 
+  if (data_type & CQL_DATA_TYPE_NULL_BIT) {
+    // compact row: the value must be zero when null so that hashing and
+    // equality of the row bytes still work
+    memset(data, 0, normal_datasizes[core_data_type]);
+    cql_row_set_null_bit(row_data, col, true);
+    return;
+  }
+
   switch (core_data_type) {
     case CQL_DATA_TYPE_BOOL:
       cql_set_null(*(cql_nullable_bool *)data);
@@ -2178,6 +3753,193 @@ void cql_initialize_meta(
   meta->copy = cql_rowset_copy;
 }
 
+// The row counts learned by cql_fetch_all_results.  The table is open
+// addressed on the crc of the proc with linear probing, the order array
+// remembers the slots in insertion order so the hints can be listed.  Once the
+// table is full new sites simply aren't learned.  The hints are only ever
+// used to size a buffer, so a stale or wrong hint costs a realloc and nothing
+// more.  Like the trace ring the table is per thread, so fetches on different
+// threads never race on claiming a slot and no locks are needed.
+#define CQL_FETCH_HINT_SLOTS 256
+#define CQL_FETCH_HINT_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct cql_fetch_hint {
+  int64_t crc;
+  cql_uint32 rows;
+  cql_bool used;
+} cql_fetch_hint;
+
+static CQL_THREAD_LOCAL cql_fetch_hint cql_fetch_hints[CQL_FETCH_HINT_SLOTS];
+static CQL_THREAD_LOCAL uint16_t cql_fetch_hint_order[CQL_FETCH_HINT_SLOTS];
+static CQL_THREAD_LOCAL cql_int32 cql_fetch_hint_count;
+
+// Find the slot for the given crc, optionally claiming a free one.
+static cql_fetch_hint *_Nullable cql_fetch_hint_find(int64_t crc, cql_bool add) {
+  uint32_t index = (uint32_t)((uint64_t)crc ^ ((uint64_t)crc >> 32)) % CQL_FETCH_HINT_SLOTS;
+
+  for (uint32_t i = 0; i < CQL_FETCH_HINT_SLOTS; i++) {
+    cql_fetch_hint *hint = &cql_fetch_hints[index];
+    if (hint->used && hint->crc == crc) {
+      return hint;
+    }
+    if (!hint->used) {
+      if (!add) {
+        return NULL;
+      }
+      hint->used = true;
+      hint->crc = crc;
+      hint->rows = 0;
+      cql_fetch_hint_order[cql_fetch_hint_count++] = (uint16_t)index;
+      return hint;
+    }
+    index = (index + 1) % CQL_FETCH_HINT_SLOTS;
+  }
+
+  return NULL;
+}
+
+// Fold the row count of a completed fetch into the smoothed count for its
+// site.  This is an exponential moving average that gives the new count a
+// weight of 1/4 so that one unusual fetch doesn't swing the size too much.
+static void cql_fetch_hint_update(int64_t crc, cql_uint32 count) {
+  cql_fetch_hint *hint = cql_fetch_hint_find(crc, true);
+  if (!hint) {
+    return;
+  }
+
+  if (hint->rows == 0) {
+    hint->rows = count;
+  }
+  else {
+    hint->rows = (cql_uint32)((3 * (uint64_t)hint->rows + count + 3) / 4);
+  }
+}
+
+// Returns the smoothed row count for the fetch site, 0 if there isn't one.
+cql_int32 cql_fetch_row_hint(int64_t crc) {
+  cql_fetch_hint *hint = cql_fetch_hint_find(crc, false);
+  return hint ? (cql_int32)hint->rows : 0;
+}
+
+// The number of fetch sites that have a hint.
+cql_int32 cql_fetch_row_hints_count(void) {
+  return cql_fetch_hint_count;
+}
+
+// Returns the crc and smoothed row count of the hint at the given index, hints
+// are listed in the order the fetch sites were first seen.
+void cql_fetch_row_hint_at(
+  cql_int32 index,
+  int64_t *_Nonnull crc,
+  cql_int32 *_Nonnull rows)
+{
+  cql_contract(index >= 0 && index < cql_fetch_hint_count);
+  cql_fetch_hint *hint = &cql_fetch_hints[cql_fetch_hint_order[index]];
+  *crc = hint->crc;
+  *rows = (cql_int32)hint->rows;
+}
+
+// Forget everything that has been learned.
+void cql_fetch_row_hints_reset(void) {
+  memset(cql_fetch_hints, 0, sizeof(cql_fetch_hints));
+  cql_fetch_hint_count = 0;
+}
+
+// The coder applied to the encoded columns of new result sets, if any.
+static cql_column_coder _Nullable cql_column_encoder;
+static void *_Nullable cql_column_encoder_context;
+
+void cql_set_column_encoder(
+  cql_column_coder _Nullable coder,
+  void *_Nullable context)
+{
+  cql_column_encoder = coder;
+  cql_column_encoder_context = context;
+}
+
+// Hands each of the indicated columns to the coder in turn, the coder gets all
+// the rows of that column in one call.
+static void cql_code_columns(
+  char *_Nonnull rows,
+  cql_int32 count,
+  cql_uint32 rowsize,
+  const uint16_t *_Nonnull col_offsets,
+  const uint8_t *_Nonnull data_types,
+  const uint16_t *_Nonnull columns,
+  cql_int32 context_column,
+  cql_column_coder _Nonnull coder,
+  void *_Nullable context)
+{
+  if (count <= 0) {
+    return;
+  }
+
+  cql_column_batch batch = {
+    .rows = rows,
+    .rowsize = rowsize,
+    .count = count,
+    .context_column = context_column,
+  };
+
+  if (context_column >= 0) {
+    batch.context_offset = col_offsets[context_column + 1];
+    batch.context_type = data_types[context_column];
+  }
+
+  for (uint16_t i = 0; i < columns[0]; i++) {
+    uint16_t col = columns[i + 1];
+    batch.column = col;
+    batch.offset = col_offsets[col + 1];
+    batch.data_type = data_types[col];
+    coder(context, &batch);
+  }
+}
+
+// Encode the sensitive columns of freshly fetched rows if an encoder has been
+// registered, with no encoder this costs one test.
+static void cql_encode_rows(
+  cql_fetch_info *_Nonnull info,
+  char *_Nullable rows,
+  cql_int32 count)
+{
+  if (!cql_column_encoder || !info->encoded_columns || !rows) {
+    return;
+  }
+
+  cql_code_columns(
+    rows,
+    count,
+    info->rowsize,
+    info->col_offsets,
+    info->data_types,
+    info->encoded_columns,
+    info->encode_context_index,
+    cql_column_encoder,
+    cql_column_encoder_context);
+}
+
+void cql_result_set_code_columns(
+  cql_result_set_ref _Nonnull result_set,
+  const uint16_t *_Nonnull columns,
+  cql_int32 context_column,
+  cql_column_coder _Nonnull coder,
+  void *_Nullable context)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  cql_contract(context_column < meta->columnCount);
+
+  cql_code_columns(
+    (char *)cql_result_set_get_data(result_set),
+    cql_result_set_get_count(result_set),
+    (cql_uint32)meta->rowsize,
+    meta->columnOffsets,
+    meta->dataTypes,
+    columns,
+    context_column,
+    coder,
+    context);
+}
+
 // By the time we get here, a CQL stored proc has completed execution and there
 // is now a statement (or an error result).  This function iterates the rows
 // that come out of the statement using the fetch info to describe the shape of
@@ -2191,34 +3953,87 @@ cql_code cql_fetch_all_results(
   *result_set = NULL;
   cql_int32 count = 0;
   cql_bytebuf b;
-  cql_bytebuf_open(&b);
   sqlite3_stmt *stmt = info->stmt;
   cql_uint32 rowsize = info->rowsize;
   char *row;
   cql_code rc = info->rc;
 
+  // Size the buffer for the rows this site usually returns plus a little
+  // slack, so that typical fetches never have to grow it.  The buffer comes
+  // from calloc which gives us the zeroed rows in bulk (large blocks are
+  // usually fresh pages that are zero already).  Everything past `zeroed` is
+  // not yet zeroed which only happens after the buffer has grown.
+  uint64_t hint_rows = cql_fetch_row_hint(info->crc);
+  uint64_t initial = (hint_rows + hint_rows / 8) * rowsize;
+  if (initial > CQL_FETCH_HINT_MAX_BYTES) {
+    initial = CQL_FETCH_HINT_MAX_BYTES;
+  }
+  if (initial < BYTEBUF_GROWTH_SIZE) {
+    initial = BYTEBUF_GROWTH_SIZE;
+  }
+  b.max = (cql_uint32)initial;
+  b.ptr = cql_calloc(1, b.max, CQL_ALLOC_ROW_DATA);
+  b.used = 0;
+  cql_uint32 zeroed = b.max;
+
   if (rc != SQLITE_OK) goto cql_error;
 
+  cql_bool timing = cql_statement_timing();
+  int64_t start_ns = timing ? cql_trace_now_ns() : 0;
+
   for (;;) {
     rc = sqlite3_step(stmt);
     if (rc == SQLITE_DONE) break;
-    if (rc != SQLITE_ROW) goto cql_error;
+    if (rc != SQLITE_ROW) {
+      if (timing) {
+        cql_step_loop_done(stmt, start_ns, count, rc);
+      }
+      goto cql_error;
+    }
     count++;
     row = cql_bytebuf_alloc(&b, rowsize);
-    memset(row, 0, rowsize);
+    if (b.used > zeroed) {
+      // the buffer grew, zero all of the new space at once
+      memset(row, 0, b.max - (b.used - rowsize));
+      zeroed = b.max;
+    }
 
     cql_multifetch_meta((char *)row, info);
   }
 
+  if (timing) {
+    cql_step_loop_done(stmt, start_ns, count, rc);
+  }
+
+  cql_fetch_hint_update(info->crc, (cql_uint32)count);
+
+  // Give back the unused space if there is a lot of it, this is the case when
+  // a site returns far fewer rows than usual or the buffer just doubled.  An
+  // empty result goes back to the minimum size, a large hint could otherwise
+  // leave the whole preallocated buffer attached to an empty result set.
+  if (b.used == 0) {
+    if (b.max > BYTEBUF_GROWTH_SIZE) {
+      b.ptr = cql_realloc(b.ptr, BYTEBUF_GROWTH_SIZE, CQL_ALLOC_ROW_DATA);
+      b.max = BYTEBUF_GROWTH_SIZE;
+    }
+  }
+  else if (b.max - b.used > b.used / 8) {
+    b.ptr = cql_realloc(b.ptr, b.used, CQL_ALLOC_ROW_DATA);
+    b.max = b.used;
+  }
+
   // If all is well, we close the statement and we're done with OK result. If
   // anything went wrong we free all the memory and we're outta here.
 
   cql_finalize_stmt(&stmt);
+  cql_encode_rows(info, b.ptr, count);
+
   cql_result_set_meta meta;
   cql_initialize_meta(&meta, info);
 
   *result_set = cql_result_set_create(b.ptr, count, meta);
   cql_autodrop_tables(info->db, info->autodrop_tables);
+  cql_profile_rows(info->crc, info->perf_index, count, b.used);
   cql_profile_stop(info->crc, info->perf_index);
   return SQLITE_OK;
 
@@ -2253,9 +4068,12 @@ void cql_results_from_data(
   cql_int32 count = (cql_int32)(buffer->used / rowsize);
 
   if (rc == SQLITE_OK) {
+    cql_encode_rows(info, buffer->ptr, count);
+
     cql_result_set_meta meta;
     cql_initialize_meta(&meta, info);
     *result_set = cql_result_set_create(buffer->ptr, count, meta);
+    cql_profile_rows(info->crc, info->perf_index, count, count * rowsize);
   }
   else {
     if (info->refs_count) {
@@ -2285,16 +4103,19 @@ cql_code cql_one_row_result(
   *result_set = NULL;
   if (rc != SQLITE_OK) goto cql_error;
 
+  cql_encode_rows(info, data, count);
+
   cql_result_set_meta meta;
   cql_initialize_meta(&meta, info);
   *result_set = cql_result_set_create(data, count, meta);
   cql_autodrop_tables(info->db, info->autodrop_tables);
+  cql_profile_rows(info->crc, info->perf_index, count, count * info->rowsize);
   cql_profile_stop(info->crc, info->perf_index);
   return SQLITE_OK;
 
 cql_error:
   cql_release_offsets(data, info->refs_count, info->refs_offset);
-  free(data);
+  cql_free(data, CQL_ALLOC_ROW_DATA);
   cql_log_database_error(info->db, "cql", "database error");
   cql_autodrop_tables(info->db, info->autodrop_tables);
   cql_profile_stop(info->crc, info->perf_index);
@@ -2332,7 +4153,7 @@ cql_fetch_info cql_no_rows_row_info = {
 cql_result_set_ref _Nonnull cql_no_rows_result_set(void) {
   cql_result_set_meta meta;
   cql_initialize_meta(&meta, &cql_no_rows_row_info);
-  return cql_result_set_create(malloc(1), 0, meta);
+  return cql_result_set_create(cql_malloc(1, CQL_ALLOC_ROW_DATA), 0, meta);
 }
 
 // This statement for sure has no rows in it
@@ -2347,7 +4168,7 @@ cql_code cql_no_rows_stmt(sqlite3 *_Nonnull db, sqlite3_stmt *_Nullable *_Nonnul
 
 // helper to set the payload array, used at init time and during rehash
 static void cql_hashtab_set_payload(cql_hashtab *_Nonnull ht) {
-  ht->payload = (cql_hashtab_entry *)calloc(ht->capacity, sizeof(cql_hashtab_entry));
+  ht->payload = (cql_hashtab_entry *)cql_calloc(ht->capacity, sizeof(cql_hashtab_entry), CQL_ALLOC_ROW_DATA);
 }
 
 
@@ -2375,7 +4196,7 @@ static void cql_hashtab_rehash(cql_hashtab *_Nonnull ht) {
     }
   }
 
-  free(old_payload);
+  cql_free(old_payload, CQL_ALLOC_ROW_DATA);
 }
 
 // Making a new hash table, initial size
@@ -2388,7 +4209,7 @@ static cql_hashtab *_Nonnull cql_hashtab_new(
   void (*_Nonnull release_val)(void *_Nullable context, cql_int64 val),
   void *_Nullable context)
 {
-  cql_hashtab *ht = malloc(sizeof(cql_hashtab));
+  cql_hashtab *ht = cql_malloc(sizeof(cql_hashtab), CQL_ALLOC_OBJECT);
   ht->hash_key = hash_key;
   ht->compare_keys = compare_keys;
   ht->retain_key = retain_key;
@@ -2416,8 +4237,8 @@ static void cql_hashtab_delete(cql_hashtab *_Nonnull ht) {
     }
   }
 
-  free(ht->payload);
-  free(ht);
+  cql_free(ht->payload, CQL_ALLOC_ROW_DATA);
+  cql_free(ht, CQL_ALLOC_OBJECT);
 }
 
 // Add a new key to the hash table
@@ -2687,56 +4508,72 @@ static cql_int64 cql_zigzag_decode_64 (uint64_t i) {
 }
 
 // variable length encoding using zigzag and 7 bits with extension note that
-// this also takes care of any endian issues
+// this also takes care of any endian issues.  The bytes are read straight out
+// of the input, small values are the common case so one byte values take the
+// shortest path.
 static bool cql_read_varint_32(
   cql_input_buf *_Nonnull buf,
   cql_int32 *_Nonnull out)
 {
+  const unsigned char *data = buf->data;
+  uint32_t remaining = buf->remaining;
+
+  if (remaining && !(data[0] & 0x80)) {
+    *out = cql_zigzag_decode_32(data[0]);
+    buf->data++;
+    buf->remaining--;
+    return true;
+  }
+
+  // 5 bytes is the most we need for a 32 bit varint
+  uint32_t limit = remaining < 5 ? remaining : 5;
   uint32_t result = 0;
-  uint8_t byte;
-  uint8_t i = 0;
-  uint8_t offset = 0;
-  while (i < 5) {
-    if (!cql_input_read(buf, &byte, 1)) {
-      return false;
-    }
-    result |= ((uint32_t)(byte & 0x7f)) << offset;
+  for (uint32_t i = 0; i < limit; i++) {
+    uint8_t byte = data[i];
+    result |= ((uint32_t)(byte & 0x7f)) << (7 * i);
     if (!(byte & 0x80)) {
       *out = cql_zigzag_decode_32(result);
+      buf->data += i + 1;
+      buf->remaining -= i + 1;
       return true;
     }
-    offset += 7;
-    i++;
   }
 
-  // badly formed buffer, 5 bytes is the most we need for a 32 bit varint
+  // badly formed or truncated buffer
   return false;
 }
 
 // variable length encoding using zigzag and 7 bits with extension note that
-// this also takes care of any endian issues
+// this also takes care of any endian issues.  Same strategy as above.
 static bool cql_read_varint_64(
   cql_input_buf *_Nonnull buf,
   cql_int64 *_Nonnull out)
 {
+  const unsigned char *data = buf->data;
+  uint32_t remaining = buf->remaining;
+
+  if (remaining && !(data[0] & 0x80)) {
+    *out = cql_zigzag_decode_64(data[0]);
+    buf->data++;
+    buf->remaining--;
+    return true;
+  }
+
+  // 10 bytes is the most we need for a 64 bit varint
+  uint32_t limit = remaining < 10 ? remaining : 10;
   uint64_t result = 0;
-  uint8_t byte;
-  uint8_t i = 0;
-  uint8_t offset = 0;
-  while (i < 10) {
-    if (!cql_input_read(buf, &byte, 1)) {
-      return false;
-    }
-    result |= ((uint64_t)(byte & 0x7f)) << offset;
+  for (uint32_t i = 0; i < limit; i++) {
+    uint8_t byte = data[i];
+    result |= ((uint64_t)(byte & 0x7f)) << (7 * i);
     if (!(byte & 0x80)) {
       *out = cql_zigzag_decode_64(result);
+      buf->data += i + 1;
+      buf->remaining -= i + 1;
       return true;
     }
-    offset += 7;
-    i++;
   }
 
-  // badly formed buffer, 10 bytes is the most we need for a 64 bit varint
+  // badly formed or truncated buffer
   return false;
 }
 
@@ -2768,18 +4605,57 @@ static void cql_write_varint_64(cql_bytebuf *_Nonnull buf, int64_t si) {
   } while (i);
 }
 
+// A serialized cursor that starts with this byte stores its integers (and
+// blob sizes) as fixed width little endian values rather than varints.  It is
+// never a valid type code so older readers reject such a blob cleanly, newer
+// readers accept both forms.
+#define CQL_CURSOR_BLOB_FIXED_WIDTH '#'
+
+static void cql_write_int32(cql_bytebuf *_Nonnull buf, cql_int32 value, cql_bool fixed) {
+  if (fixed) {
+    cql_append_value(buf, value);
+  }
+  else {
+    cql_write_varint_32(buf, value);
+  }
+}
+
+static void cql_write_int64(cql_bytebuf *_Nonnull buf, cql_int64 value, cql_bool fixed) {
+  if (fixed) {
+    cql_append_value(buf, value);
+  }
+  else {
+    cql_write_varint_64(buf, value);
+  }
+}
+
+static bool cql_read_int32(cql_input_buf *_Nonnull buf, cql_int32 *_Nonnull out, cql_bool fixed) {
+  return fixed ? cql_input_read(buf, out, sizeof(*out)) : cql_read_varint_32(buf, out);
+}
+
+static bool cql_read_int64(cql_input_buf *_Nonnull buf, cql_int64 *_Nonnull out, cql_bool fixed) {
+  return fixed ? cql_input_read(buf, out, sizeof(*out)) : cql_read_varint_64(buf, out);
+}
+
 // This standard helper walks any cursor and creates a versionable encoding of
 // it in a blob.  The dynamic cursor structure has all the necessary metadata
 // about the cursor.  By the time this is called many checks have been made
 // about the suitability of this cursor for serialization (e.g. no OBJECT
 // fields). As a consequence we get a nice simple strategy that is flexible.
-void cql_cursor_to_bytebuf(
+// Integers are varints unless the fixed width form is requested.
+static void cql_cursor_write_bytebuf(
   cql_dynamic_cursor *_Nonnull dyn_cursor,
-  cql_bytebuf *_Nonnull b)
+  cql_bytebuf *_Nonnull b,
+  cql_bool fixed)
 {
   cql_invariant(b);
   cql_invariant(*dyn_cursor->cursor_has_row);
 
+  if (fixed) {
+    char mark = CQL_CURSOR_BLOB_FIXED_WIDTH;
+    cql_append_value(b, mark);
+  }
+
   uint16_t *offsets = dyn_cursor->cursor_col_offsets;
   uint8_t *types = dyn_cursor->cursor_data_types;
   uint16_t count = offsets[0];  // the first index is the count of fields
@@ -2836,12 +4712,12 @@ void cql_cursor_to_bytebuf(
       switch (core_data_type) {
         case CQL_DATA_TYPE_INT32: {
           cql_int32 int32_data = *(cql_int32 *)(cursor + offset);
-          cql_write_varint_32(b, int32_data);
+          cql_write_int32(b, int32_data, fixed);
           break;
         }
         case CQL_DATA_TYPE_INT64: {
           cql_int64 int64_data = *(cql_int64 *)(cursor + offset);
-          cql_write_varint_64(b, int64_data);
+          cql_write_int64(b, int64_data, fixed);
           break;
         }
         case CQL_DATA_TYPE_DOUBLE: {
@@ -2871,7 +4747,7 @@ void cql_cursor_to_bytebuf(
           cql_blob_ref blob_ref = *(cql_blob_ref *)(cursor + offset);
           const void *bytes = cql_get_blob_bytes(blob_ref);
           cql_int32 size = cql_get_blob_size(blob_ref);
-          cql_write_varint_32(b, size);
+          cql_write_int32(b, size, fixed);
           cql_bytebuf_append(b, bytes, (cql_uint32)size);
           break;
         }
@@ -2883,7 +4759,7 @@ void cql_cursor_to_bytebuf(
           cql_nullable_int32 int32_data = *(cql_nullable_int32 *)(cursor + offset);
           if (!int32_data.is_null) {
             cql_setbit(bits, nullable_index);
-            cql_write_varint_32(b, int32_data.value);
+            cql_write_int32(b, int32_data.value, fixed);
           }
           break;
         }
@@ -2891,7 +4767,7 @@ void cql_cursor_to_bytebuf(
           cql_nullable_int64 int64_data = *(cql_nullable_int64 *)(cursor + offset);
           if (!int64_data.is_null) {
             cql_setbit(bits, nullable_index);
-            cql_write_varint_64(b, int64_data.value);
+            cql_write_int64(b, int64_data.value, fixed);
           }
           break;
         }
@@ -2930,7 +4806,7 @@ void cql_cursor_to_bytebuf(
             cql_setbit(bits, nullable_index);
             const void *bytes = cql_get_blob_bytes(blob_ref);
             cql_int32 size = cql_get_blob_size(blob_ref);
-            cql_write_varint_32(b, size);
+            cql_write_int32(b, size, fixed);
             cql_bytebuf_append(b, bytes, (cql_uint32)size);
           }
           break;
@@ -2942,16 +4818,19 @@ void cql_cursor_to_bytebuf(
   cql_invariant(nullable_index == nullable_count);
 }
 
-// This standard helper walks any cursor and creates a versionable encoding of
-// it in a blob.  The dynamic cursor structure has all the necessary metadata
-// about the cursor.  By the time this is called many checks have been made
-// about the suitability of this cursor for serialization (e.g. no OBJECT
-// fields). As a consequence we get a nice simple strategy that is flexible.
-// CQLABI
-cql_code cql_cursor_to_blob(
-  sqlite3 *_Nonnull db,
+// The standard (varint) encoding of a cursor.
+void cql_cursor_to_bytebuf(
   cql_dynamic_cursor *_Nonnull dyn_cursor,
-  cql_blob_ref _Nullable *_Nonnull blob)
+  cql_bytebuf *_Nonnull b)
+{
+  cql_cursor_write_bytebuf(dyn_cursor, b, false);
+}
+
+// Shared helper for the blob forms of the cursor encoding.
+static cql_code cql_cursor_to_blob_helper(
+  cql_dynamic_cursor *_Nonnull dyn_cursor,
+  cql_blob_ref _Nullable *_Nonnull blob,
+  cql_bool fixed)
 {
   if (!*dyn_cursor->cursor_has_row) {
     return SQLITE_ERROR;
@@ -2960,7 +4839,7 @@ cql_code cql_cursor_to_blob(
   cql_bytebuf b;
   cql_bytebuf_open(&b);
 
-  cql_cursor_to_bytebuf(dyn_cursor, &b);
+  cql_cursor_write_bytebuf(dyn_cursor, &b, fixed);
 
   cql_blob_ref new_blob = cql_blob_ref_new((const uint8_t *)b.ptr, (cql_uint32)b.used);
   cql_blob_release(*blob);
@@ -2970,6 +4849,31 @@ cql_code cql_cursor_to_blob(
   return SQLITE_OK;
 }
 
+// This standard helper walks any cursor and creates a versionable encoding of
+// it in a blob.  The dynamic cursor structure has all the necessary metadata
+// about the cursor.  By the time this is called many checks have been made
+// about the suitability of this cursor for serialization (e.g. no OBJECT
+// fields). As a consequence we get a nice simple strategy that is flexible.
+// CQLABI
+cql_code cql_cursor_to_blob(
+  sqlite3 *_Nonnull db,
+  cql_dynamic_cursor *_Nonnull dyn_cursor,
+  cql_blob_ref _Nullable *_Nonnull blob)
+{
+  return cql_cursor_to_blob_helper(dyn_cursor, blob, false);
+}
+
+// As above but integers are stored at fixed width, this is larger but faster
+// to decode. Any reader of cursor blobs accepts either form.
+// CQLABI
+cql_code cql_cursor_to_fixed_blob(
+  sqlite3 *_Nonnull db,
+  cql_dynamic_cursor *_Nonnull dyn_cursor,
+  cql_blob_ref _Nullable *_Nonnull blob)
+{
+  return cql_cursor_to_blob_helper(dyn_cursor, blob, true);
+}
+
 // create a single blob for the whole stream of appended blobs
 // with offsets for easy array style access.
 cql_blob_ref _Nonnull cql_make_blob_stream(cql_object_ref _Nonnull blob_list)
@@ -3080,11 +4984,13 @@ static void cql_clear_references_before_deserialization(
 // This is the inverse of cql_cursor_to_bytebuf, it takes a byte stream and
 // reconstructs a dynamic cursor from it.  The byte stream is assumed to be
 // hostile. It could be corrupted in any kind of way and this code is expected
-// to handle that.
-cql_code cql_cursor_from_bytes(
+// to handle that.  If there is an owner then the bytes are inside it and the
+// string and blob fields become views of the owner rather than copies.
+static cql_code cql_cursor_read_bytes(
   cql_dynamic_cursor *_Nonnull dyn_cursor,
   const uint8_t *_Nonnull bytes,
-  uint32_t size)
+  uint32_t size,
+  cql_blob_ref _Nullable owner)
 {
   cql_invariant(bytes);
 
@@ -3103,6 +5009,14 @@ cql_code cql_cursor_from_bytes(
   input.data = bytes;
   input.remaining = size;
 
+  // the fixed width form is marked, the type codes follow the mark
+  cql_bool fixed = size > 0 && bytes[0] == CQL_CURSOR_BLOB_FIXED_WIDTH;
+  if (fixed) {
+    input.data++;
+    input.remaining--;
+  }
+  const uint8_t *codes = input.data;
+
   uint16_t needed_count = offsets[0];  // the first index is the count of fields
 
   uint16_t nullable_count = 0;
@@ -3197,7 +5111,7 @@ cql_code cql_cursor_from_bytes(
       fetch_data = false;
     }
     else {
-      bool actual_notnull = bytes[i] >= 'A' && bytes[i] <= 'Z';
+      bool actual_notnull = codes[i] >= 'A' && codes[i] <= 'Z';
 
       if (actual_notnull) {
         // marked not null in the metadata means it is always present
@@ -3221,7 +5135,7 @@ cql_code cql_cursor_from_bytes(
             nullable_storage->is_null = false;
             result = &nullable_storage->value;
           }
-          if (!cql_read_varint_32(&input, result)) {
+          if (!cql_read_int32(&input, result, fixed)) {
             goto error;
           }
 
@@ -3237,7 +5151,7 @@ cql_code cql_cursor_from_bytes(
             nullable_storage->is_null = false;
             result = &nullable_storage->value;
           }
-          if (!cql_read_varint_64(&input, result)) {
+          if (!cql_read_int64(&input, result, fixed)) {
             goto error;
           }
           break;
@@ -3278,165 +5192,763 @@ cql_code cql_cursor_from_bytes(
           if (!cql_input_inline_str(&input, &result)) {
             goto error;
           }
-          *str_ref = cql_string_ref_new(result);
+          *str_ref = owner ? cql_string_ref_new_view(owner, result) : cql_string_ref_new(result);
           break;
         }
         case CQL_DATA_TYPE_BLOB: {
           cql_blob_ref *blob_ref = (cql_blob_ref *)(cursor + offset);
           cql_int32 byte_count;
-          if (!cql_read_varint_32(&input, &byte_count)) {
+          if (!cql_read_int32(&input, &byte_count, fixed) || byte_count < 0) {
             goto error;
           }
           const uint8_t *result;
           if (!cql_input_inline_bytes(&input, &result, (cql_uint32)byte_count)) {
             goto error;
           }
-          *blob_ref = cql_blob_ref_new(result, (cql_uint32)byte_count);
-          break;
+          *blob_ref = owner
+            ? cql_blob_ref_new_view(owner, result, (cql_uint32)byte_count)
+            : cql_blob_ref_new(result, (cql_uint32)byte_count);
+          break;
+        }
+      }
+    }
+    else {
+      switch (core_data_type) {
+        case CQL_DATA_TYPE_INT32: {
+          cql_nullable_int32 *int32_data = (cql_nullable_int32 *)(cursor + offset);
+          int32_data->value = 0;
+          int32_data->is_null = true;
+          break;
+        }
+        case CQL_DATA_TYPE_INT64: {
+          cql_nullable_int64 *int64_data = (cql_nullable_int64 *)(cursor + offset);
+          int64_data->value = 0;
+          int64_data->is_null = true;
+          break;
+        }
+        case CQL_DATA_TYPE_DOUBLE: {
+          cql_nullable_double *double_data = (cql_nullable_double *)(cursor + offset);
+          double_data->value = 0;
+          double_data->is_null = true;
+          break;
+        }
+        case CQL_DATA_TYPE_BOOL: {
+          cql_nullable_bool *bool_data = (cql_nullable_bool *)(cursor + offset);
+          bool_data->value = 0;
+          bool_data->is_null = true;
+          bool_index++;
+          break;
+        }
+        case CQL_DATA_TYPE_STRING: {
+          cql_string_ref *str_ref = (cql_string_ref *)(cursor + offset);
+          *str_ref = NULL;
+          break;
+        }
+        case CQL_DATA_TYPE_BLOB: {
+          cql_blob_ref *blob_ref = (cql_blob_ref *)(cursor + offset);
+          *blob_ref = NULL;
+          break;
+        }
+      }
+    }
+  }
+
+  *has_row = true;
+  return SQLITE_OK;
+
+error:
+  *has_row = false;
+  cql_clear_references_before_deserialization(dyn_cursor);
+  return SQLITE_ERROR;
+}
+
+// Deserialize a cursor from bytes, strings and blobs are copied out.
+cql_code cql_cursor_from_bytes(
+  cql_dynamic_cursor *_Nonnull dyn_cursor,
+  const uint8_t *_Nonnull bytes,
+  uint32_t size)
+{
+  return cql_cursor_read_bytes(dyn_cursor, bytes, size, NULL);
+}
+
+// cql friendly wrapper for blob deserialization
+// CQLABI
+cql_code cql_cursor_from_blob(
+  sqlite3 *_Nonnull db,
+  cql_dynamic_cursor *_Nonnull dyn_cursor,
+  cql_blob_ref _Nullable b)
+{
+  cql_bool *has_row = dyn_cursor->cursor_has_row;
+
+  if (!b) {
+    goto error;
+  }
+
+  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
+  const uint32_t len = (uint32_t)cql_get_blob_size(b);
+  return cql_cursor_from_bytes(dyn_cursor, bytes, len);
+
+error:
+  *has_row = false;
+  cql_clear_references_before_deserialization(dyn_cursor);
+  return SQLITE_ERROR;
+}
+
+// Like cql_cursor_from_blob but the string and blob fields of the cursor are
+// read only views into the blob, nothing is copied.  Each view holds a
+// reference to the blob so it lives as long as the cursor needs it.
+// CQLABI
+cql_code cql_cursor_view_from_blob(
+  sqlite3 *_Nonnull db,
+  cql_dynamic_cursor *_Nonnull dyn_cursor,
+  cql_blob_ref _Nullable b)
+{
+  cql_bool *has_row = dyn_cursor->cursor_has_row;
+
+  if (!b) {
+    goto error;
+  }
+
+  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
+  const uint32_t len = (uint32_t)cql_get_blob_size(b);
+  return cql_cursor_read_bytes(dyn_cursor, bytes, len, b);
+
+error:
+  *has_row = false;
+  cql_clear_references_before_deserialization(dyn_cursor);
+  return SQLITE_ERROR;
+}
+
+// extract the count from the blob stream
+// CQLABI
+cql_int32 cql_blob_stream_count(cql_blob_ref _Nonnull b)
+{
+  cql_contract(b);
+
+  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
+  const uint32_t len = (uint32_t)cql_get_blob_size(b);
+
+  // the first 4 bytes are the count of blobs
+  return len >= 4 ? *(cql_int32 *)bytes : 0;
+}
+
+
+// cql friendly wrapper for blob deserialization from blob array
+// CQLABI
+cql_code cql_cursor_from_blob_stream(
+  sqlite3 *_Nonnull db,
+  cql_dynamic_cursor *_Nonnull dyn_cursor,
+  cql_blob_ref _Nonnull b,
+  cql_int32 index)
+{
+  cql_contract(b);
+  cql_bool *has_row = dyn_cursor->cursor_has_row;
+
+  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
+  const uint32_t len = (uint32_t)cql_get_blob_size(b);
+
+  if (len < 4) {
+    goto error;
+  }
+
+  // the first 4 bytes are the count of blobs
+  // note that we're assuming little endian here, this could be generalized
+  uint32_t count = *(uint32_t *)bytes;
+
+  // We need to read 4 bytes at offset (index+1)*4, so we need (index+1)*4 + 4 <= len,
+  // i.e. (index+2)*4 <= len.  Using (index+1)*4 >= len would only verify the start of
+  // the read is in bounds, leaving up to 3 bytes readable past the end of the blob.
+  if (index < 0 || index >= count || (index + 2) * 4 > len) {
+    goto error;
+  }
+
+  // note that we're assuming little endian here, this could be generalized
+  uint32_t end = *(uint32_t *)(bytes + (index + 1) * 4);
+  if (end > len) {
+    goto error;
+  }
+
+  // the first blob starts after the offsets and count
+  uint32_t start = (count + 1) * sizeof(cql_int32);
+
+  if (index > 0) {
+    // the first blob starts at 0 which is not recorded
+    // note that we're assuming little endian here, this could be generalized
+    start = *(uint32_t *)(bytes + index * 4);
+  }
+
+  if (start > end) {
+    goto error;
+  }
+
+  return cql_cursor_from_bytes(dyn_cursor, bytes + start, end - start);
+
+error:
+  *has_row = false;
+  cql_clear_references_before_deserialization(dyn_cursor);
+  return SQLITE_ERROR;
+}
+
+// A whole result set can be serialized into one blob.  Unlike a stream of
+// cursor blobs the shape is written just once and each column is stored as a
+// contiguous block, so a reader (or anything that maps the blob into memory)
+// can get at a column without walking the rows.  All the numbers are little
+// endian, like the blob streams above.
+//
+//  * header: uint32 magic, version, column count, row count, string count,
+//    total size, dictionary offset
+//  * uint8 data types, one per column, core type plus CQL_DATA_TYPE_NOT_NULL
+//  * uint32 offsets of the column blocks, one per column
+//  * the string dictionary: uint32 offsets[string count + 1] into the string
+//    heap which follows, each string is stored once with a null terminator
+//  * the column blocks, each 8 byte aligned.  A nullable column begins with a
+//    bitmap with the bit set for each null row, padded to 8 bytes.  Then the
+//    values, null rows are stored as zero:
+//    * bool: a bitmap
+//    * integer: int32[rows]
+//    * long and real: int64[rows] and double[rows]
+//    * text: uint32[rows] ids of the strings in the dictionary
+//    * blob: uint32 offsets[rows + 1] into the heap which follows
+//
+// Object columns can't be serialized.
+#define CQL_RESULT_BLOB_MAGIC 0x52514c43 // "CQLR"
+#define CQL_RESULT_BLOB_VERSION 1
+#define CQL_RESULT_BLOB_HEADER_WORDS 7
+
+// pad the buffer with zeros to the indicated alignment
+static void cql_bytebuf_pad(cql_bytebuf *_Nonnull b, cql_uint32 align) {
+  while (b->used % align) {
+    cql_bytebuf_append(b, "", 1);
+  }
+}
+
+static void cql_bytebuf_append_uint32(cql_bytebuf *_Nonnull b, uint32_t value) {
+  cql_bytebuf_append(b, &value, sizeof(value));
+}
+
+// Adds an empty bitmap for the given number of rows, the offset of the bitmap
+// is returned because the buffer may move as it grows.
+static uint32_t cql_bytebuf_append_bitmap(cql_bytebuf *_Nonnull b, cql_int32 count) {
+  uint32_t offset = (uint32_t)b->used;
+  uint32_t bytes = ((uint32_t)count + 7) / 8;
+  memset(cql_bytebuf_alloc(b, bytes), 0, bytes);
+  return offset;
+}
+
+// Serialize all the rows of the result set, see above for the format.  If the
+// result set has an object column there is no blob and the result is an error.
+// CQLABI
+cql_code cql_result_set_to_blob(
+  cql_result_set_ref _Nonnull result_set,
+  cql_blob_ref _Nullable *_Nonnull blob)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  cql_contract(meta->columnOffsets != NULL);
+
+  uint32_t columns = meta->columnCount;
+  cql_int32 count = cql_result_set_get_count(result_set);
+
+  for (uint32_t col = 0; col < columns; col++) {
+    if (CQL_CORE_DATA_TYPE_OF(meta->dataTypes[col]) == CQL_DATA_TYPE_OBJECT) {
+      cql_blob_release(*blob);
+      *blob = NULL;
+      return SQLITE_ERROR;
+    }
+  }
+
+  // All the strings go in one dictionary, the repeated values of a column are
+  // very common.  The result set holds the strings while we work.
+  cql_hashtab *ht = cql_hashtab_new(
+    cql_key_str_hash,
+    cql_key_str_eq,
+    cql_no_op_retain_release,
+    cql_no_op_retain_release,
+    cql_no_op_retain_release,
+    cql_no_op_retain_release,
+    NULL
+  );
+
+  cql_bytebuf strings;
+  cql_bytebuf_open(&strings);
+  uint32_t string_count = 0;
+
+  for (uint32_t col = 0; col < columns; col++) {
+    if (CQL_CORE_DATA_TYPE_OF(meta->dataTypes[col]) != CQL_DATA_TYPE_STRING) {
+      continue;
+    }
+    for (cql_int32 row = 0; row < count; row++) {
+      cql_string_ref str = cql_result_set_get_string_col(result_set, row, (cql_int32)col);
+      if (str && cql_hashtab_add(ht, (cql_int64)str, string_count)) {
+        cql_bytebuf_append(&strings, &str, sizeof(str));
+        string_count++;
+      }
+    }
+  }
+
+  cql_bytebuf b;
+  cql_bytebuf_open(&b);
+
+  // the size and the block offsets are filled in when we know them
+  uint32_t header[CQL_RESULT_BLOB_HEADER_WORDS] = {
+    CQL_RESULT_BLOB_MAGIC,
+    CQL_RESULT_BLOB_VERSION,
+    columns,
+    (uint32_t)count,
+    string_count,
+    0,
+    0,
+  };
+  cql_bytebuf_append(&b, header, sizeof(header));
+
+  for (uint32_t col = 0; col < columns; col++) {
+    uint8_t type = meta->dataTypes[col];
+    uint8_t stored_type = CQL_CORE_DATA_TYPE_OF(type) | (type & CQL_DATA_TYPE_NOT_NULL);
+    cql_bytebuf_append(&b, &stored_type, 1);
+  }
+  cql_bytebuf_pad(&b, 4);
+
+  uint32_t blocks = (uint32_t)b.used;
+  memset(cql_bytebuf_alloc(&b, columns * sizeof(uint32_t)), 0, columns * sizeof(uint32_t));
+
+  // the dictionary: offsets first then the heap
+  uint32_t dictionary = (uint32_t)b.used;
+  uint32_t heap_offset = 0;
+  cql_string_ref *dict = (cql_string_ref *)strings.ptr;
+  for (uint32_t i = 0; i < string_count; i++) {
+    cql_bytebuf_append_uint32(&b, heap_offset);
+    cql_alloc_cstr(cstr, dict[i]);
+    heap_offset += (uint32_t)strlen(cstr) + 1;
+    cql_free_cstr(cstr, dict[i]);
+  }
+  cql_bytebuf_append_uint32(&b, heap_offset);
+
+  for (uint32_t i = 0; i < string_count; i++) {
+    cql_alloc_cstr(cstr, dict[i]);
+    cql_bytebuf_append(&b, cstr, (uint32_t)strlen(cstr) + 1);
+    cql_free_cstr(cstr, dict[i]);
+  }
+
+  for (uint32_t col = 0; col < columns; col++) {
+    uint8_t type = meta->dataTypes[col];
+    cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(type);
+
+    cql_bytebuf_pad(&b, 8);
+    uint32_t block = (uint32_t)b.used;
+    memcpy(b.ptr + blocks + col * sizeof(uint32_t), &block, sizeof(block));
+
+    if (!(type & CQL_DATA_TYPE_NOT_NULL)) {
+      uint32_t nulls = cql_bytebuf_append_bitmap(&b, count);
+      for (cql_int32 row = 0; row < count; row++) {
+        if (cql_result_set_get_is_null_col(result_set, row, (cql_int32)col)) {
+          b.ptr[nulls + row / 8] |= (char)(1 << (row & 7));
+        }
+      }
+      cql_bytebuf_pad(&b, 8);
+    }
+
+    switch (core_data_type) {
+      case CQL_DATA_TYPE_BOOL: {
+        uint32_t bits = cql_bytebuf_append_bitmap(&b, count);
+        for (cql_int32 row = 0; row < count; row++) {
+          if (cql_result_set_get_bool_col(result_set, row, (cql_int32)col)) {
+            b.ptr[bits + row / 8] |= (char)(1 << (row & 7));
+          }
         }
+        break;
       }
-    }
-    else {
-      switch (core_data_type) {
-        case CQL_DATA_TYPE_INT32: {
-          cql_nullable_int32 *int32_data = (cql_nullable_int32 *)(cursor + offset);
-          int32_data->value = 0;
-          int32_data->is_null = true;
-          break;
+      case CQL_DATA_TYPE_INT32:
+        for (cql_int32 row = 0; row < count; row++) {
+          cql_int32 value = cql_result_set_get_int32_col(result_set, row, (cql_int32)col);
+          cql_bytebuf_append(&b, &value, sizeof(value));
         }
-        case CQL_DATA_TYPE_INT64: {
-          cql_nullable_int64 *int64_data = (cql_nullable_int64 *)(cursor + offset);
-          int64_data->value = 0;
-          int64_data->is_null = true;
-          break;
+        break;
+      case CQL_DATA_TYPE_INT64:
+        for (cql_int32 row = 0; row < count; row++) {
+          cql_int64 value = cql_result_set_get_int64_col(result_set, row, (cql_int32)col);
+          cql_bytebuf_append(&b, &value, sizeof(value));
         }
-        case CQL_DATA_TYPE_DOUBLE: {
-          cql_nullable_double *double_data = (cql_nullable_double *)(cursor + offset);
-          double_data->value = 0;
-          double_data->is_null = true;
-          break;
+        break;
+      case CQL_DATA_TYPE_DOUBLE:
+        for (cql_int32 row = 0; row < count; row++) {
+          cql_double value = cql_result_set_get_double_col(result_set, row, (cql_int32)col);
+          cql_bytebuf_append(&b, &value, sizeof(value));
         }
-        case CQL_DATA_TYPE_BOOL: {
-          cql_nullable_bool *bool_data = (cql_nullable_bool *)(cursor + offset);
-          bool_data->value = 0;
-          bool_data->is_null = true;
-          bool_index++;
-          break;
+        break;
+      case CQL_DATA_TYPE_STRING:
+        for (cql_int32 row = 0; row < count; row++) {
+          cql_string_ref str = cql_result_set_get_string_col(result_set, row, (cql_int32)col);
+          uint32_t id = str ? (uint32_t)cql_hashtab_find(ht, (cql_int64)str)->val : 0;
+          cql_bytebuf_append_uint32(&b, id);
         }
-        case CQL_DATA_TYPE_STRING: {
-          cql_string_ref *str_ref = (cql_string_ref *)(cursor + offset);
-          *str_ref = NULL;
-          break;
+        break;
+      default: {
+        cql_contract(core_data_type == CQL_DATA_TYPE_BLOB);
+        uint32_t size = 0;
+        for (cql_int32 row = 0; row < count; row++) {
+          cql_bytebuf_append_uint32(&b, size);
+          cql_blob_ref value = cql_result_set_get_blob_col(result_set, row, (cql_int32)col);
+          size += value ? (uint32_t)cql_get_blob_size(value) : 0;
         }
-        case CQL_DATA_TYPE_BLOB: {
-          cql_blob_ref *blob_ref = (cql_blob_ref *)(cursor + offset);
-          *blob_ref = NULL;
-          break;
+        cql_bytebuf_append_uint32(&b, size);
+        for (cql_int32 row = 0; row < count; row++) {
+          cql_blob_ref value = cql_result_set_get_blob_col(result_set, row, (cql_int32)col);
+          if (value && cql_get_blob_size(value)) {
+            cql_bytebuf_append(&b, cql_get_blob_bytes(value), (uint32_t)cql_get_blob_size(value));
+          }
         }
+        break;
       }
     }
   }
 
-  *has_row = true;
+  header[5] = (uint32_t)b.used;
+  header[6] = dictionary;
+  memcpy(b.ptr, header, sizeof(header));
+
+  cql_blob_ref new_blob = cql_blob_ref_new((const uint8_t *)b.ptr, (cql_uint32)b.used);
+  cql_blob_release(*blob);
+  *blob = new_blob;
+
+  cql_bytebuf_close(&b);
+  cql_bytebuf_close(&strings);
+  cql_hashtab_delete(ht);
   return SQLITE_OK;
+}
 
-error:
-  *has_row = false;
-  cql_clear_references_before_deserialization(dyn_cursor);
-  return SQLITE_ERROR;
+// Reads a uint32 from the serialized result set, false if it is out of bounds.
+static cql_bool cql_result_blob_uint32(
+  const uint8_t *_Nonnull bytes,
+  uint32_t size,
+  uint64_t offset,
+  uint32_t *_Nonnull result)
+{
+  if (offset + sizeof(uint32_t) > size) {
+    return false;
+  }
+  memcpy(result, bytes + offset, sizeof(uint32_t));
+  return true;
 }
 
-// cql friendly wrapper for blob deserialization
-// CQLABI
-cql_code cql_cursor_from_blob(
-  sqlite3 *_Nonnull db,
-  cql_dynamic_cursor *_Nonnull dyn_cursor,
-  cql_blob_ref _Nullable b)
+// Where the null bitmap and the values of one column are in the serialized
+// bytes, blob columns also have the start of their heap.
+typedef struct cql_result_blob_column {
+  const uint8_t *_Nullable nulls;
+  const uint8_t *_Nonnull values;
+  uint64_t blob_heap;
+} cql_result_blob_column;
+
+// Finds the block of the indicated column and checks all of it: the block is
+// after the dictionary and aligned, the null bitmap and values are in bounds,
+// the string ids are in the dictionary, and the blob end offsets increase and
+// stay in bounds.  Nothing is allocated until every column passes this.
+static cql_bool cql_result_blob_column_find(
+  const uint8_t *_Nonnull bytes,
+  uint32_t size,
+  uint64_t blocks,
+  uint64_t heap,
+  uint32_t col,
+  uint8_t type,
+  uint32_t count,
+  uint32_t string_count,
+  cql_result_blob_column *_Nonnull column)
 {
-  cql_bool *has_row = dyn_cursor->cursor_has_row;
+  cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(type);
 
-  if (!b) {
-    goto error;
+  uint32_t block;
+  cql_result_blob_uint32(bytes, size, blocks + col * sizeof(uint32_t), &block);
+  if (block < heap || block % 8) {
+    return false;
   }
 
-  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
-  const uint32_t len = (uint32_t)cql_get_blob_size(b);
-  return cql_cursor_from_bytes(dyn_cursor, bytes, len);
+  uint64_t bitmap_size = ((uint64_t)count + 7) / 8;
+  uint64_t values = block;
+  column->nulls = NULL;
 
-error:
-  *has_row = false;
-  cql_clear_references_before_deserialization(dyn_cursor);
-  return SQLITE_ERROR;
+  if (!(type & CQL_DATA_TYPE_NOT_NULL)) {
+    if (values + bitmap_size > size) {
+      return false;
+    }
+    column->nulls = bytes + values;
+    values += (bitmap_size + 7) & ~(uint64_t)7;
+  }
+
+  uint64_t value_size = 0;
+  switch (core_data_type) {
+    case CQL_DATA_TYPE_BOOL: value_size = bitmap_size; break;
+    case CQL_DATA_TYPE_INT32: value_size = (uint64_t)count * sizeof(cql_int32); break;
+    case CQL_DATA_TYPE_INT64: value_size = (uint64_t)count * sizeof(cql_int64); break;
+    case CQL_DATA_TYPE_DOUBLE: value_size = (uint64_t)count * sizeof(cql_double); break;
+    case CQL_DATA_TYPE_STRING: value_size = (uint64_t)count * sizeof(uint32_t); break;
+    case CQL_DATA_TYPE_BLOB: value_size = ((uint64_t)count + 1) * sizeof(uint32_t); break;
+  }
+
+  if (values + value_size > size) {
+    return false;
+  }
+
+  const uint8_t *p = bytes + values;
+  column->values = p;
+  column->blob_heap = values + value_size;
+
+  if (core_data_type == CQL_DATA_TYPE_STRING) {
+    for (uint32_t row = 0; row < count; row++) {
+      cql_bool is_null = column->nulls && ((column->nulls[row / 8] >> (row & 7)) & 1);
+      uint32_t id;
+      memcpy(&id, p + row * sizeof(id), sizeof(id));
+      if (!is_null && id >= string_count) {
+        return false;
+      }
+    }
+  }
+  else if (core_data_type == CQL_DATA_TYPE_BLOB) {
+    uint32_t start;
+    memcpy(&start, p, sizeof(start));
+    if (start != 0) {
+      return false;
+    }
+    for (uint32_t row = 0; row < count; row++) {
+      uint32_t end;
+      memcpy(&end, p + (row + 1) * sizeof(end), sizeof(end));
+      if (end < start || column->blob_heap + end > size) {
+        return false;
+      }
+      start = end;
+    }
+  }
+
+  return true;
 }
 
-// extract the count from the blob stream
-// CQLABI
-cql_int32 cql_blob_stream_count(cql_blob_ref _Nonnull b)
+// The rows are created with the layout of the fetch info, which must have
+// exactly the shape that was serialized, and then stored with the usual column
+// setters.  Nothing in the bytes is trusted: every offset and count is checked
+// before it is used and any problem results in SQLITE_ERROR and no result set.
+// If there is an owner the strings and blobs are views into it, otherwise they
+// are copied so the bytes need not outlive the call.
+static cql_code cql_result_set_read_bytes(
+  cql_fetch_info *_Nonnull info,
+  cql_bool row_header,
+  const uint8_t *_Nonnull bytes,
+  uint32_t size,
+  cql_blob_ref _Nullable owner,
+  cql_result_set_ref _Nullable *_Nonnull result_set)
 {
-  cql_contract(b);
+  *result_set = NULL;
 
-  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
-  const uint32_t len = (uint32_t)cql_get_blob_size(b);
+  uint32_t header[CQL_RESULT_BLOB_HEADER_WORDS];
+  if (size < sizeof(header)) {
+    return SQLITE_ERROR;
+  }
+  memcpy(header, bytes, sizeof(header));
 
-  // the first 4 bytes are the count of blobs
-  return len >= 4 ? *(cql_int32 *)bytes : 0;
-}
+  uint32_t columns = header[2];
+  uint32_t count = header[3];
+  uint32_t string_count = header[4];
+  uint32_t dictionary = header[6];
 
+  if (header[0] != CQL_RESULT_BLOB_MAGIC ||
+      header[1] != CQL_RESULT_BLOB_VERSION ||
+      header[5] != size ||
+      columns != info->col_offsets[0] ||
+      count > INT32_MAX) {
+    return SQLITE_ERROR;
+  }
 
-// cql friendly wrapper for blob deserialization from blob array
-// CQLABI
-cql_code cql_cursor_from_blob_stream(
-  sqlite3 *_Nonnull db,
-  cql_dynamic_cursor *_Nonnull dyn_cursor,
-  cql_blob_ref _Nonnull b,
-  cql_int32 index)
-{
-  cql_contract(b);
-  cql_bool *has_row = dyn_cursor->cursor_has_row;
+  // the stored types must match the expected shape exactly
+  uint64_t blocks = sizeof(header) + ((columns + 3) & ~3u);
+  if (blocks + columns * sizeof(uint32_t) > size) {
+    return SQLITE_ERROR;
+  }
 
-  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
-  const uint32_t len = (uint32_t)cql_get_blob_size(b);
+  for (uint32_t col = 0; col < columns; col++) {
+    uint8_t type = info->data_types[col];
+    uint8_t expected = CQL_CORE_DATA_TYPE_OF(type) | (type & CQL_DATA_TYPE_NOT_NULL);
+    if (bytes[sizeof(header) + col] != expected || CQL_CORE_DATA_TYPE_OF(type) == CQL_DATA_TYPE_OBJECT) {
+      return SQLITE_ERROR;
+    }
+  }
 
-  if (len < 4) {
-    goto error;
+  // every row uses at least one bit of every column so this limits the
+  // allocation to something proportional to the size of the blob
+  if (columns == 0 ? count != 0 : count > (uint64_t)size * 8) {
+    return SQLITE_ERROR;
   }
 
-  // the first 4 bytes are the count of blobs
-  // note that we're assuming little endian here, this could be generalized
-  uint32_t count = *(uint32_t *)bytes;
+  // the dictionary offsets must be increasing and each string must end with
+  // its null terminator
+  uint64_t heap = (uint64_t)dictionary + ((uint64_t)string_count + 1) * sizeof(uint32_t);
+  if (dictionary < blocks + columns * sizeof(uint32_t) || heap > size) {
+    return SQLITE_ERROR;
+  }
 
-  // We need to read 4 bytes at offset (index+1)*4, so we need (index+1)*4 + 4 <= len,
-  // i.e. (index+2)*4 <= len.  Using (index+1)*4 >= len would only verify the start of
-  // the read is in bounds, leaving up to 3 bytes readable past the end of the blob.
-  if (index < 0 || index >= count || (index + 2) * 4 > len) {
-    goto error;
+  uint32_t start;
+  cql_result_blob_uint32(bytes, size, dictionary, &start);
+  if (start != 0) {
+    return SQLITE_ERROR;
   }
 
-  // note that we're assuming little endian here, this could be generalized
-  uint32_t end = *(uint32_t *)(bytes + (index + 1) * 4);
-  if (end > len) {
-    goto error;
+  for (uint32_t i = 0; i < string_count; i++) {
+    uint32_t end;
+    cql_result_blob_uint32(bytes, size, dictionary + (i + 1) * sizeof(uint32_t), &end);
+    if (end <= start || heap + end > size || bytes[heap + end - 1] != 0) {
+      return SQLITE_ERROR;
+    }
+    start = end;
   }
 
-  // the first blob starts after the offsets and count
-  uint32_t start = (count + 1) * sizeof(cql_int32);
+  // every column block is checked before anything is allocated
+  cql_result_blob_column column;
+  for (uint32_t col = 0; col < columns; col++) {
+    if (!cql_result_blob_column_find(bytes, size, blocks, heap, col, info->data_types[col], count, string_count, &column)) {
+      return SQLITE_ERROR;
+    }
+  }
 
-  if (index > 0) {
-    // the first blob starts at 0 which is not recorded
-    // note that we're assuming little endian here, this could be generalized
-    start = *(uint32_t *)(bytes + index * 4);
+  cql_uint32 rowsize = info->rowsize;
+  if (rowsize && (uint64_t)count > (SIZE_MAX - CQL_ALLOC_HEADER_SIZE) / rowsize) {
+    return SQLITE_ERROR;
   }
 
-  if (start > end) {
-    goto error;
+  cql_string_ref *strings = cql_calloc(string_count ? string_count : 1, sizeof(cql_string_ref), CQL_ALLOC_PAYLOAD);
+
+  for (uint32_t i = 0; i < string_count; i++) {
+    uint32_t offset;
+    cql_result_blob_uint32(bytes, size, dictionary + i * sizeof(uint32_t), &offset);
+    const char *cstr = (const char *)bytes + heap + offset;
+    strings[i] = owner ? cql_string_ref_new_view(owner, cstr) : cql_string_ref_new(cstr);
   }
 
-  return cql_cursor_from_bytes(dyn_cursor, bytes + start, end - start);
+  // the rows start out all zero, every column is then stored with the setters
+  // which know about the various row layouts
+  char *data = cql_calloc(count ? count : 1, rowsize, CQL_ALLOC_ROW_DATA);
+  if (row_header) {
+    for (uint32_t row = 0; row < count; row++) {
+      cql_row_header *row_data = (cql_row_header *)(data + (size_t)row * rowsize);
+      row_data->_has_row_ = true;
+      row_data->_refs_count_ = info->refs_count;
+      row_data->_refs_offset_ = info->refs_offset;
+    }
+  }
 
-error:
-  *has_row = false;
-  cql_clear_references_before_deserialization(dyn_cursor);
-  return SQLITE_ERROR;
+  cql_result_set_meta meta;
+  cql_initialize_meta(&meta, info);
+  cql_result_set_ref rs = cql_result_set_create(data, (cql_int32)count, meta);
+
+  for (uint32_t col = 0; col < columns; col++) {
+    uint8_t type = info->data_types[col];
+    cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(type);
+    cql_int32 c = (cql_int32)col;
+
+    // already checked above so this can't fail
+    cql_bool found = cql_result_blob_column_find(bytes, size, blocks, heap, col, type, count, string_count, &column);
+    cql_invariant(found);
+
+    const uint8_t *nulls = column.nulls;
+    const uint8_t *p = column.values;
+    uint32_t blob_start = 0;
+
+    for (uint32_t row = 0; row < count; row++) {
+      cql_int32 r = (cql_int32)row;
+      cql_bool is_null = nulls && ((nulls[row / 8] >> (row & 7)) & 1);
+
+      switch (core_data_type) {
+        case CQL_DATA_TYPE_BOOL:
+          if (!is_null) {
+            cql_result_set_set_bool_col(rs, r, c, (p[row / 8] >> (row & 7)) & 1);
+          }
+          break;
+        case CQL_DATA_TYPE_INT32:
+          if (!is_null) {
+            cql_int32 value;
+            memcpy(&value, p + row * sizeof(value), sizeof(value));
+            cql_result_set_set_int32_col(rs, r, c, value);
+          }
+          break;
+        case CQL_DATA_TYPE_INT64:
+          if (!is_null) {
+            cql_int64 value;
+            memcpy(&value, p + row * sizeof(value), sizeof(value));
+            cql_result_set_set_int64_col(rs, r, c, value);
+          }
+          break;
+        case CQL_DATA_TYPE_DOUBLE:
+          if (!is_null) {
+            cql_double value;
+            memcpy(&value, p + row * sizeof(value), sizeof(value));
+            cql_result_set_set_double_col(rs, r, c, value);
+          }
+          break;
+        case CQL_DATA_TYPE_STRING:
+          if (!is_null) {
+            uint32_t id;
+            memcpy(&id, p + row * sizeof(id), sizeof(id));
+            cql_result_set_set_string_col(rs, r, c, strings[id]);
+          }
+          break;
+        default: {
+          uint32_t end;
+          memcpy(&end, p + (row + 1) * sizeof(end), sizeof(end));
+          if (!is_null) {
+            const uint8_t *blob_bytes = bytes + column.blob_heap + blob_start;
+            cql_uint32 blob_size = end - blob_start;
+            cql_blob_ref value = owner
+              ? cql_blob_ref_new_view(owner, blob_bytes, blob_size)
+              : cql_blob_ref_new(blob_bytes, blob_size);
+            cql_result_set_set_blob_col(rs, r, c, value);
+            cql_blob_release(value);
+          }
+          blob_start = end;
+          break;
+        }
+      }
+
+      // null references are already there, the zeroed primitives are not null
+      if (is_null && core_data_type != CQL_DATA_TYPE_STRING && core_data_type != CQL_DATA_TYPE_BLOB) {
+        cql_result_set_set_to_null_col(rs, r, c);
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < string_count; i++) {
+    cql_string_release(strings[i]);
+  }
+  cql_free(strings, CQL_ALLOC_PAYLOAD);
+
+  *result_set = rs;
+  return SQLITE_OK;
+}
+
+// Make a result set from bytes made by cql_result_set_to_blob, for instance
+// bytes mapped from a file.  The strings and blobs are copied out of the bytes.
+// The fetch info gives the expected shape and the layout of the rows, rows that
+// begin with a cql_row_header (those of OUT and OUT UNION procs) need it filled
+// in.
+cql_code cql_result_set_from_bytes(
+  cql_fetch_info *_Nonnull info,
+  cql_bool row_header,
+  const void *_Nonnull bytes,
+  cql_uint32 size,
+  cql_result_set_ref _Nullable *_Nonnull result_set)
+{
+  return cql_result_set_read_bytes(info, row_header, (const uint8_t *)bytes, size, NULL, result_set);
+}
+
+// As above but the strings and blobs of the result are views into the blob,
+// nothing is copied and each string is created only once.
+cql_code cql_result_set_from_blob(
+  cql_fetch_info *_Nonnull info,
+  cql_bool row_header,
+  cql_blob_ref _Nullable blob,
+  cql_result_set_ref _Nullable *_Nonnull result_set)
+{
+  if (!blob) {
+    *result_set = NULL;
+    return SQLITE_ERROR;
+  }
+
+  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(blob);
+  const uint32_t len = (uint32_t)cql_get_blob_size(blob);
+  return cql_result_set_read_bytes(info, row_header, bytes, len, blob, result_set);
 }
 
 // The outside world does not need to know the details of the partitioning
@@ -3462,7 +5974,7 @@ static void cql_partition_key_release(
   if (self->c_key.cursor_refs_count) {
     cql_release_offsets(pv, self->c_key.cursor_refs_count, self->c_key.cursor_refs_offset);
   }
-  free((void *)pv);
+  cql_free((void *)pv, CQL_ALLOC_ROW_DATA);
 }
 
 // We're just going to look at the buffer and release any pointers in any rows
@@ -3497,7 +6009,7 @@ static void cql_partition_val_release(
   }
   // releases the internal buffer
   cql_bytebuf_close(buffer);
-  free(buffer);
+  cql_free(buffer, CQL_ALLOC_OBJECT);
 }
 
 // When we're going to tear down the partition we want to release anything left
@@ -3520,7 +6032,7 @@ static void cql_partition_finalize(void *_Nonnull data) {
 
   cql_hashtab_delete(self->ht);
 
-  free(self);
+  cql_free(self, CQL_ALLOC_OBJECT);
 }
 
 // We just defer to the cursor helper using the stored key metadata
@@ -3563,7 +6075,7 @@ static bool cql_key_cursor_eq(
 // its contents when they are condemned.
 cql_object_ref _Nonnull cql_partition_create(void) {
 
-  cql_partition *_Nonnull self = calloc(1, sizeof(cql_partition));
+  cql_partition *_Nonnull self = cql_calloc(1, sizeof(cql_partition), CQL_ALLOC_OBJECT);
 
   cql_object_ref obj = _cql_generic_object_create(self, cql_partition_finalize);
 
@@ -3643,10 +6155,10 @@ cql_bool cql_partition_cursor(
   }
   else {
     // create buffer and add to hash table
-    buf = malloc(sizeof(*buf));
+    buf = cql_malloc(sizeof(*buf), CQL_ALLOC_OBJECT);
     cql_bytebuf_open(buf);
 
-    char *k = malloc(key->cursor_size);
+    char *k = cql_malloc(key->cursor_size, CQL_ALLOC_ROW_DATA);
     memcpy(k, key->cursor_data, key->cursor_size);
     cql_retain_offsets(k, key->cursor_refs_count, key->cursor_refs_offset);
 
@@ -3724,7 +6236,7 @@ cql_object_ref _Nonnull cql_extract_partition(
       // the bytebuf has been harvested, we can free it now.  We do not "close"
       // it because the result set is taking over the growable buffer, we don't
       // want the buffer to be freed.
-      free(buf);
+      cql_free(buf, CQL_ALLOC_OBJECT);
 
       // retain our copy in case we need it again
       cql_object_ref result = (cql_object_ref)cql_result_set_create(data, count, meta);
@@ -3748,7 +6260,7 @@ cql_object_ref _Nonnull cql_extract_partition(
     // make the meta from standard info
     cql_result_set_meta empty_meta;
     cql_initialize_meta(&empty_meta, &empty_info);
-    self->empty_result = (cql_object_ref)cql_result_set_create(malloc(1), 0, empty_meta);
+    self->empty_result = (cql_object_ref)cql_result_set_create(cql_malloc(1, CQL_ALLOC_ROW_DATA), 0, empty_meta);
   }
 
   cql_invariant(self->empty_result);
@@ -4118,13 +6630,13 @@ static void cql_string_list_finalize(void *_Nonnull data) {
     cql_string_release(string);
   }
   cql_bytebuf_close(self);
-  free(self);
+  cql_free(self, CQL_ALLOC_OBJECT);
 }
 
 // Creates the string list storage using a byte buffer
 // CQLABI
 cql_object_ref _Nonnull cql_string_list_create(void) {
-  cql_bytebuf *self = calloc(1, sizeof(cql_bytebuf));
+  cql_bytebuf *self = cql_calloc(1, sizeof(cql_bytebuf), CQL_ALLOC_OBJECT);
   cql_bytebuf_open(self);
   return _cql_generic_object_create(self, cql_string_list_finalize);
 }
@@ -4275,13 +6787,13 @@ cql_object_ref _Nonnull cql_blob_list_set_at(
 static void cql_long_list_finalize(void *_Nonnull data) {
   cql_bytebuf *_Nonnull self = data;
   cql_bytebuf_close(self);
-  free(self);
+  cql_free(self, CQL_ALLOC_OBJECT);
 }
 
 // Creates the list storage using a byte buffer
 // CQLABI
 cql_object_ref _Nonnull cql_long_list_create(void) {
-  cql_bytebuf *self = calloc(1, sizeof(cql_bytebuf));
+  cql_bytebuf *self = cql_calloc(1, sizeof(cql_bytebuf), CQL_ALLOC_OBJECT);
   cql_bytebuf_open(self);
   return _cql_generic_object_create(self, cql_long_list_finalize);
 }
@@ -4348,7 +6860,7 @@ cql_object_ref _Nonnull cql_long_list_set_at(
 // Creates the list storage using a byte buffer
 // CQLABI
 cql_object_ref _Nonnull cql_real_list_create(void) {
-  cql_bytebuf *self = calloc(1, sizeof(cql_bytebuf));
+  cql_bytebuf *self = cql_calloc(1, sizeof(cql_bytebuf), CQL_ALLOC_OBJECT);
   cql_bytebuf_open(self);
   // the long list finalizer works, it just releases the buffer
   return _cql_generic_object_create(self, cql_long_list_finalize);
@@ -5205,11 +7717,11 @@ static cql_object_ref _Nonnull _cql_create_upgrader_input_statement_list(
       // our list when we find the delimiting parseWord for the next statement
       if (lineStart != p) {
         bytes = (cql_uint32)(p - lineStart);
-        char* temp = malloc(bytes + 1);
+        char* temp = cql_malloc(bytes + 1, CQL_ALLOC_TEMP);
         memcpy(temp, lineStart, bytes);
         temp[bytes] = '\0';
         currLine = cql_string_ref_new(temp);
-        free(temp);
+        cql_free(temp, CQL_ALLOC_TEMP);
         cql_string_list_add(list, currLine);
         cql_string_release(currLine);
         lineStart = p;
@@ -5221,11 +7733,11 @@ static cql_object_ref _Nonnull _cql_create_upgrader_input_statement_list(
   // list after seeing the entire statement i.e. beginning of the next
   // statement. We must flush it here.
   bytes = (cql_uint32)(p - lineStart);
-  char *temp = malloc(bytes + 1);
+  char *temp = cql_malloc(bytes + 1, CQL_ALLOC_TEMP);
   memcpy(temp, lineStart, bytes);
   temp[bytes] = '\0';
   currLine = cql_string_ref_new(temp);
-  free(temp);
+  cql_free(temp, CQL_ALLOC_TEMP);
   cql_string_list_add(list, currLine);
   cql_string_release(currLine);
 
@@ -5273,7 +7785,7 @@ static char* _Nonnull _cql_create_table_name_from_table_creation_statement(
   }
 
   cql_uint32 bytes = (cql_uint32)(p - lineStart);
-  char *table_name = malloc(bytes + 1);
+  char *table_name = cql_malloc(bytes + 1, CQL_ALLOC_TEMP);
   memcpy(table_name, lineStart, bytes);
   table_name[bytes] = '\0';
 
@@ -5296,7 +7808,7 @@ static char *_Nonnull _cql_create_table_name_from_index_creation_statement(
     q--;
   }
   cql_uint32 index_bytes = (cql_uint32)(q - lineStart);
-  char *index_table_name = malloc(index_bytes + 1);
+  char *index_table_name = cql_malloc(index_bytes + 1, CQL_ALLOC_TEMP);
   memcpy(index_table_name, lineStart, index_bytes);
   index_table_name[index_bytes] = '\0';
   cql_free_cstr(c_index_create, index_create);
@@ -5349,7 +7861,7 @@ cql_code cql_rebuild_recreate_group(
     cql_bytebuf_append_null(&drop);
     rc = cql_exec(db, drop.ptr);
     cql_bytebuf_close(&drop);
-    free(table_name);
+    cql_free(table_name, CQL_ALLOC_TEMP);
 
     if (rc != SQLITE_OK) goto cleanup;
   }
@@ -5368,15 +7880,15 @@ cql_code cql_rebuild_recreate_group(
       cql_string_ref indexCreate = cql_string_list_get_at(indexList, j);
       char* index_table_name = _cql_create_table_name_from_index_creation_statement(indexCreate);
       if (!strcmp(table_name, index_table_name)) {
-        free(index_table_name);
+        cql_free(index_table_name, CQL_ALLOC_TEMP);
         rc = cql_exec_internal(db, indexCreate);
         if (rc != SQLITE_OK) goto cleanup;
       }
       else {
-        free(index_table_name);
+        cql_free(index_table_name, CQL_ALLOC_TEMP);
       }
     }
-    free(table_name);
+    cql_free(table_name, CQL_ALLOC_TEMP);
   }
 
 cleanup:
@@ -5421,6 +7933,132 @@ cql_code cql_create_udf_stub(
   return rc;
 }
 
+// hex digit to its value, or -1 if it isn't a hex digit
+static int32_t cql_hex_digit_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Loads planner statistics into sqlite_stat1 and sqlite_stat4 from a JSON
+// document of the form:
+//
+// {
+//   "sqlite_stat1" : [ { "tbl" : "t", "idx" : "t_a", "stat" : "1000000 10" }, ... ],
+//   "sqlite_stat4" : [ { "tbl" : "t", "idx" : "t_a", "neq" : "5", "nlt" : "0",
+//                        "ndlt" : "0", "sample" : "hex of the record" }, ... ]
+// }
+//
+// The first ANALYZE of sqlite_schema creates the stat tables (it doesn't
+// analyze any user table) and the second makes the planner reload them.
+// The sqlite_stat4 rows are skipped if this SQLite was not built with STAT4.
+// This is used by the query plan generator so that plans reflect realistic
+// table sizes rather than empty tables.
+cql_code cql_load_planner_stats(
+  sqlite3 *_Nonnull db,
+  cql_string_ref _Nonnull stats)
+{
+  sqlite3_stmt *stmt = NULL;
+  sqlite3_stmt *insert = NULL;
+  uint8_t *sample = NULL;
+  bool has_stat4 = false;
+
+  cql_alloc_cstr(json, stats);
+
+  cql_code rc = cql_exec(db, "ANALYZE sqlite_schema");
+  if (rc) goto cleanup;
+
+  rc = cql_exec(db, "DELETE FROM sqlite_stat1");
+  if (rc) goto cleanup;
+
+  rc = cql_sqlite3_prepare_v2(db,
+    "INSERT INTO sqlite_stat1(tbl, idx, stat) "
+    "  SELECT json_extract(value, '$.tbl'), json_extract(value, '$.idx'), json_extract(value, '$.stat') "
+    "  FROM json_each(?, '$.sqlite_stat1')",
+    -1, &stmt, NULL);
+  if (rc) goto cleanup;
+
+  rc = sqlite3_bind_text(stmt, 1, json, -1, SQLITE_STATIC);
+  if (rc) goto cleanup;
+
+  rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE) goto cleanup;
+  cql_finalize_stmt(&stmt);
+
+  rc = cql_sqlite3_prepare_v2(db,
+    "SELECT 1 FROM sqlite_schema WHERE name = 'sqlite_stat4'", -1, &stmt, NULL);
+  if (rc) goto cleanup;
+
+  has_stat4 = sqlite3_step(stmt) == SQLITE_ROW;
+  cql_finalize_stmt(&stmt);
+
+  if (has_stat4) {
+    rc = cql_exec(db, "DELETE FROM sqlite_stat4");
+    if (rc) goto cleanup;
+
+    rc = cql_sqlite3_prepare_v2(db,
+      "SELECT json_extract(value, '$.tbl'), json_extract(value, '$.idx'), "
+      "  json_extract(value, '$.neq'), json_extract(value, '$.nlt'), "
+      "  json_extract(value, '$.ndlt'), json_extract(value, '$.sample') "
+      "  FROM json_each(?, '$.sqlite_stat4')",
+      -1, &stmt, NULL);
+    if (rc) goto cleanup;
+
+    rc = sqlite3_bind_text(stmt, 1, json, -1, SQLITE_STATIC);
+    if (rc) goto cleanup;
+
+    rc = cql_sqlite3_prepare_v2(db,
+      "INSERT INTO sqlite_stat4(tbl, idx, neq, nlt, ndlt, sample) VALUES(?, ?, ?, ?, ?, ?)",
+      -1, &insert, NULL);
+    if (rc) goto cleanup;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      // the sample is a record in SQLite's format, it arrives as hex text
+      const char *hex = (const char *)sqlite3_column_text(stmt, 5);
+      size_t len = hex ? strlen(hex) : 0;
+      if (len % 2) {
+        rc = SQLITE_MISMATCH;
+        goto cleanup;
+      }
+
+      sample = (uint8_t *)cql_malloc(len / 2 + 1, CQL_ALLOC_TEMP);
+      for (size_t i = 0; i < len / 2; i++) {
+        int32_t hi = cql_hex_digit_value(hex[2 * i]);
+        int32_t lo = cql_hex_digit_value(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+          rc = SQLITE_MISMATCH;
+          goto cleanup;
+        }
+        sample[i] = (uint8_t)(hi << 4 | lo);
+      }
+
+      for (int i = 0; i < 5; i++) {
+        sqlite3_bind_value(insert, i + 1, sqlite3_column_value(stmt, i));
+      }
+      sqlite3_bind_blob(insert, 6, sample, (int)(len / 2), SQLITE_STATIC);
+
+      rc = sqlite3_step(insert);
+      if (rc != SQLITE_DONE) goto cleanup;
+      sqlite3_reset(insert);
+
+      cql_free(sample, CQL_ALLOC_TEMP);
+      sample = NULL;
+    }
+
+    if (rc != SQLITE_DONE) goto cleanup;
+  }
+
+  rc = cql_exec(db, "ANALYZE sqlite_schema");
+
+cleanup:
+  cql_free(sample, CQL_ALLOC_TEMP);
+  cql_finalize_stmt(&insert);
+  cql_finalize_stmt(&stmt);
+  cql_free_cstr(json, stats);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
 // two byte portable big endian encoding
 static void cql_write_big_endian_u16(uint8_t *_Nonnull b, uint16_t val) {
   b[0] = (uint8_t)(val >> 8);
@@ -5921,7 +8559,7 @@ void bupdatekey(
   // we have to make a copy of the buffer because sqlite3_value_bytes is not
   // durable
   uint32_t original_bytes = (uint32_t)sqlite3_value_bytes(argv[0]);
-  b = (uint8_t *)malloc(original_bytes);
+  b = (uint8_t *)cql_malloc(original_bytes, CQL_ALLOC_TEMP);
   memcpy(b, sqlite3_value_blob(argv[0]), original_bytes);
 
   // read out the header
@@ -6201,7 +8839,7 @@ cql_error:
 
 cleanup:
   if (b) {
-    free(b);
+    cql_free(b, CQL_ALLOC_TEMP);
   }
 }
 
@@ -6686,7 +9324,7 @@ void bupdateval(
   // we have to make a copy of the buffer because sqlite3_value_bytes is not
   // durable
   uint32_t original_bytes = (uint32_t)sqlite3_value_bytes(argv[0]);
-  b = (uint8_t *)malloc(original_bytes);
+  b = (uint8_t *)cql_malloc(original_bytes, CQL_ALLOC_TEMP);
   memcpy(b, sqlite3_value_blob(argv[0]), original_bytes);
 
   // read out the header
@@ -7026,7 +9664,7 @@ cql_error:
 
 cleanup:
   if (b) {
-    free(b);
+    cql_free(b, CQL_ALLOC_TEMP);
   }
 }
 
@@ -7053,7 +9691,7 @@ typedef struct {
 static void cql_boxed_value_finalize(void *_Nonnull data) {
   cql_boxed_value *_Nonnull self = data;
   cql_release(*(cql_type_ref *)(&self->obj));
-  free(data);
+  cql_free(data, CQL_ALLOC_OBJECT);
 }
 
 // get the type of the thing in the box
@@ -7067,7 +9705,7 @@ cql_int32 cql_box_get_type(cql_object_ref _Nullable box) {
 }
 // create the facets storage using the hashtable
 static cql_object_ref _Nonnull cql_boxed_value_create(void) {
-  cql_boxed_value * self = malloc(sizeof(cql_boxed_value));
+  cql_boxed_value * self = cql_malloc(sizeof(cql_boxed_value), CQL_ALLOC_OBJECT);
   memset(self, 0, sizeof(*self));
   return _cql_generic_object_create(self, cql_boxed_value_finalize);
 }
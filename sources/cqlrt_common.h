@@ -45,6 +45,13 @@
 #define _64(x) x##LL
 #endif
 
+#if !defined(cql_error_prepare) && !defined(cql_error_report)
+// By default these remember the running procedure for the statement trace
+// (see cql_trace_set_enabled) and restore the caller's name on the way out.
+#define cql_error_prepare() const char *_cql_outer_proc_ = cql_trace_proc; cql_trace_proc = _PROC_
+#define cql_error_report() cql_trace_proc = _cql_outer_proc_
+#endif
+
 #ifndef cql_error_prepare
 // called at the start of every procedure that uses _rc_ (no-op by default)
 #define cql_error_prepare()
@@ -60,6 +67,12 @@
 #define cql_error_report()
 #endif
 
+#ifndef cql_profile_rows
+// called with the row count and row bytes of a finished result set just before
+// cql_profile_stop (no-op by default)
+#define cql_profile_rows(crc, index, rows, bytes)
+#endif
+
 #ifndef __has_attribute         // Optional of course.
   #define __has_attribute(x) 0  // Compatibility with non-clang compilers.
 #endif
@@ -75,8 +88,75 @@
 #define CQL_EXPORT extern __attribute__((visibility("default")))
 #define CQL_WARN_UNUSED __attribute__((warn_unused_result))
 
+#ifdef __cplusplus
+#define CQL_THREAD_LOCAL thread_local
+#else
+#define CQL_THREAD_LOCAL _Thread_local
+#endif
+
 CQL_EXTERN_C_BEGIN
 
+// All of the memory the runtime allocates goes through these, as does the row
+// memory the generated code allocates.  Each call has a hint saying what the
+// memory is for, an allocator can use it to pick a size class or just to
+// count.  The hint given to cql_free matches the one the memory was allocated
+// with.
+#define CQL_ALLOC_OBJECT   0  // fixed size headers: strings, blobs, result sets, boxes, hash tables
+#define CQL_ALLOC_ROW_DATA 1  // result set rows, growable buffers, and other arrays sized by row count
+#define CQL_ALLOC_PAYLOAD  2  // the bytes of strings and blobs
+#define CQL_ALLOC_TEMP     3  // scratch memory that is freed before the runtime call returns
+#define CQL_ALLOC_KINDS    4
+
+typedef struct cql_allocator {
+  void *_Nullable (*_Nonnull allocate)(void *_Nullable context, size_t size, int32_t kind);
+  void *_Nullable (*_Nonnull allocate_zeroed)(void *_Nullable context, size_t size, int32_t kind);
+  void *_Nullable (*_Nonnull reallocate)(void *_Nullable context, void *_Nullable ptr, size_t size, int32_t kind);
+  void (*_Nonnull deallocate)(void *_Nullable context, void *_Nullable ptr, int32_t kind);
+  void *_Nullable context;
+} cql_allocator;
+
+// Every allocation is preceded by this many bytes recording the allocator it
+// came from, so an allocator is asked for the requested size plus this.
+#define CQL_ALLOC_HEADER_SIZE 16
+
+// Sets the allocator for the calling thread and returns the previous one, NULL
+// means malloc and friends which is also the default.  Each allocation
+// remembers the allocator it came from and is resized and freed through it, so
+// objects can be released after the allocator is replaced or on another thread
+// (the allocator must then be thread safe, as malloc and the arena are).  The
+// allocator has to outlive its memory: an arena must not be reset while objects
+// made in it are still in use.
+//
+// Breaking change: anything the runtime frees must come from cql_malloc or
+// cql_calloc, including a hand built object handed to cql_release.  Memory
+// from plain malloc or calloc has no header and freeing it crashes.
+CQL_EXPORT const cql_allocator *_Nullable cql_set_allocator(const cql_allocator *_Nullable allocator);
+CQL_EXPORT const cql_allocator *_Nullable cql_get_allocator(void);
+
+CQL_EXPORT void *_Nonnull cql_malloc(size_t size, int32_t kind);
+CQL_EXPORT void *_Nonnull cql_calloc(size_t count, size_t size, int32_t kind);
+CQL_EXPORT void *_Nonnull cql_realloc(void *_Nullable ptr, size_t size, int32_t kind);
+CQL_EXPORT void cql_free(void *_Nullable ptr, int32_t kind);
+
+// A bump allocator for memory that all dies at once, such as everything made
+// while handling one request.  Freeing the most recent allocation gives it
+// back, otherwise freeing does nothing until the arena is reset.  Allocations
+// bigger than half a chunk get their own chunk.  Allocating, resizing, and
+// freeing take a spin lock so memory can be released on any thread, but reset
+// and destroy must not race with any other use of the arena.
+typedef struct cql_arena cql_arena;
+
+CQL_EXPORT cql_arena *_Nonnull cql_arena_create(size_t chunk_size);
+CQL_EXPORT const cql_allocator *_Nonnull cql_arena_allocator(cql_arena *_Nonnull arena);
+
+// The bytes handed out since the last reset, per hint and in total.
+CQL_EXPORT size_t cql_arena_bytes_used(cql_arena *_Nonnull arena, int32_t kind);
+CQL_EXPORT size_t cql_arena_total_bytes_used(cql_arena *_Nonnull arena);
+
+// Frees everything allocated from the arena, one chunk is kept for reuse.
+CQL_EXPORT void cql_arena_reset(cql_arena *_Nonnull arena);
+CQL_EXPORT void cql_arena_destroy(cql_arena *_Nonnull arena);
+
 typedef struct cql_nullable_int32 {
  cql_bool is_null;
  cql_int32 value;
@@ -109,6 +189,7 @@ typedef long long llint_t;
 #define CQL_DATA_TYPE_BLOB      6
 #define CQL_DATA_TYPE_OBJECT    7
 #define CQL_DATA_TYPE_CORE      0x3f    // bit mask for core types
+#define CQL_DATA_TYPE_NULL_BIT  0x40    // nullable primitive stored bare, its null flag is in the row null bitmap (was ENCODED)
 #define CQL_DATA_TYPE_NOT_NULL  0x80    // set if and only if null is not possible
 #define CQL_CORE_DATA_TYPE_OF(type) ((type) & CQL_DATA_TYPE_CORE)
 
@@ -149,6 +230,18 @@ CQL_EXPORT void cql_copyoutrow(
   cql_int32 row,
   cql_uint32 count, ...);
 
+// Copy a row of the result set straight into a cursor with the given column
+// offsets (count first) and types.  Returns false, having done nothing, unless
+// the row exists and the result set rows have the cursor's layout; use
+// cql_copyoutrow then.
+CQL_EXPORT cql_bool cql_copyoutrow_direct(
+  cql_result_set_ref _Nonnull rs,
+  cql_int32 row,
+  void *_Nonnull cursor,
+  cql_uint32 cursor_size,
+  const uint16_t *_Nonnull col_offsets,
+  const uint8_t *_Nonnull data_types);
+
 CQL_EXPORT void cql_multifetch(
   cql_code rc,
   sqlite3_stmt *_Nullable stmt,
@@ -167,6 +260,29 @@ CQL_EXPORT void cql_multibind_var(
   cql_uint32 count,
   const char *_Nullable vpreds, ...);
 
+// Bulk insert: all the rows are bound and stepped in a tight loop using
+// multi-row VALUES statements inside a savepoint.  Either every row is inserted
+// or, on error, none are and the first error is returned.
+CQL_EXPORT cql_code cql_result_set_insert_rows(
+  sqlite3 *_Nonnull db,
+  cql_result_set_ref _Nonnull result_set,
+  const char *_Nonnull table,
+  const char *_Nonnull columns);
+
+CQL_EXPORT cql_code cql_insert_cursor_rows(
+  sqlite3 *_Nonnull db,
+  const char *_Nonnull table,
+  cql_dynamic_cursor *_Nonnull shape,
+  const void *_Nonnull rows,
+  cql_int32 count);
+
+// The same for CQL callers, see cqlrt_common.c for the declaration.
+CQL_EXPORT cql_code cql_insert_rows(
+  sqlite3 *_Nonnull db,
+  cql_object_ref _Nonnull rs,
+  cql_string_ref _Nonnull table_name,
+  cql_string_ref _Nonnull columns);
+
 CQL_EXPORT cql_code cql_best_error(cql_code rc);
 
 typedef struct cql_fetch_info {
@@ -178,12 +294,51 @@ typedef struct cql_fetch_info {
   uint16_t refs_count;
   uint16_t refs_offset;
   uint16_t *_Nullable identity_columns;
+  uint16_t *_Nullable encoded_columns;
+  int16_t encode_context_index;
   cql_uint32 rowsize;
   const char *_Nullable autodrop_tables;
   int64_t crc;
   cql_int32 *_Nullable perf_index;
 } cql_fetch_info;
 
+// A column coder sees one column of a whole block of rows at once rather than
+// one value at a time.  `rows` is the first row, the column value in row `i` is
+// at `rows + i * rowsize + offset` and has the given CQL_DATA_TYPE_* type.  If
+// the proc named a context column its index, offset and type are provided,
+// otherwise `context_column` is -1.  The coder may rewrite values in place,
+// reference types must be released if they are replaced.
+typedef struct cql_column_batch {
+  char *_Nonnull rows;
+  cql_uint32 rowsize;
+  cql_int32 count;
+  cql_int32 column;
+  cql_uint16 offset;
+  uint8_t data_type;
+  cql_int32 context_column;
+  cql_uint16 context_offset;
+  uint8_t context_type;
+} cql_column_batch;
+
+typedef void (*cql_column_coder)(
+  void *_Nullable context,
+  cql_column_batch *_Nonnull batch);
+
+// Registers the coder that is applied to the [[vault_sensitive]] columns of
+// every result set as it is created, pass NULL to stop encoding.
+CQL_EXPORT void cql_set_column_encoder(
+  cql_column_coder _Nullable coder,
+  void *_Nullable context);
+
+// Runs the coder over the indicated columns (count first) of all the rows in
+// the result set, this is how encoded columns are decoded in bulk.
+CQL_EXPORT void cql_result_set_code_columns(
+  cql_result_set_ref _Nonnull result_set,
+  const uint16_t *_Nonnull columns,
+  cql_int32 context_column,
+  cql_column_coder _Nonnull coder,
+  void *_Nullable context);
+
 CQL_EXPORT void cql_multifetch_meta(
   char *_Nonnull data,
   cql_fetch_info *_Nonnull info);
@@ -192,6 +347,18 @@ CQL_EXPORT cql_code cql_fetch_all_results(
   cql_fetch_info *_Nonnull info,
   cql_result_set_ref _Nullable *_Nonnull result_set);
 
+// cql_fetch_all_results remembers a smoothed row count for each fetch site
+// (keyed by the proc crc) and uses it to size the row buffer up front.  These
+// let you see what has been learned.  The count is 0 for unknown sites.  The
+// hints are per thread, these see and reset the calling thread's hints.
+CQL_EXPORT cql_int32 cql_fetch_row_hint(int64_t crc);
+CQL_EXPORT cql_int32 cql_fetch_row_hints_count(void);
+CQL_EXPORT void cql_fetch_row_hint_at(
+  cql_int32 index,
+  int64_t *_Nonnull crc,
+  cql_int32 *_Nonnull rows);
+CQL_EXPORT void cql_fetch_row_hints_reset(void);
+
 CQL_EXPORT cql_code cql_one_row_result(
   cql_fetch_info *_Nonnull info,
   char *_Nullable data,
@@ -261,6 +428,71 @@ CQL_EXPORT cql_code cql_exec_frags(
   const char *_Nonnull base,
   const char *_Nonnull frags);
 
+// The statement trace is a fixed size ring of compact events, one for each
+// prepare, exec, bind and result set step loop the runtime does.  It is off
+// until enabled.  Writers never block, when the ring is full the oldest events
+// are overwritten and counted as lost.
+#define CQL_TRACE_PREPARE 1
+#define CQL_TRACE_EXEC    2
+#define CQL_TRACE_BIND    3
+#define CQL_TRACE_STEP    4
+
+typedef struct cql_trace_event {
+  int64_t stmt_id;              // hash of the statement text, see cql_trace_stmt_id
+  const char *_Nullable proc;   // the procedure that ran the statement, if known
+  int64_t duration_ns;
+  cql_int32 rows;               // rows stepped (CQL_TRACE_STEP only)
+  cql_int32 rc;                 // the final sqlite result code
+  cql_int32 kind;               // one of the CQL_TRACE_* values
+} cql_trace_event;
+
+// The running procedure, maintained by cql_error_prepare/cql_error_report.
+CQL_EXPORT CQL_THREAD_LOCAL const char *_Nullable cql_trace_proc;
+
+CQL_EXPORT void cql_trace_set_enabled(cql_bool enabled);
+CQL_EXPORT cql_bool cql_trace_enabled(void);
+
+// Copies out up to max of the oldest undrained events and returns how many.
+// There must only be one drainer at a time but events can be added during the
+// drain.  This doesn't allocate or lock so it can be used from a crash handler.
+CQL_EXPORT cql_int32 cql_trace_drain(cql_trace_event *_Nonnull events, cql_int32 max);
+
+// The number of events that were overwritten before they were drained.
+CQL_EXPORT int64_t cql_trace_lost(void);
+
+// The id used for the statement with the given text.
+CQL_EXPORT int64_t cql_trace_stmt_id(const char *_Nullable sql);
+
+// The slow statement log reports each prepare, exec, or result set step loop
+// that takes at least the threshold.  The strings are only valid during the
+// callback.
+typedef struct cql_slow_statement {
+  const char *_Nonnull sql;           // the statement text, with parameters not values
+  const char *_Nullable proc;         // the procedure that ran the statement, if known
+  const char *_Nonnull param_types;   // the CQL types of the bound parameters e.g. "int!, text"
+  const char *_Nonnull plan;          // EXPLAIN QUERY PLAN output, empty if there is no plan connection
+  int64_t duration_ns;
+  cql_int32 rows;                     // rows stepped (CQL_TRACE_STEP only)
+  cql_int32 rc;                       // the final sqlite result code
+  cql_int32 kind;                     // one of the CQL_TRACE_* values
+} cql_slow_statement;
+
+typedef void (*cql_slow_statement_callback)(
+  const cql_slow_statement *_Nonnull slow,
+  void *_Nullable context);
+
+// The query plan is captured on plan_db, a separate connection to the same
+// database, so the caller's connection and statement are never disturbed.  It
+// must outlive the log.  Enable the log before running statements, the
+// callback can run on any thread that runs statements.
+CQL_EXPORT void cql_slow_statement_log_enable(
+  int64_t threshold_ns,
+  sqlite3 *_Nullable plan_db,
+  cql_slow_statement_callback _Nonnull callback,
+  void *_Nullable context);
+
+CQL_EXPORT void cql_slow_statement_log_disable(void);
+
 CQL_EXPORT void cql_finalize_on_error(
   cql_code rc,
   sqlite3_stmt *_Nullable *_Nonnull pstmt);
@@ -402,6 +634,31 @@ CQL_EXPORT void cql_release_offsets(
   cql_uint16 refs_count,
   cql_uint16 refs_offset);
 
+// Every generated row struct begins with these standard fields so code that
+// doesn't know the shape of a row can still find its references.
+typedef struct cql_row_header {
+  cql_bool _has_row_;
+  cql_uint16 _refs_count_;
+  cql_uint16 _refs_offset_;
+} cql_row_header;
+
+// A row sink receives each row produced by OUT UNION in a procedure marked
+// [[stream_rows]].  The row is borrowed, it is only valid for the duration of
+// the call, so a sink that keeps it must copy it and retain its references.
+// Return false to stop the procedure early; it then returns normally.
+typedef cql_bool (*cql_row_sink)(
+  void *_Nullable context,
+  const void *_Nonnull row,
+  cql_uint32 size);
+
+// The standard sink, context is a cql_bytebuf.  The row is copied into the
+// buffer and its references retained, exactly as the materializing
+// _fetch_results form does.  It never stops the stream.
+CQL_EXPORT cql_bool cql_bytebuf_row_sink(
+  void *_Nullable context,
+  const void *_Nonnull row,
+  cql_uint32 size);
+
 // hash a row in a row set using the metadata
 CQL_EXPORT cql_hash_code cql_row_hash(
   cql_result_set_ref _Nonnull result_set,
@@ -433,6 +690,10 @@ CQL_EXPORT cql_string_ref _Nonnull cql_cursor_format_column(
   cql_dynamic_cursor *_Nonnull dyn_cursor,
   cql_int32 i);
 
+// The null flag of a CQL_DATA_TYPE_NULL_BIT column, it is in the bitmap at the
+// start of a compact row (see cql:compact_rows)
+CQL_EXPORT cql_bool cql_row_null_bit(const char *_Nonnull row, cql_uint32 col);
+
 // compare two rows for equality
 CQL_EXPORT cql_bool cql_rows_equal(
   cql_result_set_ref _Nonnull rs1,
@@ -447,6 +708,36 @@ CQL_EXPORT cql_bool cql_rows_same(
   cql_result_set_ref _Nonnull rs2,
   cql_int32 row2);
 
+// The result of comparing two result sets of the same shape by identity.
+// Rows are matched using the identity columns (see cql_rows_same). All of the
+// index lists are in ascending order.
+//  * new_to_old[j] is the matching old row for new row j or -1 if none
+//  * inserted are new rows with no matching old row
+//  * deleted are old rows with no matching new row
+//  * moved are new rows whose old row is out of order relative to the others
+//  * changed are new rows whose matching old row is not cql_rows_equal
+// Release the lists with cql_result_set_diff_release.
+typedef struct cql_result_set_diff_info {
+  cql_int32 *_Nullable new_to_old;
+  cql_int32 *_Nullable inserted;
+  cql_int32 inserted_count;
+  cql_int32 *_Nullable deleted;
+  cql_int32 deleted_count;
+  cql_int32 *_Nullable moved;
+  cql_int32 moved_count;
+  cql_int32 *_Nullable changed;
+  cql_int32 changed_count;
+} cql_result_set_diff_info;
+
+// diff two result sets using their identity columns
+CQL_EXPORT void cql_result_set_diff(
+  cql_result_set_ref _Nonnull old_rs,
+  cql_result_set_ref _Nonnull new_rs,
+  cql_result_set_diff_info *_Nonnull diff);
+
+// free the index lists produced by cql_result_set_diff
+CQL_EXPORT void cql_result_set_diff_release(cql_result_set_diff_info *_Nonnull diff);
+
 // copy a set of rows from a result_set
 CQL_EXPORT void cql_rowset_copy(
   cql_result_set_ref _Nonnull result_set,
@@ -454,8 +745,32 @@ CQL_EXPORT void cql_rowset_copy(
   cql_int32 from,
   cql_int32 count);
 
+// make a result set that shares a range of rows with a result_set
+CQL_EXPORT void cql_rowset_slice(
+  cql_result_set_ref _Nonnull result_set,
+  cql_result_set_ref _Nonnull *_Nonnull to_result_set,
+  cql_int32 from,
+  cql_int32 count);
+
 // getters
 
+// Getters generated with --unchecked_getters read the column storage directly,
+// the only check they make is that the row is in range, and only in debug builds.
+// A runtime can define the contract itself to make the check unconditional.
+#define cql_unchecked_col_address(result_set, row, col) \
+  ((char *)cql_result_set_get_data(result_set) + \
+   (size_t)(row) * cql_result_set_get_meta(result_set)->rowsize + \
+   cql_result_set_get_meta(result_set)->columnOffsets[(col) + 1])
+
+#ifndef cql_unchecked_getter_contract
+#ifdef NDEBUG
+#define cql_unchecked_getter_contract(result_set, row)
+#else
+#define cql_unchecked_getter_contract(result_set, row) \
+  cql_contract((row) >= 0 && (row) < cql_result_set_get_count(result_set))
+#endif
+#endif
+
 // Generic is_null value getter on base result set object.
 // @param result_set The cql result_set object.
 // @param row The row number to fetch the value for.
@@ -640,6 +955,47 @@ CQL_EXPORT void cql_result_set_set_object_col(
   cql_int32 col,
   cql_object_ref _Nullable new_value);
 
+// Columnar export of a range of rows for language bindings, see
+// cqlrt_common.c for the buffer layout.
+CQL_EXPORT cql_int32 cql_result_set_export_column(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 col,
+  cql_int32 from,
+  cql_int32 count,
+  void *_Nonnull values,
+  uint8_t *_Nullable nulls,
+  char *_Nullable heap,
+  cql_int32 heap_size);
+
+CQL_EXPORT cql_int32 cql_result_set_export_heap_size(
+  cql_result_set_ref _Nonnull result_set,
+  cql_int32 col,
+  cql_int32 from,
+  cql_int32 count);
+
+// Whole result set serialization, the shape is stored once, the strings are
+// stored in a dictionary and the columns are stored in blocks.  See
+// cqlrt_common.c for the format.
+// CQLABI
+CQL_EXPORT cql_code cql_result_set_to_blob(
+  cql_result_set_ref _Nonnull result_set,
+  cql_blob_ref _Nullable *_Nonnull blob);
+
+// The fetch info must have the shape that was serialized, row_header is true
+// for rows that begin with a cql_row_header (OUT and OUT UNION procs).
+CQL_EXPORT cql_code cql_result_set_from_bytes(
+  cql_fetch_info *_Nonnull info,
+  cql_bool row_header,
+  const void *_Nonnull bytes,
+  cql_uint32 size,
+  cql_result_set_ref _Nullable *_Nonnull result_set);
+
+CQL_EXPORT cql_code cql_result_set_from_blob(
+  cql_fetch_info *_Nonnull info,
+  cql_bool row_header,
+  cql_blob_ref _Nullable blob,
+  cql_result_set_ref _Nullable *_Nonnull result_set);
+
 // result set metadata management
 CQL_EXPORT void cql_initialize_meta(
   cql_result_set_meta *_Nonnull meta,
@@ -977,6 +1333,13 @@ CQL_EXPORT cql_code cql_create_udf_stub(
   sqlite3 *_Nonnull db,
   cql_string_ref _Nonnull name);
 
+// The query plan code can be given realistic planner statistics, this loads
+// them into sqlite_stat1 and sqlite_stat4 from a JSON document and makes the
+// planner use them.  See the query plan chapter of the guide for the format.
+CQL_EXPORT cql_code cql_load_planner_stats(
+  sqlite3 *_Nonnull db,
+  cql_string_ref _Nonnull stats);
+
 void bcreatekey(
   sqlite3_context *_Nonnull context,
   cql_int32 argc,
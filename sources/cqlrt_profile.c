@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// The optional profiling runtime, see cqlrt_profile.h.  This file is included
+// by cqlrt.c when CQL_PROFILING is defined.
+
+#include <pthread.h>
+#include <time.h>
+
+// The latency histogram is log-linear in the style of HdrHistogram. Each power
+// of two is split into 4 sub-buckets so any value is within 1/4 of its bucket's
+// bounds.  Values below 4ns get a bucket each.  Anything beyond 2^44ns (about 5
+// hours) goes into the last bucket.
+#define CQL_PROFILE_SUB_BITS 2
+#define CQL_PROFILE_SUB_COUNT (1 << CQL_PROFILE_SUB_BITS)
+#define CQL_PROFILE_MAX_EXP 43
+#define CQL_PROFILE_BUCKETS ((CQL_PROFILE_MAX_EXP - 1) * CQL_PROFILE_SUB_COUNT + CQL_PROFILE_SUB_COUNT)
+
+// The counters for one slot on one thread.  Only the owning thread writes
+// them, the report reads them while they might be changing so both sides use
+// relaxed atomic loads and stores; there is never a read-modify-write.
+typedef struct cql_profile_counters {
+  uint64_t calls;
+  uint64_t rows;
+  uint64_t bytes;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint32_t histogram[CQL_PROFILE_BUCKETS];
+} cql_profile_counters;
+
+typedef struct cql_profile_frame {
+  cql_int32 slot;
+  uint64_t start_ns;
+} cql_profile_frame;
+
+// Each thread that runs a profiled procedure gets one of these.  They are
+// linked into a list for the report and are never freed because the report
+// still wants the counts after the thread is gone.
+typedef struct cql_profile_thread {
+  struct cql_profile_thread *_Nullable next;
+  cql_profile_counters *_Nullable slots[CQL_PROFILE_MAX_SLOTS];
+  cql_int32 depth;
+  cql_profile_frame frames[CQL_PROFILE_MAX_DEPTH];
+} cql_profile_thread;
+
+static _Thread_local cql_profile_thread *_Nullable cql_profile_self;
+
+// This lock guards the slot assignment and the thread list, it is only taken
+// the first time a procedure or thread is seen and by the report.
+static pthread_mutex_t cql_profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cql_profile_thread *_Nullable cql_profile_threads;
+static int64_t cql_profile_crcs[CQL_PROFILE_MAX_SLOTS];
+static cql_int32 cql_profile_slots_used;
+
+#define cql_profile_load(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define cql_profile_store(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static uint64_t cql_profile_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Maps a latency to its histogram bucket.
+static uint32_t cql_profile_bucket(uint64_t ns) {
+  if (ns < CQL_PROFILE_SUB_COUNT) {
+    return (uint32_t)ns;
+  }
+
+  uint32_t exp = 63 - (uint32_t)__builtin_clzll(ns);
+  if (exp > CQL_PROFILE_MAX_EXP) {
+    return CQL_PROFILE_BUCKETS - 1;
+  }
+
+  uint32_t sub = (uint32_t)(ns >> (exp - CQL_PROFILE_SUB_BITS)) & (CQL_PROFILE_SUB_COUNT - 1);
+  return (exp - 1) * CQL_PROFILE_SUB_COUNT + sub;
+}
+
+// The largest latency that maps to the given bucket.
+static uint64_t cql_profile_bucket_max(uint32_t bucket) {
+  if (bucket < CQL_PROFILE_SUB_COUNT) {
+    return bucket;
+  }
+
+  uint32_t exp = bucket / CQL_PROFILE_SUB_COUNT + 1;
+  uint64_t sub = bucket % CQL_PROFILE_SUB_COUNT;
+  uint64_t low = (CQL_PROFILE_SUB_COUNT + sub) << (exp - CQL_PROFILE_SUB_BITS);
+  return low + (1ull << (exp - CQL_PROFILE_SUB_BITS)) - 1;
+}
+
+// Gives the procedure its slot the first time it is seen.  The slot number is
+// stored in its perf_index as slot+1 so that zero means "not yet", a full table
+// stores -1 so we don't come back here.
+static cql_int32 cql_profile_claim_slot(int64_t crc, cql_int32 *_Nonnull index) {
+  pthread_mutex_lock(&cql_profile_mutex);
+
+  cql_int32 value = __atomic_load_n(index, __ATOMIC_ACQUIRE);
+  if (value == 0) {
+    if (cql_profile_slots_used < CQL_PROFILE_MAX_SLOTS) {
+      cql_profile_crcs[cql_profile_slots_used] = crc;
+      value = ++cql_profile_slots_used;
+    }
+    else {
+      value = -1;
+    }
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&cql_profile_mutex);
+  return value;
+}
+
+// The calling thread's state, created and registered on first use.
+static cql_profile_thread *_Nonnull cql_profile_thread_state(void) {
+  cql_profile_thread *self = cql_profile_self;
+  if (!self) {
+    self = calloc(1, sizeof(cql_profile_thread));
+    pthread_mutex_lock(&cql_profile_mutex);
+    self->next = cql_profile_threads;
+    cql_profile_threads = self;
+    pthread_mutex_unlock(&cql_profile_mutex);
+    cql_profile_self = self;
+  }
+  return self;
+}
+
+// The calling thread's counters for the slot, created on first use.  They are
+// published with a release store so the report sees them initialized.
+static cql_profile_counters *_Nonnull cql_profile_counters_for(
+  cql_profile_thread *_Nonnull self,
+  cql_int32 slot)
+{
+  cql_profile_counters *counters = self->slots[slot];
+  if (!counters) {
+    counters = calloc(1, sizeof(cql_profile_counters));
+    __atomic_store_n(&self->slots[slot], counters, __ATOMIC_RELEASE);
+  }
+  return counters;
+}
+
+// Returns the slot for the procedure, or -1 if it isn't profiled.
+static cql_int32 cql_profile_slot(int64_t crc, cql_int32 *_Nullable index) {
+  if (!index) {
+    return -1;
+  }
+
+  cql_int32 value = __atomic_load_n(index, __ATOMIC_ACQUIRE);
+  if (value == 0) {
+    value = cql_profile_claim_slot(crc, index);
+  }
+  return value - 1;
+}
+
+// Called when a procedure starts, this only remembers the start time.
+void cql_profile_begin(int64_t crc, cql_int32 *_Nullable index) {
+  cql_int32 slot = cql_profile_slot(crc, index);
+  if (slot < 0) {
+    return;
+  }
+
+  cql_profile_thread *self = cql_profile_thread_state();
+  if (self->depth < CQL_PROFILE_MAX_DEPTH) {
+    cql_profile_frame *frame = &self->frames[self->depth];
+    frame->slot = slot;
+    frame->start_ns = cql_profile_now_ns();
+  }
+  self->depth++;
+}
+
+// Called when the procedure's result set is complete (or it failed).  The
+// frame for the slot is normally on top of the stack but if some start had no
+// matching stop we unwind to the right frame.
+void cql_profile_end(int64_t crc, cql_int32 *_Nullable index) {
+  cql_int32 slot = cql_profile_slot(crc, index);
+  if (slot < 0) {
+    return;
+  }
+
+  cql_profile_thread *self = cql_profile_thread_state();
+  if (self->depth > CQL_PROFILE_MAX_DEPTH) {
+    // too deep, the start of this call wasn't recorded
+    self->depth--;
+    return;
+  }
+
+  cql_int32 depth = self->depth;
+  while (depth > 0 && self->frames[depth - 1].slot != slot) {
+    depth--;
+  }
+
+  if (depth == 0) {
+    // no matching start
+    return;
+  }
+
+  depth--;
+  uint64_t elapsed = cql_profile_now_ns() - self->frames[depth].start_ns;
+  self->depth = depth;
+
+  cql_profile_counters *c = cql_profile_counters_for(self, slot);
+  cql_profile_store(c->calls, c->calls + 1);
+  cql_profile_store(c->total_ns, c->total_ns + elapsed);
+  if (elapsed > c->max_ns) {
+    cql_profile_store(c->max_ns, elapsed);
+  }
+  uint32_t bucket = cql_profile_bucket(elapsed);
+  cql_profile_store(c->histogram[bucket], c->histogram[bucket] + 1);
+}
+
+// Called with the size of the finished result set just before the end.
+void cql_profile_add_rows(int64_t crc, cql_int32 *_Nullable index, int64_t rows, int64_t bytes) {
+  cql_int32 slot = cql_profile_slot(crc, index);
+  if (slot < 0) {
+    return;
+  }
+
+  cql_profile_counters *c = cql_profile_counters_for(cql_profile_thread_state(), slot);
+  cql_profile_store(c->rows, c->rows + (uint64_t)rows);
+  cql_profile_store(c->bytes, c->bytes + (uint64_t)bytes);
+}
+
+cql_int32 cql_profile_slot_count(void) {
+  pthread_mutex_lock(&cql_profile_mutex);
+  cql_int32 count = cql_profile_slots_used;
+  pthread_mutex_unlock(&cql_profile_mutex);
+  return count;
+}
+
+// The value at the given percentile of the merged histogram.
+static int64_t cql_profile_percentile(
+  uint64_t *_Nonnull histogram,
+  uint64_t total,
+  uint32_t percent,
+  uint64_t max_ns)
+{
+  if (!total) {
+    return 0;
+  }
+
+  uint64_t target = (total * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < CQL_PROFILE_BUCKETS; i++) {
+    seen += histogram[i];
+    if (seen >= target) {
+      uint64_t value = cql_profile_bucket_max(i);
+      return (int64_t)(value < max_ns ? value : max_ns);
+    }
+  }
+  return (int64_t)max_ns;
+}
+
+void cql_profile_get_stats(cql_int32 slot, cql_profile_stats *_Nonnull stats) {
+  memset(stats, 0, sizeof(*stats));
+  uint64_t histogram[CQL_PROFILE_BUCKETS];
+  memset(histogram, 0, sizeof(histogram));
+
+  pthread_mutex_lock(&cql_profile_mutex);
+  cql_contract(slot >= 0 && slot < cql_profile_slots_used);
+  stats->crc = cql_profile_crcs[slot];
+
+  uint64_t max_ns = 0;
+  for (cql_profile_thread *t = cql_profile_threads; t; t = t->next) {
+    cql_profile_counters *c = __atomic_load_n(&t->slots[slot], __ATOMIC_ACQUIRE);
+    if (!c) {
+      continue;
+    }
+    stats->calls += (int64_t)cql_profile_load(c->calls);
+    stats->rows += (int64_t)cql_profile_load(c->rows);
+    stats->bytes += (int64_t)cql_profile_load(c->bytes);
+    stats->total_ns += (int64_t)cql_profile_load(c->total_ns);
+    uint64_t m = cql_profile_load(c->max_ns);
+    if (m > max_ns) {
+      max_ns = m;
+    }
+    for (uint32_t i = 0; i < CQL_PROFILE_BUCKETS; i++) {
+      histogram[i] += cql_profile_load(c->histogram[i]);
+    }
+  }
+  pthread_mutex_unlock(&cql_profile_mutex);
+
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < CQL_PROFILE_BUCKETS; i++) {
+    total += histogram[i];
+  }
+
+  stats->max_ns = (int64_t)max_ns;
+  stats->p50_ns = cql_profile_percentile(histogram, total, 50, max_ns);
+  stats->p90_ns = cql_profile_percentile(histogram, total, 90, max_ns);
+  stats->p99_ns = cql_profile_percentile(histogram, total, 99, max_ns);
+}
+
+void cql_profile_reset(void) {
+  pthread_mutex_lock(&cql_profile_mutex);
+  for (cql_profile_thread *t = cql_profile_threads; t; t = t->next) {
+    for (cql_int32 slot = 0; slot < cql_profile_slots_used; slot++) {
+      cql_profile_counters *c = __atomic_load_n(&t->slots[slot], __ATOMIC_ACQUIRE);
+      if (c) {
+        memset(c, 0, sizeof(*c));
+      }
+    }
+  }
+  pthread_mutex_unlock(&cql_profile_mutex);
+}
+
+// The row shape of the report, this has to match the declaration of
+// cql_profile_report in cqlrt_profile.sql.
+typedef struct cql_profile_report_row {
+  int64_t crc;
+  int64_t calls;
+  int64_t row_count;
+  int64_t bytes;
+  int64_t total_ns;
+  int64_t max_ns;
+  int64_t p50_ns;
+  int64_t p90_ns;
+  int64_t p99_ns;
+} cql_profile_report_row;
+
+static uint8_t cql_profile_report_data_types[] = {
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // crc
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // calls
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // row_count
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // bytes
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // total_ns
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // max_ns
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // p50_ns
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // p90_ns
+  CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL, // p99_ns
+};
+
+static cql_uint16 cql_profile_report_col_offsets[] = { 9,
+  cql_offsetof(cql_profile_report_row, crc),
+  cql_offsetof(cql_profile_report_row, calls),
+  cql_offsetof(cql_profile_report_row, row_count),
+  cql_offsetof(cql_profile_report_row, bytes),
+  cql_offsetof(cql_profile_report_row, total_ns),
+  cql_offsetof(cql_profile_report_row, max_ns),
+  cql_offsetof(cql_profile_report_row, p50_ns),
+  cql_offsetof(cql_profile_report_row, p90_ns),
+  cql_offsetof(cql_profile_report_row, p99_ns),
+};
+
+// Builds the report result set, one row per slot.  The stats struct has the
+// same layout as the row so it can be copied straight in.
+void cql_profile_report_fetch_results(cql_profile_report_result_set_ref _Nullable *_Nonnull result_set) {
+  cql_fetch_info info = {
+    .data_types = cql_profile_report_data_types,
+    .col_offsets = cql_profile_report_col_offsets,
+    .rowsize = sizeof(cql_profile_report_row),
+  };
+
+  cql_int32 count = cql_profile_slot_count();
+  cql_bytebuf b;
+  cql_bytebuf_open(&b);
+
+  for (cql_int32 slot = 0; slot < count; slot++) {
+    cql_profile_stats stats;
+    cql_profile_get_stats(slot, &stats);
+    cql_bytebuf_append(&b, &stats, sizeof(cql_profile_report_row));
+  }
+
+  cql_result_set_meta meta;
+  cql_initialize_meta(&meta, &info);
+  *result_set = (cql_profile_report_result_set_ref)cql_result_set_create(b.ptr, count, meta);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+// This is the optional profiling runtime.  It's enabled by compiling the
+// generated code and cqlrt.c with CQL_PROFILING defined, in which case cqlrt.h
+// includes this file rather than defining the profiling hooks as no-ops.
+//
+// Every procedure that produces a result set calls cql_profile_start with its
+// CRC and the address of its perf_index.  On the first call the procedure is
+// given a dense slot number which is stored in the perf_index so later calls
+// go straight to their counters.  The counters are kept per thread so the hot
+// path takes no locks, the report sums them up over all the threads.
+//
+// This runtime uses pthreads, _Thread_local, and the gcc/clang __atomic
+// builtins.
+
+// The most procedures that will get a slot, calls to others are not profiled.
+#define CQL_PROFILE_MAX_SLOTS 512
+
+// Nested calls deeper than this are not timed.
+#define CQL_PROFILE_MAX_DEPTH 64
+
+typedef struct cql_profile_stats {
+  int64_t crc;        // the CRC of the procedure (CRC_proc_name)
+  int64_t calls;      // number of completed calls
+  int64_t rows;       // rows returned in total
+  int64_t bytes;      // bytes of row storage materialized in total
+  int64_t total_ns;   // total time in the procedure
+  int64_t max_ns;     // the slowest call
+  int64_t p50_ns;     // percentiles from the latency histogram, these are
+  int64_t p90_ns;     // accurate to within 1/4 of the value
+  int64_t p99_ns;
+} cql_profile_stats;
+
+void cql_profile_begin(int64_t crc, cql_int32 *_Nullable index);
+void cql_profile_end(int64_t crc, cql_int32 *_Nullable index);
+void cql_profile_add_rows(int64_t crc, cql_int32 *_Nullable index, int64_t rows, int64_t bytes);
+
+// The number of procedures that have a slot so far.
+cql_int32 cql_profile_slot_count(void);
+
+// Fills in the stats for the indicated slot (0 to count-1) summed over all
+// threads.
+void cql_profile_get_stats(cql_int32 slot, cql_profile_stats *_Nonnull stats);
+
+// Clears the counters, the slots are kept.  Calls that are running on other
+// threads at the same time might not be completely cleared.
+void cql_profile_reset(void);
+
+// The implementation of the CQL procedure `cql_profile_report`, see
+// cqlrt_profile.sql, one row per slot with the columns of cql_profile_stats.
+#ifndef result_set_type_decl_cql_profile_report_result_set
+#define result_set_type_decl_cql_profile_report_result_set 1
+cql_result_set_type_decl(cql_profile_report_result_set, cql_profile_report_result_set_ref);
+#endif
+
+void cql_profile_report_fetch_results(cql_profile_report_result_set_ref _Nullable *_Nonnull result_set);
+
+#define cql_profile_start(crc, index) cql_profile_begin(crc, index);
+#define cql_profile_stop(crc, index) cql_profile_end(crc, index);
+#define cql_profile_rows(crc, index, rows, bytes) cql_profile_add_rows(crc, index, rows, bytes);
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+-- The profiling report, available when the runtime is compiled with
+-- CQL_PROFILING (see cqlrt_profile.h).  One row per profiled procedure, the
+-- procedure is identified by its CRC (CRC_proc_name in the generated code).
+-- Times are in nanoseconds, the percentiles are accurate to within 1/4.
+declare proc cql_profile_report() out union (
+  crc long!,
+  calls long!,
+  row_count long!,
+  bytes long!,
+  total_ns long!,
+  max_ns long!,
+  p50_ns long!,
+  p90_ns long!,
+  p99_ns long!
+);
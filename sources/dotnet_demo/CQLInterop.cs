@@ -145,6 +145,116 @@ public sealed class CQLResultSet {
     return new CQLResultSet(copy(result_set_ref, row, count));
   }
 
+  // Bulk readers: each of these reads a column of rows [from, from + count)
+  // with one native call rather than one call per cell.  The arrays are pinned
+  // for the call so the native code writes straight into them.
+
+  private static bool isNullBit(byte[] nulls, int i) {
+    return ((nulls[i >> 3] >> (i & 7)) & 1) != 0;
+  }
+
+  private static byte[] newNulls(int count) {
+    return new byte[(count + 7) / 8];
+  }
+
+  public bool[] getBooleanColumn(int column, int from, int count) {
+    byte[] values = new byte[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null, 0);
+    return Array.ConvertAll(values, b => b != 0);
+  }
+
+  public bool?[] getNullableBooleanColumn(int column, int from, int count) {
+    byte[] values = new byte[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null, 0);
+    bool?[] result = new bool?[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i] != 0;
+    }
+    return result;
+  }
+
+  public int[] getIntegerColumn(int column, int from, int count) {
+    int[] values = new int[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null, 0);
+    return values;
+  }
+
+  public int?[] getNullableIntegerColumn(int column, int from, int count) {
+    int[] values = new int[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null, 0);
+    int?[] result = new int?[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i];
+    }
+    return result;
+  }
+
+  public long[] getLongColumn(int column, int from, int count) {
+    long[] values = new long[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null, 0);
+    return values;
+  }
+
+  public long?[] getNullableLongColumn(int column, int from, int count) {
+    long[] values = new long[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null, 0);
+    long?[] result = new long?[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i];
+    }
+    return result;
+  }
+
+  public double[] getDoubleColumn(int column, int from, int count) {
+    double[] values = new double[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null, 0);
+    return values;
+  }
+
+  public double?[] getNullableDoubleColumn(int column, int from, int count) {
+    double[] values = new double[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null, 0);
+    double?[] result = new double?[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i];
+    }
+    return result;
+  }
+
+  public String[] getStringColumn(int column, int from, int count) {
+    int[] offsets = new int[count + 1];
+    byte[] nulls = newNulls(count);
+    int heapSize = exportHeapSize(result_set_ref, column, from, count);
+    byte[] heap = new byte[heapSize];
+    exportColumn(result_set_ref, column, from, count, offsets, nulls, heap, heapSize);
+    String[] result = new String[count];
+    for (int i = 0; i < count; i++) {
+      if (!isNullBit(nulls, i)) {
+        result[i] = Encoding.UTF8.GetString(heap, offsets[i], offsets[i + 1] - offsets[i]);
+      }
+    }
+    return result;
+  }
+
+  public byte[][] getBlobColumn(int column, int from, int count) {
+    int[] offsets = new int[count + 1];
+    byte[] nulls = newNulls(count);
+    int heapSize = exportHeapSize(result_set_ref, column, from, count);
+    byte[] heap = new byte[heapSize];
+    exportColumn(result_set_ref, column, from, count, offsets, nulls, heap, heapSize);
+    byte[][] result = new byte[count][];
+    for (int i = 0; i < count; i++) {
+      if (!isNullBit(nulls, i)) {
+        result[i] = heap[offsets[i]..offsets[i + 1]];
+      }
+    }
+    return result;
+  }
+
   [DllImport(@"cql_interop.dll")]
   public static extern void close(long result_set_ref);
 
@@ -189,6 +299,26 @@ public sealed class CQLResultSet {
 
   [DllImport(@"cql_interop.dll")]
   public static extern long copy(long result_set_ref, int row, int count);
+
+  // one entry point, the values array type depends on the column type
+  [DllImport(@"cql_interop.dll")]
+  public static extern int exportColumn(long result_set_ref, int column, int from, int count,
+    byte[] values, byte[]? nulls, byte[]? heap, int heapSize);
+
+  [DllImport(@"cql_interop.dll")]
+  public static extern int exportColumn(long result_set_ref, int column, int from, int count,
+    int[] values, byte[]? nulls, byte[]? heap, int heapSize);
+
+  [DllImport(@"cql_interop.dll")]
+  public static extern int exportColumn(long result_set_ref, int column, int from, int count,
+    long[] values, byte[]? nulls, byte[]? heap, int heapSize);
+
+  [DllImport(@"cql_interop.dll")]
+  public static extern int exportColumn(long result_set_ref, int column, int from, int count,
+    double[] values, byte[]? nulls, byte[]? heap, int heapSize);
+
+  [DllImport(@"cql_interop.dll")]
+  public static extern int exportHeapSize(long result_set_ref, int column, int from, int count);
 }
 
 /**
@@ -139,6 +139,23 @@ public class MyCode {
         Expect(formatted.Equals(t), "invalid format transform through the CQL");
       }
     }
+
+    // the bulk readers get the same values with one native call per column
+    var names = data.get_name_column(0, count);
+    var ages = data.get_age_column(0, count);
+    var things = data.get_thing_column(0, count);
+    var blobs = data.get_bytes_column(0, count);
+    var keys = data.get_key1_column(1, count - 1);
+    for (int i = 0; i < count; i++) {
+      Expect(names[i].Equals(data.get_name(i)), "bulk name mismatch");
+      Expect(ages[i] == data.get_age(i), "bulk age mismatch");
+      Expect(things[i] == data.get_thing(i), "bulk thing mismatch");
+      Expect(blobs[i].SequenceEqual(data.get_bytes(i)), "bulk blob mismatch");
+      if (i > 0) {
+        Expect(keys[i - 1].Equals(data.get_key1(i)), "bulk key1 mismatch");
+      }
+    }
+    Console.WriteLine("bulk column readers match");
   }
 
   public static void Expect(bool b, String str) {
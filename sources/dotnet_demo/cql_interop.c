@@ -127,3 +127,26 @@ cql_int64 copy(cql_int64 rs, cql_int32 row, cql_int32 count) {
   cql_rowset_copy(ref, &refNew, row, count);
   return (cql_int64)refNew;
 }
+
+// Columnar export, values is an int, long, double, or byte (for bool) array
+// depending on the column type, or the int offsets for text and blob columns.
+cql_int32 exportColumn(
+  cql_int64 rs,
+  cql_int32 col,
+  cql_int32 from,
+  cql_int32 count,
+  void *values,
+  uint8_t *nulls,
+  char *heap,
+  cql_int32 heap_size)
+{
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+
+  return cql_result_set_export_column(ref, col, from, count, values, nulls, heap, heap_size);
+}
+
+cql_int32 exportHeapSize(cql_int64 rs, cql_int32 col, cql_int32 from, cql_int32 count) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+
+  return cql_result_set_export_heap_size(ref, col, from, count);
+}
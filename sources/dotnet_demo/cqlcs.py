@@ -665,6 +665,17 @@ def emit_result_set_projection(proc, attributes):
         )
         print("    }\n")
 
+        # result sets with rows also get a bulk reader that gets a range of the
+        # column with one native call, child result sets are only read per cell
+        if not hasOutResult and getter != "ChildResultSet":
+            print(
+                f"    public {c_type}{q}[] get_{c_name}_column(int from, int count) {{"
+            )
+            print(
+                f"      return mResultSet.get{nullable}{getter}Column({col}, from, count);"
+            )
+            print("    }\n")
+
         col += 1
 
 
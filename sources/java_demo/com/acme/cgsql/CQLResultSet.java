@@ -7,6 +7,9 @@
 
 package com.acme.cgsql;
 
+import java.nio.charset.StandardCharsets;
+import java.util.Arrays;
+
 /**
  * CQLResultSet is a simple utility class that holds a native cql_result_set_ref
  *
@@ -124,6 +127,115 @@ public final class CQLResultSet {
     return getIsEncoded(result_set_ref, column);
   }
 
+  // Bulk readers: each of these reads a column of rows [from, from + count)
+  // with one native call rather than one call per cell.  The nullable versions
+  // box the values, text and blobs come back as null when the cell is null.
+  // Untested: these and the JNI exportColumn have not been compiled yet.
+
+  private static boolean isNullBit(byte[] nulls, int i) {
+    return ((nulls[i >> 3] >> (i & 7)) & 1) != 0;
+  }
+
+  private static byte[] newNulls(int count) {
+    return new byte[(count + 7) / 8];
+  }
+
+  public boolean[] getBooleanColumn(int column, int from, int count) {
+    boolean[] values = new boolean[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null);
+    return values;
+  }
+
+  public Boolean[] getNullableBooleanColumn(int column, int from, int count) {
+    boolean[] values = new boolean[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null);
+    Boolean[] result = new Boolean[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i];
+    }
+    return result;
+  }
+
+  public int[] getIntegerColumn(int column, int from, int count) {
+    int[] values = new int[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null);
+    return values;
+  }
+
+  public Integer[] getNullableIntegerColumn(int column, int from, int count) {
+    int[] values = new int[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null);
+    Integer[] result = new Integer[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i];
+    }
+    return result;
+  }
+
+  public long[] getLongColumn(int column, int from, int count) {
+    long[] values = new long[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null);
+    return values;
+  }
+
+  public Long[] getNullableLongColumn(int column, int from, int count) {
+    long[] values = new long[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null);
+    Long[] result = new Long[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i];
+    }
+    return result;
+  }
+
+  public double[] getDoubleColumn(int column, int from, int count) {
+    double[] values = new double[count];
+    exportColumn(result_set_ref, column, from, count, values, null, null);
+    return values;
+  }
+
+  public Double[] getNullableDoubleColumn(int column, int from, int count) {
+    double[] values = new double[count];
+    byte[] nulls = newNulls(count);
+    exportColumn(result_set_ref, column, from, count, values, nulls, null);
+    Double[] result = new Double[count];
+    for (int i = 0; i < count; i++) {
+      result[i] = isNullBit(nulls, i) ? null : values[i];
+    }
+    return result;
+  }
+
+  public String[] getStringColumn(int column, int from, int count) {
+    int[] offsets = new int[count + 1];
+    byte[] nulls = newNulls(count);
+    byte[] heap = new byte[exportHeapSize(result_set_ref, column, from, count)];
+    exportColumn(result_set_ref, column, from, count, offsets, nulls, heap);
+    String[] result = new String[count];
+    for (int i = 0; i < count; i++) {
+      if (!isNullBit(nulls, i)) {
+        result[i] = new String(heap, offsets[i], offsets[i + 1] - offsets[i], StandardCharsets.UTF_8);
+      }
+    }
+    return result;
+  }
+
+  public byte[][] getBlobColumn(int column, int from, int count) {
+    int[] offsets = new int[count + 1];
+    byte[] nulls = newNulls(count);
+    byte[] heap = new byte[exportHeapSize(result_set_ref, column, from, count)];
+    exportColumn(result_set_ref, column, from, count, offsets, nulls, heap);
+    byte[][] result = new byte[count][];
+    for (int i = 0; i < count; i++) {
+      if (!isNullBit(nulls, i)) {
+        result[i] = Arrays.copyOfRange(heap, offsets[i], offsets[i + 1]);
+      }
+    }
+    return result;
+  }
+
   // native calls
   public native void close(long result_set_ref);
 
@@ -154,4 +266,9 @@ public final class CQLResultSet {
   public native long copy(long result_set_ref, int row, int count);
 
   public native boolean getIsEncoded(long result_set_ref, int column);
+
+  public native int exportColumn(
+      long result_set_ref, int column, int from, int count, Object values, byte[] nulls, byte[] heap);
+
+  public native int exportHeapSize(long result_set_ref, int column, int from, int count);
 }
@@ -719,6 +719,18 @@ def emit_result_set_projection(proc, attributes):
         )
         print("    }\n")
 
+        # result sets with rows also get a bulk reader that gets a range of the
+        # column with one JNI call, child result sets are only read per cell
+        if not hasOutResult and getter != "ChildResultSet":
+            col_type = nullable_types[p["type"]] if nullable else c_type
+            print(
+                f"    public {col_type}[] get_{c_name}_column(int from, int count) {{"
+            )
+            print(
+                f"      return mResultSet.get{nullable}{getter}Column({col}, from, count);"
+            )
+            print("    }\n")
+
         col += 1
 
 
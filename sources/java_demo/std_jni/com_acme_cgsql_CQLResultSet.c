@@ -195,3 +195,44 @@ JNIEXPORT jlong JNICALL Java_com_acme_cgsql_CQLResultSet_copy
   cql_rowset_copy(ref, &refNew, row, count);
   return (jlong)refNew;
 }
+
+/*
+ * Class:     com_acme_cgsql_CQLResultSet
+ * Method:    exportColumn
+ * Signature: (JIIILjava/lang/Object;[B[B)I
+ */
+JNIEXPORT jint JNICALL Java_com_acme_cgsql_CQLResultSet_exportColumn
+  (JNIEnv *env, jobject thiz, jlong rs, jint col, jint from, jint count,
+   jobject values, jbyteArray nulls, jbyteArray heap) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+
+  // the values array is int[], long[], double[], or boolean[] depending on the
+  // column type, the export writes straight into the java arrays
+  jint heap_size = heap ? (*env)->GetArrayLength(env, heap) : 0;
+  void *values_ptr = (*env)->GetPrimitiveArrayCritical(env, (jarray)values, NULL);
+  void *nulls_ptr = nulls ? (*env)->GetPrimitiveArrayCritical(env, nulls, NULL) : NULL;
+  void *heap_ptr = heap ? (*env)->GetPrimitiveArrayCritical(env, heap, NULL) : NULL;
+
+  jint result = cql_result_set_export_column(ref, col, from, count, values_ptr, nulls_ptr, heap_ptr, heap_size);
+
+  if (heap_ptr) {
+    (*env)->ReleasePrimitiveArrayCritical(env, heap, heap_ptr, 0);
+  }
+  if (nulls_ptr) {
+    (*env)->ReleasePrimitiveArrayCritical(env, nulls, nulls_ptr, 0);
+  }
+  (*env)->ReleasePrimitiveArrayCritical(env, (jarray)values, values_ptr, 0);
+  return result;
+}
+
+/*
+ * Class:     com_acme_cgsql_CQLResultSet
+ * Method:    exportHeapSize
+ * Signature: (JIII)I
+ */
+JNIEXPORT jint JNICALL Java_com_acme_cgsql_CQLResultSet_exportHeapSize
+  (JNIEnv *env, jobject thiz, jlong rs, jint col, jint from, jint count) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+
+  return cql_result_set_export_heap_size(ref, col, from, count);
+}
@@ -1568,6 +1568,22 @@ cql_noexport bool_t is_proc_emit_setters(ast_node *_Nonnull proc_stmt) {
   return misc_attrs && exists_attribute_str(misc_attrs, "emit_setters");
 }
 
+// helper to search for the indicated misc attribute on a procedure
+cql_noexport bool_t is_proc_compact_rows(ast_node *_Nonnull proc_stmt) {
+  Contract(is_ast_create_proc_stmt(proc_stmt) || is_ast_declare_proc_stmt(proc_stmt));
+  EXTRACT_MISC_ATTRS(proc_stmt, misc_attrs);
+
+  return misc_attrs && exists_attribute_str(misc_attrs, "compact_rows");
+}
+
+// helper to search for the indicated misc attribute on a procedure
+cql_noexport bool_t is_proc_stream_rows(ast_node *_Nonnull proc_stmt) {
+  Contract(is_ast_create_proc_stmt(proc_stmt) || is_ast_declare_proc_stmt(proc_stmt));
+  EXTRACT_MISC_ATTRS(proc_stmt, misc_attrs);
+
+  return misc_attrs && exists_attribute_str(misc_attrs, "stream_rows");
+}
+
 // helper to search for the indicated misc attribute on a procedure
 cql_noexport bool_t is_proc_shared_fragment(ast_node *_Nonnull proc_stmt) {
   Contract(is_ast_create_proc_stmt(proc_stmt) || is_ast_declare_proc_stmt(proc_stmt));
@@ -10773,7 +10789,8 @@ static void sem_expr_call(ast_node *ast, CSTR cstr) {
   return;
 
 additional_checks:
-  if (!StrCaseCmp(name, "cql_cursor_to_blob")) {
+  if (!StrCaseCmp(name, "cql_cursor_to_blob") ||
+      !StrCaseCmp(name, "cql_cursor_to_fixed_blob")) {
      Contract(arg_count == 1); // already failed if wrong
      sem_infer_result_blob_type(ast, arg_list);
   }
@@ -23483,14 +23500,16 @@ static void sem_call_stmt_opt_cursor(ast_node *ast, CSTR cursor_name) {
   ast->sem = name_ast->sem;
 }
 
-// some procedures require additional checks, so far only two
-// if this list grows we'll use a name table like the other cases
+// some procedures require additional checks, so far only the cursor
+// serialization helpers, if this list grows we'll use a name table like the
+// other cases
 static void sem_proc_call_post_check(CSTR name, ast_node *ast, ast_node *arg_list) {
   Contract(is_ast_call_stmt(ast));
   Contract(!is_error(ast));
   Contract(name);
 
-  if (!StrCaseCmp("cql_cursor_from_blob", name)) {
+  if (!StrCaseCmp("cql_cursor_from_blob", name) ||
+      !StrCaseCmp("cql_cursor_view_from_blob", name)) {
     // additional validation for cql_cursor_from_blob -- ensure blob is compatible
     Contract(is_ast_arg_list(arg_list));
     EXTRACT_ANY_NOTNULL(cursor, arg_list->left);
@@ -23507,7 +23526,8 @@ static void sem_proc_call_post_check(CSTR name, ast_node *ast, ast_node *arg_lis
       sem_set_has_row_improved(cursor->sem->name);
     }
   }
-  else if (!StrCaseCmp("cql_cursor_to_blob", name)) {
+  else if (!StrCaseCmp("cql_cursor_to_blob", name) ||
+           !StrCaseCmp("cql_cursor_to_fixed_blob", name)) {
     // additional validation for cql_cursor_to_blob -- ensure blob is compatible
     Contract(is_ast_arg_list(arg_list));
     EXTRACT_ANY_NOTNULL(cursor, arg_list->left);
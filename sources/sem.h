@@ -264,6 +264,8 @@ cql_noexport bool_t is_proc_private(ast_node *proc_stmt);
 cql_noexport bool_t is_proc_suppress_result_set(ast_node *proc_stmt);
 cql_noexport bool_t is_proc_suppress_getters(ast_node *proc_stmt);
 cql_noexport bool_t is_proc_emit_setters(ast_node *proc_stmt);
+cql_noexport bool_t is_proc_compact_rows(ast_node *proc_stmt);
+cql_noexport bool_t is_proc_stream_rows(ast_node *proc_stmt);
 cql_noexport bool_t is_proc_shared_fragment(ast_node *ast);
 cql_noexport bool_t is_alias_ast(ast_node *ast);
 cql_noexport CSTR get_inserted_table_alias_string_override(ast_node *ast);
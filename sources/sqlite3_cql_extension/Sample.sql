@@ -34,6 +34,76 @@ begin
   end;
 end;
 
+-- a select result is streamed, the rows are only computed as they
+-- are consumed so a limit on the outside bounds the work done here
+proc numbers(n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i, printf("number_%d", i) as label, i % 2 = 0 as even from nums;
+end;
+
+-- the plan attributes, step may be left out and is then NULL
+[[tvf_optional=step]]
+[[tvf_rows=10]]
+[[tvf_cost=50]]
+proc stepped(n int!, step int)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i * ifnull(step, 1) as v from nums;
+end;
+
+-- the results are reused when the same argument comes up again in a statement
+[[tvf_memoize]]
+[[tvf_memoize_limit=2]]
+proc memo_rows(x int!)
+begin
+  with recursive
+    nums(i) as (select 1 union all select i + 1 from nums limit x)
+  select i, i * 10 as w from nums;
+end;
+
+-- nullable columns of every type, the memo makes this a result set so the
+-- columns are read by the accessors, odd rows are all null
+[[tvf_memoize]]
+proc nullable_cols(n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i as id,
+    iif(i % 2, null, i % 4 = 0) as nb,
+    iif(i % 2, null, i * 10) as ni,
+    iif(i % 2, null, i * 100L) as nl,
+    iif(i % 2, null, i * 1.5) as nr,
+    iif(i % 2, null, printf("row %d", i)) as nt,
+    iif(i % 2, null, printf("blob %d", i) ~blob~) as nbl
+  from nums;
+end;
+
+-- the same in the compact layout where the nulls are in a bitmap
+[[tvf_memoize]]
+[[compact_rows]]
+proc compact_nullable_cols(n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i as id,
+    iif(i % 2, null, i % 4 = 0) as nb,
+    iif(i % 2, null, i * 10) as ni,
+    iif(i % 2, null, i * 100L) as nl,
+    iif(i % 2, null, i * 1.5) as nr,
+    iif(i % 2, null, printf("row %d", i)) as nt,
+    iif(i % 2, null, printf("blob %d", i) ~blob~) as nbl
+  from nums;
+end;
+
+-- more arguments than SQLite will omit the checks for
+proc wide_args(a1 int!, a2 int!, a3 int!, a4 int!, a5 int!, a6 int!, a7 int!, a8 int!, a9 int!, a10 int!, a11 int!, a12 int!, a13 int!, a14 int!, a15 int!, a16 int!, a17 int!, a18 int!)
+begin
+  select a1 + a2 + a3 + a4 + a5 + a6 + a7 + a8 + a9 + a10 + a11 + a12 + a13 + a14 + a15 + a16 + a17 + a18 as total;
+end;
+
 -- first of 3 tests that aim to ensure each arg type can be
 -- verified and marshalled correctly.  We use 3 tests
 -- because the max number of args is 16 if we are going to
@@ -47,6 +47,9 @@ SELECT FUNC inout__real__nullable(`inout__x` real) real;
 SELECT FUNC inout__text__not_null(`inout__x` text!) text!;
 SELECT FUNC inout__text__nullable(`inout__x` text) text;
 SELECT FUNC many_rows(`x` integer) (`x` integer!, `y` integer!, `z` text!);
+SELECT FUNC numbers(`n` integer!) (`i` integer!, `label` text!, `even` bool!);
+SELECT FUNC nullable_cols(`n` integer!) (`id` integer!, `nb` bool, `ni` integer, `nl` long, `nr` real, `nt` text, `nbl` blob);
+SELECT FUNC compact_nullable_cols(`n` integer!) (`id` integer!, `nb` bool, `ni` integer, `nl` long, `nr` real, `nt` text, `nbl` blob);
 SELECT FUNC out__blob__not_null() blob!;
 SELECT FUNC out__blob__nullable() blob;
 SELECT FUNC out__bool__not_null() bool!;
@@ -101,6 +104,25 @@ begin
   end if;
 end;
 
+-- checks the columns of nullable_cols or compact_nullable_cols, the
+-- even rows have values and the odd rows are all null
+@macro(stmt_list) nullable_cols!(f! expr)
+begin
+  cursor @tmp(C) for
+    select count(ni) c, sum(nb) b, sum(ni) i, sum(nl) l, sum(nr) r, max(nt) t, count(nbl) bl,
+      sum(nbl == cast("blob 2" as blob)) blob_match
+    from @id(f!)(6);
+  fetch @tmp(C);
+  EXPECT_EQ!(@tmp(C).c, 3);
+  EXPECT_EQ!(@tmp(C).b, 2);
+  EXPECT_EQ!(@tmp(C).i, 60);
+  EXPECT_EQ!(@tmp(C).l, 600);
+  EXPECT_EQ!(@tmp(C).r, 9.0);
+  EXPECT_EQ!(@tmp(C).t, "row 4");
+  EXPECT_EQ!(@tmp(C).bl, 3);
+  EXPECT_EQ!(@tmp(C).blob_match, 1);
+end;
+
 -- we'll itemize the various declared functions above and
 -- test each one in turn.  The first few tests are chatty
 -- because that's where things are likely to go wrong
@@ -171,6 +193,40 @@ begin
   end;
   EXPECT_EQ!(got, wanted);
 
+  -- the producer is streamed so only the rows that are fetched get computed
+  -- a materialized version of this would never finish
+  cursor N for select * from numbers(2000000000);
+  got := 0;
+  loop fetch N
+  begin
+    EXPECT_EQ!(N.i, got);
+    EXPECT_EQ!(N.label, printf("number_%d", got));
+    got += 1;
+    if got == 3 leave;
+  end;
+  close N;
+  EXPECT_EQ!(got, 3);
+
+  -- LIMIT and constraints on result columns are left to SQLite
+  let limited := (select count(*) from (select * from numbers(2000000000) limit 5));
+  EXPECT_EQ!(limited, 5);
+  let seven := (select label from numbers(10) where i = 7);
+  EXPECT_EQ!(seven, "number_7");
+
+  -- every type of nullable column in both row layouts
+  nullable_cols!(nullable_cols);
+  nullable_cols!(compact_nullable_cols);
+
+  -- the inner scan is filtered again for each outer row, restarting its statement
+  let joined := (select sum(b.i) from numbers(3) a join numbers(4) b);
+  EXPECT_EQ!(joined, 18);
+
+  -- streamed columns convert just like materialized ones
+  let evens := (select sum(even) from numbers(10));
+  EXPECT_EQ!(evens, 5);
+  let label := (select max(label) from numbers(8));
+  EXPECT_EQ!(label, "number_7");
+
   var i int;
   var l long;
   var r real;
@@ -279,8 +335,8 @@ begin
   let bl_nn := (select x'1234');
 
   -- comprehensive test of all the types in 3 parts
-  -- this used to be one bit test but then there are too many arguments
-  -- 16 is the max SQLite can handle.
+  -- this used to be one big test when 16 arguments was the limit, see
+  -- wide_args in plan_test for calls with more arguments than that.
 
   t := (select result from comprehensive_test1(
     false, null, 1.5, null, 1, null, 12345679012345L, null, 'foo', null,  (select x'1234'), null));
@@ -299,6 +355,8 @@ end;
 
 
 @echo C, '
+#include "cql_sqlite_extension.h"
+
 int sqlite3_cqlextension_init(sqlite3 *_Nonnull db, char *_Nonnull *_Nonnull pzErrMsg, const sqlite3_api_routines *_Nonnull pApi);
 
 #define trace_printf(x,...)
@@ -334,6 +392,89 @@ void explicit_test(sqlite3 *db) {
     printf("done explicit test\n");
 }
 
+// check one integer result of a query, this is raw SQL because CQL wants
+// every argument of a table valued function and some of these leave one out
+static void expect_int(sqlite3 *db, const char *sql, int expected) {
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (rc == SQLITE_OK) rc = sqlite3_step(stmt);
+  if (rc != SQLITE_ROW || sqlite3_column_int(stmt, 0) != expected) {
+    printf("error: %s: %s\n", sql, sqlite3_errmsg(db));
+    exit(1);
+  }
+  sqlite3_finalize(stmt);
+}
+
+// the plans made by xBestIndex from the tvf attributes
+void plan_test(sqlite3 *db) {
+  printf("plan test\n");
+
+  // the optional step argument may be left out
+  expect_int(db, "SELECT sum(v) FROM stepped(3)", 3);
+  expect_int(db, "SELECT sum(v) FROM stepped(3, 10)", 30);
+
+  // without the required argument there is no plan at all
+  sqlite3_stmt *stmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "SELECT * FROM stepped", -1, &stmt, NULL);
+  printf("missing argument: %s\n", sqlite3_errmsg(db));
+  if (rc == SQLITE_OK) exit(1);
+
+  // the argument comes from a table that is named later, SQLite has to scan
+  // that table first so that the argument is available
+  sqlite3_exec(db, "CREATE TABLE plan_t(x INT); INSERT INTO plan_t VALUES (2), (3);", NULL, NULL, NULL);
+  expect_int(db, "SELECT sum(s.v) FROM stepped(plan_t.x) s JOIN plan_t", 4);
+
+  // SQLite checks the arguments past 16 itself using the hidden columns
+  expect_int(db, "SELECT total FROM wide_args(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18)", 171);
+
+  printf("done plan test\n");
+}
+
+// the rescans get new result sets, the values from the earlier ones must
+// still be good after those are gone
+void accessor_test(sqlite3 *db) {
+  printf("accessor test\n");
+  // the largest values are "row 8" and "blob 8", we pull out the 8
+  expect_int(db, "SELECT substr(max(b.nt), 5) FROM plan_t JOIN nullable_cols(plan_t.x * 3) b", 8);
+  expect_int(db, "SELECT substr(CAST(max(b.nbl) AS TEXT), 6) FROM plan_t JOIN compact_nullable_cols(plan_t.x * 3) b", 8);
+  expect_int(db, "SELECT substr(max(b.z), 6) FROM plan_t JOIN many_rows(plan_t.x * 3) b", 8);
+
+  // a correlated subquery closes and reopens the cursor for each outer row
+  // while max() still holds the best value, so that value must be a copy
+  sqlite3_exec(db, "CREATE TABLE accessor_t(x INT); INSERT INTO accessor_t VALUES (9), (3), (5), (7);", NULL, NULL, NULL);
+  expect_int(db, "SELECT substr(max((SELECT nt FROM nullable_cols(accessor_t.x) WHERE id = accessor_t.x - 1)), 5) FROM accessor_t", 8);
+  expect_int(db, "SELECT substr(CAST(max((SELECT nbl FROM compact_nullable_cols(accessor_t.x) WHERE id = accessor_t.x - 1)) AS TEXT), 6) FROM accessor_t", 8);
+  printf("done accessor test\n");
+}
+
+extern cql_rowset_memo memo_rows_memo;
+
+// the memoized tvf on the inner side of a join, the outer rows repeat
+void memo_test(sqlite3 *db) {
+  printf("memo test\n");
+
+  // 1, 2, 1, 2, 1 computes each distinct argument once
+  sqlite3_exec(db, "CREATE TABLE memo_t(x INT); INSERT INTO memo_t VALUES (1), (2), (1), (2), (1);", NULL, NULL, NULL);
+  expect_int(db, "SELECT sum(m.w) FROM memo_t JOIN memo_rows(memo_t.x) m", 90);
+  printf("hits %lld misses %lld\n", (long long)memo_rows_memo.hits, (long long)memo_rows_memo.misses);
+  if (memo_rows_memo.hits != 3 || memo_rows_memo.misses != 2) exit(1);
+
+  // the cache holds two results, 3 pushes out 1 so the last 1 is computed again
+  sqlite3_exec(db, "DELETE FROM memo_t; INSERT INTO memo_t VALUES (1), (2), (3), (1);", NULL, NULL, NULL);
+  expect_int(db, "SELECT sum(m.w) FROM memo_t JOIN memo_rows(memo_t.x) m", 110);
+  printf("hits %lld misses %lld\n", (long long)memo_rows_memo.hits, (long long)memo_rows_memo.misses);
+  if (memo_rows_memo.hits != 3 || memo_rows_memo.misses != 6) exit(1);
+
+  // a correlated subquery opens a new cursor for each outer row, so the
+  // repeated arguments are not remembered
+  sqlite3_exec(db, "DELETE FROM memo_t; INSERT INTO memo_t VALUES (1), (1), (1), (1);", NULL, NULL, NULL);
+  expect_int(db, "SELECT sum((SELECT sum(w) FROM memo_rows(memo_t.x))) FROM memo_t", 40);
+  printf("hits %lld misses %lld\n", (long long)memo_rows_memo.hits, (long long)memo_rows_memo.misses);
+  if (memo_rows_memo.hits != 3 || memo_rows_memo.misses != 10) exit(1);
+
+  printf("done memo test\n");
+}
+
 int main(int argc, char **argv) {
   // create an in-memory database
   sqlite3 *db = NULL;
@@ -350,6 +491,9 @@ int main(int argc, char **argv) {
 
   // this is a hand written test case
   explicit_test(db);
+  plan_test(db);
+  memo_test(db);
+  accessor_test(db);
 
   // this is CQL exercising its own generated procs via the interop interface
   rc = test_cases(db);
@@ -225,6 +225,10 @@ static int cql_rowset_connect(
   memset(pTab, 0, sizeof(cql_rowset_table));
 
   pTab->func = pAux->func;
+  pTab->stmt_func = pAux->stmt_func;
+  pTab->data_types = pAux->data_types;
+  pTab->plan = pAux->plan;
+  pTab->memo = pAux->memo;
   pTab->db = db;
   *ppVtab = (sqlite3_vtab *)pTab;
   return SQLITE_OK;
@@ -247,10 +251,493 @@ static int cql_rowset_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor)
   cql_rowset_table *pTab = (cql_rowset_table *)pVtab;
   pCur->db = pTab->db;
 
+  // one slot per argument, see cql_rowset_bind_args
+  if (pTab->plan && pTab->plan->arg_count > 0) {
+    sqlite3_uint64 size = sizeof(sqlite3_value *) * (sqlite3_uint64)pTab->plan->arg_count;
+    pCur->args = sqlite3_malloc64(size);
+    if (!pCur->args) {
+      sqlite3_free(pCur);
+      return SQLITE_NOMEM;
+    }
+    memset(pCur->args, 0, size);
+  }
+
   *ppCursor = (sqlite3_vtab_cursor *)pCur;
   return SQLITE_OK;
 }
 
+// Move the statement of a streaming cursor to its next row.  When the rows
+// run out the statement is finalized right away, there is no reason to hold
+// it until xClose.
+static int cql_rowset_step(cql_rowset_cursor *pCur) {
+  int rc = sqlite3_step(pCur->stmt);
+  if (rc == SQLITE_ROW) {
+    return SQLITE_OK;
+  }
+
+  pCur->eof = true;
+  cql_finalize_stmt(&pCur->stmt);
+
+  if (rc == SQLITE_DONE) {
+    return SQLITE_OK;
+  }
+
+  sqlite3_vtab *pVtab = pCur->base.pVtab;
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(pCur->db));
+  return rc;
+}
+
+// Optional arguments that were left out of the call are passed as NULL, we
+// need a real value for that so we make one the first time it is needed.
+static int cql_rowset_null_value(cql_rowset_table *pTab, sqlite3_value **result) {
+  if (!pTab->null_value) {
+    sqlite3_stmt *stmt = NULL;
+    int rc = sqlite3_prepare_v2(pTab->db, "SELECT NULL", -1, &stmt, NULL);
+    if (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+      pTab->null_value = sqlite3_value_dup(sqlite3_column_value(stmt, 0));
+    }
+    cql_finalize_stmt(&stmt);
+    if (!pTab->null_value) return SQLITE_NOMEM;
+  }
+  *result = pTab->null_value;
+  return SQLITE_OK;
+}
+
+// When we have a plan, argv holds only the arguments that xBestIndex chose
+// to use, in argument order.  idxStr says which those are ('1' for supplied),
+// no idxStr means all of them.  We rebuild the full argument list here with
+// NULL for the missing optional arguments.  The values are copied because
+// argv only lives as long as this call and xColumn reports them back for the
+// hidden columns.
+static int cql_rowset_bind_args(
+  cql_rowset_cursor *pCur,
+  cql_rowset_table *pTab,
+  const char *idxStr,
+  int argc,
+  sqlite3_value **argv)
+{
+  const cql_rowset_plan *plan = pTab->plan;
+  int supplied = 0;
+
+  for (int32_t i = 0; i < plan->arg_count; i++) {
+    sqlite3_value *value = NULL;
+    if (idxStr && idxStr[i] == '0') {
+      int rc = cql_rowset_null_value(pTab, &value);
+      if (rc != SQLITE_OK) return rc;
+    }
+    else {
+      if (supplied >= argc) {
+        sqlite3_free(pTab->base.zErrMsg);
+        pTab->base.zErrMsg = sqlite3_mprintf("CQL extension: argument %d is missing", i + 1);
+        return SQLITE_ERROR;
+      }
+      value = argv[supplied++];
+    }
+
+    sqlite3_value_free(pCur->args[i]);
+    pCur->args[i] = sqlite3_value_dup(value);
+    if (!pCur->args[i]) return SQLITE_NOMEM;
+  }
+
+  return SQLITE_OK;
+}
+
+// The streaming form of xFilter, the wrapped proc gives us its statement and
+// we step it to the first row.  The remaining rows are only computed if
+// SQLite asks for them with xNext, so a LIMIT or an early xClose stops the
+// work.  As with the result set form, xFilter may be called many times on
+// the same cursor, so any previous statement is finalized first.
+static int cql_rowset_stmt_filter(
+  cql_rowset_cursor *pCur,
+  cql_rowset_table *pTab,
+  int argc,
+  sqlite3_value **argv)
+{
+  cql_finalize_stmt(&pCur->stmt);
+  pCur->data_types = pTab->data_types;
+  pCur->current_row = 0;
+  pCur->eof = true;
+
+  pTab->stmt_func(pCur->db, argc, argv, &pCur->stmt);
+  if (!pCur->stmt) {
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = sqlite3_mprintf("CQL extension: unable to start the procedure");
+    return SQLITE_ERROR;
+  }
+
+  pCur->column_count = sqlite3_column_count(pCur->stmt);
+  pCur->eof = false;
+  return cql_rowset_step(pCur);
+}
+
+// The accessors for the columns of a materialized result set.  Each one
+// knows the layout of its column so xColumn is a load from the row and one
+// sqlite3_result_* call, the checks and the type dispatch of the result set
+// getters are done once per xFilter instead of once per cell.  There is one
+// function for each type and each way a nullable primitive can be stored:
+// not null, the nullable struct, or a bit in the null bitmap at the start
+// of a compact row (see cql:compact_rows).
+
+#define CQL_ROWSET_PRIMITIVE_ACCESSORS(name, c_type, nullable_type, result_func) \
+static void cql_rowset_result_##name( \
+  sqlite3_context *context, \
+  const char *row, \
+  const cql_rowset_accessor *accessor) \
+{ \
+  result_func(context, *(const c_type *)(row + accessor->offset)); \
+} \
+static void cql_rowset_result_nullable_##name( \
+  sqlite3_context *context, \
+  const char *row, \
+  const cql_rowset_accessor *accessor) \
+{ \
+  const nullable_type *value = (const nullable_type *)(row + accessor->offset); \
+  if (value->is_null) { \
+    sqlite3_result_null(context); \
+  } \
+  else { \
+    result_func(context, value->value); \
+  } \
+} \
+static void cql_rowset_result_null_bit_##name( \
+  sqlite3_context *context, \
+  const char *row, \
+  const cql_rowset_accessor *accessor) \
+{ \
+  if (cql_row_null_bit(row, accessor->column)) { \
+    sqlite3_result_null(context); \
+  } \
+  else { \
+    result_func(context, *(const c_type *)(row + accessor->offset)); \
+  } \
+}
+
+CQL_ROWSET_PRIMITIVE_ACCESSORS(bool, cql_bool, cql_nullable_bool, sqlite3_result_int)
+CQL_ROWSET_PRIMITIVE_ACCESSORS(int32, cql_int32, cql_nullable_int32, sqlite3_result_int)
+CQL_ROWSET_PRIMITIVE_ACCESSORS(int64, cql_int64, cql_nullable_int64, sqlite3_result_int64)
+CQL_ROWSET_PRIMITIVE_ACCESSORS(double, cql_double, cql_nullable_double, sqlite3_result_double)
+
+// Strings and blobs are always copied.  SQLite can close and reopen the
+// cursor while it still holds a value, for instance the best value of max()
+// over a correlated subquery, so the result set can't own the bytes.
+static void cql_rowset_result_string(
+  sqlite3_context *context,
+  const char *row,
+  const cql_rowset_accessor *accessor)
+{
+  cql_string_ref str_ref = *(cql_string_ref *)(row + accessor->offset);
+  if (!str_ref) {
+    sqlite3_result_null(context);
+    return;
+  }
+  cql_alloc_cstr(c_str, str_ref);
+  sqlite3_result_text(context, c_str, -1, SQLITE_TRANSIENT);
+  cql_free_cstr(c_str, str_ref);
+}
+
+static void cql_rowset_result_blob(
+  sqlite3_context *context,
+  const char *row,
+  const cql_rowset_accessor *accessor)
+{
+  cql_blob_ref blob_ref = *(cql_blob_ref *)(row + accessor->offset);
+  if (!blob_ref) {
+    sqlite3_result_null(context);
+    return;
+  }
+  const void *bytes = cql_get_blob_bytes(blob_ref);
+  cql_uint32 size = cql_get_blob_size(blob_ref);
+  sqlite3_result_blob(context, bytes, size, SQLITE_TRANSIENT);
+}
+
+static void cql_rowset_result_object(
+  sqlite3_context *context,
+  const char *row,
+  const cql_rowset_accessor *accessor)
+{
+  // Objects cannot be meaningfully represented as a SQLite column value.
+  // We return NULL here rather than crash or leak.
+  //
+  // Why this is fundamentally hard:
+  //
+  // 1. LIFETIME / REFERENCE COUNTING
+  //    CQL objects are ref-counted.  sqlite3_result_pointer() (see
+  //    https://www.sqlite.org/bindptr.html) can smuggle a raw pointer
+  //    through a result column, and it accepts a destructor callback, so
+  //    lifetime *could* be managed that way for a single consumer reading
+  //    the value exactly once.  But SQLite may copy or cache the value,
+  //    and the calling SQL expression may read the column multiple times.
+  //    The ref-count discipline becomes very difficult to reason about.
+  //
+  // 2. TYPE IDENTITY
+  //    sqlite3_result_pointer() tags the pointer with a caller-supplied
+  //    string ("type name"), but that is just a convention, not enforced
+  //    by SQLite.  There is no way to express the full CQL type — the
+  //    consumer must already know what it is getting and cast accordingly.
+  //    Any mismatch is a silent memory-safety bug.
+  //
+  // 3. NESTED RESULT SETS (the really crazy case)
+  //    A common CQL object column type is a child result set — a full
+  //    cql_result_set_ref representing a one-to-many relationship.  If we
+  //    tried to expose that through this TVF bridge, each row of the parent
+  //    TVF would need to somehow return a child *table* as a single column
+  //    value.  SQLite has no concept of a table-valued column; the only
+  //    options are:
+  //      a) Serialize the child rows into a blob — lossy, requires a
+  //         schema agreement, and loses all type information.
+  //      b) Return a raw pointer via sqlite3_result_pointer() and let the
+  //         caller invoke a second TVF over it — but now the child result
+  //         set must stay alive across an unbounded query lifetime, the
+  //         caller must know the child schema out-of-band, and joining the
+  //         two TVFs in SQL produces a cross-product unless the query
+  //         planner is very clever.
+  //      c) Flatten the parent+child into a single wide TVF — possible but
+  //         requires custom code per schema; this generic bridge cannot do
+  //         it automatically.
+  //    None of these are something a generic bridge layer can handle safely.
+  //
+  // 4. THE RECOMMENDED PATTERN FOR CHILD RESULT SETS
+  //    If you genuinely need to expose a child result set to SQL callers,
+  //    the best approach is a dedicated helper procedure with a contract
+  //    that is explicitly designed for it — e.g. a stored proc that accepts
+  //    a parent key, runs the child query directly, and returns those rows
+  //    as its own result set.  The caller then joins or correlates the two
+  //    result sets in application code rather than in SQL.
+  //    Trying to do it inside a TVF is highly problematic: the TVF can
+  //    appear in arbitrary JOIN expressions, meaning the child result set
+  //    pointer could be evaluated in any join order, duplicated across
+  //    multiple rows of a cross product, or held alive across a long-running
+  //    query with no predictable release point.  A purpose-built helper
+  //    procedure sidesteps all of that by having clear call/return
+  //    ownership semantics.
+  //
+  // Bottom line: if you need object columns exposed to SQL, you need a
+  // hand-written TVF that knows the specific object type and has a clear
+  // ownership contract.  This generic bridge deliberately returns NULL.
+  sqlite3_result_null(context);
+}
+
+// Pick the accessor for each column of the result set.  All the result sets
+// of one proc share the same meta so this only does work the first time, or
+// if the cursor somehow sees different meta.
+static int cql_rowset_build_accessors(cql_rowset_cursor *pCur, cql_rowset_table *pTab, cql_result_set_meta *meta) {
+  if (pCur->accessor_meta == meta) {
+    return SQLITE_OK;
+  }
+
+  if (meta->columnOffsets == NULL || meta->dataTypes == NULL) {
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = sqlite3_mprintf("CQL extension: rowset metadata null");
+    return SQLITE_ERROR;
+  }
+
+  sqlite3_free(pCur->accessors);
+  pCur->accessor_meta = NULL;
+  pCur->accessors = NULL;
+
+  if (meta->columnCount > 0) {
+    pCur->accessors = sqlite3_malloc64(sizeof(cql_rowset_accessor) * (sqlite3_uint64)meta->columnCount);
+    if (!pCur->accessors) return SQLITE_NOMEM;
+  }
+
+  for (cql_int32 i = 0; i < meta->columnCount; i++) {
+    cql_rowset_accessor *accessor = &pCur->accessors[i];
+    uint8_t data_type = meta->dataTypes[i];
+    // the first entry of columnOffsets is the count
+    accessor->offset = meta->columnOffsets[i + 1];
+    accessor->column = (uint32_t)i;
+
+    // 0 for not null, 1 for the nullable struct, 2 for the null bit
+    int form = (data_type & CQL_DATA_TYPE_NOT_NULL) ? 0 : (data_type & CQL_DATA_TYPE_NULL_BIT) ? 2 : 1;
+
+    switch (CQL_CORE_DATA_TYPE_OF(data_type)) {
+      case CQL_DATA_TYPE_BOOL:
+        accessor->result = form == 0 ? cql_rowset_result_bool :
+                           form == 1 ? cql_rowset_result_nullable_bool : cql_rowset_result_null_bit_bool;
+        break;
+      case CQL_DATA_TYPE_INT32:
+        accessor->result = form == 0 ? cql_rowset_result_int32 :
+                           form == 1 ? cql_rowset_result_nullable_int32 : cql_rowset_result_null_bit_int32;
+        break;
+      case CQL_DATA_TYPE_INT64:
+        accessor->result = form == 0 ? cql_rowset_result_int64 :
+                           form == 1 ? cql_rowset_result_nullable_int64 : cql_rowset_result_null_bit_int64;
+        break;
+      case CQL_DATA_TYPE_DOUBLE:
+        accessor->result = form == 0 ? cql_rowset_result_double :
+                           form == 1 ? cql_rowset_result_nullable_double : cql_rowset_result_null_bit_double;
+        break;
+      case CQL_DATA_TYPE_STRING:
+        accessor->result = cql_rowset_result_string;
+        break;
+      case CQL_DATA_TYPE_BLOB:
+        accessor->result = cql_rowset_result_blob;
+        break;
+      default:
+        accessor->result = cql_rowset_result_object;
+        break;
+    }
+  }
+
+  pCur->accessor_meta = meta;
+  return SQLITE_OK;
+}
+
+// djb2 over the type and contents of each argument, equal arguments hash
+// the same.  Integers and reals are kept apart by the type so 1 and 1.0 are
+// different calls, which is safe, it just means a miss.
+static uint64_t cql_rowset_args_hash(int argc, sqlite3_value **argv) {
+  uint64_t hash = 5381;
+  for (int i = 0; i < argc; i++) {
+    int type = sqlite3_value_type(argv[i]);
+    const unsigned char *bytes = NULL;
+    size_t size = 0;
+    sqlite3_int64 i64;
+    double d;
+
+    switch (type) {
+      case SQLITE_INTEGER:
+        i64 = sqlite3_value_int64(argv[i]);
+        bytes = (const unsigned char *)&i64;
+        size = sizeof(i64);
+        break;
+      case SQLITE_FLOAT:
+        d = sqlite3_value_double(argv[i]);
+        bytes = (const unsigned char *)&d;
+        size = sizeof(d);
+        break;
+      case SQLITE_TEXT:
+        bytes = sqlite3_value_text(argv[i]);
+        size = (size_t)sqlite3_value_bytes(argv[i]);
+        break;
+      case SQLITE_BLOB:
+        bytes = sqlite3_value_blob(argv[i]);
+        size = (size_t)sqlite3_value_bytes(argv[i]);
+        break;
+    }
+
+    hash = ((hash << 5) + hash) + (uint64_t)type;
+    while (size--) {
+      hash = ((hash << 5) + hash) + *bytes++;
+    }
+  }
+  return hash;
+}
+
+// Exact comparison of two argument values, same type and same contents.
+static cql_bool cql_rowset_value_equal(sqlite3_value *v1, sqlite3_value *v2) {
+  int type = sqlite3_value_type(v1);
+  if (type != sqlite3_value_type(v2)) return false;
+
+  switch (type) {
+    case SQLITE_INTEGER:
+      return sqlite3_value_int64(v1) == sqlite3_value_int64(v2);
+    case SQLITE_FLOAT: {
+      double d1 = sqlite3_value_double(v1);
+      double d2 = sqlite3_value_double(v2);
+      return memcmp(&d1, &d2, sizeof(d1)) == 0;
+    }
+    case SQLITE_TEXT: {
+      const unsigned char *t1 = sqlite3_value_text(v1);
+      const unsigned char *t2 = sqlite3_value_text(v2);
+      int size = sqlite3_value_bytes(v1);
+      return size == sqlite3_value_bytes(v2) && (size == 0 || memcmp(t1, t2, size) == 0);
+    }
+    case SQLITE_BLOB: {
+      const void *b1 = sqlite3_value_blob(v1);
+      const void *b2 = sqlite3_value_blob(v2);
+      int size = sqlite3_value_bytes(v1);
+      return size == sqlite3_value_bytes(v2) && (size == 0 || memcmp(b1, b2, size) == 0);
+    }
+  }
+
+  // both null
+  return true;
+}
+
+// Release what one remembered call holds.
+static void cql_rowset_memo_entry_clear(cql_rowset_memo_entry *entry) {
+  if (entry->args) {
+    for (int32_t i = 0; i < entry->argc; i++) {
+      sqlite3_value_free(entry->args[i]);
+    }
+    sqlite3_free(entry->args);
+  }
+  cql_result_set_release(entry->result_set);
+  memset(entry, 0, sizeof(*entry));
+}
+
+// Look for an earlier call with the same arguments on this cursor.
+static cql_rowset_memo_entry *cql_rowset_memo_find(
+  cql_rowset_cursor *pCur,
+  uint64_t hash,
+  int argc,
+  sqlite3_value **argv)
+{
+  for (int32_t i = 0; i < pCur->memo_count; i++) {
+    cql_rowset_memo_entry *entry = &pCur->memo_entries[i];
+    if (entry->hash != hash || entry->argc != argc) continue;
+
+    cql_bool equal = true;
+    for (int j = 0; equal && j < argc; j++) {
+      equal = cql_rowset_value_equal(entry->args[j], argv[j]);
+    }
+    if (equal) return entry;
+  }
+  return NULL;
+}
+
+// Remember the result of a call, once the cache is at capacity the oldest
+// entry is replaced.  If we can't copy the arguments we just don't remember
+// the call, the caller already has its result.
+static void cql_rowset_memo_add(
+  cql_rowset_cursor *pCur,
+  cql_rowset_memo *memo,
+  uint64_t hash,
+  int argc,
+  sqlite3_value **argv,
+  cql_result_set_ref result_set)
+{
+  if (!pCur->memo_entries) {
+    sqlite3_uint64 size = sizeof(cql_rowset_memo_entry) * (sqlite3_uint64)memo->capacity;
+    pCur->memo_entries = sqlite3_malloc64(size);
+    if (!pCur->memo_entries) return;
+    memset(pCur->memo_entries, 0, size);
+  }
+
+  cql_rowset_memo_entry *entry;
+  if (pCur->memo_count < memo->capacity) {
+    entry = &pCur->memo_entries[pCur->memo_count++];
+  }
+  else {
+    entry = &pCur->memo_entries[pCur->memo_next];
+    pCur->memo_next = (pCur->memo_next + 1) % memo->capacity;
+    cql_rowset_memo_entry_clear(entry);
+  }
+
+  entry->hash = hash;
+  entry->argc = argc;
+  if (argc > 0) {
+    entry->args = sqlite3_malloc64(sizeof(sqlite3_value *) * (sqlite3_uint64)argc);
+    if (!entry->args) goto error;
+    memset(entry->args, 0, sizeof(sqlite3_value *) * (size_t)argc);
+    for (int i = 0; i < argc; i++) {
+      entry->args[i] = sqlite3_value_dup(argv[i]);
+      if (!entry->args[i]) goto error;
+    }
+  }
+
+  cql_result_set_retain(result_set);
+  entry->result_set = result_set;
+  return;
+
+error:
+  // leave the slot empty, an entry with no result set never matches below
+  cql_rowset_memo_entry_clear(entry);
+  entry->argc = -1;
+}
+
 // Filter the result set based on the arguments passed to the function
 // This is where we actually call the function to get the result set
 // and set up the cursor to iterate over the result set.
@@ -273,6 +760,18 @@ static int cql_rowset_filter(
   trace_printf("filter\n");
   cql_rowset_cursor *pCur = (cql_rowset_cursor *)cur;
   cql_rowset_table *pTab = (cql_rowset_table *)pCur->base.pVtab;
+
+  if (pTab->plan) {
+    int rc = cql_rowset_bind_args(pCur, pTab, idxStr, argc, argv);
+    if (rc != SQLITE_OK) return rc;
+    argc = pTab->plan->arg_count;
+    argv = pCur->args;
+  }
+
+  if (pTab->stmt_func) {
+    return cql_rowset_stmt_filter(pCur, pTab, argc, argv);
+  }
+
   pCur->func = pTab->func;
 
   // Release any previous result set before calling the function.
@@ -306,16 +805,49 @@ static int cql_rowset_filter(
   cql_result_set_release(pCur->result_set);
   pCur->result_set = NULL;
 
-  // Call the function to get the result set
-  cql_rowset_func func = pCur->func;
-  func(pCur->db, argc, argv, &pCur->result_set);
+  // A memoized TVF reuses the result set of an earlier call on this cursor
+  // with the same arguments.  That is the inner side of a nested-loop join, a
+  // correlated subquery opens a new cursor each time it runs and never hits.
+  // The counters are shared by every connection so they are bumped atomically.
+  cql_rowset_memo *memo = pTab->memo;
+  cql_bool memoize = memo && memo->capacity > 0;
+  uint64_t hash = 0;
+  cql_rowset_memo_entry *entry = NULL;
+
+  if (memoize) {
+    hash = cql_rowset_args_hash(argc, argv);
+    entry = cql_rowset_memo_find(pCur, hash, argc, argv);
+  }
+
+  if (entry) {
+    __atomic_fetch_add(&memo->hits, 1, __ATOMIC_RELAXED);
+    cql_result_set_retain(entry->result_set);
+    pCur->result_set = entry->result_set;
+  }
+  else {
+    // Call the function to get the result set
+    cql_rowset_func func = pCur->func;
+    func(pCur->db, argc, argv, &pCur->result_set);
+
+    if (memoize) {
+      __atomic_fetch_add(&memo->misses, 1, __ATOMIC_RELAXED);
+      if (pCur->result_set) {
+        cql_rowset_memo_add(pCur, memo, hash, argc, argv, pCur->result_set);
+      }
+    }
+  }
 
   // Check to make sure the meta data has column data
   cql_result_set_meta *meta = cql_result_set_get_meta(pCur->result_set);
   cql_contract(meta->columnOffsets != NULL);
 
+  int rc = cql_rowset_build_accessors(pCur, pTab, meta);
+  if (rc != SQLITE_OK) return rc;
+
   pCur->column_count =  meta->columnCount;
   pCur->row_count = cql_result_set_get_count(pCur->result_set);
+  pCur->rows = (const char *)cql_result_set_get_data(pCur->result_set);
+  pCur->row_size = meta->rowsize;
   pCur->current_row = 0;
 
   return SQLITE_OK;
@@ -327,16 +859,35 @@ static int cql_rowset_filter(
 static int cql_rowset_disconnect(sqlite3_vtab *pVtab) {
   trace_printf("disconnect\n");
   cql_rowset_table *pTab = (cql_rowset_table *)pVtab;
+  sqlite3_value_free(pTab->null_value);
   sqlite3_free(pTab);
   return SQLITE_OK;
 }
 
-// Close Cursor, release the result set here
+// Close Cursor, release the result set or the statement here
 static int cql_rowset_close(sqlite3_vtab_cursor *cur) {
   trace_printf("close\n");
   cql_rowset_cursor *pCur = (cql_rowset_cursor *)cur;
   cql_result_set_release(pCur->result_set);
   pCur->result_set = NULL;
+  sqlite3_free(pCur->accessors);
+  cql_finalize_stmt(&pCur->stmt);
+
+  if (pCur->memo_entries) {
+    for (int32_t i = 0; i < pCur->memo_count; i++) {
+      cql_rowset_memo_entry_clear(&pCur->memo_entries[i]);
+    }
+    sqlite3_free(pCur->memo_entries);
+  }
+
+  if (pCur->args) {
+    cql_rowset_table *pTab = (cql_rowset_table *)cur->pVtab;
+    for (int32_t i = 0; i < pTab->plan->arg_count; i++) {
+      sqlite3_value_free(pCur->args[i]);
+    }
+    sqlite3_free(pCur->args);
+  }
+
   sqlite3_free(cur);
   return SQLITE_OK;
 }
@@ -346,6 +897,10 @@ static int cql_rowset_next(sqlite3_vtab_cursor *cur) {
   trace_printf("next\n");
   cql_rowset_cursor *pCur = (cql_rowset_cursor *)cur;
   pCur->current_row++;
+
+  if (pCur->stmt) {
+    return cql_rowset_step(pCur);
+  }
   return SQLITE_OK;
 }
 
@@ -353,9 +908,58 @@ static int cql_rowset_next(sqlite3_vtab_cursor *cur) {
 static int cql_rowset_eof(sqlite3_vtab_cursor *cur) {
   trace_printf("eof\n");
   cql_rowset_cursor *pCur = (cql_rowset_cursor *)cur;
+  if (pCur->data_types) {
+    return pCur->eof;
+  }
   return pCur->current_row >= pCur->row_count;
 }
 
+// Retrieve Column Data from the current row of a streaming cursor.  The
+// values are converted just as cql_fetch_all_results would have converted
+// them so both forms give the same answers.
+static int cql_rowset_stmt_column(cql_rowset_cursor *pCur, sqlite3_context *context, int column) {
+  sqlite3_stmt *stmt = pCur->stmt;
+  if (!stmt) {
+    sqlite3_result_text(context, "row out of range", -1, SQLITE_TRANSIENT);
+    return SQLITE_ERROR;
+  }
+
+  if (sqlite3_column_type(stmt, column) == SQLITE_NULL) {
+    sqlite3_result_null(context);
+    return SQLITE_OK;
+  }
+
+  switch (CQL_CORE_DATA_TYPE_OF(pCur->data_types[column])) {
+    case CQL_DATA_TYPE_INT32:
+      sqlite3_result_int(context, sqlite3_column_int(stmt, column));
+      break;
+    case CQL_DATA_TYPE_INT64:
+      sqlite3_result_int64(context, sqlite3_column_int64(stmt, column));
+      break;
+    case CQL_DATA_TYPE_DOUBLE:
+      sqlite3_result_double(context, sqlite3_column_double(stmt, column));
+      break;
+    case CQL_DATA_TYPE_BOOL:
+      sqlite3_result_int(context, !!sqlite3_column_int(stmt, column));
+      break;
+    case CQL_DATA_TYPE_STRING: {
+      const char *text = (const char *)sqlite3_column_text(stmt, column);
+      sqlite3_result_text(context, text, sqlite3_column_bytes(stmt, column), SQLITE_TRANSIENT);
+      break;
+    }
+    case CQL_DATA_TYPE_BLOB: {
+      const void *bytes = sqlite3_column_blob(stmt, column);
+      sqlite3_result_blob(context, bytes, sqlite3_column_bytes(stmt, column), SQLITE_TRANSIENT);
+      break;
+    }
+    default:
+      // objects can't come from a statement, see cql_rowset_column
+      sqlite3_result_null(context);
+      break;
+  }
+  return SQLITE_OK;
+}
+
 // Retrieve Column Data
 static int cql_rowset_column(sqlite3_vtab_cursor *cur, sqlite3_context *context, int column) {
   trace_printf("column %d\n", column);
@@ -367,6 +971,31 @@ static int cql_rowset_column(sqlite3_vtab_cursor *cur, sqlite3_context *context,
   // it is ever violated by a future SQLite change or a direct call from tests.
   cql_contract(column >= 0);
 
+  // With a plan the hidden columns read back the arguments of the call.
+  // SQLite can only skip its own check of the first 16 constraints, the
+  // rest are checked against these values so they must be the real ones.
+  cql_rowset_table *pTab = (cql_rowset_table *)cur->pVtab;
+  const cql_rowset_plan *plan = pTab->plan;
+  if (plan && column >= plan->column_count) {
+    int32_t arg = column - plan->column_count;
+    if (arg < plan->arg_count && pCur->args[arg]) {
+      sqlite3_result_value(context, pCur->args[arg]);
+    }
+    else {
+      sqlite3_result_null(context);
+    }
+    return SQLITE_OK;
+  }
+
+  if (pCur->data_types) {
+    if (column >= pCur->column_count) {
+      // the hidden columns, see below
+      sqlite3_result_text(context, "column out of range (maybe >16 args?)", -1, SQLITE_TRANSIENT);
+      return SQLITE_OK;
+    }
+    return cql_rowset_stmt_column(pCur, context, column);
+  }
+
   cql_result_set_ref result_set = pCur->result_set;
   if (result_set == NULL) {
     sqlite3_result_text(context, "nil result set", -1, SQLITE_TRANSIENT);
@@ -374,10 +1003,11 @@ static int cql_rowset_column(sqlite3_vtab_cursor *cur, sqlite3_context *context,
   }
 
   if (column >= pCur->column_count) {
-    // These are the hidden columns, any attempt to read these indicates
-    // that we likely have too many arguments.  The best index function
-    // is supposed to ensure that we omit all columns but the normal data
-    // columns but it can only do so for the first 16 columns.  So either
+    // These are the hidden columns of a table with no plan, any attempt to
+    // read these indicates that we likely have too many arguments.  The best
+    // index function is supposed to ensure that we omit all columns but the
+    // normal data columns but it can only do so for the first 16 columns.
+    // Tables with a plan answer with the argument values above.  So either
     // we have a bug where .omit is not being set or we have more than 16.
     // Check out the cql_rowset_best_index function.
     sqlite3_result_text(context, "column out of range (maybe >16 args?)", -1, SQLITE_TRANSIENT);
@@ -389,109 +1019,9 @@ static int cql_rowset_column(sqlite3_vtab_cursor *cur, sqlite3_context *context,
     return SQLITE_ERROR;
   }
 
-  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
-
-  if (meta->columnOffsets == NULL || meta->dataTypes == NULL) {
-    sqlite3_result_text(context, "rowset metadata null", -1, SQLITE_TRANSIENT);
-    return SQLITE_ERROR;
-  }
-
-  if (cql_result_set_get_is_null_col(result_set, row, column)) {
-    sqlite3_result_null(context);
-    return SQLITE_OK;
-  }
-
-  switch (CQL_CORE_DATA_TYPE_OF(meta->dataTypes[column])) {
-    case CQL_DATA_TYPE_INT32:
-      sqlite3_result_int(context, cql_result_set_get_int32_col(result_set, row, column));
-      break;
-    case CQL_DATA_TYPE_INT64:
-      sqlite3_result_int64(context, cql_result_set_get_int64_col(result_set, row, column));
-      break;
-    case CQL_DATA_TYPE_DOUBLE:
-      sqlite3_result_double(context, cql_result_set_get_double_col(result_set, row, column));
-      break;
-    case CQL_DATA_TYPE_BOOL:
-      sqlite3_result_int(context, cql_result_set_get_bool_col(result_set, row, column));
-      break;
-    case CQL_DATA_TYPE_STRING: {
-      cql_string_ref str_ref = cql_result_set_get_string_col(result_set, row, column);
-      cql_alloc_cstr(c_str, str_ref);
-      sqlite3_result_text(context, c_str, -1, SQLITE_TRANSIENT);
-      cql_free_cstr(c_str, str_ref);
-      break;
-    }
-    case CQL_DATA_TYPE_BLOB: {
-      cql_blob_ref blob_ref = cql_result_set_get_blob_col(result_set, row, column);
-      const void *bytes = cql_get_blob_bytes(blob_ref);
-      cql_uint32 size = cql_get_blob_size(blob_ref);
-      sqlite3_result_blob(context, bytes, size, SQLITE_TRANSIENT);
-      break;
-    }
-    case CQL_DATA_TYPE_OBJECT: {
-      // Objects cannot be meaningfully represented as a SQLite column value.
-      // We return NULL here rather than crash or leak.
-      //
-      // Why this is fundamentally hard:
-      //
-      // 1. LIFETIME / REFERENCE COUNTING
-      //    CQL objects are ref-counted.  sqlite3_result_pointer() (see
-      //    https://www.sqlite.org/bindptr.html) can smuggle a raw pointer
-      //    through a result column, and it accepts a destructor callback, so
-      //    lifetime *could* be managed that way for a single consumer reading
-      //    the value exactly once.  But SQLite may copy or cache the value,
-      //    and the calling SQL expression may read the column multiple times.
-      //    The ref-count discipline becomes very difficult to reason about.
-      //
-      // 2. TYPE IDENTITY
-      //    sqlite3_result_pointer() tags the pointer with a caller-supplied
-      //    string ("type name"), but that is just a convention, not enforced
-      //    by SQLite.  There is no way to express the full CQL type — the
-      //    consumer must already know what it is getting and cast accordingly.
-      //    Any mismatch is a silent memory-safety bug.
-      //
-      // 3. NESTED RESULT SETS (the really crazy case)
-      //    A common CQL object column type is a child result set — a full
-      //    cql_result_set_ref representing a one-to-many relationship.  If we
-      //    tried to expose that through this TVF bridge, each row of the parent
-      //    TVF would need to somehow return a child *table* as a single column
-      //    value.  SQLite has no concept of a table-valued column; the only
-      //    options are:
-      //      a) Serialize the child rows into a blob — lossy, requires a
-      //         schema agreement, and loses all type information.
-      //      b) Return a raw pointer via sqlite3_result_pointer() and let the
-      //         caller invoke a second TVF over it — but now the child result
-      //         set must stay alive across an unbounded query lifetime, the
-      //         caller must know the child schema out-of-band, and joining the
-      //         two TVFs in SQL produces a cross-product unless the query
-      //         planner is very clever.
-      //      c) Flatten the parent+child into a single wide TVF — possible but
-      //         requires custom code per schema; this generic bridge cannot do
-      //         it automatically.
-      //    None of these are something a generic bridge layer can handle safely.
-      //
-      // 4. THE RECOMMENDED PATTERN FOR CHILD RESULT SETS
-      //    If you genuinely need to expose a child result set to SQL callers,
-      //    the best approach is a dedicated helper procedure with a contract
-      //    that is explicitly designed for it — e.g. a stored proc that accepts
-      //    a parent key, runs the child query directly, and returns those rows
-      //    as its own result set.  The caller then joins or correlates the two
-      //    result sets in application code rather than in SQL.
-      //    Trying to do it inside a TVF is highly problematic: the TVF can
-      //    appear in arbitrary JOIN expressions, meaning the child result set
-      //    pointer could be evaluated in any join order, duplicated across
-      //    multiple rows of a cross product, or held alive across a long-running
-      //    query with no predictable release point.  A purpose-built helper
-      //    procedure sidesteps all of that by having clear call/return
-      //    ownership semantics.
-      //
-      // Bottom line: if you need object columns exposed to SQL, you need a
-      // hand-written TVF that knows the specific object type and has a clear
-      // ownership contract.  This generic bridge deliberately returns NULL.
-      sqlite3_result_null(context);
-      break;
-    }
-  }
+  // everything was worked out in xFilter, see cql_rowset_build_accessors
+  const cql_rowset_accessor *accessor = &pCur->accessors[column];
+  accessor->result(context, pCur->rows + (size_t)row * pCur->row_size, accessor);
   return SQLITE_OK;
 }
 
@@ -509,8 +1039,8 @@ static int cql_rowset_rowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
 // arguments as parameters to the function.  We don't want it to apply
 // any where clause to the data in the table.  We are not a table, we
 // are a function.  We'll get the actual arguments in cql_rowset_filter
-static int cql_rowset_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxInfo) {
-  trace_printf("best index\n");
+// This is the fallback for tables registered without a plan.
+static int cql_rowset_best_index_no_plan(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxInfo) {
   // Loop through each constraint
   for (int i = 0; i < pIdxInfo->nConstraint; i++) {
     // Make sure every constraint is marked as usable
@@ -539,6 +1069,107 @@ static int cql_rowset_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxIn
   return SQLITE_OK;
 }
 
+// With a plan we only take the equality constraints on the hidden argument
+// columns, everything else (constraints on result columns, LIMIT, ...) is
+// left for SQLite to apply.  Each argument takes its first usable constraint
+// and the arguments are numbered in order so xFilter knows which is which.
+//
+// A plan that can't supply a required argument is rejected with
+// SQLITE_CONSTRAINT, as is a plan where an argument has a constraint that
+// isn't usable yet (e.g. it comes from a table later in the join).  Calling
+// the proc with that argument missing would give the wrong rows, SQLite will
+// find the join order that binds it first.
+//
+// The row and cost estimates come from the plan so SQLite can weigh the
+// proc against the other tables in the join.
+static int cql_rowset_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxInfo) {
+  trace_printf("best index\n");
+  cql_rowset_table *pTab = (cql_rowset_table *)pVtab;
+  const cql_rowset_plan *plan = pTab->plan;
+  if (!plan) {
+    return cql_rowset_best_index_no_plan(pVtab, pIdxInfo);
+  }
+
+  int32_t arg_count = plan->arg_count;
+  int32_t supplied = 0;
+  int rc = SQLITE_OK;
+
+  // constraint index for each argument (-1 for none) and a flag for an
+  // argument that has a constraint we can't use in this plan
+  int *arg_constraint = NULL;
+  cql_bool *arg_unusable = NULL;
+  if (arg_count > 0) {
+    arg_constraint = sqlite3_malloc64(sizeof(int) * (sqlite3_uint64)arg_count);
+    arg_unusable = sqlite3_malloc64(sizeof(cql_bool) * (sqlite3_uint64)arg_count);
+    if (!arg_constraint || !arg_unusable) {
+      rc = SQLITE_NOMEM;
+      goto cleanup;
+    }
+    for (int32_t i = 0; i < arg_count; i++) {
+      arg_constraint[i] = -1;
+      arg_unusable[i] = false;
+    }
+  }
+
+  for (int i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *constraint = &pIdxInfo->aConstraint[i];
+    if (constraint->op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+
+    int32_t arg = constraint->iColumn - plan->column_count;
+    if (constraint->iColumn < plan->column_count || arg >= arg_count) continue;
+
+    if (!constraint->usable) {
+      arg_unusable[arg] = true;
+    }
+    else if (arg_constraint[arg] < 0) {
+      arg_constraint[arg] = i;
+    }
+  }
+
+  for (int32_t i = 0; i < arg_count; i++) {
+    if (arg_constraint[i] >= 0) {
+      // argvIndex is 1 based, the values arrive in argv in argument order
+      int c = arg_constraint[i];
+      pIdxInfo->aConstraintUsage[c].argvIndex = ++supplied;
+      pIdxInfo->aConstraintUsage[c].omit = 1;
+      continue;
+    }
+
+    cql_bool optional = plan->arg_flags && (plan->arg_flags[i] & CQL_ROWSET_ARG_OPTIONAL);
+    if (arg_unusable[i] || !optional) {
+      rc = SQLITE_CONSTRAINT;
+      goto cleanup;
+    }
+  }
+
+  // tell xFilter which arguments are present if any were left out
+  if (supplied < arg_count) {
+    char *mask = sqlite3_malloc(arg_count + 1);
+    if (!mask) {
+      rc = SQLITE_NOMEM;
+      goto cleanup;
+    }
+    for (int32_t i = 0; i < arg_count; i++) {
+      mask[i] = arg_constraint[i] >= 0 ? '1' : '0';
+    }
+    mask[arg_count] = 0;
+    pIdxInfo->idxStr = mask;
+    pIdxInfo->needToFreeIdxStr = 1;
+  }
+
+  pIdxInfo->idxNum = supplied;
+  pIdxInfo->estimatedRows = (sqlite3_int64)plan->estimated_rows;
+  pIdxInfo->estimatedCost = plan->estimated_cost;
+  if (plan->estimated_rows <= 1) {
+    pIdxInfo->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+  }
+
+cleanup:
+  sqlite3_free(arg_constraint);
+  sqlite3_free(arg_unusable);
+  return rc;
+}
+
 // the standard helper to register a named tvf for wrapping a CQL proc and
 // access its result set as a virtual table function.
 //
@@ -560,9 +1191,9 @@ static int cql_rowset_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxIn
 int register_cql_rowset_tvf(sqlite3 *db, cql_rowset_aux_init *aux, const char *name) {
   trace_printf("register %s\n", name);
 
-  // all of the tvfs we create use the same helper functions, it always just decodes
-  // a result set.  The only difference is what helper function we call to get the
-  // result set and that flows to us in the aux pointer.  The aux pointer is
+  // all of the tvfs we create use the same helper functions, they decode either
+  // a result set or the rows of a statement.  The only difference is what helper
+  // function we call to get the rows and that flows to us in the aux pointer.  The aux pointer is
   // passed to us in the xCreate and xConnect functions.  We use it to get the
   // function to call to get the result set and the virtual table declaration.
   static sqlite3_module rowsetModule = {
@@ -592,11 +1223,47 @@ cql_rowset_aux_init *cql_rowset_create_aux_init(
 {
   cql_rowset_aux_init *pAux = sqlite3_malloc(sizeof(cql_rowset_aux_init));
   if (!pAux) return NULL;
+  memset(pAux, 0, sizeof(cql_rowset_aux_init));
   pAux->func = func;
   pAux->table_decl = table_decl;
   return pAux;
 }
 
+// As above but for a proc that provides its statement, the data types are the
+// CQL types of the result columns and control how each value is converted.
+// The ownership contract is the same as cql_rowset_create_aux_init.
+cql_rowset_aux_init *cql_rowset_create_stmt_aux_init(
+  cql_rowset_stmt_func stmt_func,
+  const uint8_t *data_types,
+  const char *table_decl)
+{
+  cql_rowset_aux_init *pAux = sqlite3_malloc(sizeof(cql_rowset_aux_init));
+  if (!pAux) return NULL;
+  memset(pAux, 0, sizeof(cql_rowset_aux_init));
+  pAux->stmt_func = stmt_func;
+  pAux->data_types = data_types;
+  pAux->table_decl = table_decl;
+  return pAux;
+}
+
+// Attach the plan used by xBestIndex, the plan is not copied so it must
+// outlive the module, normally it is a static.  A NULL aux is ignored so
+// this can follow the create call directly.
+void cql_rowset_aux_set_plan(cql_rowset_aux_init *aux, const cql_rowset_plan *plan) {
+  if (aux) {
+    aux->plan = plan;
+  }
+}
+
+// Make the TVF memoized, memo holds the size cap and the counters.  Like the
+// plan it is not copied, it must outlive the module.  Memoization needs a
+// result set to hold on to, so it has no effect on a streaming TVF.
+void cql_rowset_aux_set_memo(cql_rowset_aux_init *aux, cql_rowset_memo *memo) {
+  if (aux) {
+    aux->memo = memo;
+  }
+}
+
 // release the aux structure
 // this is called when the virtual table is no longer needed
 void cql_rowset_create_aux_destroy(void *pv) {
@@ -34,9 +34,56 @@ typedef void (*cql_rowset_func)(
   sqlite3_value *_Nonnull *_Nonnull argv,
   cql_result_set_ref _Nonnull *_Nonnull result);
 
+// Procs whose result comes from a SELECT can provide the statement instead,
+// the rows are then stepped one at a time as SQLite asks for them.
+typedef void (*cql_rowset_stmt_func)(
+  sqlite3 *_Nonnull db,
+  int32_t argc,
+  sqlite3_value *_Nonnull *_Nonnull argv,
+  sqlite3_stmt *_Nullable *_Nonnull stmt);
+
+// arg_flags bit: the argument may be left out of the call, it is then NULL
+#define CQL_ROWSET_ARG_OPTIONAL 1
+
+// What xBestIndex needs to know to plan a call.  The hidden argument columns
+// follow the column_count result columns, one per in/inout argument.  Without
+// a plan every constraint is passed to the proc as an argument.
+typedef struct {
+    int32_t column_count;
+    int32_t arg_count;
+    const uint8_t *_Nullable arg_flags;
+    double estimated_rows;
+    double estimated_cost;
+} cql_rowset_plan;
+
+// The size cap and hit counters of a memoized TVF.  Results are reused when
+// xFilter sees the same arguments again on the same cursor, which is the inner
+// side of a nested-loop join; a correlated subquery gets a fresh cursor each
+// time and doesn't benefit.  The counters accumulate over all statements and
+// connections and are updated atomically, read them with __atomic_load_n if
+// other threads may be running queries.
+typedef struct {
+    int32_t capacity;
+    int64_t hits;
+    int64_t misses;
+} cql_rowset_memo;
+
+// One remembered call: copies of the arguments and the result set it made.
+typedef struct {
+    uint64_t hash;
+    int32_t argc;
+    sqlite3_value *_Nullable *_Nullable args;
+    cql_result_set_ref _Nullable result_set;
+} cql_rowset_memo_entry;
+
+// Exactly one of func and stmt_func is set, data_types goes with stmt_func.
 typedef struct {
     const char *_Nonnull table_decl;
-    cql_rowset_func _Nonnull func;
+    cql_rowset_func _Nullable func;
+    cql_rowset_stmt_func _Nullable stmt_func;
+    const uint8_t *_Nullable data_types;
+    const cql_rowset_plan *_Nullable plan;
+    cql_rowset_memo *_Nullable memo;
 } cql_rowset_aux_init;
 
 int register_cql_rowset_tvf(
@@ -46,15 +93,46 @@ int register_cql_rowset_tvf(
 
 typedef struct {
     sqlite3_vtab base;
-    cql_rowset_func _Nonnull func;
+    cql_rowset_func _Nullable func;
+    cql_rowset_stmt_func _Nullable stmt_func;
+    const uint8_t *_Nullable data_types;
+    const cql_rowset_plan *_Nullable plan;
+    sqlite3_value *_Nullable null_value;
+    cql_rowset_memo *_Nullable memo;
     sqlite3 *_Nonnull db;
 } cql_rowset_table;
 
+// How xColumn reads one column of a materialized result set, the function
+// knows the type and the null representation, the rest is where to look.
+typedef struct cql_rowset_accessor cql_rowset_accessor;
+
+typedef void (*cql_rowset_result_func)(
+  sqlite3_context *_Nonnull context,
+  const char *_Nonnull row,
+  const cql_rowset_accessor *_Nonnull accessor);
+
+struct cql_rowset_accessor {
+  cql_rowset_result_func _Nonnull result;
+  uint32_t offset;
+  uint32_t column;
+};
+
 typedef struct {
   sqlite3_vtab_cursor base;
   sqlite3 *_Nonnull db;
-  cql_rowset_func _Nonnull func;
-  cql_result_set_ref _Nonnull result_set;
+  cql_rowset_func _Nullable func;
+  cql_result_set_ref _Nullable result_set;
+  cql_rowset_accessor *_Nullable accessors;
+  cql_result_set_meta *_Nullable accessor_meta;
+  const char *_Nullable rows;
+  size_t row_size;
+  sqlite3_stmt *_Nullable stmt;
+  const uint8_t *_Nullable data_types;
+  sqlite3_value *_Nullable *_Nullable args;
+  cql_rowset_memo_entry *_Nullable memo_entries;
+  int32_t memo_count;
+  int32_t memo_next;
+  cql_bool eof;
   int row_count;
   int column_count;
   int current_row;
@@ -64,4 +142,17 @@ cql_rowset_aux_init *_Nullable cql_rowset_create_aux_init(
   cql_rowset_func _Nonnull func,
   const char *_Nonnull create_table_str);
 
+cql_rowset_aux_init *_Nullable cql_rowset_create_stmt_aux_init(
+  cql_rowset_stmt_func _Nonnull stmt_func,
+  const uint8_t *_Nonnull data_types,
+  const char *_Nonnull create_table_str);
+
+void cql_rowset_aux_set_plan(
+  cql_rowset_aux_init *_Nullable aux,
+  const cql_rowset_plan *_Nonnull plan);
+
+void cql_rowset_aux_set_memo(
+  cql_rowset_aux_init *_Nullable aux,
+  cql_rowset_memo *_Nonnull memo);
+
 void cql_rowset_create_aux_destroy(void *_Nullable pAux);
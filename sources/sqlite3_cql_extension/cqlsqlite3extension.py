@@ -27,6 +27,12 @@
 #
 # RESULT TYPES:
 # - Procedures with projections become table-valued functions (TVFs)
+#   - if the rows come from a SELECT the TVF steps the statement one row at a
+#     time so LIMIT and early exits stop the work
+#   - otherwise (e.g. OUT UNION) the whole result set is made in xFilter
+#   - the [[tvf_optional]], [[tvf_rows]] and [[tvf_cost]] attributes feed the
+#     plan that xBestIndex uses to cost the call and check the arguments
+#   - [[tvf_memoize]] reuses results for repeated arguments within a statement
 # - Procedures with OUT parameters return the first OUT value as a scalar
 # - Void procedures return NULL
 #
@@ -266,6 +272,57 @@ def emit_headers(cmd_args, json_file):
     print(f"#include \"{cmd_args['cql_header']}\"")  # CQL-generated declarations
     print(f"")
 
+def tvf_procs(data):
+    """The non-private procedures with a projection, these become TVFs."""
+    all_procs = data['queries'] + data['deletes'] + data['inserts'] + data['generalInserts'] + data['updates'] + data['general']
+    return [proc for proc in all_procs if "cql:private" not in proc['attributes'] and 'projection' in proc]
+
+def emit_tvf_plan(proc, cmd_args):
+    """
+    Emit the static cql_rowset_plan for a TVF.
+
+    The plan tells xBestIndex where the hidden argument columns start, which
+    arguments may be left out, and what a call is expected to cost.  These
+    come from proc attributes (see normalize_json_output):
+
+      [[tvf_optional=(a, b)]]  these nullable args may be omitted, they are NULL
+      [[tvf_rows=100]]         estimated number of rows per call (default 25)
+      [[tvf_cost=500]]         estimated cost of one call (default: the rows)
+
+    A proc marked [[tvf_memoize]] also gets a cql_rowset_memo named
+    <proc>_memo, it holds the cache size ([[tvf_memoize_limit=n]], default 16)
+    and the hit and miss counters.
+
+    Every other IN/INOUT argument is required, a query plan that can't supply
+    it is rejected.
+    """
+    ___, __v, _vv, vvv, indent, dedent = codegen_utils(cmd_args)
+
+    proc_name = proc['canonicalName']
+    args = proc['tvfArgs']
+    arg_flags = "NULL"
+
+    if args:
+        flags = ", ".join("CQL_ROWSET_ARG_OPTIONAL" if a['name'] in proc['tvfOptional'] else "0" for a in args)
+        ___(f"static const uint8_t {proc_name}_arg_flags[] = {{ {flags} }};")
+        arg_flags = f"{proc_name}_arg_flags"
+
+    ___(f"static const cql_rowset_plan {proc_name}_plan = {{")
+    indent()
+    ___(f".column_count = {len(proc['projection'])},")
+    ___(f".arg_count = {len(args)},")
+    ___(f".arg_flags = {arg_flags},")
+    ___(f".estimated_rows = {proc['tvfRows']},")
+    ___(f".estimated_cost = {proc['tvfCost']},")
+    dedent()
+    ___("};")
+    ___()
+
+    if proc['tvfMemoize']:
+        # not static, the hit and miss counters are there for the app to read
+        ___(f"cql_rowset_memo {proc_name}_memo = {{ .capacity = {proc['tvfMemoizeLimit']} }};")
+        ___()
+
 def emit_extension_initializer(data, cmd_args):
     """
     Emit the SQLite extension entry point function.
@@ -281,8 +338,12 @@ def emit_extension_initializer(data, cmd_args):
 
     For TVFs, we generate a CREATE TABLE declaration that describes the virtual
     table schema. This includes the projection columns (visible) and the input
-    arguments as hidden columns (used for parameter passing).
+    arguments as hidden columns (used for parameter passing).  Each TVF also
+    gets a plan (see emit_tvf_plan) that xBestIndex uses to cost the call.
     """
+    for proc in tvf_procs(data):
+        emit_tvf_plan(proc, cmd_args)
+
     print("""
 int sqlite3_cqlextension_init(sqlite3 *_Nonnull db, char *_Nonnull *_Nonnull pzErrMsg, const sqlite3_api_routines *_Nonnull pApi) {
 #ifdef CQL_SQLITE_EXT
@@ -309,13 +370,26 @@ int sqlite3_cqlextension_init(sqlite3 *_Nonnull db, char *_Nonnull *_Nonnull pzE
             # - Hidden columns: input arguments, accessed via special syntax
             #
             # Example: SELECT * FROM my_proc(arg1, arg2) WHERE col1 > 5
-            args = [{'name': f"arg_{a['name']}", 'type': f"{a['type']} hidden"} for a in proc['args']]
+            # Only IN and INOUT args can be passed so only those get columns.
+            args = [{'name': f"arg_{a['name']}", 'type': f"{a['type']} hidden"} for a in proc['tvfArgs']]
             col = [{'name': p['name'], 'type' : p['type'] } for p in proc['projection']]
             cols = ", ".join(f"[{p['name']}] {p['type']}" for p in (col + args))
             table_decl = f"CREATE TABLE {proc_name}({cols})"
-            print(f"""
-  aux = cql_rowset_create_aux_init(call_{proc_name}, "{table_decl}");
+            if proc['streamsRows']:
+                # the statement is stepped as rows are needed, the data types
+                # tell the helpers how to convert each column
+                print(f"""
+  aux = cql_rowset_create_stmt_aux_init(call_{proc_name}, {proc['name']}_data_types, "{table_decl}");
+  cql_rowset_aux_set_plan(aux, &{proc_name}_plan);
   rc = register_cql_rowset_tvf(db, aux, "{proc_name}");
+""")
+            else:
+                print(f"""
+  aux = cql_rowset_create_aux_init(call_{proc_name}, "{table_decl}");
+  cql_rowset_aux_set_plan(aux, &{proc_name}_plan);""")
+                if proc['tvfMemoize']:
+                    print(f"  cql_rowset_aux_set_memo(aux, &{proc_name}_memo);")
+                print(f"""  rc = register_cql_rowset_tvf(db, aux, "{proc_name}");
 """)
         else:
             # SCALAR FUNCTION REGISTRATION
@@ -372,6 +446,31 @@ def emit_all_procs(data, cmd_args):
         if not suppressed:
             emit_proc_c_func_body(proc, cmd_args)
 
+def emit_stmt_proc_prototype(proc, cmd_args):
+    """
+    Emit the prototype of the statement form of a procedure.
+
+    The CQL header only declares the _fetch_results form of a procedure that
+    returns a SELECT, the procedure that yields the statement is declared in
+    the generated C file where it is used.  The streaming TVFs call it
+    directly so we declare it here with the same signature.
+    """
+    ___, __v, _vv, vvv, indent, dedent = codegen_utils(cmd_args)
+
+    params = ["sqlite3 *_Nonnull _db_", "sqlite3_stmt *_Nullable *_Nonnull _result_stmt"]
+    for arg in proc['args']:
+        c_type = cql_types[arg['isNotNull']][arg['type']]
+        if is_ref_type[arg['type']]:
+            # out args start as null even if they are not null
+            nonnull = arg['isNotNull'] and arg['binding'] != 'out'
+            c_type += " _Nonnull" if nonnull else " _Nullable"
+        if arg['binding'] != 'in':
+            c_type += " *_Nonnull"
+        params.append(f"{c_type} {arg['name']}")
+
+    ___(f"extern CQL_WARN_UNUSED cql_code {proc['name']}({', '.join(params)});")
+    ___()
+
 def emit_proc_c_func_body(proc, cmd_args):
     """
     Emit the C wrapper function for a single CQL procedure.
@@ -428,6 +527,7 @@ def emit_proc_c_func_body(proc, cmd_args):
 
     proc_name = proc['canonicalName']
     has_projection = 'projection' in proc  # True = TVF, False = scalar function
+    streams_rows = proc['streamsRows']     # True = TVF over the proc's statement
 
     # Build SQL-like signature comment for documentation in generated code
     sql_in_args = ', '.join(f"`{a['name']}` {a['type']}{'!' if a['isNotNull'] else ''}" for a in innie_arguments)
@@ -451,7 +551,11 @@ def emit_proc_c_func_body(proc, cmd_args):
     # for either a scalar function or a table valued function, we need the C
     # signature for a SQLite UDF or TVF
 
-    if has_projection:
+    if streams_rows:
+        # this will be a TVF that steps the statement the proc gives us
+        emit_stmt_proc_prototype(proc, cmd_args)
+        ___(f"void call_{proc_name}(sqlite3 *_Nonnull db, int32_t argc, sqlite3_value *_Nonnull *_Nonnull argv, sqlite3_stmt *_Nullable *_Nonnull result)")
+    elif has_projection:
         # this will be a TVF so we need to return the result set
         ___(f"void call_{proc_name}(sqlite3 *_Nonnull db, int32_t argc, sqlite3_value *_Nonnull *_Nonnull argv, cql_result_set_ref *result)")
     else:
@@ -464,7 +568,7 @@ def emit_proc_c_func_body(proc, cmd_args):
     # each section below is documented by the numbered output step
 
     if has_projection:
-        _vv(f"// 0. Ensure output result set is cleared in case of early out")
+        _vv(f"// 0. Ensure output {'statement' if streams_rows else 'result set'} is cleared in case of early out")
         ___(f"*result = NULL;")
         ___(f"")
 
@@ -517,7 +621,10 @@ def emit_proc_c_func_body(proc, cmd_args):
 
     # clear result set if needed
 
-    if has_projection:
+    if streams_rows:
+        ___(f"sqlite3_stmt *_data_stmt_ = NULL;")
+        ___(f"")
+    elif has_projection:
         ___(f"{proc['name']}_result_set_ref _data_result_set_ = NULL;")
         ___(f"")
 
@@ -527,10 +634,10 @@ def emit_proc_c_func_body(proc, cmd_args):
     # or not there is a result set to capture.
 
     _vv("// 5. Call the procedure")
-    ___(f"{'rc = ' if proc['usesDatabase'] else ''}{proc['name']}{'_fetch_results' if has_projection else ''}(", end="")
+    ___(f"{'rc = ' if proc['usesDatabase'] else ''}{proc['name']}{'_fetch_results' if has_projection and not streams_rows else ''}(", end="")
     for index, computed_arg in enumerate(
         (["db"] if proc['usesDatabase'] else []) +
-        (["&_data_result_set_"] if has_projection else []) +
+        (["&_data_stmt_"] if streams_rows else ["&_data_result_set_"] if has_projection else []) +
         [
             # args passed by reference for out and inout, by value for in
             # arg variables already declared above
@@ -559,6 +666,8 @@ def emit_proc_c_func_body(proc, cmd_args):
         ___("if (rc != SQLITE_OK) {")
         if not has_projection:
             ___("  sqlite3_result_null(context);")
+        if streams_rows:
+            ___("  cql_finalize_stmt(&_data_stmt_);")
         ___("  goto cleanup;")
         ___("}")
     ___()
@@ -568,7 +677,13 @@ def emit_proc_c_func_body(proc, cmd_args):
     vvv("//   (B) The first outtie argument (out or inout) value, if any")
     vvv("//   (C) Fallback to: null")
     vvv("//")
-    if has_projection:
+    if streams_rows:
+        vvv("// Current strategy: (A) Table valued function that steps the statement")
+
+        ___("*result = _data_stmt_;")
+        ___("goto cleanup;")
+        ___()
+    elif has_projection:
         vvv("// Current strategy: (A) Table valued function that exposes the result set")
 
         ___("*result = (cql_result_set_ref)_data_result_set_;")
@@ -626,8 +741,22 @@ def normalize_json_output(data, cmd_args):
        - From: [{"name": "cql:private", "value": 1}, ...]
        - To: {"cql:private": 1, ...}
 
+    4. Marks the procedures whose TVF can stream rows (streamsRows):
+       - the rows come from a SELECT (hasSelectResult)
+       - no encoded columns or autodrop tables, those need a fetched result set
+
+    5. Gathers what the TVF plan needs (see emit_tvf_plan):
+       - tvfArgs: the IN/INOUT args, these are the hidden columns
+       - tvfOptional: names from [[tvf_optional=(...)]], each must be a nullable tvfArg
+       - tvfRows, tvfCost: from [[tvf_rows=n]] and [[tvf_cost=n]]
+       - tvfMemoize, tvfMemoizeLimit: from [[tvf_memoize]] and [[tvf_memoize_limit=n]]
+
     This normalization simplifies the code generation logic.
     """
+    # procs in "queries" are exactly a SELECT, others say if they have one
+    for proc in data["queries"]:
+        proc['hasSelectResult'] = True
+
     for proc in (
         data["queries"] +
         data["deletes"] +
@@ -644,12 +773,50 @@ def normalize_json_output(data, cmd_args):
 
         # Convert attributes array to dict for fast lookups
         proc['attributes'] = {attr['name']: attr['value'] for attr in proc.get("attributes", [])}
+
+        # A SELECT proc can give us its statement so the TVF can stream the
+        # rows.  Encoded columns and autodrop tables are handled when a result
+        # set is fetched so those procs have to be materialized.  Memoized
+        # procs are materialized too, the cache holds on to the result sets.
+        proc['streamsRows'] = (
+            'projection' in proc
+            and proc.get('hasSelectResult', False)
+            and "cql:vault_sensitive" not in proc['attributes']
+            and "cql:autodrop" not in proc['attributes']
+            and "cql:tvf_memoize" not in proc['attributes'])
         for arg in proc['args']:
             # Default binding is 'in' (input parameter)
             arg['binding'] = arg.get('binding', 'in')
 
+        normalize_tvf_plan(proc)
+
     return data
 
+def normalize_tvf_plan(proc):
+    """Fill in the tvf plan fields of a proc, see normalize_json_output."""
+    attributes = proc['attributes']
+    proc['tvfArgs'] = [arg for arg in proc['args'] if arg['binding'] in ['in', 'inout']]
+
+    # a single name comes to us as a string, a list of names as a list
+    optional = attributes.get("cql:tvf_optional", [])
+    if isinstance(optional, str):
+        optional = [optional]
+
+    arg_names = {arg['name']: arg for arg in proc['tvfArgs']}
+    for name in optional:
+        if name not in arg_names or arg_names[name]['isNotNull']:
+            print(f"{proc['name']}: tvf_optional '{name}' must be a nullable in or inout argument", file=sys.stderr)
+            sys.exit(1)
+
+    proc['tvfOptional'] = optional
+    proc['tvfRows'] = attributes.get("cql:tvf_rows", 25)
+    proc['tvfCost'] = attributes.get("cql:tvf_cost", proc['tvfRows'])
+    proc['tvfMemoize'] = "cql:tvf_memoize" in attributes
+    proc['tvfMemoizeLimit'] = attributes.get("cql:tvf_memoize_limit", 16)
+    if not isinstance(proc['tvfMemoizeLimit'], int) or proc['tvfMemoizeLimit'] < 1:
+        print(f"{proc['name']}: tvf_memoize_limit must be a positive integer", file=sys.stderr)
+        sys.exit(1)
+
 def main():
     """
     Main entry point: parse arguments, load JSON, and generate C code.
@@ -406,6 +406,20 @@ code_gen_c_test() {
   TEST_CMD="do_make $O/cg_test_c_with_type_getters.o"
   run_test_expect_success
 
+  TEST_NAME="cg_test_c_unchecked_getters"
+  TEST_DESC="Running codegen test with unchecked getters enabled"
+  TEST_CMD="${CQL} --test --cg \"$O/cg_test_c_with_unchecked_getters.h\" \"$O/cg_test_c_with_unchecked_getters.c\" --in \"$T/cg_test_c_unchecked_getters.sql\" --global_proc cql_startup --unchecked_getters"
+  run_test_expect_success
+
+  echo Validating codegen
+  cql_verify "$T/cg_test_c_unchecked_getters.sql" "$O/cg_test_c_with_unchecked_getters.h"
+
+  rm -f out/cg_test_c_with_unchecked_getters.o
+  TEST_NAME="cg_test_c_with_unchecked_getters_compile"
+  TEST_DESC="Compiling generated C code from unchecked getters codegen test"
+  TEST_CMD="do_make $O/cg_test_c_with_unchecked_getters.o"
+  run_test_expect_success
+
   TEST_NAME="cg_test_c_with_namespace"
   TEST_DESC="Running codegen test with namespace enabled"
   TEST_CMD="${CQL} --dev --test --cg \"$O/cg_test_c_with_namespace.h\" \"$O/cg_test_c_with_namespace.c\" \"$O/cg_test_imports_with_namespace.ref\" --in \"$T/cg_test.sq\"l --global_proc cql_startup --c_include_namespace test_namespace --generate_exports"
@@ -433,6 +447,8 @@ code_gen_c_test() {
   on_diff_exit cg_test_c_with_header.h
   on_diff_exit cg_test_c_with_type_getters.c
   on_diff_exit cg_test_c_with_type_getters.h
+  on_diff_exit cg_test_c_with_unchecked_getters.c
+  on_diff_exit cg_test_c_with_unchecked_getters.h
   on_diff_exit cg_test_exports.out
   on_diff_exit cg_test_c.err
 
@@ -705,6 +721,20 @@ misc_cases() {
 
   on_diff_exit bigquote.err
 
+  TEST_NAME="loop_prepare_warning"
+  TEST_DESC="Running loop prepare warnings test"
+  TEST_CMD="${CQL} --warn_loop_prepare --cg \"$O/__temp.h\" \"$O/__temp.c\" --in \"$T/loop_prepare_warning.sql\""
+  run_test_expect_success
+
+  on_diff_exit loop_prepare_warning.err
+
+  TEST_NAME="loop_prepare_warning_lua"
+  TEST_DESC="Running loop prepare warnings test for Lua"
+  TEST_CMD="${CQL} --warn_loop_prepare --cg \"$O/__temp.lua\" --in \"$T/loop_prepare_warning.sql\" --rt lua"
+  run_test_expect_success
+
+  on_diff_exit loop_prepare_warning_lua.err
+
   TEST_NAME="alt_cqlrt"
   TEST_DESC="Running alternate cqlrt.h test"
   TEST_CMD="${CQL} --dev --cg \"$O/__temp.h\" \"$O/__temp.c\" --in \"$T/cg_test.sql\" --global_proc x --cqlrt alternate_cqlrt.h"
@@ -917,6 +947,40 @@ run_test() {
   TEST_DESC="Running compressed run test in C"
   TEST_CMD="./$O/run_test_compressed"
   run_test_expect_success
+
+  mkdir -p "$O/unchecked"
+
+  TEST_NAME="run_test_unchecked_codegen"
+  TEST_DESC="Generating run test code with unchecked getters"
+  TEST_CMD="${CQL} --nolines --unchecked_getters --cg \"$O/unchecked/run_test.h\" \"$O/unchecked/run_test.c\" --in \"$T/run_test.sql\" --global_proc cql_startup --rt c"
+  run_test_expect_success
+
+  TEST_NAME="run_test_unchecked_compile_code"
+  TEST_DESC="Compiling run test code with unchecked getters"
+  TEST_CMD="do_make run_test_unchecked"
+  run_test_expect_success
+
+  TEST_NAME="run_test_unchecked_run"
+  TEST_DESC="Running run test in C with unchecked getters"
+  TEST_CMD="./$O/run_test_unchecked"
+  run_test_expect_success
+
+  mkdir -p "$O/profiled"
+
+  TEST_NAME="run_test_profiled_codegen"
+  TEST_DESC="Generating run test code with the profiling runtime"
+  TEST_CMD="${CQL} --nolines --defines profiling --cg \"$O/profiled/run_test.h\" \"$O/profiled/run_test.c\" --in \"$T/run_test.sql\" --global_proc cql_startup --rt c"
+  run_test_expect_success
+
+  TEST_NAME="run_test_profiled_compile_code"
+  TEST_DESC="Compiling run test code with the profiling runtime"
+  TEST_CMD="do_make run_test_profiled"
+  run_test_expect_success
+
+  TEST_NAME="run_test_profiled_run"
+  TEST_DESC="Running run test in C with the profiling runtime"
+  TEST_CMD="./$O/run_test_profiled"
+  run_test_expect_success
 }
 
 upgrade_test() {
@@ -1010,6 +1074,160 @@ query_plan_test() {
   echo "Validating query plan empty result (this is stable)"
   echo "  computing diffs (empty if none)"
   on_diff_exit query_plan_empty_run.out
+
+  TEST_NAME="query_plan_advisor_codegen"
+  TEST_DESC="Generating query plan code with the index advisor"
+  TEST_CMD="${CQL} --test --dev --cg \"$O/cg_test_query_plan_advisor.out\" --in \"$T/cg_test_query_plan_advisor.sql\" --rt query_plan --query_plan_advisor"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_advisor_sem"
+  TEST_DESC="Running semantic analysis on index advisor query plan"
+  TEST_CMD="${CQL} --sem --ast --dev --test --in \"$O/cg_test_query_plan_advisor.out\""
+  run_test_expect_success
+
+  echo Validating index advisor test results
+  cql_verify "$T/cg_test_query_plan_advisor.sql" "$O/cg_test_query_plan_advisor.out"
+
+  echo Validating query plan codegen with the index advisor
+  echo "  computing diffs (empty if none)"
+  on_diff_exit cg_test_query_plan_advisor.out
+
+  TEST_NAME="query_plan_advisor_c_build"
+  TEST_DESC="Building index advisor query plan C code"
+  TEST_CMD="${CQL} --test --dev --cg \"$O/query_plan.h\" \"$O/query_plan.c\" --in \"$O/cg_test_query_plan_advisor.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_advisor_compile"
+  TEST_DESC="Compiling index advisor query plan code"
+  TEST_CMD="rm $O/query_plan.o && do_make query_plan_test"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_advisor_run"
+  TEST_DESC="Running index advisor query plan in C"
+  TEST_CMD="./$O/query_plan_test"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_advisor_json_validate"
+  TEST_DESC="Validating JSON format of index advisor report"
+  TEST_CMD="common/json_check.py <\"$O/query_plan_advisor_run.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_advisor_report"
+  TEST_DESC="Checking that the index advisor recommended an index"
+  TEST_CMD="grep '\"index\" : \"CREATE INDEX' \"$O/query_plan_advisor_run.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_stats_codegen"
+  TEST_DESC="Generating query plan code with planner statistics"
+  TEST_CMD="${CQL} --test --dev --cg \"$O/cg_test_query_plan_stats.out\" --in \"$T/cg_test_query_plan_stats.sql\" --rt query_plan --query_plan_stats \"$T/query_plan_stats.json\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_stats_sem"
+  TEST_DESC="Running semantic analysis on query plan with planner statistics"
+  TEST_CMD="${CQL} --sem --ast --dev --test --in \"$O/cg_test_query_plan_stats.out\""
+  run_test_expect_success
+
+  echo Validating planner statistics test results
+  cql_verify "$T/cg_test_query_plan_stats.sql" "$O/cg_test_query_plan_stats.out"
+
+  echo Validating query plan codegen with planner statistics
+  echo "  computing diffs (empty if none)"
+  on_diff_exit cg_test_query_plan_stats.out
+
+  TEST_NAME="query_plan_stats_c_build"
+  TEST_DESC="Building planner statistics query plan C code"
+  TEST_CMD="${CQL} --test --dev --cg \"$O/query_plan.h\" \"$O/query_plan.c\" --in \"$O/cg_test_query_plan_stats.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_stats_compile"
+  TEST_DESC="Compiling planner statistics query plan code"
+  TEST_CMD="rm $O/query_plan.o && do_make query_plan_test"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_stats_run"
+  TEST_DESC="Running planner statistics query plan in C"
+  TEST_CMD="./$O/query_plan_test"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_stats_json_validate"
+  TEST_DESC="Validating JSON format of planner statistics query plan report"
+  TEST_CMD="common/json_check.py <\"$O/query_plan_stats_run.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_stats_index_choice"
+  TEST_DESC="Checking that the planner used the statistics to choose an index"
+  TEST_CMD="grep 'USING INDEX users_city' \"$O/query_plan_stats_run.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_stats_missing_file"
+  TEST_DESC="Missing planner statistics file is an error"
+  TEST_CMD="${CQL} --dev --cg \"$O/cg_test_query_plan_stats_missing.out\" --in \"$T/cg_test_query_plan_stats.sql\" --rt query_plan --query_plan_stats \"$T/query_plan_stats_missing.json\""
+  run_test_expect_fail
+
+  TEST_NAME="query_plan_baseline_codegen"
+  TEST_DESC="Generating query plan code with a plan baseline"
+  TEST_CMD="${CQL} --test --dev --cg \"$O/cg_test_query_plan_baseline.out\" --in \"$T/cg_test_query_plan_baseline.sql\" --rt query_plan --query_plan_baseline \"$T/query_plan_baseline.json\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_sem"
+  TEST_DESC="Semantic analysis of the query plan code with a plan baseline"
+  TEST_CMD="${CQL} --sem --ast --dev --test --in \"$O/cg_test_query_plan_baseline.out\""
+  run_test_expect_success
+
+  echo "  computing diffs (expect no changes) -- query plan baseline"
+  cql_verify "$T/cg_test_query_plan_baseline.sql" "$O/cg_test_query_plan_baseline.out"
+
+  on_diff_exit cg_test_query_plan_baseline.out
+
+  TEST_NAME="query_plan_baseline_c_build"
+  TEST_DESC="Building C code for query plan with a plan baseline"
+  TEST_CMD="${CQL} --test --dev --cg \"$O/query_plan.h\" \"$O/query_plan.c\" --in \"$O/cg_test_query_plan_baseline.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_compile"
+  TEST_DESC="Compiling query plan with a plan baseline"
+  TEST_CMD="rm $O/query_plan.o && do_make query_plan_test"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_run"
+  TEST_DESC="Running query plan with only tolerated regressions"
+  TEST_CMD="./$O/query_plan_test"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_json_validate"
+  TEST_DESC="Validating query plan JSON output with a plan baseline"
+  TEST_CMD="common/json_check.py <\"$O/query_plan_baseline_run.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_report"
+  TEST_DESC="Tolerated plan regressions are reported but not counted against the run"
+  TEST_CMD="grep '\"untoleratedRegressions\" : 0' \"$O/query_plan_baseline_run.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_regressed_codegen"
+  TEST_DESC="Generating query plan code with a baseline that was better"
+  TEST_CMD="${CQL} --dev --cg \"$O/cg_test_query_plan_baseline_regressed.out\" --in \"$T/cg_test_query_plan_baseline.sql\" --rt query_plan --query_plan_baseline \"$T/query_plan_baseline_regressed.json\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_regressed_c_build"
+  TEST_DESC="Building C code for query plan with a baseline that was better"
+  TEST_CMD="${CQL} --test --dev --cg \"$O/query_plan.h\" \"$O/query_plan.c\" --in \"$O/cg_test_query_plan_baseline_regressed.out\""
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_regressed_compile"
+  TEST_DESC="Compiling query plan with a baseline that was better"
+  TEST_CMD="rm $O/query_plan.o && do_make query_plan_test"
+  run_test_expect_success
+
+  TEST_NAME="query_plan_baseline_regressed_run"
+  TEST_DESC="Untolerated plan regressions fail the query plan run"
+  TEST_CMD="./$O/query_plan_test"
+  run_test_expect_fail
+
+  TEST_NAME="query_plan_baseline_regressed_report"
+  TEST_DESC="Untolerated plan regressions are counted in the report"
+  TEST_CMD="grep '\"untoleratedRegressions\" : 1' \"$O/query_plan_baseline_regressed_run.out\""
+  run_test_expect_success
 }
 
 line_number_test() {
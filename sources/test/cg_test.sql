@@ -1617,7 +1617,6 @@ end;
 -- + cql_set_notnull(C.rate, _seed_);
 -- + cql_set_notnull(C.type, _seed_);
 -- + cql_set_notnull(C.size, (cql_double)(_seed_));
--- - _rc_
 -- - cql_cleanup
 proc fetch_values_dummy()
 begin
@@ -2273,6 +2272,47 @@ create table radioactive(
  data text @sensitive
 );
 
+-- TEST: vault_sensitive with no columns encodes the sensitive columns
+-- + cql_uint16 vault_all_sensitive_encoded_columns[] = { 1,
+-- +   1, // data
+-- + .encoded_columns = vault_all_sensitive_encoded_columns,
+-- + .encode_context_index = -1,
+[[vault_sensitive]]
+proc vault_all_sensitive()
+begin
+  select * from radioactive;
+end;
+
+-- TEST: vault_sensitive with a context column and a column list
+-- + cql_uint16 vault_with_context_encoded_columns[] = { 1,
+-- +   0, // id
+-- + .encoded_columns = vault_with_context_encoded_columns,
+-- + .encode_context_index = 1,
+[[vault_sensitive=(data, (id))]]
+proc vault_with_context()
+begin
+  select * from radioactive;
+end;
+
+-- TEST: vault_sensitive on an OUT UNION proc
+-- + cql_uint16 vault_out_union_encoded_columns[] = { 1,
+-- + .encoded_columns = vault_out_union_encoded_columns,
+[[vault_sensitive=(data)]]
+proc vault_out_union()
+begin
+  cursor C for select * from radioactive;
+  fetch C;
+  out union C;
+end;
+
+-- TEST: no sensitive columns means nothing is encoded
+-- - encoded_columns
+[[vault_sensitive]]
+proc vault_nothing_sensitive()
+begin
+  select id from radioactive;
+end;
+
 -- TEST: with delete form
 -- + _rc_ = cql_exec(_db_,
 -- + "WITH "
@@ -2659,11 +2699,17 @@ end;
 
 -- TEST:  we need to be able to call the above proc, this requires
 -- the args be emitted correctly, with a comma (!)
+-- the cursor layout is recorded so that matching rows can be copied directly
+-- + static cql_uint16 C_cols_[] = { 2,
+-- + cql_offsetof(read_out_union_values_C_row, x),
+-- + static uint8_t C_data_types_[] = {
 -- + out_union_values_fetch_results(&C_result_set_, a, b);
 -- + C_row_num_ = C_row_count_ = -1;
 -- + C_row_count_ = cql_result_set_get_count((cql_result_set_ref)C_result_set_);
 -- + C_row_num_++;
 -- + C._has_row_ = C_row_num_ < C_row_count_;
+-- + if (!cql_copyoutrow_direct((cql_result_set_ref)C_result_set_, C_row_num_, &C, sizeof(C), C_cols_, C_data_types_)) {
+-- otherwise the columns are read one by one
 -- + cql_copyoutrow(NULL, (cql_result_set_ref)C_result_set_, C_row_num_, 2,
 -- +   CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_INT32, &C.x,
 -- +   CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_INT32, &C.y);
@@ -2850,6 +2896,28 @@ begin
   select * from bar;
 end;
 
+-- TEST: the result set blob reader is generated, the writer is a macro
+-- + CQL_WARN_UNUSED cql_code sproc_with_serializer_from_blob(cql_blob_ref _Nullable blob, sproc_with_serializer_result_set_ref _Nullable *_Nonnull result_set) {
+-- + .data_types = sproc_with_serializer_data_types,
+-- + .col_offsets = sproc_with_serializer_col_offsets,
+-- + .rowsize = sizeof(sproc_with_serializer_row),
+-- + return cql_result_set_from_blob(&info, false, blob, (cql_result_set_ref *)result_set);
+[[generate_serializer]]
+proc sproc_with_serializer()
+begin
+  select * from bar;
+end;
+
+-- TEST: out union rows begin with a row header which the reader fills in
+-- + CQL_WARN_UNUSED cql_code out_union_with_serializer_from_blob(cql_blob_ref _Nullable blob, out_union_with_serializer_result_set_ref _Nullable *_Nonnull result_set) {
+-- + return cql_result_set_from_blob(&info, true, blob, (cql_result_set_ref *)result_set);
+[[generate_serializer]]
+proc out_union_with_serializer()
+begin
+  cursor C like bar;
+  out union C;
+end;
+
 -- TEST: emit an object result set with setters with not null values
 -- all this stuff goes in the header file so it's no longer present here
 -- - emit_object_with_setters_get_o
@@ -2901,6 +2969,107 @@ begin
   select * from bar;
 end;
 
+-- TEST: compact rows, nullable primitives are stored bare with their null
+-- flags in a bitmap at the front, then the primitives by size, then refs
+-- + typedef struct compact_rows_proc_row {
+-- +   uint8_t _null_bits_[1];
+-- +   cql_bool b;
+-- +   cql_bool nb;
+-- +   cql_int32 i;
+-- +   cql_int32 ni;
+-- +   cql_int64 l;
+-- +   cql_double nr;
+-- +   cql_string_ref _Nullable t;
+-- + } compact_rows_proc_row;
+-- + CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_NOT_NULL, // i
+-- + CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_NULL_BIT, // ni
+-- + CQL_DATA_TYPE_DOUBLE | CQL_DATA_TYPE_NULL_BIT, // nr
+-- + CQL_DATA_TYPE_BOOL | CQL_DATA_TYPE_NULL_BIT, // nb
+-- + CQL_DATA_TYPE_STRING, // t
+-- + cql_offsetof(compact_rows_proc_row, ni)
+-- - cql_nullable_
+[[compact_rows]]
+proc compact_rows_proc()
+begin
+  select 1 i, nullable(2) ni, 3L l, nullable(1.5) nr, true b, nullable(false) nb, nullable("x") t;
+end;
+
+-- TEST: compact rows without nullable primitives needs no bitmap
+-- + typedef struct compact_rows_no_nulls_row {
+-- +   cql_bool b;
+-- +   cql_int32 i;
+-- +   cql_int64 l;
+-- +   cql_string_ref _Nonnull t;
+-- - _null_bits_
+-- - CQL_DATA_TYPE_NULL_BIT
+[[compact_rows]]
+proc compact_rows_no_nulls()
+begin
+  select 3L l, "x" t, 1 i, true b;
+end;
+
+-- TEST: compact rows has no effect on procs that use the cursor layout
+-- - _null_bits_
+-- - CQL_DATA_TYPE_NULL_BIT
+[[compact_rows]]
+proc compact_rows_out_proc()
+begin
+  declare C cursor like select nullable(1) x;
+  fetch C using 1 x;
+  out C;
+end;
+
+-- TEST: stream rows emits the body as a streaming function
+-- + void stream_rows_proc_stream(cql_int32 n, cql_row_sink _Nonnull _sink_, void *_Nullable _sink_context_)
+-- + if (C._has_row_ && !_sink_(_sink_context_, (const void *)&C, sizeof(C))) {
+-- + goto cql_cleanup;
+-- the wrapper makes the result set from the streamed rows
+-- + void stream_rows_proc_fetch_results(stream_rows_proc_result_set_ref _Nullable *_Nonnull _result_set_, cql_int32 n) {
+-- + stream_rows_proc_stream(n, cql_bytebuf_row_sink, &_rows_);
+-- + cql_results_from_data(SQLITE_OK, &_rows_, &stream_rows_proc_info, (cql_result_set_ref *)_result_set_);
+-- the rows are lent to the sink, no retain and no buffer in the body
+-- - cql_retain_row(C);
+-- - cql_bytebuf_append(&_rows_
+[[stream_rows]]
+proc stream_rows_proc(n int!)
+begin
+  declare C cursor like select 1 x, "y" y;
+  declare i int!;
+  while i < n
+  begin
+    fetch C using i x, "y" y;
+    out union C;
+    i += 1;
+  end;
+end;
+
+-- TEST: stream rows in a dml proc clears _rc_ when the sink stops early
+-- + CQL_WARN_UNUSED cql_code stream_rows_dml_stream(sqlite3 *_Nonnull _db_, cql_string_ref _Nullable _in__t, cql_row_sink _Nonnull _sink_, void *_Nullable _sink_context_)
+-- + _rc_ = SQLITE_OK;
+-- + cql_code _rc_ = stream_rows_dml_stream(_db_, _in__t, cql_bytebuf_row_sink, &_rows_);
+-- + stream_rows_dml_info.db = _db_;
+-- + cql_results_from_data(_rc_, &_rows_, &stream_rows_dml_info, (cql_result_set_ref *)_result_set_);
+-- + return _rc_;
+[[stream_rows]]
+proc stream_rows_dml(t text)
+begin
+  t := "z";
+  declare C cursor for select 1 x, t y;
+  loop fetch C
+  begin
+    out union C;
+  end;
+end;
+
+-- TEST: stream rows has no effect on a proc that forwards a result
+-- - cql_row_sink
+-- - _sink_
+[[stream_rows]]
+proc stream_rows_forwarder()
+begin
+  call stream_rows_proc(2);
+end;
+
 -- TEST: no result set items should be generated at all
 -- - CQL_DATA_TYPE
 -- - lotsa_columns_no_result_set_fetch_results
@@ -4862,6 +5031,21 @@ begin
   D:from_blob(B);
 end;
 
+-- TEST: fixed width serialization and views use the same validation
+-- + _rc_ = cql_cursor_to_fixed_blob(_db_, &C_dyn, &B);
+-- + _rc_ = cql_cursor_view_from_blob(_db_, &D_dyn, B);
+proc blob_fixed_width_view_test(name text!)
+begin
+  cursor C like structured_storage;
+  fetch C using 1 id, name name;
+
+  declare B blob<structured_storage>!;
+  C:to_fixed_blob(B);
+
+  declare D cursor like C;
+  D:view_from_blob(B);
+end;
+
 func make_blob() create blob<structured_storage>;
 
 -- TEST: get a blob from somewhere other than a local
@@ -5644,11 +5828,13 @@ begin
 end;
 
 -- TEST: in_loop variation of statement prep with cursor
--- finalize on entry causes another finalize
--- +2 cql_finalize_stmt(&C_stmt);
+-- the cursor statement is prepared once and reset on later iterations
+-- +1 cql_finalize_stmt(&C_stmt);
 -- +2 cql_finalize_stmt(&_temp_stmt);
--- verify that we went back to _temp_stmt after using C_stmt
+-- + if (!C_stmt) {
 -- +1 _rc_ = cql_prepare(_db_, &C_stmt,
+-- + sqlite3_reset(C_stmt);
+-- verify that we went back to _temp_stmt after using C_stmt
 -- +1 _rc_ = cql_prepare(_db_, &_temp_stmt,
 proc cursor_in_loop()
 begin
@@ -5663,6 +5849,39 @@ begin
    let x := (select exists(select 1 from foo));
 end;
 
+-- TEST: in_loop cursor with conditional fragments can't keep its statement
+-- the text changes with x so the statement is finalized on every iteration
+-- +2 cql_finalize_stmt(&C_stmt);
+-- - if (!C_stmt) {
+proc conditional_cursor_in_loop()
+begin
+   let i := 0;
+   while i < 10
+   begin
+      cursor C for
+        with frag(*) as (call shared_conditional(i))
+        select * from frag;
+      fetch C;
+      set i := i + 1;
+   end;
+end;
+
+-- TEST: in_loop DML with no bindings is prepared once and stepped
+-- + if (!_temp1_stmt) {
+-- + _rc_ = cql_prepare(_db_, &_temp1_stmt,
+-- + _rc_ = sqlite3_step(_temp1_stmt);
+-- +1 sqlite3_reset(_temp1_stmt);
+-- - cql_exec(_db_,
+proc unbound_stmt_in_loop()
+begin
+   let i := 0;
+   while i < 10
+   begin
+      delete from foo where id = 1;
+      set i := i + 1;
+   end;
+end;
+
 -- TEST: in_loop variation of select expression case
 -- +1 sqlite3_reset(_temp1_stmt);
 -- +1 cql_finalize_stmt(&_temp1_stmt);
@@ -5703,7 +5922,7 @@ end;
 -- +1 cql_int32 int_cast_foo = 0;
 -- +1 cql_int32 int_sql_val = 0;
 -- +1 int_lit_foo = 1;
--- +1 cql_set_string_ref(&a_string, _literal_26_abc_my_proc_check_type);
+-- +1 cql_set_string_ref(&a_string, _literal_27_abc_my_proc_check_type);
 -- +1 cql_set_string_ref(&str_foo, a_string);
 -- +1 int_cast_foo = 1;
 -- +1 _rc_ = cql_prepare(_db_, &_temp_stmt,
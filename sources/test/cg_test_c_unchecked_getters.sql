@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Note this file is set up to verify the .h file rather than the .c file in test.sh
+ * It is compiled with --unchecked_getters
+ */
+
+create table foo (
+  f1 integer not null,
+  f2 text not null,
+  f3 real not null,
+  f4 bool not null,
+  f5 long not null,
+  f6 blob not null,
+
+  g1 integer,
+  g2 text,
+  g3 real,
+  g4 bool,
+  g5 long,
+  g6 blob
+);
+
+-- TEST: unchecked getters read the column storage directly
+-- not null types
+-- +1 static inline cql_int32 selector_get_f1(selector_result_set_ref _Nonnull result_set, cql_int32 row) {
+-- +1   return *(cql_int32 *)cql_unchecked_col_address(result_set, row, 0);
+-- +1 static inline cql_string_ref _Nonnull selector_get_f2(selector_result_set_ref _Nonnull result_set, cql_int32 row) {
+-- +1   return *(cql_string_ref _Nonnull *)cql_unchecked_col_address(result_set, row, 1);
+-- +1   return *(cql_double *)cql_unchecked_col_address(result_set, row, 2);
+-- +1   return *(cql_bool *)cql_unchecked_col_address(result_set, row, 3);
+-- +1   return *(cql_int64 *)cql_unchecked_col_address(result_set, row, 4);
+-- +1   return *(cql_blob_ref _Nonnull *)cql_unchecked_col_address(result_set, row, 5);
+--
+-- nullable primitives read the nullable struct, no second call for the null bit
+-- +1 static inline cql_bool selector_get_g1_is_null(selector_result_set_ref _Nonnull result_set, cql_int32 row) {
+-- +1   return ((cql_nullable_int32 *)cql_unchecked_col_address(result_set, row, 6))->is_null;
+-- +1 static inline cql_int32 selector_get_g1_value(selector_result_set_ref _Nonnull result_set, cql_int32 row) {
+-- +1   return ((cql_nullable_int32 *)cql_unchecked_col_address(result_set, row, 6))->value;
+-- +1   return ((cql_nullable_double *)cql_unchecked_col_address(result_set, row, 8))->is_null;
+-- +1   return ((cql_nullable_bool *)cql_unchecked_col_address(result_set, row, 9))->value;
+-- +1   return ((cql_nullable_int64 *)cql_unchecked_col_address(result_set, row, 10))->value;
+--
+-- nullable references are just null
+-- +1   return *(cql_string_ref _Nullable *)cql_unchecked_col_address(result_set, row, 7);
+-- +1   return *(cql_blob_ref _Nullable *)cql_unchecked_col_address(result_set, row, 11);
+--
+-- the row is checked in debug builds only, and none of the checked helpers are used
+-- +16 cql_unchecked_getter_contract(result_set, row);
+-- - cql_result_set_get_is_null_col
+create proc selector()
+begin
+  select * from foo;
+end;
+
+-- TEST: single row result sets use row 0
+-- + static inline cql_object_ref _Nonnull out_object_get_o(out_object_result_set_ref _Nonnull result_set) {
+-- +   cql_unchecked_getter_contract(result_set, 0);
+-- +   return *(cql_object_ref _Nonnull *)cql_unchecked_col_address(result_set, 0, 0);
+create proc out_object(o object not null)
+begin
+  declare C cursor like out_object arguments;
+  fetch C from arguments;
+  out C;
+end;
+
+create proc simple_child_proc()
+begin
+  select 1 x, 2 y;
+end;
+
+-- TEST: result set typed columns are cast to their result set type
+-- + static inline simple_child_proc_result_set_ref _Nullable simple_container_proc_get_c(simple_container_proc_result_set_ref _Nonnull result_set, cql_int32 row) {
+-- +   return (simple_child_proc_result_set_ref _Nullable )*(cql_object_ref _Nullable *)cql_unchecked_col_address(result_set, row, 2);
+create proc simple_container_proc()
+begin
+  declare C cursor like (a integer, b integer not null, c object<simple_child_proc set>);
+  fetch C using
+     1 a,
+     2 b,
+     simple_child_proc() c;
+
+  out union C;
+end;
+
+-- TEST: nullable primitives in compact rows use the checked helpers because a
+-- result set extracted from a partition has the cursor layout instead
+-- + return *(cql_int32 *)cql_unchecked_col_address(result_set, row, 0);
+-- + return cql_result_set_get_is_null_col((cql_result_set_ref)result_set, row, 1);
+-- + return cql_result_set_get_int32_col((cql_result_set_ref)result_set, row, 1);
+-- + return *(cql_string_ref _Nullable *)cql_unchecked_col_address(result_set, row, 2);
+[[compact_rows]]
+proc compact_selector()
+begin
+  select f1, g1, g2 from foo;
+end;
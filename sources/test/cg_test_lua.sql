@@ -128,7 +128,7 @@ set r2 := 3.5;
 -- + i1_nullable = cql_to_num(cql_unary_not(cql_unary_not(cql_to_bool(i0_nullable))))
 set i1_nullable := NOT NOT i0_nullable;
 
--- + i2 = cql_to_num(not not b2)
+-- + i2 = ((not not b2) and 1 or 0)
 set i2 := NOT NOT b2;
 
 -- TEST: not null arithmetic
@@ -168,7 +168,7 @@ set t2 := "This is a \" \\ test '' \n \" ";
 call printf("Hello, world\n");
 
 -- TEST: logical AND with short circuit
--- + i2 = cql_to_num(cql_to_bool(r2) and cql_to_bool(l2))
+-- + i2 = (((r2 ~= 0) and (l2 ~= 0)) and 1 or 0)
 set i2 := r2 and l2;
 
 -- helper methods for the next test
@@ -192,8 +192,8 @@ func side_effect2() integer;
 -- +   end
 -- +   _tmp_int_1 = 7
 -- + until true
--- + _tmp_n_bool_3 = _tmp_int_1
--- + if cql_is_false(_tmp_n_bool_3) then
+-- + _tmp_n_bool_3 = (_tmp_int_1 ~= 0)
+-- + if not _tmp_n_bool_3 then
 -- +   _tmp_bool_0 = false
 -- + else
 -- +   repeat
@@ -204,9 +204,9 @@ func side_effect2() integer;
 -- +     end
 -- +     _tmp_int_2 = 5
 -- +   until true
--- +   _tmp_bool_0 = cql_logical_and(_tmp_n_bool_3, _tmp_int_2)
+-- +   _tmp_bool_0 = (_tmp_int_2 ~= 0)
 -- + end
--- + i2 = cql_to_num(_tmp_bool_0)
+-- + i2 = (_tmp_bool_0 and 1 or 0)
 set i2 := coalesce(side_effect1(), 7) and coalesce(side_effect2(), 5);
 
 -- TEST: trival NULL on AND
@@ -226,7 +226,7 @@ set i0_nullable := NULL and i1_nullable;
 set i0_nullable := i0_nullable and NULL;
 
 -- TEST: logical OR with short circuit
--- + i2 = cql_to_num(cql_to_bool(r2) or cql_to_bool(l2))
+-- + i2 = (((r2 ~= 0) or (l2 ~= 0)) and 1 or 0)
 set i2 := r2 or l2;
 
 -- TEST: complex side effect, looks safe (no nullables) but it isn't because of codegen on the right
@@ -241,8 +241,8 @@ set i2 := r2 or l2;
 -- +   end
 -- +   _tmp_int_1 = 7
 -- + until true
--- + _tmp_n_bool_3 = _tmp_int_1
--- + if cql_is_true(_tmp_n_bool_3) then
+-- + _tmp_n_bool_3 = (_tmp_int_1 ~= 0)
+-- + if _tmp_n_bool_3 then
 -- +   _tmp_bool_0 = true
 -- + else
 -- +   repeat
@@ -253,9 +253,9 @@ set i2 := r2 or l2;
 -- +     end
 -- +     _tmp_int_2 = 5
 -- +   until true
--- +   _tmp_bool_0 = cql_logical_or(_tmp_n_bool_3, _tmp_int_2)
+-- +   _tmp_bool_0 = (_tmp_int_2 ~= 0)
 -- + end
--- + i2 = cql_to_num(_tmp_bool_0)
+-- + i2 = (_tmp_bool_0 and 1 or 0)
 set i2 := coalesce(side_effect1(), 7) or coalesce(side_effect2(), 5);
 
 -- TEST: trival NULL on OR
@@ -275,19 +275,19 @@ set i0_nullable := NULL or i1_nullable;
 set i0_nullable := i0_nullable or NULL;
 
 -- TEST: is null basic test
--- + i2 = cql_to_num(nil == nil)
+-- + i2 = ((nil == nil) and 1 or 0)
 set i2 := null is null;
 
 -- TEST: is null test general case
--- + i2 = cql_to_num(cql_add(i0_nullable, i1_nullable) == nil)
+-- + i2 = ((cql_add(i0_nullable, i1_nullable) == nil) and 1 or 0)
 set i2 := (i0_nullable + i1_nullable) is null;
 
 -- TEST: is not null basic test
--- + i2 = cql_to_num(nil ~= nil)
+-- + i2 = ((nil ~= nil) and 1 or 0)
 set i2 := null is not null;
 
 -- TEST: is not null test general case
--- + i2 = cql_to_num(cql_add(i0_nullable, i1_nullable) ~= nil)
+-- + i2 = ((cql_add(i0_nullable, i1_nullable) ~= nil) and 1 or 0)
 set i2 := (i0_nullable + i1_nullable) is not null;
 
 -- TEST: complex if/else pattern
@@ -336,7 +336,7 @@ end if;
 -- do not remove this contract it's necessary
 -- + cql_contract_argument_notnull(i, 1)
 -- ------------------------------------------
--- +   if cql_to_bool(i) then
+-- +   if (i ~= 0) then
 -- +     puts("true")
 -- +   end
 -- + end
@@ -540,7 +540,7 @@ end;
 -- +     i2 = 100
 -- +     break
 -- +   end
--- +   if cql_to_bool(2) then
+-- +   if (2 ~= 0) then
 -- +     i2 = 200
 -- +     break
 -- +   end
@@ -557,7 +557,7 @@ set i2 := case when 1 then 100 when 2 then 200 else 300 end;
 -- +    if _tmp_int_1 == 4 then break end
 -- +    _tmp_bool_0 = false
 -- + until true
--- + i2 = cql_to_num(_tmp_bool_0)
+-- + i2 = (_tmp_bool_0 and 1 or 0)
 set i2 := 3 in (1, 2, null, 4);
 
 -- TEST: in with nullables
@@ -585,7 +585,7 @@ set i0_nullable := i1_nullable in (1, 2, null, b0_nullable);
 -- +   if _tmp_int_1 == 4 then break end
 -- +   _tmp_bool_0 = true
 -- + until true
--- + i2 = cql_to_num(_tmp_bool_0)
+-- + i2 = (_tmp_bool_0 and 1 or 0)
 set i2 := 3 not in (1, 2, null, 4);
 
 -- TEST: not in with nullables
@@ -2038,11 +2038,11 @@ declare global_cursor cursor for select 1 a, 2 b;
 fetch global_cursor;
 
 -- TEST: use like in an expression
--- +  i2 = cql_to_num(cql_like("x", "y"))
+-- +  i2 = ((cql_like("x", "y")) and 1 or 0)
 set i2 := 'x' LIKE 'y';
 
 -- TEST: use not like in an expression
--- +  i2 = cql_to_num(cql_not_like("x", "y"))
+-- +  i2 = ((cql_not_like("x", "y")) and 1 or 0)
 set i2 := 'x' NOT LIKE 'y';
 
 -- TEST: use like in a SQL statement
@@ -2107,7 +2107,7 @@ end;
 -- + b = 1 == 1
 -- + b = "x" == "x"
 -- + b = "x" == "y"
--- + b = cql_to_bool(1 + cql_to_num((3 == 4)))
+-- + b = (1 + ((3 == 4) and 1 or 0) ~= 0)
 -- + i = 1
 -- + j = 2
 -- + b = i == j
@@ -2141,7 +2141,7 @@ end;
 -- + b = 1 ~= 1
 -- + b = "x" ~= "x"
 -- + b = "x" ~= "y"
--- + b = cql_to_bool(1 + cql_to_num((3 ~= 4)))
+-- + b = (1 + ((3 ~= 4) and 1 or 0) ~= 0)
 -- + i = 1
 -- + j = 2
 -- + b = i ~= j
@@ -3229,13 +3229,13 @@ DECLARE x INT!;
 
 -- TEST: a series of paren checks on left association
 -- avoid hard coded divide by zero (hence 4/3 not e.g 1/3)
--- + x = 1 * cql_idiv(4, 3)
+-- + x = 1 * (4 // 3)
 SET x := 1 * (4 / 3);
 
 -- + x = cql_idiv(1 * 2, 3)
 SET x := 1 * 2 / 3;
 
--- + x = 1 + cql_idiv(2, 3)
+-- + x = 1 + 2 // 3
 SET x := 1 + 2 / 3;
 
 -- + x = 1 + (2 - 3)
@@ -3260,16 +3260,53 @@ SET x := 1 - 2 - (2 - 3);
 -- + x = 1 - 2 - (2 - 3)
 SET x := (1 - 2) - (2 - 3);
 
--- + x = cql_idiv(cql_idiv(1, 2), 3)
+-- + x = 1 // 2 // 3
 SET x := 1 / 2 / 3;
 
 -- avoid hard coded divide by zero
--- + x = cql_idiv(1, cql_idiv(4, 3))
+-- + x = 1 // (4 // 3)
 SET x := 1 / (4 / 3);
 
--- + x = cql_idiv(1, 2)
+-- + x = 1 // 2
 SET x := 1 / 2;
 
+-- TEST: not null division by a non-negative value only needs the left sign
+-- - cql_idiv
+-- + x = (x >= 0 and x // 2 or -(-x // 2))
+SET x := x / 2;
+
+-- TEST: not null division of simple operands open codes the C truncation
+-- - cql_idiv
+-- + x = ((x < 0) == (i2 < 0) and x // i2 or -(-x // i2))
+SET x := x / i2;
+
+-- TEST: not null division with a complex operand still needs the helper
+-- + x = cql_idiv((x + 1), i2)
+SET x := (x + 1) / i2;
+
+-- TEST: nullable division uses the helper
+-- + i0_nullable = cql_idiv(i0_nullable, 2)
+SET i0_nullable := i0_nullable / 2;
+
+-- TEST: not null modulus of non-negative literals is the Lua operator
+-- - cql_mod
+-- + x = 7 % 3
+SET x := 7 % 3;
+
+-- TEST: not null modulus by a non-negative value only needs the left sign
+-- - cql_mod
+-- + x = (x >= 0 and x % 3 or -(-x % 3))
+SET x := x % 3;
+
+-- TEST: not null modulus otherwise uses math.fmod which truncates like C
+-- - cql_mod
+-- + x = math.fmod((x + 1), i2)
+SET x := (x + 1) % i2;
+
+-- TEST: nullable modulus uses the helper
+-- + i0_nullable = cql_mod(i0_nullable, 3)
+SET i0_nullable := i0_nullable % 3;
+
 -- + x = 1 * 2 * (3 * 4)
 SET x := 1 * 2 * (3 * 4);
 
@@ -3320,7 +3357,7 @@ set x := 1 | (2 << 3);
 -- + x = 1 << (2 << 3)
 set x := 1 << (2 << 3);
 
--- + cql_to_num(1 < cql_to_num((2 > 3)))
+-- + ((1 < ((2 > 3) and 1 or 0)) and 1 or 0)
 set x := 1 < (2 > 3);
 
 -- + x = 1 << (2 >> 3)
@@ -3332,7 +3369,7 @@ set x := 1 | (2 | 3);
 -- + x = 1 | 2 | 3
 set x := (1 | 2) | 3;
 
--- + cql_to_num(1 == cql_to_num((2 ~= 3)))
+-- + ((1 == ((2 ~= 3) and 1 or 0)) and 1 or 0)
 set x := 1 == (2 != 3);
 
 create table SalesInfo(
@@ -4019,7 +4056,7 @@ end;
 -- + _tmp_int_0 = i2
 -- + repeat
 -- +   if _tmp_int_0 == 1 then
--- +     if cql_to_bool(i2) then
+-- +     if (i2 ~= 0) then
 -- +       break
 -- +     end
 -- +     i2 = 999
@@ -5158,11 +5195,13 @@ begin
 end;
 
 -- TEST: in_loop variation of statement prep with cursor
--- finalize on entry causes another finalize
--- +2 cql_finalize_stmt(C_stmt)
+-- the cursor statement is prepared once and reset on later iterations
+-- +1 cql_finalize_stmt(C_stmt)
 -- +2 cql_finalize_stmt(_temp_stmt)
--- verify that we went back to _temp_stmt after using C_stmt
+-- + if C_stmt == nil then
 -- +1 _rc_, C_stmt = cql_prepare(_db_,
+-- + cql_reset_stmt(C_stmt)
+-- verify that we went back to _temp_stmt after using C_stmt
 -- +1 _rc_, _temp_stmt = cql_prepare(_db_,
 proc cursor_in_loop()
 begin
@@ -5177,6 +5216,22 @@ begin
    let x := (select exists(select 1 from foo));
 end;
 
+-- TEST: in_loop DML with no bindings is prepared once and stepped
+-- + if _temp1_stmt == nil then
+-- + _rc_, _temp1_stmt = cql_prepare(_db_,
+-- + _rc_ = cql_step(_temp1_stmt)
+-- +1 cql_reset_stmt(_temp1_stmt)
+-- - cql_exec(_db_,
+proc unbound_stmt_in_loop()
+begin
+   let i := 0;
+   while i < 10
+   begin
+      delete from foo where id = 1;
+      set i := i + 1;
+   end;
+end;
+
 -- TEST: in_loop variation of select expression case
 -- +1 cql_reset_stmt(_temp1_stmt)
 -- +1 cql_finalize_stmt(_temp1_stmt)
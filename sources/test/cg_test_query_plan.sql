@@ -168,7 +168,7 @@
 -- +   LET query_plan_trivial_blob := trivial_blob();
 --
 -- +   LET stmt := "SELECT %\\n  FROM `table one`\\n  WHERE name = 'Nelly' AND id IN (SELECT id\\n  FROM t2\\n  WHERE id = 1\\nUNION\\nSELECT id\\n  FROM t3)\\n  ORDER BY name ASC";
--- +   INSERT INTO sql_temp(id, sql) VALUES(1, stmt);
+-- +   INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(1, stmt, "sample#1", "sample", "300c67b7a412b1cb");
 -- +   CURSOR C FOR EXPLAIN QUERY PLAN
 -- +   SELECT %
 -- +     FROM `table one`
@@ -219,7 +219,7 @@
 -- +   LET query_plan_trivial_blob := trivial_blob();
 --
 -- +   LET stmt := "WITH\\n  I (id) AS (CALL ids_from_string('1')),\\n  E (id) AS (CALL ids_from_string('1'))\\nSELECT %\\n  FROM C\\n  WHERE C.id IN (SELECT %\\n  FROM I) AND C.id NOT IN (SELECT %\\n  FROM E)";
--- +   INSERT INTO sql_temp(id, sql) VALUES(21, stmt);
+-- +   INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(21, stmt, "use_shared#1", "use_shared", "708f4695407c1c15");
 -- +   CURSOR C FOR EXPLAIN QUERY PLAN
 -- +   WITH
 -- +     I (id) AS (CALL ids_from_string('1')),
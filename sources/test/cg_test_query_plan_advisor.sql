@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+-- TEST: index advisor schema
+-- + CREATE TABLE advisor_candidate(
+-- + CREATE TABLE advisor_stmt(
+-- + CREATE TABLE advisor_plan(
+-- + (1, "users", "CREATE INDEX users_city_idx ON users (city)"),
+-- + (2, "users", "CREATE INDEX users_city_age_idx ON users (city, age)"),
+-- + (3, "orders", "CREATE INDEX orders_user_id_created_idx ON orders (user_id, created)"),
+-- + (4, "users", "CREATE INDEX users_id_age_idx ON users (id, age)"),
+-- + (5, "orders", "CREATE INDEX orders_user_id_idx ON orders (user_id)"),
+-- + (6, "orders", "CREATE INDEX orders_status_idx ON orders (status)");
+-- + CALL advise_indexes();
+-- + CALL print_index_advice();
+create table users(
+  id int primary key,
+  name text,
+  age int,
+  city text
+);
+
+create table orders(
+  id int primary key,
+  user_id int,
+  status text,
+  created long,
+  total real
+);
+
+create index orders_status on orders(status);
+
+create view order_view as select * from orders;
+
+-- TEST: equality then range, and equality then order by
+-- + (1, 1, "users_by_city"),
+-- + (2, 1, "users_by_city"),
+-- + PROC advise_query_plan_1(candidate_id INT!)
+proc users_by_city(city_ text)
+begin
+  select * from users where city = city_ order by age;
+end;
+
+-- TEST: the same candidate is shared by two statements
+-- + (3, 2, "orders_for_user"),
+-- + (3, 3, "recent_orders_for_user"),
+-- + CREATE INDEX cql_advisor_3 ON orders (user_id, created);
+-- + CALL advise_query_plan_2(3);
+-- + CALL advise_query_plan_3(3);
+-- + DROP INDEX cql_advisor_3;
+proc orders_for_user(uid int)
+begin
+  select * from orders where user_id = uid and created > 5;
+end;
+
+-- TEST: aliases are resolved, the order by column is also the range column
+-- + PROC advise_query_plan_3(candidate_id INT!)
+proc recent_orders_for_user(uid int)
+begin
+  select id from orders O where O.user_id = uid and created >= 10 order by O.created;
+end;
+
+-- TEST: join conditions give equality columns on both sides
+-- + (4, 4, "user_orders"),
+-- + (5, 4, "user_orders"),
+proc user_orders()
+begin
+  select U.name, O.total
+    from users U
+    join orders O on O.user_id = U.id
+    where U.age between 20 and 30;
+end;
+
+-- TEST: delete statements are advised too, a covering index makes it no benefit at runtime
+-- + (6, 5, "delete_stale"),
+proc delete_stale()
+begin
+  delete from orders where status = 'stale';
+end;
+
+-- TEST: OR terms can't use an index, no candidate (statement 6 is skipped)
+-- + PROC advise_query_plan_5(candidate_id INT!)
+-- + PROC advise_query_plan_7(candidate_id INT!)
+proc rename_users(old_name text)
+begin
+  update users set name = 'x' where name = old_name or age = 1;
+end;
+
+-- TEST: group by columns are candidates
+-- + (1, 7, "cities");
+-- + CALL advise_query_plan_7(1);
+proc cities()
+begin
+  select city, count(*) c from users group by city;
+end;
+
+-- TEST: views are not indexed (statement 8 is skipped)
+-- + PROC advise_index_1()
+proc view_lookup()
+begin
+  select * from order_view where user_id = 1;
+end;
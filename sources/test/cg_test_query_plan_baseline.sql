@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+-- The plans here are compared with query_plan_baseline.json which records
+-- an earlier build: sorted_by_age used no temp b-tree, by_name used to scan,
+-- and a proc called dropped existed.  query_plan_baseline_regressed.json is
+-- the same except that it says by_age was once a search.
+
+-- TEST: baseline tables and procs
+-- + CREATE TABLE ok_plan_regression(
+-- + CREATE TABLE plan_baseline(
+-- + CREATE TABLE plan_diff(
+-- + PROC load_plan_baseline()
+-- + LET baseline := "{\n
+-- + PROC compute_plan_diff()
+-- + PROC print_plan_diff(OUT untolerated INT!)
+-- + CALL load_plan_baseline();
+-- + CALL compute_plan_diff();
+-- + CALL print_plan_diff(untolerated);
+-- + IF untolerated THEN
+create table users(
+  id int primary key,
+  name text,
+  age int
+);
+
+create index users_name on users(name);
+
+-- TEST: statements get stable ids made from the proc name and ordinal
+-- + INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(1, stmt, "by_name#1", "by_name",
+proc by_name(name_ text)
+begin
+  select * from users where name = name_;
+end;
+
+-- TEST: a full scan that is already in the baseline
+-- + INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(2, stmt, "by_age#1", "by_age",
+proc by_age(age_ int)
+begin
+  select * from users where age = age_;
+end;
+
+-- TEST: a proc level tolerated regression, the reason is recorded
+-- + INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(3, stmt, "sorted_by_age#1", "sorted_by_age",
+-- + INSERT INTO ok_plan_regression(sql_id, reason) VALUES(3, "sorting \\\"small\\\" tables is fine");
+[[ok_plan_regression="sorting \"small\" tables is fine"]]
+proc sorted_by_age()
+begin
+  select * from users order by age;
+end;
+
+-- TEST: a statement level tolerated regression, ordinals count each statement
+-- + INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(4, stmt, "counts#1", "counts",
+-- + INSERT INTO sql_temp(id, sql, stable_id, proc_name, sql_hash) VALUES(5, stmt, "counts#2", "counts",
+-- + INSERT INTO ok_plan_regression(sql_id, reason) VALUES(5, "");
+proc counts(out named int!, out total int!)
+begin
+  set named := (select count(*) from users where name is not null);
+  [[ok_plan_regression]]
+  set total := (select count(*) from users);
+end;
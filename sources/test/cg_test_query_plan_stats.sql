@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+-- The statistics in query_plan_stats.json say that city is far more
+-- selective than age so the planner should pick users_city.  With no
+-- statistics both indices look the same and users_age wins.
+
+-- TEST: planner statistics are embedded and loaded before the plans
+-- + PROC load_planner_stats()
+-- + CALL cql_load_planner_stats("{\n  \"sqlite_stat1\" : [\n
+-- + CALL load_planner_stats();
+-- + CALL printf("failed loading planner statistics\n");
+create table users(
+  id int primary key,
+  name text,
+  age int,
+  city text
+);
+
+create index users_age on users(age);
+create index users_city on users(city);
+
+proc users_in_city_by_age(city_ text, age_ int)
+begin
+  select * from users where city = city_ and age = age_;
+end;
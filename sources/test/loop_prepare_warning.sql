@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+-- statements in loops that have to be prepared on every iteration
+-- are reported with --warn_loop_prepare
+
+create table foo(id int!);
+
+[[shared_fragment]]
+proc frag(x int!)
+begin
+  if x == 1 then
+    select id from foo;
+  else
+    select id from foo where id = x;
+  end if;
+end;
+
+proc warnings()
+begin
+  let i := 0;
+  while i < 10
+  begin
+    -- no warning, this statement is reused
+    delete from foo where id = i;
+
+    -- warning, the text depends on i
+    cursor C for with f(*) as (call frag(i)) select * from f;
+    fetch C;
+
+    -- warning, a boxed cursor gets a new statement every time
+    cursor D for select * from foo;
+    declare box object<D cursor>;
+    set box from cursor D;
+    set i := i + 1;
+  end;
+end;
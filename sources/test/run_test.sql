@@ -5,6 +5,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+-- the profiling report, only callable when the runtime is built with CQL_PROFILING
+@include "../cqlrt_profile.sql"
+
 declare tests int!;
 declare tests_passed int!;
 declare fails int!;
@@ -1071,6 +1074,40 @@ begin
   EXPECT_EQ!(sum, 4);  -- correct sum computed: 1 + 3
 end);
 
+-- statements and cursors in a loop keep their prepared statement between iterations
+TEST!(loop_statement_reuse,
+begin
+  create temp table loop_reuse(id int!);
+  let i := 0;
+  let sum := 0;
+  while i < 5
+  begin
+    i += 1;
+    insert into loop_reuse values(i);
+    cursor C for select id from loop_reuse where id = i;
+    fetch C;
+    EXPECT_EQ!(C.id, i);  -- the reset cursor sees the new binding
+
+    -- a cursor abandoned mid-way is reset for the next iteration
+    cursor D for select id from loop_reuse order by id;
+    fetch D;
+    EXPECT_EQ!(D.id, 1);
+    sum += D.id;
+  end;
+
+  EXPECT_EQ!(sum, 5);
+
+  i := 0;
+  while i < 3
+  begin
+    i += 1;
+    -- no bindings, this is prepared once and stepped each time
+    delete from loop_reuse where id = (select max(id) from loop_reuse);
+  end;
+
+  EXPECT_EQ!((select count(*) from loop_reuse), 2);
+end);
+
 -- same test but the control variable is nullable making the expression nullable
 TEST!(while_control_flow_with_nullables,
 begin
@@ -1399,6 +1436,75 @@ begin
   select * from mixed limit lim;
 end;
 
+-- Version 0 is rows 0..n-1 in order.  Version 1 of the same rows drops every
+-- id ending in 7, renames every id ending in 3, moves every id ending in 5 up
+-- between its neighbors and adds a new row for each dropped one at the end.
+-- This gives the result set diff something to find in each category.
+[[identity=(id)]]
+proc get_diff_rows(version int!, n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i as id,
+    iif(version = 1 and i % 10 = 3, printf("renamed %d", i), printf("row %d", i)) as name,
+    iif(version = 1 and i % 10 = 5, 2 * i - 9, 2 * i) as sort_key
+    from nums
+    where version = 0 or i % 10 != 7
+  union all
+  select n + i as id, printf("row %d", n + i) as name, 2 * (n + i) as sort_key
+    from nums
+    where version = 1 and i % 10 = 7
+  order by sort_key;
+end;
+
+-- The same rows in the compact layout and in the normal layout so the client
+-- test can compare them.  Every nullable column has a different null pattern.
+[[compact_rows]]
+[[identity=(id, ni)]]
+[[generate_copy]]
+[[emit_setters]]
+proc get_compact_rows(n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i as id,
+    iif(i % 2, null, i * 10) as ni,
+    iif(i % 3 = 0, null, i % 2 = 0) as nb,
+    iif(i % 5 = 0, null, i * 1.5) as nr,
+    iif(i % 4 = 0, null, i * 100L) as nl,
+    iif(i % 2, null, printf("row %d", i)) as name
+    from nums;
+end;
+
+proc get_padded_rows(n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i as id,
+    iif(i % 2, null, i * 10) as ni,
+    iif(i % 3 = 0, null, i % 2 = 0) as nb,
+    iif(i % 5 = 0, null, i * 1.5) as nr,
+    iif(i % 4 = 0, null, i * 100L) as nl,
+    iif(i % 2, null, printf("row %d", i)) as name
+    from nums;
+end;
+
+-- The rows are handed to a sink as they are produced; the client test stops
+-- the stream early and also checks the materialized form.
+[[stream_rows]]
+proc get_streamed_rows(n int!)
+begin
+  cursor C for
+    with recursive
+      nums(i) as (select 0 union all select i + 1 from nums limit n)
+    select i as id, printf("row %d", i) as name
+      from nums;
+  loop fetch C
+  begin
+    out union C;
+  end;
+end;
+
 [[generate_copy]]
 proc get_one_from_mixed(id_ int!)
 begin
@@ -1407,6 +1513,64 @@ begin
   out C;
 end;
 
+-- Every serializable type with repeated strings and a different null pattern
+-- in each nullable column, the client test round trips these through a blob.
+[[generate_serializer]]
+[[identity=(id)]]
+proc get_serialized_rows(n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i as id,
+    i % 2 = 0 as flag,
+    iif(i % 3 = 0, null, i % 2 = 1) as nflag,
+    iif(i % 2, null, i * 10) as ni,
+    i * 1000000000000L as big,
+    iif(i % 4 = 0, null, i * 100L) as nl,
+    i * 0.5 as r,
+    iif(i % 5 = 0, null, i * 1.5) as nr,
+    printf("group %d", i % 3) as grp,
+    iif(i % 2, null, printf("row %d", i)) as name,
+    iif(i % 3 = 1, null, cast(printf("blob %d", i) as blob)) as bl
+    from nums;
+end;
+
+-- The same rows in the compact layout, the blob doesn't depend on the layout
+[[generate_serializer]]
+[[compact_rows]]
+proc get_compact_serialized_rows(n int!)
+begin
+  with recursive
+    nums(i) as (select 0 union all select i + 1 from nums limit n)
+  select i as id,
+    i % 2 = 0 as flag,
+    iif(i % 3 = 0, null, i % 2 = 1) as nflag,
+    iif(i % 2, null, i * 10) as ni,
+    i * 1000000000000L as big,
+    iif(i % 4 = 0, null, i * 100L) as nl,
+    i * 0.5 as r,
+    iif(i % 5 = 0, null, i * 1.5) as nr,
+    printf("group %d", i % 3) as grp,
+    iif(i % 2, null, printf("row %d", i)) as name,
+    iif(i % 3 = 1, null, cast(printf("blob %d", i) as blob)) as bl
+    from nums;
+end;
+
+-- The rows of an OUT UNION proc begin with a row header
+[[generate_serializer]]
+proc get_serialized_out_union(n int!)
+begin
+  cursor C for
+    with recursive
+      nums(i) as (select 0 union all select i + 1 from nums limit n)
+    select i as id, printf("group %d", i % 3) as grp, iif(i % 2, null, i * 10) as ni
+      from nums;
+  loop fetch C
+  begin
+    out union C;
+  end;
+end;
+
 TEST!(proc_loop_fetch,
 begin
   load_mixed();
@@ -2939,6 +3103,13 @@ begin
   out C;
 end;
 
+-- the client test encodes these columns in batches, s1 is the context
+[[vault_sensitive=(s1, (i0, i1, no_such_column))]]
+proc select_encoded_rows()
+begin
+  select * from all_types_encoded_table;
+end;
+
 [[vault_sensitive]]
 proc out_union_dml()
 begin
@@ -3263,6 +3434,46 @@ begin
   end;
 end);
 
+declare proc cql_insert_rows(rs object!, table_name text!, columns text!) using transaction;
+
+create table bulk_integers(
+  v int!,
+  vsq int! unique,
+  junk text!
+);
+
+-- bulk insert a result set, then make sure a failure part way through
+-- leaves nothing behind
+TEST!(insert_rows_from_result_set,
+begin
+  create table bulk_integers(
+    v int!,
+    vsq int! unique,
+    junk text!
+  );
+
+  declare rs object!;
+  some_integers_fetch(rs, 0, 200);
+  cql_insert_rows(rs, "bulk_integers", "v, vsq, junk");
+
+  EXPECT_EQ!((select count(*) from bulk_integers), 200);
+  EXPECT_EQ!((select sum(vsq) from bulk_integers), (select sum(v * v) from bulk_integers));
+  EXPECT_EQ!((select junk from bulk_integers where v = 199), "199");
+
+  -- the squares of -199 and up collide with the unique index, the earlier
+  -- chunks go in but the savepoint takes them back out
+  some_integers_fetch(rs, -400, -150);
+  try
+    cql_insert_rows(rs, "bulk_integers", "v, vsq, junk");
+    EXPECT!(0);
+  catch
+    EXPECT_EQ!(@rc, 19); -- SQLITE_CONSTRAINT
+  end;
+  EXPECT_EQ!((select count(*) from bulk_integers), 200);
+
+  drop table bulk_integers;
+end);
+
 TEST!(row_set_reading_language_support,
 begin
   declare cur int!;
@@ -4866,6 +5077,59 @@ begin
   @echo lua, "cql_disable_tracing = false\n";
 end);
 
+TEST!(blob_serialization_fixed_width_and_views,
+begin
+  @echo lua, "cql_disable_tracing = true\n";
+
+  let a_blob := blob_from_string("a blob");
+  let b_blob := blob_from_string("b blob");
+  declare cursor_both cursor like storage_both;
+  fetch cursor_both using
+      false f, true t, -22 i, 9223372036854775807L l, 3.14 r, a_blob bl, "text" str,
+      false `bool 2 not null`, true `bool 1 not null`, 2147483647 i_nn, -66L l_nn, 6.28 r_nn, b_blob bl_nn, "text2" str_nn;
+
+  let blob_varint := cursor_both:to_blob;
+  declare blob_fixed blob<storage_both>;
+  blob_fixed := cursor_both:to_fixed_blob;
+  EXPECT!(hex(blob_varint) != hex(blob_fixed));
+
+  -- the ordinary reader accepts the fixed width form
+  declare test_cursor cursor like cursor_both;
+  test_cursor:from_blob(blob_fixed);
+  EXPECT_EQ!(cql_cursor_diff_val(test_cursor, cursor_both), null);
+
+  -- views read either form
+  test_cursor:view_from_blob(blob_varint);
+  EXPECT_EQ!(cql_cursor_diff_val(test_cursor, cursor_both), null);
+  test_cursor:view_from_blob(blob_fixed);
+  EXPECT_EQ!(cql_cursor_diff_val(test_cursor, cursor_both), null);
+
+  -- the cursor keeps the viewed blob alive
+  blob_fixed := null;
+  EXPECT_EQ!(test_cursor.str_nn, "text2");
+  EXPECT_EQ!(string_from_blob(test_cursor.bl), "a blob");
+
+  -- truncated fixed width blobs are rejected
+  let fixed_again := cursor_both:to_fixed_blob;
+  let full_size := cql_get_blob_size(fixed_again);
+  let i := 0;
+  for i < full_size; i += 1;
+  begin
+    declare blob_broken blob<storage_both>;
+    blob_broken := create_truncated_blob(fixed_again, i);
+    let caught := false;
+    try
+      test_cursor:view_from_blob(blob_broken);
+    catch
+      EXPECT!(not test_cursor);
+      caught := true;
+    end;
+    EXPECT!(caught);
+  end;
+
+  @echo lua, "cql_disable_tracing = false\n";
+end);
+
 TEST!(corrupt_blob_deserialization,
 begin
   @echo lua, "cql_disable_tracing = true\n";
@@ -7990,6 +8254,44 @@ begin
   EXPECT_EQ!(C, false);
 end);
 
+@ifdef profiling
+
+-- an out union proc with a known number of rows for the profiler
+proc profiled_rows(n int!)
+begin
+  cursor C like (x int!);
+  let i := 0;
+  while i < n
+  begin
+    fetch C using i x;
+    out union C;
+    i += 1;
+  end;
+end;
+
+TEST!(profile_report,
+begin
+  cursor P for call profiled_rows(5);
+  loop fetch P begin end;
+
+  let found := false;
+  cursor R for call cql_profile_report();
+  loop fetch R
+  begin
+    EXPECT!(R.calls >= 0);
+    EXPECT!(R.p50_ns <= R.p90_ns);
+    EXPECT!(R.p90_ns <= R.p99_ns);
+    EXPECT!(R.p99_ns <= R.max_ns);
+    EXPECT!(R.max_ns <= R.total_ns);
+    if R.calls > 0 and R.row_count >= 5 then
+      found := true;
+    end if;
+  end;
+  EXPECT!(found);
+end);
+
+@endif
+
 END_SUITE();
 
 -- manually force tracing on by redefining the macros
@@ -5,7 +5,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <pthread.h>
 #include <setjmp.h>
+#include <time.h>
 
 #include "cqlrt.h"
 #include "run_test.h"
@@ -13,7 +15,25 @@
 
 cql_code test_c_rowsets(sqlite3 *db);
 cql_code test_rowset_same(sqlite3 *db);
+cql_code test_rowset_slice(sqlite3 *db);
+cql_code test_result_set_diff(sqlite3 *db);
+cql_code test_result_set_diff_large(sqlite3 *db);
+cql_code test_compact_rows(sqlite3 *db);
+cql_code test_fetch_row_hints(sqlite3 *db);
 cql_code test_bytebuf_growth(sqlite3 *db);
+cql_code test_statement_trace(sqlite3 *db);
+cql_code test_slow_statement_log(sqlite3 *db);
+cql_code test_allocator(sqlite3 *db);
+cql_code test_bulk_insert(sqlite3 *db);
+cql_code test_column_export(sqlite3 *db);
+cql_code test_stream_rows(sqlite3 *db);
+cql_code test_copyoutrow_direct(sqlite3 *db);
+cql_code test_column_coder(sqlite3 *db);
+cql_code test_cursor_blob_views(sqlite3 *db);
+cql_code test_result_set_blob(sqlite3 *db);
+#ifdef CQL_PROFILING
+cql_code test_profiler(sqlite3 *db);
+#endif
 cql_code test_cql_finalize_on_error(sqlite3 *db);
 cql_code test_blob_rowsets(sqlite3 *db);
 cql_code test_sparse_blob_rowsets(sqlite3 *db);
@@ -109,6 +129,56 @@ cql_code run_client(sqlite3 *db) {
   SQL_E(test_rowset_same(db));
   E(!cql_outstanding_refs, "outstanding refs in test_rowset_same: %d\n", cql_outstanding_refs);
 
+  SQL_E(test_rowset_slice(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_rowset_slice: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_result_set_diff(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_result_set_diff: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_result_set_diff_large(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_result_set_diff_large: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_compact_rows(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_compact_rows: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_fetch_row_hints(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_fetch_row_hints: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_statement_trace(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_statement_trace: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_slow_statement_log(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_slow_statement_log: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_allocator(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_allocator: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_bulk_insert(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_bulk_insert: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_column_export(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_column_export: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_stream_rows(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_stream_rows: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_copyoutrow_direct(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_copyoutrow_direct: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_column_coder(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_column_coder: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_cursor_blob_views(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_cursor_blob_views: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_result_set_blob(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_result_set_blob: %d\n", cql_outstanding_refs);
+
+#ifdef CQL_PROFILING
+  SQL_E(test_profiler(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_profiler: %d\n", cql_outstanding_refs);
+#endif
+
   SQL_E(test_blob_rowsets(db));
   E(!cql_outstanding_refs, "outstanding refs in test_blob_rowsets: %d\n", cql_outstanding_refs);
 
@@ -287,6 +357,57 @@ cql_code test_c_rowsets(sqlite3 *db) {
   return SQLITE_OK;
 }
 
+cql_code test_rowset_slice(sqlite3 *db) {
+  printf("Running rowset slice test\n");
+  tests++;
+
+  get_mixed_result_set_ref result_set;
+  SQL_E(drop_mixed(db));
+  SQL_E(make_mixed(db));
+  SQL_E(load_mixed_with_nulls(db));
+  SQL_E(get_mixed_fetch_results(db, &result_set, 100));
+
+  // hold a string from the source so we can check it is not retained again
+  cql_string_ref name = get_mixed_get_name(result_set, 1);
+  cql_int32 name_refs = name->base.ref_count;
+
+  get_mixed_result_set_ref slice;
+  get_mixed_slice(result_set, &slice, 1, 3);
+
+  E(get_mixed_result_count(slice) == 3, "expected 3 rows in the slice\n");
+  E(name->base.ref_count == name_refs, "slicing should not retain the row references\n");
+  E(cql_result_set_get_data(slice) ==
+    (char *)cql_result_set_get_data(result_set) + cql_result_set_get_meta(result_set)->rowsize,
+    "slice should point into the rows of the source\n");
+
+  // a slice of a slice still refers to the rows of the original
+  get_mixed_result_set_ref slice_of_slice;
+  get_mixed_slice(slice, &slice_of_slice, 2, 1);
+  E(((cql_result_set_ref)slice_of_slice)->parent == (cql_result_set_ref)result_set,
+    "a slice of a slice should refer to the original\n");
+
+  // the slices keep the rows alive after the source is gone
+  cql_result_set_release(result_set);
+
+  E(get_mixed_get_id(slice, 0) == 2, "first slice row should be id 2\n");
+  E(get_mixed_get_name(slice, 1) == NULL, "second slice row should have a null name\n");
+  E(get_mixed_get_id(slice_of_slice, 0) == 4, "slice of a slice should be id 4\n");
+  E(strcmp("last name", get_mixed_get_name(slice_of_slice, 0)->ptr) == 0, "slice of a slice should have the last name\n");
+  E(get_mixed_row_equal(slice, 2, slice_of_slice, 0), "slices of the same row should be equal\n");
+
+  // an empty slice is fine too
+  get_mixed_result_set_ref empty;
+  get_mixed_slice(slice, &empty, 3, 0);
+  E(get_mixed_result_count(empty) == 0, "expected an empty slice\n");
+
+  cql_result_set_release(slice);
+  cql_result_set_release(slice_of_slice);
+  cql_result_set_release(empty);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
 static cql_nullable_int64 make_nullable_code(cql_bool is_null, cql_int64 value) {
   cql_nullable_int64 code;
   cql_set_nullable(code, is_null, value);
@@ -356,6 +477,1442 @@ cql_code test_rowset_same(sqlite3 *db) {
   return SQLITE_OK;
 }
 
+static cql_bool same_indices(cql_int32 *actual, cql_int32 actual_count, cql_int32 *expected, cql_int32 expected_count) {
+  return actual_count == expected_count && !memcmp(actual, expected, sizeof(cql_int32) * (size_t)expected_count);
+}
+
+cql_code test_result_set_diff(sqlite3 *db) {
+  printf("Running result set diff test\n");
+  tests++;
+
+  get_diff_rows_result_set_ref old_rs;
+  get_diff_rows_result_set_ref new_rs;
+  SQL_E(get_diff_rows_fetch_results(db, &old_rs, 0, 20));
+  SQL_E(get_diff_rows_fetch_results(db, &new_rs, 1, 20));
+
+  cql_result_set_diff_info diff;
+  get_diff_rows_diff(old_rs, new_rs, &diff);
+
+  // new order is ids 0, 5, 1, 2, 3, 4, 6, 8, 9, 10, 15, 11, ... 19, 27, 37
+  cql_int32 inserted[] = { 18, 19 };
+  cql_int32 deleted[] = { 7, 17 };
+  cql_int32 moved[] = { 1, 10 };
+  // the moved rows also have a new sort key so they are changed too
+  cql_int32 changed[] = { 1, 4, 10, 13 };
+
+  E(same_indices(diff.inserted, diff.inserted_count, inserted, 2), "inserted rows should be the two new ids\n");
+  E(same_indices(diff.deleted, diff.deleted_count, deleted, 2), "deleted rows should be ids 7 and 17\n");
+  E(same_indices(diff.moved, diff.moved_count, moved, 2), "moved rows should be ids 5 and 15\n");
+  E(same_indices(diff.changed, diff.changed_count, changed, 4), "changed rows should be ids 5, 3, 15 and 13\n");
+  E(diff.new_to_old[0] == 0, "new row 0 should be old row 0\n");
+  E(diff.new_to_old[1] == 5, "new row 1 should be old row 5\n");
+  E(diff.new_to_old[18] == -1, "new row 18 should have no old row\n");
+
+  cql_result_set_diff_release(&diff);
+
+  // a result set compared with itself has no differences at all
+  get_diff_rows_diff(old_rs, old_rs, &diff);
+  E(diff.inserted_count + diff.deleted_count + diff.moved_count + diff.changed_count == 0,
+    "a result set should not differ from itself\n");
+  cql_result_set_diff_release(&diff);
+
+  cql_result_set_release(old_rs);
+  cql_result_set_release(new_rs);
+
+  // duplicate identities are matched in order so the extra copies show up as
+  // inserted/deleted rather than as moves
+  get_mixed_result_set_ref dupes;
+  get_mixed_result_set_ref mixed;
+  SQL_E(load_mixed_dupes(db));
+  SQL_E(get_mixed_fetch_results(db, &dupes, 100));
+  SQL_E(load_mixed(db));
+  SQL_E(get_mixed_fetch_results(db, &mixed, 100));
+
+  get_mixed_diff(dupes, mixed, &diff);
+
+  // identity is (id, code, bl); old rows 0, 1 and 5 have blob null, 2 and 3 are
+  // the same as new row 1 and 4 is the same as new row 0
+  cql_int32 dupes_deleted[] = { 0, 1, 3, 5 };
+  E(diff.inserted_count == 0, "no rows should be inserted\n");
+  E(same_indices(diff.deleted, diff.deleted_count, dupes_deleted, 4), "unmatched duplicates should be deleted\n");
+  E(diff.new_to_old[0] == 4, "new row 0 should be old row 4\n");
+  E(diff.new_to_old[1] == 2, "new row 1 should be the first of the duplicates\n");
+  E(diff.moved_count == 1, "one of the two matched rows should be out of order\n");
+
+  cql_result_set_diff_release(&diff);
+  cql_result_set_release(dupes);
+  cql_result_set_release(mixed);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// This is the large version of the diff test, it also reports the time taken
+// for the diff itself so that regressions in the hashing are easy to spot.
+cql_code test_result_set_diff_large(sqlite3 *db) {
+  printf("Running result set diff 100k row test\n");
+  tests++;
+
+  const cql_int32 n = 100000;
+  get_diff_rows_result_set_ref old_rs;
+  get_diff_rows_result_set_ref new_rs;
+  SQL_E(get_diff_rows_fetch_results(db, &old_rs, 0, n));
+  SQL_E(get_diff_rows_fetch_results(db, &new_rs, 1, n));
+
+  cql_result_set_diff_info diff;
+  clock_t start = clock();
+  get_diff_rows_diff(old_rs, new_rs, &diff);
+  double ms = 1000.0 * (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("  diff of %d rows took %.1fms\n", n, ms);
+
+  E(diff.inserted_count == n / 10, "expected %d inserted rows, got %d\n", n / 10, diff.inserted_count);
+  E(diff.deleted_count == n / 10, "expected %d deleted rows, got %d\n", n / 10, diff.deleted_count);
+  E(diff.moved_count == n / 10, "expected %d moved rows, got %d\n", n / 10, diff.moved_count);
+  E(diff.changed_count == n / 5, "expected %d changed rows, got %d\n", n / 5, diff.changed_count);
+
+  cql_result_set_diff_release(&diff);
+  cql_result_set_release(old_rs);
+  cql_result_set_release(new_rs);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+cql_code test_compact_rows(sqlite3 *db) {
+  printf("Running compact rows test\n");
+  tests++;
+
+  const cql_int32 n = 20;
+  get_compact_rows_result_set_ref compact;
+  get_compact_rows_result_set_ref compact2;
+  get_padded_rows_result_set_ref padded;
+  SQL_E(get_compact_rows_fetch_results(db, &compact, n));
+  SQL_E(get_compact_rows_fetch_results(db, &compact2, n));
+  SQL_E(get_padded_rows_fetch_results(db, &padded, n));
+
+  size_t compact_size = cql_result_set_get_meta((cql_result_set_ref)compact)->rowsize;
+  size_t padded_size = cql_result_set_get_meta((cql_result_set_ref)padded)->rowsize;
+  printf("  row size %d bytes compact vs. %d bytes padded\n", (int)compact_size, (int)padded_size);
+  E(compact_size < padded_size, "compact rows should be smaller\n");
+
+  E(get_compact_rows_result_count(compact) == n, "expected %d compact rows\n", n);
+
+  // every column reads back exactly as it does from the normal layout
+  for (cql_int32 i = 0; i < n; i++) {
+    E(get_compact_rows_get_id(compact, i) == get_padded_rows_get_id(padded, i), "id mismatch at row %d\n", i);
+
+    cql_bool ni_null = get_compact_rows_get_ni_is_null(compact, i);
+    E(ni_null == get_padded_rows_get_ni_is_null(padded, i), "ni null mismatch at row %d\n", i);
+    E(ni_null == (i % 2 != 0), "ni should be null for odd rows, row %d\n", i);
+    E(get_compact_rows_get_ni_value(compact, i) == get_padded_rows_get_ni_value(padded, i), "ni mismatch at row %d\n", i);
+
+    cql_bool nb_null = get_compact_rows_get_nb_is_null(compact, i);
+    E(nb_null == get_padded_rows_get_nb_is_null(padded, i), "nb null mismatch at row %d\n", i);
+    E(nb_null == (i % 3 == 0), "nb should be null every third row, row %d\n", i);
+    E(get_compact_rows_get_nb_value(compact, i) == get_padded_rows_get_nb_value(padded, i), "nb mismatch at row %d\n", i);
+
+    E(get_compact_rows_get_nr_is_null(compact, i) == get_padded_rows_get_nr_is_null(padded, i), "nr null mismatch at row %d\n", i);
+    E(get_compact_rows_get_nr_value(compact, i) == get_padded_rows_get_nr_value(padded, i), "nr mismatch at row %d\n", i);
+
+    E(get_compact_rows_get_nl_is_null(compact, i) == get_padded_rows_get_nl_is_null(padded, i), "nl null mismatch at row %d\n", i);
+    E(get_compact_rows_get_nl_value(compact, i) == get_padded_rows_get_nl_value(padded, i), "nl mismatch at row %d\n", i);
+
+    cql_string_ref name = get_compact_rows_get_name(compact, i);
+    cql_string_ref name2 = get_padded_rows_get_name(padded, i);
+    E(cql_string_equal(name, name2), "name mismatch at row %d\n", i);
+
+    E(get_compact_rows_row_hash(compact, i) == get_compact_rows_row_hash(compact2, i), "row %d hash should match\n", i);
+    E(get_compact_rows_row_equal(compact, i, compact2, i), "row %d should be equal\n", i);
+    E(get_compact_rows_row_same(compact, i, compact2, i), "row %d should be the same\n", i);
+  }
+
+  // a null that was set reads back as null, and not null with a zero value is
+  // different from null
+  E(!get_compact_rows_get_ni_is_null(compact, 0), "row 0 ni should not be null\n");
+  E(get_compact_rows_get_ni_value(compact, 0) == 0, "row 0 ni should be zero\n");
+  get_compact_rows_set_ni_to_null(compact, 0);
+  E(get_compact_rows_get_ni_is_null(compact, 0), "row 0 ni should be null now\n");
+  E(!get_compact_rows_row_equal(compact, 0, compact2, 0), "null is not equal to zero\n");
+  E(!get_compact_rows_row_same(compact, 0, compact2, 0), "null identity is not the same as zero\n");
+
+  // setting it back restores the original bytes exactly
+  get_compact_rows_set_ni_value(compact, 0, 0);
+  E(get_compact_rows_row_equal(compact, 0, compact2, 0), "row 0 should be equal again\n");
+  E(get_compact_rows_row_hash(compact, 0) == get_compact_rows_row_hash(compact2, 0), "row 0 hash should match again\n");
+
+  // a null set to a value clears the null bit
+  E(get_compact_rows_get_nb_is_null(compact, 3), "row 3 nb should be null\n");
+  get_compact_rows_set_nb_value(compact, 3, true);
+  E(!get_compact_rows_get_nb_is_null(compact, 3), "row 3 nb should not be null now\n");
+  E(get_compact_rows_get_nb_value(compact, 3), "row 3 nb should be true\n");
+  E(!get_compact_rows_get_ni_is_null(compact, 2), "row 2 ni should be untouched\n");
+
+  // setting a value to null zeros the storage so it equals a fetched null
+  get_compact_rows_set_nb_to_null(compact, 3);
+  E(get_compact_rows_row_equal(compact, 3, compact2, 3), "row 3 should be equal again\n");
+
+  // copies carry the null bitmap along with the rest of the row
+  get_compact_rows_result_set_ref copy;
+  get_compact_rows_copy(compact, &copy, 5, 10);
+  E(get_compact_rows_result_count(copy) == 10, "expected 10 copied rows\n");
+  for (cql_int32 i = 0; i < 10; i++) {
+    E(get_compact_rows_row_equal(copy, i, compact, i + 5), "copied row %d should be equal\n", i);
+    E(get_compact_rows_get_nr_is_null(copy, i) == ((i + 5) % 5 == 0), "copied row %d nr null flag wrong\n", i);
+  }
+
+  cql_result_set_release(copy);
+  cql_result_set_release(compact);
+  cql_result_set_release(compact2);
+  cql_result_set_release(padded);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// An allocator that uses malloc and remembers the size of the last row data
+// allocation or reallocation, not counting the header that records the
+// allocator
+static void *sizing_allocate(void *context, size_t size, int32_t kind) {
+  if (kind == CQL_ALLOC_ROW_DATA) {
+    *(size_t *)context = size - CQL_ALLOC_HEADER_SIZE;
+  }
+  return malloc(size);
+}
+
+static void *sizing_allocate_zeroed(void *context, size_t size, int32_t kind) {
+  if (kind == CQL_ALLOC_ROW_DATA) {
+    *(size_t *)context = size - CQL_ALLOC_HEADER_SIZE;
+  }
+  return calloc(1, size);
+}
+
+static void *sizing_reallocate(void *context, void *ptr, size_t size, int32_t kind) {
+  if (kind == CQL_ALLOC_ROW_DATA) {
+    *(size_t *)context = size - CQL_ALLOC_HEADER_SIZE;
+  }
+  return realloc(ptr, size);
+}
+
+static void sizing_deallocate(void *context, void *ptr, int32_t kind) {
+  free(ptr);
+}
+
+cql_code test_fetch_row_hints(sqlite3 *db) {
+  printf("Running fetch row hints test\n");
+  tests++;
+
+  cql_fetch_row_hints_reset();
+  E(cql_fetch_row_hints_count() == 0, "expected no hints after reset\n");
+  E(cql_fetch_row_hint(CRC_get_diff_rows) == 0, "expected no hint for an unseen site\n");
+
+  // the first fetch is remembered as is, later ones are smoothed
+  get_diff_rows_result_set_ref result_set;
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 1000));
+  cql_result_set_release(result_set);
+  E(cql_fetch_row_hint(CRC_get_diff_rows) == 1000, "expected a hint of 1000 rows, got %d\n",
+    cql_fetch_row_hint(CRC_get_diff_rows));
+
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 200));
+  E(cql_fetch_row_hint(CRC_get_diff_rows) == 800, "expected a hint of 800 rows, got %d\n",
+    cql_fetch_row_hint(CRC_get_diff_rows));
+
+  // the preallocated buffer was trimmed and the rows are intact
+  E(get_diff_rows_result_count(result_set) == 200, "expected 200 rows\n");
+  for (cql_int32 i = 0; i < 200; i++) {
+    E(get_diff_rows_get_id(result_set, i) == i, "row %d has the wrong id\n", i);
+  }
+  cql_result_set_release(result_set);
+
+  // a second site gets its own hint, in first seen order
+  get_compact_rows_result_set_ref compact;
+  SQL_E(get_compact_rows_fetch_results(db, &compact, 10));
+  cql_result_set_release(compact);
+
+  E(cql_fetch_row_hints_count() == 2, "expected 2 hints, got %d\n", cql_fetch_row_hints_count());
+  int64_t crc;
+  cql_int32 rows;
+  cql_fetch_row_hint_at(1, &crc, &rows);
+  E(crc == CRC_get_compact_rows, "second hint should be for get_compact_rows\n");
+  E(rows == 10, "expected 10 rows, got %d\n", rows);
+
+  // a large fetch, the second time the buffer is the right size up front
+  const cql_int32 n = 50000;
+  for (int32_t pass = 0; pass < 2; pass++) {
+    clock_t start = clock();
+    SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, n));
+    double ms = 1000.0 * (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("  %s fetch of %d rows took %.1fms\n", pass ? "warm" : "cold", n, ms);
+    E(get_diff_rows_result_count(result_set) == n, "expected %d rows\n", n);
+    E(get_diff_rows_get_id(result_set, n - 1) == n - 1, "last row has the wrong id\n");
+    cql_result_set_release(result_set);
+  }
+
+  // an empty fetch after the large ones does not keep the big buffer the
+  // hint asked for
+  size_t last_size = 0;
+  cql_allocator sizing = {
+    sizing_allocate, sizing_allocate_zeroed, sizing_reallocate, sizing_deallocate, &last_size
+  };
+  cql_set_allocator(&sizing);
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 0));
+  cql_set_allocator(NULL);
+  E(get_diff_rows_result_count(result_set) == 0, "expected no rows\n");
+  E(last_size <= BYTEBUF_GROWTH_SIZE, "expected the empty buffer to shrink, last size %zu\n", last_size);
+  cql_result_set_release(result_set);
+
+  cql_fetch_row_hints_reset();
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+static void drain_trace(void) {
+  cql_trace_event events[64];
+  while (cql_trace_drain(events, 64)) {
+  }
+}
+
+cql_code test_statement_trace(sqlite3 *db) {
+  printf("Running statement trace test\n");
+  tests++;
+
+  drain_trace();
+  E(!cql_trace_enabled(), "expected tracing to be off by default\n");
+
+  // nothing is recorded while tracing is off
+  get_diff_rows_result_set_ref result_set;
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 10));
+  cql_result_set_release(result_set);
+  cql_trace_event events[16];
+  E(cql_trace_drain(events, 16) == 0, "expected no events with tracing off\n");
+
+  // prepare, bind, and the step loop all refer to the same statement and proc
+  cql_trace_set_enabled(true);
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 10));
+  cql_result_set_release(result_set);
+  cql_trace_set_enabled(false);
+
+  cql_int32 count = cql_trace_drain(events, 16);
+  E(count == 3, "expected 3 events, got %d\n", count);
+  E(events[0].kind == CQL_TRACE_PREPARE, "expected a prepare event\n");
+  E(events[1].kind == CQL_TRACE_BIND, "expected a bind event\n");
+  E(events[2].kind == CQL_TRACE_STEP, "expected a step event\n");
+  for (cql_int32 i = 0; i < count; i++) {
+    E(events[i].stmt_id == events[0].stmt_id, "event %d has a different statement id\n", i);
+    E(events[i].proc && !strcmp(events[i].proc, "get_diff_rows"), "event %d has proc %s\n", i,
+      events[i].proc ? events[i].proc : "(null)");
+    E(events[i].duration_ns >= 0, "event %d has a negative duration\n", i);
+  }
+  E(events[0].rc == SQLITE_OK && events[1].rc == SQLITE_OK, "expected prepare and bind to succeed\n");
+  E(events[2].rows == 10, "expected 10 rows stepped, got %d\n", events[2].rows);
+  E(events[2].rc == SQLITE_DONE, "expected the step loop to end with SQLITE_DONE, got %d\n", events[2].rc);
+
+  // a failing step loop records the rows so far and the error
+  cql_trace_set_enabled(true);
+  steps_until_fail = 3;
+  E(get_diff_rows_fetch_results(db, &result_set, 0, 10) != SQLITE_OK, "expected the fetch to fail\n");
+  steps_until_fail = 0;
+  cql_trace_set_enabled(false);
+
+  count = cql_trace_drain(events, 16);
+  E(count == 3, "expected 3 events, got %d\n", count);
+  E(events[2].kind == CQL_TRACE_STEP, "expected a step event\n");
+  E(events[2].rows == 2, "expected 2 rows stepped, got %d\n", events[2].rows);
+  E(events[2].rc == SQLITE_ERROR, "expected SQLITE_ERROR, got %d\n", events[2].rc);
+
+  // exec events use the hash of the text, when the ring overflows the oldest
+  // events are lost and the newest are kept
+  int64_t lost = cql_trace_lost();
+  cql_trace_set_enabled(true);
+  for (cql_int32 i = 0; i < 1100; i++) {
+    SQL_E(cql_exec(db, "select 1"));
+  }
+  cql_trace_set_enabled(false);
+
+  cql_int32 drained = 0;
+  while ((count = cql_trace_drain(events, 16))) {
+    for (cql_int32 i = 0; i < count; i++) {
+      E(events[i].kind == CQL_TRACE_EXEC, "expected an exec event\n");
+      E(events[i].stmt_id == cql_trace_stmt_id("select 1"), "expected the id of the exec text\n");
+    }
+    drained += count;
+  }
+  E(drained + cql_trace_lost() - lost == 1100, "expected every event drained or lost, drained %d lost %lld\n",
+    drained, (long long)(cql_trace_lost() - lost));
+  E(cql_trace_lost() - lost == 1100 - 1024, "expected the overflow to be lost\n");
+
+  // the cost of tracing a typical fetch
+  for (cql_int32 pass = 0; pass < 2; pass++) {
+    cql_trace_set_enabled(pass == 1);
+    clock_t start = clock();
+    for (cql_int32 i = 0; i < 2000; i++) {
+      SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 20));
+      cql_result_set_release(result_set);
+      drain_trace();
+    }
+    printf("  2000 fetches with tracing %s: %.1fms\n", pass ? "on" : "off",
+      (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+  }
+  cql_trace_set_enabled(false);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// the last few slow statements reported, the strings are copied because they
+// are only valid during the callback
+typedef struct slow_statement_copy {
+  cql_int32 kind;
+  cql_int32 rows;
+  cql_int32 rc;
+  char proc[64];
+  char param_types[64];
+  char plan[1024];
+} slow_statement_copy;
+
+static slow_statement_copy slow_statements[8];
+static cql_int32 slow_statement_count;
+
+static void on_slow_statement(const cql_slow_statement *slow, void *context) {
+  (*(cql_int32 *)context)++;
+  if (slow_statement_count < 8) {
+    slow_statement_copy *copy = &slow_statements[slow_statement_count++];
+    copy->kind = slow->kind;
+    copy->rows = slow->rows;
+    copy->rc = slow->rc;
+    snprintf(copy->proc, sizeof(copy->proc), "%s", slow->proc ? slow->proc : "");
+    snprintf(copy->param_types, sizeof(copy->param_types), "%s", slow->param_types);
+    snprintf(copy->plan, sizeof(copy->plan), "%s", slow->plan);
+  }
+}
+
+cql_code test_slow_statement_log(sqlite3 *db) {
+  printf("Running slow statement log test\n");
+  tests++;
+
+  // get_diff_rows uses no tables so any connection can explain it
+  sqlite3 *plan_db = NULL;
+  SQL_E(sqlite3_open(":memory:", &plan_db));
+
+  // with a threshold of 0 everything is slow, the prepare and the step loop are
+  // reported (binds are not)
+  cql_int32 calls = 0;
+  slow_statement_count = 0;
+  cql_slow_statement_log_enable(0, plan_db, on_slow_statement, &calls);
+  get_diff_rows_result_set_ref result_set;
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 10));
+  cql_result_set_release(result_set);
+  cql_slow_statement_log_disable();
+
+  E(calls == 2, "expected 2 slow statements, got %d\n", calls);
+  slow_statement_copy *prep = &slow_statements[0];
+  slow_statement_copy *step = &slow_statements[1];
+  E(prep->kind == CQL_TRACE_PREPARE, "expected a prepare first\n");
+  E(!strcmp(prep->proc, "get_diff_rows"), "expected proc get_diff_rows, got %s\n", prep->proc);
+  E(!strcmp(prep->param_types, ""), "expected no parameter types at prepare, got %s\n", prep->param_types);
+  E(step->kind == CQL_TRACE_STEP, "expected a step loop second\n");
+  E(!strcmp(step->proc, "get_diff_rows"), "expected proc get_diff_rows, got %s\n", step->proc);
+  E(step->rows == 10 && step->rc == SQLITE_DONE, "expected 10 rows and SQLITE_DONE\n");
+  // version and n are used 8 times in the statement so they are bound 8 times
+  E(!strcmp(step->param_types, "int!, int!, int!, int!, int!, int!, int!, int!"),
+    "expected the parameter types, got %s\n", step->param_types);
+  E(strstr(step->plan, "nums"), "expected a plan that mentions nums, got %s\n", step->plan);
+
+  // nothing is reported under the threshold or when the log is off
+  calls = 0;
+  cql_slow_statement_log_enable(1000000000000, plan_db, on_slow_statement, &calls);
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 10));
+  cql_result_set_release(result_set);
+  cql_slow_statement_log_disable();
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 10));
+  cql_result_set_release(result_set);
+  E(calls == 0, "expected no slow statements, got %d\n", calls);
+
+  // without a plan connection there is no plan, a plan connection that can't
+  // explain the statement says why
+  calls = 0;
+  slow_statement_count = 0;
+  cql_slow_statement_log_enable(0, NULL, on_slow_statement, &calls);
+  SQL_E(cql_exec(db, "select 1"));
+  cql_slow_statement_log_enable(0, plan_db, on_slow_statement, &calls);
+  SQL_E(cql_exec(db, "create temp table if not exists slow_log_test(x int)"));
+  SQL_E(cql_exec(db, "select * from slow_log_test"));
+  cql_slow_statement_log_disable();
+  E(calls == 3, "expected 3 slow statements, got %d\n", calls);
+  E(slow_statements[0].kind == CQL_TRACE_EXEC, "expected an exec\n");
+  E(!strcmp(slow_statements[0].plan, ""), "expected no plan, got %s\n", slow_statements[0].plan);
+  E(!strncmp(slow_statements[2].plan, "no plan: ", 9), "expected no plan, got %s\n", slow_statements[2].plan);
+
+  SQL_E(cql_exec(db, "drop table slow_log_test"));
+  sqlite3_close(plan_db);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// An allocator that uses malloc but counts what it sees by kind
+typedef struct counting_allocator_stats {
+  int32_t allocs[CQL_ALLOC_KINDS];
+  int32_t frees[CQL_ALLOC_KINDS];
+} counting_allocator_stats;
+
+static void *counting_allocate(void *context, size_t size, int32_t kind) {
+  ((counting_allocator_stats *)context)->allocs[kind]++;
+  return malloc(size);
+}
+
+static void *counting_allocate_zeroed(void *context, size_t size, int32_t kind) {
+  ((counting_allocator_stats *)context)->allocs[kind]++;
+  return calloc(1, size);
+}
+
+static void *counting_reallocate(void *context, void *ptr, size_t size, int32_t kind) {
+  if (!ptr) {
+    ((counting_allocator_stats *)context)->allocs[kind]++;
+  }
+  return realloc(ptr, size);
+}
+
+static void counting_deallocate(void *context, void *ptr, int32_t kind) {
+  if (ptr) {
+    ((counting_allocator_stats *)context)->frees[kind]++;
+  }
+  free(ptr);
+}
+
+// Releases a string on a thread that has no allocator installed.
+static void *release_on_thread(void *str) {
+  cql_string_release((cql_string_ref)str);
+  return NULL;
+}
+
+#define ARENA_THREAD_BLOCKS 1000
+
+// Frees an array of blocks on a thread while the owner keeps using the arena,
+// plain blocks rather than objects so the test's ref counter isn't shared.
+static void *free_all_on_thread(void *blocks) {
+  for (int32_t i = 0; i < ARENA_THREAD_BLOCKS; i++) {
+    cql_free(((char **)blocks)[i], CQL_ALLOC_TEMP);
+  }
+  return NULL;
+}
+
+cql_code test_allocator(sqlite3 *db) {
+  printf("Running allocator test\n");
+  tests++;
+
+  // everything the runtime allocates goes to the installed allocator and comes
+  // back to it with the same kind
+  counting_allocator_stats stats = {0};
+  cql_allocator counting = {
+    counting_allocate, counting_allocate_zeroed, counting_reallocate, counting_deallocate, &stats
+  };
+  E(cql_set_allocator(&counting) == NULL, "expected no allocator to start\n");
+  E(cql_get_allocator() == &counting, "expected the counting allocator\n");
+
+  get_diff_rows_result_set_ref result_set;
+  SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 100));
+  cql_string_ref str = cql_string_ref_new("hello allocator");
+  E(stats.allocs[CQL_ALLOC_OBJECT] >= 2, "expected the result set and string headers\n");
+  E(stats.allocs[CQL_ALLOC_ROW_DATA] >= 1, "expected row data\n");
+  E(stats.allocs[CQL_ALLOC_PAYLOAD] >= 1, "expected the string payload\n");
+  cql_string_release(str);
+  cql_result_set_release(result_set);
+
+  for (int32_t i = 0; i < CQL_ALLOC_KINDS; i++) {
+    E(stats.allocs[i] == stats.frees[i], "kind %d: %d allocations but %d frees\n", i, stats.allocs[i], stats.frees[i]);
+  }
+  E(cql_set_allocator(NULL) == &counting, "expected the counting allocator back\n");
+
+  // memory goes back to the allocator it came from, not the current one,
+  // even after the allocator is replaced or when released on another thread
+  memset(&stats, 0, sizeof(stats));
+  cql_set_allocator(&counting);
+  str = cql_string_ref_new("made with the counting allocator");
+  cql_string_ref other = cql_string_ref_new("released on another thread");
+  char *temp = cql_malloc(16, CQL_ALLOC_TEMP);
+  cql_set_allocator(NULL);
+
+  temp = cql_realloc(temp, 64, CQL_ALLOC_TEMP);
+  cql_free(temp, CQL_ALLOC_TEMP);
+  cql_string_release(str);
+  pthread_t thread;
+  E(!pthread_create(&thread, NULL, release_on_thread, other), "could not start a thread\n");
+  pthread_join(thread, NULL);
+
+  for (int32_t i = 0; i < CQL_ALLOC_KINDS; i++) {
+    E(stats.allocs[i] == stats.frees[i], "kind %d: %d allocations but %d frees after restore\n", i, stats.allocs[i], stats.frees[i]);
+  }
+  E(stats.frees[CQL_ALLOC_TEMP] == 1, "expected the temp memory back in the counting allocator\n");
+
+  // an arena makes the same objects, freeing them is cheap and reset gets
+  // everything back at once
+  cql_arena *arena = cql_arena_create(4096);
+  cql_set_allocator(cql_arena_allocator(arena));
+
+  for (int32_t round = 0; round < 3; round++) {
+    SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 100));
+    E(get_diff_rows_result_count(result_set) == 100, "expected 100 rows\n");
+    E(get_diff_rows_get_id(result_set, 99) == 99, "expected the last row to be intact\n");
+
+    // more than half a chunk gets its own chunk
+    str = cql_string_ref_new("x");
+    char *big = cql_malloc(10000, CQL_ALLOC_TEMP);
+    memset(big, 'x', 10000);
+    E(cql_arena_bytes_used(arena, CQL_ALLOC_TEMP) >= 10000, "expected the big temp allocation\n");
+    E(cql_arena_bytes_used(arena, CQL_ALLOC_ROW_DATA) > 0, "expected row data in the arena\n");
+    E(cql_arena_total_bytes_used(arena) > 10000, "expected the total to include everything\n");
+    cql_free(big, CQL_ALLOC_TEMP);
+
+    // the most recent allocation grows in place
+    char *grow = cql_malloc(16, CQL_ALLOC_TEMP);
+    strcpy(grow, "arena");
+    char *grown = cql_realloc(grow, 256, CQL_ALLOC_TEMP);
+    E(grown == grow && !strcmp(grown, "arena"), "expected realloc in place\n");
+    cql_free(grown, CQL_ALLOC_TEMP);
+
+    // arena memory is still resized in the arena with no allocator installed
+    grow = cql_malloc(16, CQL_ALLOC_TEMP);
+    cql_set_allocator(NULL);
+    grown = cql_realloc(grow, 256, CQL_ALLOC_TEMP);
+    E(grown == grow, "expected realloc in the arena\n");
+    cql_free(grown, CQL_ALLOC_TEMP);
+    cql_set_allocator(cql_arena_allocator(arena));
+
+    cql_string_release(str);
+    cql_result_set_release(result_set);
+    cql_arena_reset(arena);
+    E(cql_arena_total_bytes_used(arena) == 0, "expected nothing used after reset\n");
+  }
+
+  // memory made in the arena is freed on another thread while this one keeps
+  // allocating from the same arena
+  char *blocks[ARENA_THREAD_BLOCKS];
+  for (int32_t i = 0; i < ARENA_THREAD_BLOCKS; i++) {
+    blocks[i] = cql_malloc(32, CQL_ALLOC_TEMP);
+  }
+  pthread_t releaser;
+  E(!pthread_create(&releaser, NULL, free_all_on_thread, blocks), "could not start a thread\n");
+  for (int32_t i = 0; i < ARENA_THREAD_BLOCKS; i++) {
+    char *block = cql_malloc(32, CQL_ALLOC_TEMP);
+    memset(block, 'x', 32);
+    block = cql_realloc(block, 64, CQL_ALLOC_TEMP);
+    cql_free(block, CQL_ALLOC_TEMP);
+  }
+  pthread_join(releaser, NULL);
+  cql_arena_reset(arena);
+
+  cql_set_allocator(NULL);
+  cql_arena_destroy(arena);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// runs a query that returns one integer
+static cql_int64 bulk_query_int(sqlite3 *db, const char *sql) {
+  sqlite3_stmt *stmt = NULL;
+  cql_int64 result = -1;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    result = sqlite3_column_int64(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+// the same columns as get_compact_rows and get_padded_rows
+#define BULK_ROWS_COLUMNS "id, ni, nb, nr, nl, name"
+
+// the rows that don't match what get_compact_rows(n) produces
+#define BULK_ROWS_MISMATCHES(table, n) \
+  "select count(*) from (select * from " table " except " \
+  "select * from (with recursive nums(i) as (select 0 union all select i + 1 from nums limit " #n ") " \
+  "select i, iif(i % 2, null, i * 10), iif(i % 3 = 0, null, i % 2 = 0), iif(i % 5 = 0, null, i * 1.5), " \
+  "iif(i % 4 = 0, null, i * 100), iif(i % 2, null, printf('row %d', i)) from nums))"
+
+// an array of these is inserted using a hand made cursor shape
+typedef struct bulk_cursor_row {
+  cql_bool _has_row_;
+  cql_uint16 _refs_count_;
+  cql_uint16 _refs_offset_;
+  cql_int32 id;
+  cql_nullable_int64 nl;
+  cql_string_ref name;
+} bulk_cursor_row;
+
+cql_code test_bulk_insert(sqlite3 *db) {
+  printf("Running bulk insert test\n");
+  tests++;
+
+  SQL_E(cql_exec(db,
+    "create table bulk_rows(id int primary key, ni int, nb bool, nr real, nl long int, name text)"));
+
+  // compact rows, then the same rows in the normal layout, 300 rows is some
+  // full chunks and a partial one
+  get_compact_rows_result_set_ref compact;
+  get_padded_rows_result_set_ref padded;
+  SQL_E(get_compact_rows_fetch_results(db, &compact, 300));
+  SQL_E(get_padded_rows_fetch_results(db, &padded, 300));
+
+  SQL_E(cql_result_set_insert_rows(db, (cql_result_set_ref)compact, "bulk_rows", BULK_ROWS_COLUMNS));
+  E(bulk_query_int(db, "select count(*) from bulk_rows") == 300, "expected 300 rows\n");
+  E(bulk_query_int(db, BULK_ROWS_MISMATCHES("bulk_rows", 300)) == 0, "compact rows were not inserted intact\n");
+
+  // a small variable limit means a few rows per statement, this one runs in a
+  // transaction so the savepoint is nested
+  SQL_E(cql_exec(db, "delete from bulk_rows"));
+  int old_limit = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, 13);
+  SQL_E(cql_exec(db, "begin"));
+  SQL_E(cql_result_set_insert_rows(db, (cql_result_set_ref)padded, "bulk_rows", BULK_ROWS_COLUMNS));
+  SQL_E(cql_exec(db, "commit"));
+  sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, old_limit);
+  E(bulk_query_int(db, "select count(*) from bulk_rows") == 300, "expected 300 rows\n");
+  E(bulk_query_int(db, BULK_ROWS_MISMATCHES("bulk_rows", 300)) == 0, "padded rows were not inserted intact\n");
+
+  // inserting them again fails on the first row, nothing changes and the
+  // error is the constraint not something from the cleanup
+  cql_code rc = cql_result_set_insert_rows(db, (cql_result_set_ref)compact, "bulk_rows", BULK_ROWS_COLUMNS);
+  E(rc == SQLITE_CONSTRAINT, "expected a constraint error, got %d\n", rc);
+  E(bulk_query_int(db, "select count(*) from bulk_rows") == 300, "expected the failed insert to do nothing\n");
+
+  // a statement that can't be prepared fails the same way
+  rc = cql_result_set_insert_rows(db, (cql_result_set_ref)compact, "bulk_rows", "id, ni, nb, nr, nl, no_such_column");
+  E(rc == SQLITE_ERROR, "expected a prepare error, got %d\n", rc);
+
+  cql_result_set_release(compact);
+  cql_result_set_release(padded);
+
+  // an array of cursor shaped rows, the field names are the columns
+  const cql_int32 n = 100;
+  bulk_cursor_row rows[n];
+  for (cql_int32 i = 0; i < n; i++) {
+    rows[i].id = 1000 + i;
+    rows[i].nl.is_null = i % 2;
+    rows[i].nl.value = i;
+    rows[i].name = i % 3 ? cql_string_ref_new("cursor row") : NULL;
+  }
+
+  uint8_t types[] = {
+    CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_NOT_NULL,
+    CQL_DATA_TYPE_INT64,
+    CQL_DATA_TYPE_STRING
+  };
+  cql_uint16 offsets[] = {
+    3,
+    offsetof(bulk_cursor_row, id),
+    offsetof(bulk_cursor_row, nl),
+    offsetof(bulk_cursor_row, name)
+  };
+  const char *fields[] = { "id", "nl", "name" };
+  cql_dynamic_cursor shape = {
+    .cursor_data = &rows[0],
+    .cursor_has_row = &rows[0]._has_row_,
+    .cursor_col_offsets = offsets,
+    .cursor_data_types = types,
+    .cursor_fields = fields,
+    .cursor_size = sizeof(bulk_cursor_row),
+  };
+
+  SQL_E(cql_insert_cursor_rows(db, "bulk_rows", &shape, rows, n));
+  E(bulk_query_int(db, "select count(*) from bulk_rows where id >= 1000") == n, "expected %d cursor rows\n", n);
+  E(bulk_query_int(db, "select count(nl) from bulk_rows where id >= 1000") == n / 2, "expected half the nl values\n");
+  E(bulk_query_int(db, "select sum(nl) from bulk_rows where id >= 1000") == 2450, "expected the even nl values\n");
+  E(bulk_query_int(db, "select count(*) from bulk_rows where name = 'cursor row'") == 66, "expected 66 names\n");
+
+  // the names are identifiers, never SQL, so odd names work and a name with
+  // SQL in it is just a name that doesn't exist
+  SQL_E(cql_exec(db, "create table \"bulk \"\"odd\"\" rows\"(\"my id\" int, \"nl\" long int, \"na\"\"me\" text)"));
+  const char *odd_fields[] = { "my id", "nl", "na\"me" };
+  shape.cursor_fields = odd_fields;
+  SQL_E(cql_insert_cursor_rows(db, "bulk \"odd\" rows", &shape, rows, n));
+  E(bulk_query_int(db, "select count(\"na\"\"me\") from \"bulk \"\"odd\"\" rows\"") == 66, "expected 66 odd names\n");
+  rc = cql_insert_cursor_rows(db, "bulk_rows(id) select 1; --", &shape, rows, n);
+  E(rc == SQLITE_ERROR, "expected no such table, got %d\n", rc);
+  SQL_E(cql_exec(db, "drop table \"bulk \"\"odd\"\" rows\""));
+
+  // an object column can't be stored, nothing is inserted
+  types[2] = CQL_DATA_TYPE_OBJECT;
+  shape.cursor_fields = fields;
+  rc = cql_insert_cursor_rows(db, "bulk_rows", &shape, rows, n);
+  E(rc == SQLITE_ERROR, "expected object columns to be rejected, got %d\n", rc);
+  E(bulk_query_int(db, "select count(*) from bulk_rows") == 300 + n, "expected the object rows not to be inserted\n");
+  types[2] = CQL_DATA_TYPE_STRING;
+
+  for (cql_int32 i = 0; i < n; i++) {
+    cql_set_string_ref(&rows[i].name, NULL);
+  }
+
+  SQL_E(cql_exec(db, "drop table bulk_rows"));
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+#define EXPORT_IS_NULL(nulls, i) (((nulls)[(i) >> 3] >> ((i) & 7)) & 1)
+
+// exports every column of rows [from, from + n) and checks each cell against
+// the getters, this works for both layouts
+static cql_code check_column_export(cql_result_set_ref rs, cql_int32 from, cql_int32 n) {
+  cql_int32 values[64];
+  cql_int64 longs[64];
+  cql_double doubles[64];
+  cql_bool bools[64];
+  cql_int32 offsets[65];
+  uint8_t nulls[8];
+  char heap[1024];
+
+  // id int!, ni int, nb bool, nr real, nl long, name text
+  E(cql_result_set_export_column(rs, 0, from, n, values, nulls, NULL, 0) == n, "expected all of id\n");
+  for (cql_int32 i = 0; i < n; i++) {
+    E(values[i] == cql_result_set_get_int32_col(rs, from + i, 0), "id %d mismatch\n", i);
+    E(!EXPORT_IS_NULL(nulls, i), "id %d should not be null\n", i);
+  }
+
+  E(cql_result_set_export_column(rs, 1, from, n, values, nulls, NULL, 0) == n, "expected all of ni\n");
+  E(cql_result_set_export_column(rs, 2, from, n, bools, NULL, NULL, 0) == n, "expected all of nb\n");
+  E(cql_result_set_export_column(rs, 3, from, n, doubles, NULL, NULL, 0) == n, "expected all of nr\n");
+  E(cql_result_set_export_column(rs, 4, from, n, longs, NULL, NULL, 0) == n, "expected all of nl\n");
+  for (cql_int32 i = 0; i < n; i++) {
+    cql_int32 row = from + i;
+    cql_bool ni_null = cql_result_set_get_is_null_col(rs, row, 1);
+    E(EXPORT_IS_NULL(nulls, i) == ni_null, "ni %d null mismatch\n", i);
+    E(values[i] == (ni_null ? 0 : cql_result_set_get_int32_col(rs, row, 1)), "ni %d mismatch\n", i);
+    cql_bool nb_null = cql_result_set_get_is_null_col(rs, row, 2);
+    E(bools[i] == (nb_null ? 0 : cql_result_set_get_bool_col(rs, row, 2)), "nb %d mismatch\n", i);
+    cql_bool nr_null = cql_result_set_get_is_null_col(rs, row, 3);
+    E(doubles[i] == (nr_null ? 0 : cql_result_set_get_double_col(rs, row, 3)), "nr %d mismatch\n", i);
+    cql_bool nl_null = cql_result_set_get_is_null_col(rs, row, 4);
+    E(longs[i] == (nl_null ? 0 : cql_result_set_get_int64_col(rs, row, 4)), "nl %d mismatch\n", i);
+  }
+
+  cql_int32 heap_size = cql_result_set_export_heap_size(rs, 5, from, n);
+  E(heap_size <= sizeof(heap), "heap too big for the test %d\n", heap_size);
+  E(cql_result_set_export_column(rs, 5, from, n, offsets, nulls, heap, heap_size) == n, "expected all of name\n");
+  E(offsets[n] == heap_size, "expected the heap to be exactly full\n");
+  for (cql_int32 i = 0; i < n; i++) {
+    cql_string_ref name = cql_result_set_get_string_col(rs, from + i, 5);
+    E(EXPORT_IS_NULL(nulls, i) == !name, "name %d null mismatch\n", i);
+    cql_int32 len = offsets[i + 1] - offsets[i];
+    if (name) {
+      cql_alloc_cstr(c_name, name);
+      E(len == strlen(c_name) && !memcmp(heap + offsets[i], c_name, len), "name %d mismatch\n", i);
+      cql_free_cstr(c_name, name);
+    }
+    else {
+      E(len == 0, "null name %d should be empty\n", i);
+    }
+  }
+
+  // a heap that's too small stops at the last row that fits
+  cql_int32 partial = cql_result_set_export_column(rs, 5, from, n, offsets, nulls, heap, heap_size - 1);
+  E(partial < n && offsets[partial] <= heap_size - 1, "expected a partial export, got %d\n", partial);
+
+  return SQLITE_OK;
+}
+
+cql_code test_column_export(sqlite3 *db) {
+  printf("Running column export test\n");
+  tests++;
+
+  get_compact_rows_result_set_ref compact;
+  get_padded_rows_result_set_ref padded;
+  SQL_E(get_compact_rows_fetch_results(db, &compact, 100));
+  SQL_E(get_padded_rows_fetch_results(db, &padded, 100));
+
+  // whole chunks and an unaligned range in both layouts
+  SQL_E(check_column_export((cql_result_set_ref)compact, 0, 64));
+  SQL_E(check_column_export((cql_result_set_ref)compact, 37, 19));
+  SQL_E(check_column_export((cql_result_set_ref)padded, 0, 64));
+  SQL_E(check_column_export((cql_result_set_ref)padded, 37, 19));
+
+  cql_result_set_release(compact);
+  cql_result_set_release(padded);
+
+  // compare one export per column with one call per cell, copying each string
+  // the way the bindings do, for 10000 rows
+  const cql_int32 n = 10000;
+  SQL_E(get_padded_rows_fetch_results(db, &padded, n));
+  cql_result_set_ref rs = (cql_result_set_ref)padded;
+
+  clock_t start = clock();
+  cql_int64 checksum1 = 0;
+  for (cql_int32 row = 0; row < n; row++) {
+    checksum1 += cql_result_set_get_int32_col(rs, row, 0);
+    for (cql_int32 col = 1; col < 5; col++) {
+      checksum1 += cql_result_set_get_is_null_col(rs, row, col);
+    }
+    checksum1 += cql_result_set_get_int32_col(rs, row, 1);
+    checksum1 += cql_result_set_get_bool_col(rs, row, 2);
+    checksum1 += (cql_int64)cql_result_set_get_double_col(rs, row, 3);
+    checksum1 += cql_result_set_get_int64_col(rs, row, 4);
+    cql_string_ref name = cql_result_set_get_string_col(rs, row, 5);
+    if (name) {
+      cql_alloc_cstr(c_name, name);
+      char *copy = strdup(c_name);
+      checksum1 += strlen(copy);
+      free(copy);
+      cql_free_cstr(c_name, name);
+    }
+  }
+  clock_t per_cell = clock() - start;
+
+  start = clock();
+  cql_int64 checksum2 = 0;
+  cql_int32 *ints = malloc(n * sizeof(cql_int32));
+  cql_int64 *longs = malloc(n * sizeof(cql_int64));
+  cql_double *doubles = malloc(n * sizeof(cql_double));
+  cql_bool *bools = malloc(n);
+  cql_int32 *offsets = malloc((n + 1) * sizeof(cql_int32));
+  uint8_t *nulls = malloc((n + 7) / 8);
+
+  cql_result_set_export_column(rs, 0, 0, n, ints, NULL, NULL, 0);
+  for (cql_int32 i = 0; i < n; i++) checksum2 += ints[i];
+  cql_result_set_export_column(rs, 1, 0, n, ints, nulls, NULL, 0);
+  for (cql_int32 i = 0; i < n; i++) checksum2 += ints[i] + EXPORT_IS_NULL(nulls, i);
+  cql_result_set_export_column(rs, 2, 0, n, bools, nulls, NULL, 0);
+  for (cql_int32 i = 0; i < n; i++) checksum2 += bools[i] + EXPORT_IS_NULL(nulls, i);
+  cql_result_set_export_column(rs, 3, 0, n, doubles, nulls, NULL, 0);
+  for (cql_int32 i = 0; i < n; i++) checksum2 += (cql_int64)doubles[i] + EXPORT_IS_NULL(nulls, i);
+  cql_result_set_export_column(rs, 4, 0, n, longs, nulls, NULL, 0);
+  for (cql_int32 i = 0; i < n; i++) checksum2 += longs[i] + EXPORT_IS_NULL(nulls, i);
+  cql_int32 heap_size = cql_result_set_export_heap_size(rs, 5, 0, n);
+  char *heap = malloc(heap_size);
+  cql_result_set_export_column(rs, 5, 0, n, offsets, NULL, heap, heap_size);
+  checksum2 += offsets[n];
+  clock_t columnar = clock() - start;
+
+  E(checksum1 == checksum2, "checksums differ %lld %lld\n", (long long)checksum1, (long long)checksum2);
+  printf("  %d rows: per cell %ld us, columnar %ld us\n", n,
+    (long)(per_cell * 1000000 / CLOCKS_PER_SEC), (long)(columnar * 1000000 / CLOCKS_PER_SEC));
+
+  free(heap);
+  free(ints);
+  free(longs);
+  free(doubles);
+  free(bools);
+  free(offsets);
+  free(nulls);
+  cql_result_set_release(padded);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+typedef struct stream_sink_state {
+  cql_int32 rows;
+  cql_int32 limit;
+  cql_bool names_ok;
+} stream_sink_state;
+
+// Counts the rows and checks each one; stops once the limit is reached.
+static cql_bool stream_sink(void *_Nullable context, const void *_Nonnull row, cql_uint32 size) {
+  stream_sink_state *state = (stream_sink_state *)context;
+  const get_streamed_rows_row *r = (const get_streamed_rows_row *)row;
+
+  char expected[32];
+  snprintf(expected, sizeof(expected), "row %d", state->rows);
+  cql_alloc_cstr(name, r->name);
+  if (size != sizeof(get_streamed_rows_row) || r->id != state->rows || strcmp(name, expected)) {
+    state->names_ok = false;
+  }
+  cql_free_cstr(name, r->name);
+
+  state->rows++;
+  return state->rows < state->limit;
+}
+
+cql_code test_stream_rows(sqlite3 *db) {
+  printf("Running stream rows test\n");
+  tests++;
+
+  // every row arrives, nothing is retained by the stream
+  stream_sink_state all = { .limit = 1000, .names_ok = true };
+  SQL_E(get_streamed_rows_stream(db, 100, stream_sink, &all));
+  E(all.rows == 100 && all.names_ok, "streamed %d rows, names ok %d\n", all.rows, all.names_ok);
+  E(!cql_outstanding_refs, "outstanding refs after streaming: %d\n", cql_outstanding_refs);
+
+  // the sink stops the proc early, that is not an error
+  stream_sink_state some = { .limit = 7, .names_ok = true };
+  SQL_E(get_streamed_rows_stream(db, 100, stream_sink, &some));
+  E(some.rows == 7 && some.names_ok, "early stop streamed %d rows\n", some.rows);
+
+  // the materializing form is built on the stream and sees the same rows
+  get_streamed_rows_result_set_ref rs;
+  SQL_E(get_streamed_rows_fetch_results(db, &rs, 100));
+  cql_int32 count = get_streamed_rows_result_count(rs);
+  E(count == 100, "expected 100 rows, got %d\n", count);
+  for (cql_int32 i = 0; i < count; i++) {
+    E(get_streamed_rows_get_id(rs, i) == i, "row %d has the wrong id\n", i);
+  }
+  cql_result_set_release(rs);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+cql_code test_copyoutrow_direct(sqlite3 *db) {
+  printf("Running copyoutrow direct test\n");
+  tests++;
+
+  // a cursor with the same shape as the rows of get_streamed_rows
+  uint16_t cols[] = { 2,
+    cql_offsetof(get_streamed_rows_row, id),
+    cql_offsetof(get_streamed_rows_row, name)
+  };
+  uint8_t types[] = {
+    CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_NOT_NULL,
+    CQL_DATA_TYPE_STRING | CQL_DATA_TYPE_NOT_NULL
+  };
+  get_streamed_rows_row C = {
+    ._refs_count_ = 1,
+    ._refs_offset_ = cql_offsetof(get_streamed_rows_row, name)
+  };
+
+  // OUT UNION rows have the cursor layout, they are copied directly
+  get_streamed_rows_result_set_ref rs;
+  SQL_E(get_streamed_rows_fetch_results(db, &rs, 10));
+  for (cql_int32 i = 0; i < 10; i++) {
+    E(cql_copyoutrow_direct((cql_result_set_ref)rs, i, &C, sizeof(C), cols, types), "row %d not copied\n", i);
+    E(C.id == i, "expected id %d, got %d\n", i, C.id);
+    E(C.name == get_streamed_rows_get_name(rs, i), "row %d has the wrong name\n", i);
+  }
+  E(!cql_copyoutrow_direct((cql_result_set_ref)rs, 10, &C, sizeof(C), cols, types), "copied a row past the end\n");
+
+  // the cursor holds its own reference, the result set can go first
+  cql_string_ref name = C.name;
+  cql_result_set_release(rs);
+  cql_alloc_cstr(cname, name);
+  E(!strcmp(cname, "row 9"), "cursor lost its name, got %s\n", cname);
+  cql_free_cstr(cname, name);
+
+  cql_teardown_row(C);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+typedef struct column_coder_state {
+  cql_int32 delta;
+  cql_int32 calls;
+  cql_int32 values;
+  cql_int32 context_column;
+} column_coder_state;
+
+// Shifts int columns by delta, other columns are only counted.
+static void column_coder(void *context, cql_column_batch *batch) {
+  column_coder_state *state = (column_coder_state *)context;
+  state->calls++;
+  state->values += batch->count;
+  state->context_column = batch->context_column;
+
+  if (CQL_CORE_DATA_TYPE_OF(batch->data_type) != CQL_DATA_TYPE_INT32) {
+    return;
+  }
+
+  char *row = batch->rows;
+  for (cql_int32 i = 0; i < batch->count; i++, row += batch->rowsize) {
+    char *value = row + batch->offset;
+    if (batch->data_type & CQL_DATA_TYPE_NOT_NULL) {
+      *(cql_int32 *)value += state->delta;
+    }
+    else if (!((cql_nullable_int32 *)value)->is_null) {
+      ((cql_nullable_int32 *)value)->value += state->delta;
+    }
+  }
+}
+
+cql_code test_column_coder(sqlite3 *db) {
+  printf("Running column coder test\n");
+  tests++;
+
+  // this creates and fills all_types_encoded_table
+  load_encoded_table_result_set_ref lrs;
+  SQL_E(load_encoded_table_fetch_results(db, &lrs));
+  cql_result_set_release(lrs);
+
+  // nothing is registered, the values are as stored
+  select_encoded_rows_result_set_ref rs;
+  SQL_E(select_encoded_rows_fetch_results(db, &rs));
+  E(select_encoded_rows_result_count(rs) == 1, "expected one row\n");
+  E(select_encoded_rows_get_i1(rs, 0) == 1, "i1 was changed without an encoder\n");
+  cql_result_set_release(rs);
+
+  // the named columns are encoded, one call each for all the rows
+  column_coder_state enc = { .delta = 100 };
+  cql_set_column_encoder(column_coder, &enc);
+  SQL_E(select_encoded_rows_fetch_results(db, &rs));
+  E(enc.calls == 2 && enc.values == 2, "expected 2 calls, got %d\n", enc.calls);
+  E(enc.context_column == 10, "expected context column 10, got %d\n", enc.context_column);
+  E(select_encoded_rows_get_i0_value(rs, 0) == 100, "i0 not encoded\n");
+  E(select_encoded_rows_get_i1(rs, 0) == 101, "i1 not encoded\n");
+  E(select_encoded_rows_get_l1(rs, 0) == 1, "l1 should not be encoded\n");
+
+  // decoding is the same operation in the other direction
+  column_coder_state dec = { .delta = -100 };
+  cql_result_set_code_columns((cql_result_set_ref)rs, select_encoded_rows_encoded_columns, 10, column_coder, &dec);
+  E(dec.calls == 2, "expected 2 decode calls, got %d\n", dec.calls);
+  E(select_encoded_rows_get_i0_value(rs, 0) == 0, "i0 not decoded\n");
+  E(select_encoded_rows_get_i1(rs, 0) == 1, "i1 not decoded\n");
+  cql_result_set_release(rs);
+
+  // with no column list all the sensitive columns are encoded, this is the
+  // OUT UNION path
+  enc.calls = 0;
+  out_union_dml_result_set_ref urs;
+  SQL_E(out_union_dml_fetch_results(db, &urs));
+  E(enc.calls == 12, "expected 12 calls, got %d\n", enc.calls);
+  E(enc.context_column == -1, "unexpected context column %d\n", enc.context_column);
+  E(out_union_dml_get_i1(urs, 0) == 101, "i1 not encoded\n");
+  cql_result_set_release(urs);
+
+  // and the single row OUT path
+  enc.calls = 0;
+  load_encoded_cursor_result_set_ref crs;
+  SQL_E(load_encoded_cursor_fetch_results(db, &crs));
+  E(enc.calls == 12, "expected 12 calls, got %d\n", enc.calls);
+  E(load_encoded_cursor_get_i1(crs) == 101, "i1 not encoded\n");
+  cql_result_set_release(crs);
+
+  cql_set_column_encoder(NULL, NULL);
+  SQL_E(sqlite3_exec(db, "drop table all_types_encoded_table", NULL, NULL, NULL));
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// these builtins are declared by the generated code where they are used
+cql_code cql_cursor_to_blob(sqlite3 *db, cql_dynamic_cursor *C, cql_blob_ref *result);
+cql_code cql_cursor_to_fixed_blob(sqlite3 *db, cql_dynamic_cursor *C, cql_blob_ref *result);
+cql_code cql_cursor_view_from_blob(sqlite3 *db, cql_dynamic_cursor *C, cql_blob_ref b);
+
+typedef struct view_cursor_row {
+  cql_bool _has_row_;
+  cql_uint16 _refs_count_;
+  cql_uint16 _refs_offset_;
+  cql_int64 big;
+  cql_string_ref name;
+  cql_blob_ref data;
+} view_cursor_row;
+
+static cql_bool inside_blob(cql_blob_ref b, const void *p) {
+  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(b);
+  return (const uint8_t *)p >= bytes && (const uint8_t *)p < bytes + cql_get_blob_size(b);
+}
+
+cql_code test_cursor_blob_views(sqlite3 *db) {
+  printf("Running cursor blob views test\n");
+  tests++;
+
+  uint8_t types[] = {
+    CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL,
+    CQL_DATA_TYPE_STRING | CQL_DATA_TYPE_NOT_NULL,
+    CQL_DATA_TYPE_BLOB
+  };
+  cql_uint16 offsets[] = {
+    3,
+    offsetof(view_cursor_row, big),
+    offsetof(view_cursor_row, name),
+    offsetof(view_cursor_row, data)
+  };
+  const char *fields[] = { "big", "name", "data" };
+
+  view_cursor_row src = {
+    ._has_row_ = true,
+    ._refs_count_ = 2,
+    ._refs_offset_ = offsetof(view_cursor_row, name),
+    .big = -1234567890123LL,
+    .name = cql_string_ref_new("viewed name"),
+    .data = cql_blob_ref_new("viewed data", 11),
+  };
+  view_cursor_row dest = {
+    ._refs_count_ = 2,
+    ._refs_offset_ = offsetof(view_cursor_row, name),
+  };
+
+  cql_dynamic_cursor src_dyn = {
+    .cursor_data = &src,
+    .cursor_has_row = &src._has_row_,
+    .cursor_col_offsets = offsets,
+    .cursor_data_types = types,
+    .cursor_fields = fields,
+    .cursor_size = sizeof(src),
+    .cursor_refs_count = 2,
+    .cursor_refs_offset = offsetof(view_cursor_row, name),
+  };
+  cql_dynamic_cursor dest_dyn = src_dyn;
+  dest_dyn.cursor_data = &dest;
+  dest_dyn.cursor_has_row = &dest._has_row_;
+
+  cql_blob_ref blobs[2] = { NULL, NULL };
+  SQL_E(cql_cursor_to_blob(db, &src_dyn, &blobs[0]));
+  SQL_E(cql_cursor_to_fixed_blob(db, &src_dyn, &blobs[1]));
+
+  for (int32_t i = 0; i < 2; i++) {
+    cql_blob_ref b = blobs[i];
+    SQL_E(cql_cursor_view_from_blob(db, &dest_dyn, b));
+    E(dest._has_row_, "view %d has no row\n", i);
+    E(dest.big == src.big, "view %d has the wrong big value\n", i);
+
+    // the text and blob fields point into the source and hold it
+    E(inside_blob(b, dest.name->ptr), "view %d name was copied\n", i);
+    E(inside_blob(b, dest.data->ptr), "view %d data was copied\n", i);
+    E(cql_string_equal(dest.name, src.name), "view %d has the wrong name\n", i);
+    E(cql_blob_equal(dest.data, src.data), "view %d has the wrong data\n", i);
+    E(b->base.ref_count == 3, "view %d expected 3 refs on the source, got %d\n", i, b->base.ref_count);
+
+    // the cursor outlives our reference to the source
+    cql_blob_release(b);
+    blobs[i] = NULL;
+    E(cql_string_equal(dest.name, src.name), "view %d lost its name\n", i);
+    cql_teardown_row(dest);
+  }
+
+  cql_teardown_row(src);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// defined below with the object result set tests
+cql_object_ref _Nonnull set_create(void);
+
+// A result set blob made from the given bytes, for damaged copies
+static cql_blob_ref blob_from_bytes(const void *bytes, cql_uint32 size) {
+  return cql_blob_ref_new(size ? bytes : "", size);
+}
+
+cql_code test_result_set_blob(sqlite3 *db) {
+  printf("Running result set blob test\n");
+  tests++;
+
+  get_serialized_rows_result_set_ref rs;
+  SQL_E(get_serialized_rows_fetch_results(db, &rs, 50));
+  cql_int32 count = get_serialized_rows_result_count(rs);
+  E(count == 50, "expected 50 rows, got %d\n", count);
+
+  cql_blob_ref blob = NULL;
+  SQL_E(get_serialized_rows_to_blob(rs, &blob));
+
+  // 3 groups and 25 names, each string is stored once
+  const uint8_t *bytes = (const uint8_t *)cql_get_blob_bytes(blob);
+  cql_uint32 size = (cql_uint32)cql_get_blob_size(blob);
+  uint32_t string_count;
+  memcpy(&string_count, bytes + 16, sizeof(string_count));
+  E(string_count == 28, "expected 28 strings, got %d\n", string_count);
+
+  get_serialized_rows_result_set_ref rs2;
+  SQL_E(get_serialized_rows_from_blob(blob, &rs2));
+  E(get_serialized_rows_result_count(rs2) == count, "wrong row count after round trip\n");
+  for (cql_int32 i = 0; i < count; i++) {
+    E(get_serialized_rows_row_equal(rs, i, rs2, i), "row %d changed in the round trip\n", i);
+    E(cql_result_set_get_is_null_col((cql_result_set_ref)rs2, i, 9) == (i % 2 == 1), "row %d name null flag\n", i);
+  }
+
+  // the strings are views into the blob and shared by every row that has them
+  E(get_serialized_rows_get_grp(rs2, 0) == get_serialized_rows_get_grp(rs2, 3), "group string was not shared\n");
+  E(inside_blob(blob, get_serialized_rows_get_grp(rs2, 0)->ptr), "group string was copied\n");
+  E(inside_blob(blob, get_serialized_rows_get_bl(rs2, 0)->ptr), "blob was copied\n");
+
+  // the bytes form copies so the bytes can go away
+  cql_result_set_meta *meta = cql_result_set_get_meta((cql_result_set_ref)rs);
+  cql_fetch_info info = {
+    .data_types = meta->dataTypes,
+    .col_offsets = meta->columnOffsets,
+    .refs_count = meta->refsCount,
+    .refs_offset = meta->refsOffset,
+    .identity_columns = meta->identityColumns,
+    .rowsize = (cql_uint32)meta->rowsize,
+  };
+  get_serialized_rows_result_set_ref rs3;
+  SQL_E(cql_result_set_from_bytes(&info, false, bytes, size, (cql_result_set_ref *)&rs3));
+  E(!inside_blob(blob, get_serialized_rows_get_grp(rs3, 0)->ptr), "bytes form made a view\n");
+  for (cql_int32 i = 0; i < count; i++) {
+    E(get_serialized_rows_row_equal(rs, i, rs3, i), "row %d changed in the bytes round trip\n", i);
+  }
+  cql_result_set_release(rs3);
+
+  // every shortened blob is rejected
+  for (cql_uint32 len = 0; len < size; len++) {
+    cql_blob_ref shorter = blob_from_bytes(bytes, len);
+    rs3 = (get_serialized_rows_result_set_ref)1;
+    E(get_serialized_rows_from_blob(shorter, &rs3) == SQLITE_ERROR, "blob of %d bytes accepted\n", len);
+    E(!rs3, "failed read left a result set\n");
+    cql_blob_release(shorter);
+  }
+
+  // damage every byte, a read can fail or succeed but it must stay in bounds
+  uint8_t *damaged = malloc(size);
+  for (cql_uint32 i = 0; i < size; i++) {
+    memcpy(damaged, bytes, size);
+    damaged[i] ^= 0xff;
+    if (cql_result_set_from_bytes(&info, false, damaged, size, (cql_result_set_ref *)&rs3) == SQLITE_OK) {
+      cql_result_set_release(rs3);
+    }
+  }
+
+  // the magic number, a column type and the first string id are all checked
+  cql_uint32 string_ids;
+  cql_uint32 grp_block;
+  memcpy(&grp_block, bytes + 28 + 12 + 8 * 4, sizeof(grp_block));
+  memcpy(damaged, bytes, size);
+  damaged[0]++;
+  E(cql_result_set_from_bytes(&info, false, damaged, size, (cql_result_set_ref *)&rs3), "bad magic accepted\n");
+  memcpy(damaged, bytes, size);
+  damaged[28] ^= CQL_DATA_TYPE_NOT_NULL;
+  E(cql_result_set_from_bytes(&info, false, damaged, size, (cql_result_set_ref *)&rs3), "bad type accepted\n");
+  memcpy(damaged, bytes, size);
+  string_ids = 1000;
+  memcpy(damaged + grp_block, &string_ids, sizeof(string_ids));
+  E(cql_result_set_from_bytes(&info, false, damaged, size, (cql_result_set_ref *)&rs3), "bad string id accepted\n");
+
+  // a huge row count is rejected before any rows are allocated
+  memcpy(damaged, bytes, size);
+  uint32_t huge_count = size * 8;
+  memcpy(damaged + 12, &huge_count, sizeof(huge_count));
+  size_t last_size = 0;
+  cql_allocator sizing = {
+    sizing_allocate, sizing_allocate_zeroed, sizing_reallocate, sizing_deallocate, &last_size
+  };
+  cql_set_allocator(&sizing);
+  E(cql_result_set_from_bytes(&info, false, damaged, size, (cql_result_set_ref *)&rs3), "huge count accepted\n");
+  cql_set_allocator(NULL);
+  E(last_size == 0, "rows of %zu bytes allocated for a bad header\n", last_size);
+  free(damaged);
+
+  // a blob of a different shape is rejected
+  get_serialized_out_union_result_set_ref other;
+  E(get_serialized_out_union_from_blob(blob, &other) == SQLITE_ERROR, "wrong shape accepted\n");
+
+  // compact rows make the same blob, which can be read in either layout
+  get_compact_serialized_rows_result_set_ref compact;
+  SQL_E(get_compact_serialized_rows_fetch_results(db, &compact, 50));
+  cql_blob_ref compact_blob = NULL;
+  SQL_E(get_compact_serialized_rows_to_blob(compact, &compact_blob));
+  E(cql_blob_equal(blob, compact_blob), "compact rows made a different blob\n");
+  get_compact_serialized_rows_result_set_ref compact2;
+  SQL_E(get_compact_serialized_rows_from_blob(blob, &compact2));
+  for (cql_int32 i = 0; i < count; i++) {
+    E(get_compact_serialized_rows_row_equal(compact, i, compact2, i), "compact row %d changed\n", i);
+  }
+  cql_result_set_release(compact2);
+  cql_result_set_release(compact);
+  cql_blob_release(compact_blob);
+
+  // the result sets outlive the blob
+  cql_blob_release(blob);
+  E(cql_string_equal(get_serialized_rows_get_grp(rs2, 4), get_serialized_rows_get_grp(rs, 4)), "lost a string\n");
+  cql_result_set_release(rs2);
+  cql_result_set_release(rs);
+
+  // out union rows have a header which must be filled in
+  get_serialized_out_union_result_set_ref out_rs;
+  SQL_E(get_serialized_out_union_fetch_results(db, &out_rs, 10));
+  blob = NULL;
+  SQL_E(get_serialized_out_union_to_blob(out_rs, &blob));
+  get_serialized_out_union_result_set_ref out_rs2;
+  SQL_E(get_serialized_out_union_from_blob(blob, &out_rs2));
+  E(get_serialized_out_union_result_count(out_rs2) == 10, "wrong out union row count\n");
+  for (cql_int32 i = 0; i < 10; i++) {
+    E(get_serialized_out_union_row_equal(out_rs, i, out_rs2, i), "out union row %d changed\n", i);
+  }
+  cql_result_set_release(out_rs2);
+  cql_result_set_release(out_rs);
+  cql_blob_release(blob);
+
+  // empty result sets round trip too
+  SQL_E(get_serialized_rows_fetch_results(db, &rs, 0));
+  blob = NULL;
+  SQL_E(get_serialized_rows_to_blob(rs, &blob));
+  SQL_E(get_serialized_rows_from_blob(blob, &rs2));
+  E(get_serialized_rows_result_count(rs2) == 0, "empty result set has rows\n");
+  cql_result_set_release(rs2);
+  cql_result_set_release(rs);
+
+  // object columns can't be serialized
+  cql_object_ref set = set_create();
+  emit_object_result_set_result_set_ref object_result_set;
+  emit_object_result_set_fetch_results(&object_result_set, set);
+  E(cql_result_set_to_blob((cql_result_set_ref)object_result_set, &blob) == SQLITE_ERROR, "object column serialized\n");
+  E(!blob, "blob left after failure\n");
+  cql_result_set_release(object_result_set);
+  cql_object_release(set);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+#ifdef CQL_PROFILING
+
+static cql_bool find_profile_stats(int64_t crc, cql_profile_stats *stats) {
+  for (cql_int32 slot = 0; slot < cql_profile_slot_count(); slot++) {
+    cql_profile_get_stats(slot, stats);
+    if (stats->crc == crc) {
+      return true;
+    }
+  }
+  return false;
+}
+
+cql_code test_profiler(sqlite3 *db) {
+  printf("Running profiler test\n");
+  tests++;
+
+  cql_profile_reset();
+
+  get_diff_rows_result_set_ref result_set;
+  for (int32_t i = 0; i < 3; i++) {
+    SQL_E(get_diff_rows_fetch_results(db, &result_set, 0, 100));
+    cql_result_set_release(result_set);
+  }
+
+  cql_profile_stats stats;
+  E(find_profile_stats(CRC_get_diff_rows, &stats), "expected a profile slot for get_diff_rows\n");
+  E(stats.calls == 3, "expected 3 calls, got %lld\n", (long long)stats.calls);
+  E(stats.rows == 300, "expected 300 rows, got %lld\n", (long long)stats.rows);
+  E(stats.bytes > 0 && stats.bytes % 300 == 0, "expected whole rows of bytes, got %lld\n", (long long)stats.bytes);
+  E(stats.total_ns >= stats.max_ns, "total time less than the slowest call\n");
+  E(stats.p50_ns <= stats.p90_ns && stats.p90_ns <= stats.p99_ns && stats.p99_ns <= stats.max_ns,
+    "percentiles out of order %lld %lld %lld %lld\n",
+    (long long)stats.p50_ns, (long long)stats.p90_ns, (long long)stats.p99_ns, (long long)stats.max_ns);
+
+  // a failed fetch is still a call but it adds no rows
+  steps_until_fail = 3;
+  E(get_diff_rows_fetch_results(db, &result_set, 0, 100) != SQLITE_OK, "expected the fetch to fail\n");
+  steps_until_fail = 0;
+  E(find_profile_stats(CRC_get_diff_rows, &stats), "expected a profile slot for get_diff_rows\n");
+  E(stats.calls == 4, "expected 4 calls, got %lld\n", (long long)stats.calls);
+  E(stats.rows == 300, "expected 300 rows, got %lld\n", (long long)stats.rows);
+
+  // the report has one row per slot with the same numbers, it's a declared
+  // procedure so there are no typed getters, columns are crc, calls, row_count, ...
+  cql_profile_report_result_set_ref report;
+  cql_profile_report_fetch_results(&report);
+  cql_result_set_ref rs = (cql_result_set_ref)report;
+  cql_int32 count = cql_result_set_get_count(rs);
+  E(count == cql_profile_slot_count(), "expected %d report rows, got %d\n", cql_profile_slot_count(), count);
+  cql_bool found = false;
+  for (cql_int32 row = 0; row < count; row++) {
+    if (cql_result_set_get_int64_col(rs, row, 0) == CRC_get_diff_rows) {
+      E(cql_result_set_get_int64_col(rs, row, 1) == 4, "expected 4 calls in the report\n");
+      E(cql_result_set_get_int64_col(rs, row, 2) == 300, "expected 300 rows in the report\n");
+      E(cql_result_set_get_int64_col(rs, row, 8) == stats.p99_ns, "report p99 doesn't match\n");
+      found = true;
+    }
+  }
+  E(found, "expected get_diff_rows in the report\n");
+  cql_result_set_release(report);
+
+  // a reset keeps the slots but clears the counts
+  cql_profile_reset();
+  E(find_profile_stats(CRC_get_diff_rows, &stats), "expected a profile slot for get_diff_rows\n");
+  E(stats.calls == 0 && stats.rows == 0 && stats.bytes == 0, "expected cleared counts after reset\n");
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+#endif
+
 cql_code test_ref_comparisons(sqlite3 *db) {
   printf("Running ref comparison test\n");
   tests++;
@@ -450,7 +2007,7 @@ static void set_finalize(cql_type_ref _Nonnull ref)
 
 cql_object_ref _Nonnull set_create()
 {
-  cql_object_ref obj = (cql_object_ref)calloc(sizeof(cql_object), 1);
+  cql_object_ref obj = (cql_object_ref)cql_calloc(sizeof(cql_object), 1, CQL_ALLOC_OBJECT);
   obj->base.type = CQL_C_TYPE_OBJECT;
   obj->base.ref_count = 1;
   obj->base.finalize = set_finalize;
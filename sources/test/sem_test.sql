@@ -21179,6 +21179,43 @@ begin
   C:from_blob(a_blob);
 end;
 
+-- TEST: fixed width serialization gets the same blob type checks
+-- + CALL cql_cursor_to_fixed_blob(C, a_blob);
+-- + error: % blob variable must have a type-kind for type safety 'a_blob'
+-- + {call_stmt}: err
+-- +1 error:
+proc use_direct_to_fixed_blob_badly()
+begin
+  cursor C for select 1 id, 'foo' name;
+  fetch C;
+
+  declare a_blob blob!;
+  C:to_fixed_blob(a_blob);
+end;
+
+-- TEST: the fixed width form can infer the blob type like to_blob
+-- + {name a_blob}: a_blob: blob<structured_storage> notnull variable
+-- - error:
+proc use_fixed_blob_as_func()
+begin
+  cursor C like structured_storage;
+  fetch C using 1 id, 'foo' name;
+  let a_blob := C:to_fixed_blob;
+end;
+
+-- TEST: views get the same blob type checks
+-- + CALL cql_cursor_view_from_blob(C, a_blob);
+-- + error: % blob variable must have a type-kind for type safety 'a_blob'
+-- + {call_stmt}: err
+-- +1 error:
+proc use_direct_view_from_blob_badly()
+begin
+  cursor C like select 1 id, 'foo' name;
+
+  let a_blob := (select 'x' ~blob~);
+  C:view_from_blob(a_blob);
+end;
+
 [[backed_by=simple_backing_table]]
 create table basic_table(
   id integer primary key,